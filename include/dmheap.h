@@ -18,6 +18,172 @@ typedef struct dmheap_context_t dmheap_context_t;
  * @return Pointer to the heap context, or NULL if initialization fails.
  */
 DMOD_BUILTIN_API( dmheap, 1.0, dmheap_context_t*, _init, ( void* buffer, size_t size, size_t alignment ) );
+
+/**
+ * @brief dmheap_init_ex() flag: the buffer is known to be all zero.
+ *
+ * Set this for buffers in .bss or freshly mapped pages. dmheap then tracks
+ * which free space has never been written, and dmheap_calloc() skips clearing
+ * memory that is still in that state.
+ */
+#define DMHEAP_BUFFER_ZEROED    (1u << 0)
+
+/**
+ * @brief dmheap_init_ex() flag: keep a dense side index of free-block sizes.
+ *
+ * Fit searches then scan a cache-aligned array of sizes (with SSE2/AVX2/NEON
+ * compares where available) instead of chasing `next` pointers through block
+ * headers all over the heap. Costs sizeof(uint32_t) + sizeof(void*) bytes per
+ * entry for DMHEAP_FREE_INDEX_CAPACITY entries, taken from the buffer. With
+ * more free blocks than that the index is set aside until the next
+ * dmheap_concatenate_free_blocks() rebuilds it.
+ */
+#define DMHEAP_FREE_INDEX       (1u << 1)
+
+/**
+ * @brief dmheap_init_ex() flag: keep block headers out of band.
+ *
+ * Block metadata then lives in a dense table between the context and the heap
+ * (one entry per DMHEAP_METADATA_GRANULE bytes of heap) instead of right in
+ * front of each allocation. A buffer overrun can no longer corrupt the
+ * allocator, user data stays contiguous, and stats, visitors and coalescing
+ * only read the table. Allocations fail once every table entry is in use.
+ */
+#define DMHEAP_SEPARATE_METADATA (1u << 2)
+
+/**
+ * @brief dmheap_init_ex() flag: manage the heap with a binary buddy engine.
+ *
+ * Every allocation is rounded up to a power-of-two block (at least
+ * DMHEAP_BUDDY_MIN_BLOCK bytes) that is aligned to its own size, so allocation
+ * and freeing are O(log n) and free blocks merge with their buddy right away.
+ * Suits heaps of power-of-two objects such as packet buffers. Implies
+ * DMHEAP_SEPARATE_METADATA (module tracking, stats and visitors work as usual),
+ * with one header table entry per DMHEAP_BUDDY_MIN_BLOCK bytes.
+ * Alignments above DMHEAP_BUDDY_BASE_ALIGN (256 by default) or the heap's own
+ * alignment, whichever is larger, and dmheap_set_large_region() are not
+ * supported.
+ */
+#define DMHEAP_ENGINE_BUDDY     (1u << 3)
+
+/**
+ * @brief dmheap_init_ex() flag: the heap is only ever used from one thread.
+ *
+ * Calls on the heap then take no lock at all. Heap-list operations (adding,
+ * naming, searching the default heap list) still use Dmod_EnterCritical().
+ */
+#define DMHEAP_LOCK_NONE        (1u << 4)
+
+/**
+ * @brief dmheap_init_ex() flag: guard the heap with its own spinlock.
+ *
+ * Instead of the global Dmod_EnterCritical(), so threads working on different
+ * heaps no longer serialise against each other. Meant for multi-core hosts
+ * where a lock holder is not preempted by a waiter. The lock is not
+ * recursive: block visitors must not call back into the same heap.
+ */
+#define DMHEAP_LOCK_SPIN        (1u << 5)
+
+/**
+ * @brief dmheap_init_ex() flag: keep a histogram of allocation requests.
+ *
+ * Every allocation served by the heap is counted in a log2 histogram of its
+ * requested size and alignment, kept per module (plus one for untracked
+ * requests), to help size pools and size classes. Costs one
+ * dmheap_request_histogram_t per module record. Read it with
+ * dmheap_get_request_histogram() / dmheap_for_each_request_histogram().
+ */
+#define DMHEAP_REQUEST_HISTOGRAM (1u << 6)
+
+/**
+ * @brief Initialize the heap with a given buffer, size and DMHEAP_* flags.
+ *
+ * Same as dmheap_init(), which is equivalent to passing flags = 0.
+ *
+ * @param buffer    Pointer to the memory buffer to be used as heap.
+ * @param size      Size of the memory buffer.
+ * @param alignment Alignment for allocations.
+ * @param flags     Bitwise OR of DMHEAP_* flags (e.g. DMHEAP_BUFFER_ZEROED).
+ *
+ * @return Pointer to the heap context, or NULL if initialization fails.
+ */
+DMOD_BUILTIN_API( dmheap, 1.0, dmheap_context_t*, _init_ex, ( void* buffer, size_t size, size_t alignment, uint32_t flags ) );
+
+/**
+ * @brief Lock or unlock callback for dmheap_set_lock().
+ *
+ * @param user_data Pointer passed to dmheap_set_lock().
+ */
+typedef void (*dmheap_lock_fn_t)( void* user_data );
+
+/**
+ * @brief Guard a heap with caller-provided lock callbacks.
+ *
+ * For locks dmheap has no portable way to build itself, such as a pthread or
+ * RTOS mutex. The callbacks replace the lock chosen by the DMHEAP_LOCK_* flags
+ * and must not be swapped while other threads may be using the heap - call
+ * this right after dmheap_init_ex(). Like DMHEAP_LOCK_SPIN, a non-recursive
+ * lock means block visitors must not call back into the same heap. On a heap
+ * from dmheap_init_sharded() every shard gets the same callbacks and user_data.
+ *
+ * @param ctx       Pointer to the heap context.
+ * @param lock      Called to enter the heap's critical section, or NULL to go
+ *                  back to the lock chosen by the DMHEAP_LOCK_* flags.
+ * @param unlock    Called to leave it (NULL together with lock).
+ * @param user_data Passed to both callbacks.
+ *
+ * @return true on success, false if ctx is NULL or only one callback is given.
+ */
+DMOD_BUILTIN_API( dmheap, 1.0, bool, _set_lock, ( dmheap_context_t* ctx, dmheap_lock_fn_t lock, dmheap_lock_fn_t unlock, void* user_data ) );
+
+/**
+ * @brief Initialize a heap split into shard_count independent sub-heaps.
+ *
+ * The buffer is cut into equal, cache-line aligned slices, each an ordinary
+ * heap with its own lock (pass DMHEAP_LOCK_SPIN, or give it a lock with
+ * dmheap_set_lock(), so threads on different shards stop contending). An
+ * allocation tries the shard picked by the shard selector first - the caller's
+ * CPU by default - and steals from the other shards when that one is full; a
+ * free goes back to whichever shard's slice holds the pointer. Everything else
+ * sees a single context: stats and visitors cover all shards, modules are
+ * registered on all of them, and only this context joins the default heap
+ * list. dmheap_set_large_region() is not supported, and permanent allocations
+ * come from the first shard.
+ *
+ * @param buffer      Pointer to the memory buffer to be used as heap.
+ * @param size        Size of the memory buffer.
+ * @param alignment   Alignment for allocations.
+ * @param shard_count Number of sub-heaps, typically the number of CPUs.
+ * @param flags       Bitwise OR of DMHEAP_* flags, applied to every shard.
+ *
+ * @return Pointer to the heap context, or NULL if initialization fails.
+ */
+DMOD_BUILTIN_API( dmheap, 1.0, dmheap_context_t*, _init_sharded, ( void* buffer, size_t size, size_t alignment, size_t shard_count, uint32_t flags ) );
+
+/**
+ * @brief Shard selector for dmheap_set_shard_selector().
+ *
+ * @param user_data Pointer passed to dmheap_set_shard_selector().
+ *
+ * @return Any number - the allocation tries shard (result % shard_count) first.
+ */
+typedef size_t (*dmheap_shard_selector_t)( void* user_data );
+
+/**
+ * @brief Choose which shard of a sharded heap an allocation tries first.
+ *
+ * By default that is the caller's CPU (sched_getcpu() on Linux hosts built with
+ * -DDMHEAP_SHARD_GETCPU=ON) or, failing that, a hash of the caller's stack
+ * address, which keeps each thread on one shard. An RTOS would typically
+ * return the current core or task number here.
+ *
+ * @param ctx       Pointer to a context returned by dmheap_init_sharded().
+ * @param selector  Shard selector, or NULL to restore the default one.
+ * @param user_data Passed to selector.
+ *
+ * @return true on success, false if ctx is not a sharded heap.
+ */
+DMOD_BUILTIN_API( dmheap, 1.0, bool, _set_shard_selector, ( dmheap_context_t* ctx, dmheap_shard_selector_t selector, void* user_data ) );
 /**
  * @brief Assign a name to a heap context.
  *
@@ -128,6 +294,71 @@ DMOD_BUILTIN_API( dmheap, 1.0, dmheap_context_t*, _get_context_by_name, ( const
  * @return true if initialized, false otherwise.
  */
 DMOD_BUILTIN_API( dmheap, 1.0, bool             , _is_initialized, ( dmheap_context_t* ctx ) );
+/**
+ * @brief Serve big allocations from a dedicated, page-granular region.
+ *
+ * Carves a region of region_size bytes (rounded down to whole
+ * DMHEAP_LARGE_PAGE_SIZE pages) off the top of the heap. From then on every
+ * allocation of at least threshold bytes on this context is handed whole pages
+ * from that region by a simple extent allocator, tracked in a small ownership
+ * table instead of an inline block header - so firmware images, decompression
+ * windows and the like no longer fragment small-block space, and freeing them
+ * never merges into it. When the region cannot satisfy a request, the
+ * allocation falls back to the general heap.
+ *
+ * Must be called while the top of the heap is still free (normally right after
+ * dmheap_init()), and only once per context. On Linux hosts built with
+ * DMHEAP_LARGE_MMAP, a region_size of 0 maps each large allocation with mmap()
+ * instead of reserving heap space for it.
+ *
+ * @param ctx         Pointer to the heap context.
+ * @param threshold   Minimum request size (bytes) routed to the large region.
+ * @param region_size Size of the region in bytes (0 for mmap-backed mode).
+ *
+ * @return true on success, false if the parameters are invalid, the region is
+ *         already configured, or the top of the heap has too little free space.
+ */
+DMOD_BUILTIN_API( dmheap, 1.0, bool             , _set_large_region, ( dmheap_context_t* ctx, size_t threshold, size_t region_size ) );
+/**
+ * @brief Hold back free memory for critical modules.
+ *
+ * Once set, an allocation, realloc growth or permanent allocation that would
+ * leave the general heap with fewer than reserve_bytes free bytes fails unless
+ * its module has been marked with dmheap_set_module_critical() - so a watchdog
+ * or logger can still allocate after everything else has run the heap dry.
+ * The records of other modules, taken when one is registered or first named,
+ * are held to the same line; the record of a module made critical is not.
+ * The reserve is a byte budget, not a separate region: fragmentation can still
+ * keep a critical request from fitting. A sharded heap splits the reserve
+ * evenly across its shards.
+ *
+ * @param ctx           Pointer to the heap context.
+ * @param reserve_bytes Bytes to hold back (0 to drop the reserve).
+ *
+ * @return true on success, false if ctx is NULL or the heap does not have that
+ *         many free bytes left.
+ */
+DMOD_BUILTIN_API( dmheap, 1.0, bool             , _set_reserve, ( dmheap_context_t* ctx, size_t reserve_bytes ) );
+/**
+ * @brief Merge free blocks automatically once the heap gets fragmented.
+ *
+ * Fragmentation is the share of the free bytes lying outside the largest free
+ * block, which the heap knows without a walk. Once it reaches percent (and
+ * the heap has at least DMHEAP_COALESCE_MIN_BLOCKS free blocks), every free
+ * that does not merge carries a coalescing pass on by DMHEAP_COALESCE_SLICE
+ * free blocks until the pass is over, instead of leaving all the merging to
+ * the allocation that fails. After a pass the next one waits until there are
+ * more free blocks than that pass left. Buddy heaps merge
+ * on every free anyway and are unaffected. A sharded heap sets the threshold
+ * of every shard.
+ *
+ * @param ctx     Pointer to the heap context.
+ * @param percent Fragmentation percentage that starts a pass (1-100), 0 to
+ *                turn automatic coalescing off (the default).
+ *
+ * @return true on success, false if ctx is NULL or percent is above 100.
+ */
+DMOD_BUILTIN_API( dmheap, 1.0, bool             , _set_coalesce_threshold, ( dmheap_context_t* ctx, uint32_t percent ) );
 /**
  * @brief Register a module with the heap.
  * 
@@ -137,6 +368,18 @@ DMOD_BUILTIN_API( dmheap, 1.0, bool             , _is_initialized, ( dmheap_cont
  * @return true if registration is successful, false otherwise.
  */
 DMOD_BUILTIN_API( dmheap, 1.0, bool             , _register_module, ( dmheap_context_t* ctx, const char* module_name ) );
+/**
+ * @brief Allow or forbid a module to allocate from the heap's reserve (see
+ * dmheap_set_reserve()). The module is registered if it is not yet - when it
+ * is being made critical, its record may itself come out of the reserve.
+ *
+ * @param ctx         Pointer to the heap context (NULL for every default heap).
+ * @param module_name Name of the module.
+ * @param critical    true to let the module use the reserve.
+ *
+ * @return true on success, false if the module cannot be registered.
+ */
+DMOD_BUILTIN_API( dmheap, 1.0, bool             , _set_module_critical, ( dmheap_context_t* ctx, const char* module_name, bool critical ) );
 /**
  * @brief Unregister a module from the heap.
  * 
@@ -144,6 +387,38 @@ DMOD_BUILTIN_API( dmheap, 1.0, bool             , _register_module, ( dmheap_con
  * @param module_name Name of the module to unregister.
  */
 DMOD_BUILTIN_API( dmheap, 1.0, void             , _unregister_module, ( dmheap_context_t* ctx, const char* module_name ) );
+/**
+ * @brief Unregister a module without freeing its memory on the spot.
+ *
+ * The module is detached right away: lookups by name no longer find it (the
+ * name can be registered again) and it drops out of the module statistics,
+ * while its blocks stay allocated until dmheap_maintain() frees them in bounded
+ * slices. The caller's cost does not depend on how many blocks the module
+ * holds. An allocation that fails finishes any pending teardown and retries.
+ *
+ * @param ctx         Pointer to the heap context (NULL for every default heap).
+ * @param module_name Name of the module to unregister.
+ */
+DMOD_BUILTIN_API( dmheap, 1.0, void             , _unregister_module_async, ( dmheap_context_t* ctx, const char* module_name ) );
+/**
+ * @brief Do a bounded slice of deferred heap work - the teardown of modules
+ * unregistered with dmheap_unregister_module_async().
+ *
+ * Each call looks at no more than budget allocations per heap, picking up where
+ * the previous call stopped. Once a sweep is through, the module records are
+ * released and the heap's free blocks merged by a coalescing pass that the
+ * following calls carry on, checking no more than budget free blocks each.
+ * Every heap is entered under its own lock - maintaining every default heap
+ * never holds them all up at once. Meant for an idle hook or a low-priority
+ * worker that calls it until it returns false.
+ *
+ * @param ctx    Pointer to the heap context (NULL for every default heap).
+ * @param budget Maximum number of allocations (or free blocks) to look at on
+ *               each heap (0 only reports whether work is pending).
+ *
+ * @return true if work is still pending.
+ */
+DMOD_BUILTIN_API( dmheap, 1.0, bool             , _maintain, ( dmheap_context_t* ctx, size_t budget ) );
 /**
  * @brief Allocate memory from the heap.
  * 
@@ -154,8 +429,143 @@ DMOD_BUILTIN_API( dmheap, 1.0, void             , _unregister_module, ( dmheap_c
  * @return Pointer to the allocated memory, or NULL if allocation fails.
  */
 DMOD_BUILTIN_API( dmheap, 1.0, void*            , _malloc, ( dmheap_context_t* ctx, size_t size, const char* module_name ) );
+/**
+ * @brief Placement hints for dmheap_malloc_hint().
+ */
+#define DMHEAP_HINT_SHORT_LIVED (1u << 0)   //!< Freed again soon (request buffers, scratch space).
+#define DMHEAP_HINT_LONG_LIVED  (1u << 1)   //!< Kept for a long time (driver state, caches).
+#define DMHEAP_HINT_ISOLATED    (1u << 2)   //!< Owns its cache lines outright (per-thread counters, locks).
+
+/**
+ * @brief Allocate memory from the heap, placed according to its expected lifetime.
+ *
+ * Long-lived blocks are carved from the top end of the highest free block that
+ * fits, short-lived ones from the bottom of the lowest, so the two do not
+ * interleave: once the short-lived blocks are freed, the space they used merges
+ * back into large free blocks instead of staying pinned between long-lived ones.
+ * The hint is kept with the block, so a realloc that has to move it keeps its
+ * placement.
+ *
+ * Without a hint, or with both, this is the same as dmheap_malloc(). Hints
+ * trade the best fit for placement, so they are best used for the allocations
+ * that really are at either extreme. Lifetime hints are ignored by the buddy
+ * engine and for requests served from the large region. Long-lived blocks end
+ * up right below the permanent region, so make permanent allocations first.
+ *
+ * DMHEAP_HINT_ISOLATED, which combines with either lifetime, rounds both the
+ * start and the size of the block to the cache-line size (see
+ * dmheap_get_cache_line_size()), so no other block's data or header shares a
+ * line with it and data written by other threads cannot cause false sharing.
+ * A realloc keeps the block isolated.
+ *
+ * @param ctx         Pointer to the heap context (NULL to use default context).
+ * @param size        Size of memory to allocate.
+ * @param hints       Bitwise OR of DMHEAP_HINT_* bits.
+ * @param module_name Name of the module requesting allocation (for logging).
+ *
+ * @return Pointer to the allocated memory, or NULL if allocation fails.
+ */
+DMOD_BUILTIN_API( dmheap, 1.0, void*            , _malloc_hint, ( dmheap_context_t* ctx, size_t size, uint32_t hints, const char* module_name ) );
+/**
+ * @brief Get the cache-line size DMHEAP_HINT_ISOLATED allocations are rounded to.
+ *
+ * Read with sysconf() when the heap is initialized on Linux hosts, otherwise
+ * DMHEAP_CACHE_LINE_SIZE (64 unless defined at build time).
+ *
+ * @param ctx Pointer to the heap context (NULL to use the primary default context).
+ *
+ * @return Cache-line size in bytes.
+ */
+DMOD_BUILTIN_API( dmheap, 1.0, size_t           , _get_cache_line_size, ( dmheap_context_t* ctx ) );
+/**
+ * @brief Allocate zero-filled memory for an array from the heap.
+ *
+ * Unlike dmheap_malloc() + memset(), memory that is known to be zero already -
+ * never-used space of a heap initialized with DMHEAP_BUFFER_ZEROED, or fresh
+ * large-region pages - is handed out without clearing it again.
+ *
+ * @param ctx         Pointer to the heap context (NULL to use default context).
+ * @param count       Number of elements.
+ * @param size        Size of each element.
+ * @param module_name Name of the module requesting allocation (for logging).
+ *
+ * @return Pointer to the zeroed memory, or NULL if allocation fails or count * size overflows.
+ */
+DMOD_BUILTIN_API( dmheap, 1.0, void*            , _calloc, ( dmheap_context_t* ctx, size_t count, size_t size, const char* module_name ) );
+/**
+ * @brief Heap capability bits for dmheap_set_capabilities()/dmheap_malloc_caps().
+ *
+ * Bits 8 and up are free for board-specific capabilities.
+ */
+#define DMHEAP_CAP_DMA          (1u << 0)   //!< Reachable by DMA controllers.
+#define DMHEAP_CAP_FAST         (1u << 1)   //!< Tightly coupled / single-cycle RAM.
+#define DMHEAP_CAP_EXTERNAL     (1u << 2)   //!< External (typically slower) RAM.
+#define DMHEAP_CAP_EXEC         (1u << 3)   //!< Code can be executed from it.
+
+/**
+ * @brief Tag a heap with the capabilities of the memory behind it.
+ *
+ * Only consulted by dmheap_malloc_caps(); every other NULL-context call keeps
+ * treating the default heaps as interchangeable. Contexts start out with no
+ * capabilities.
+ *
+ * @param ctx  Pointer to the heap context.
+ * @param caps Bitwise OR of DMHEAP_CAP_* bits (replaces any previous value).
+ *
+ * @return true on success, false if ctx is NULL.
+ */
+DMOD_BUILTIN_API( dmheap, 1.0, bool             , _set_capabilities, ( dmheap_context_t* ctx, uint32_t caps ) );
+/**
+ * @brief Get the capabilities assigned to a heap.
+ *
+ * @param ctx Pointer to the heap context (NULL to use the primary default context).
+ *
+ * @return DMHEAP_CAP_* bits of the heap, or 0 if none were set or no context is available.
+ */
+DMOD_BUILTIN_API( dmheap, 1.0, uint32_t         , _get_capabilities, ( dmheap_context_t* ctx ) );
+/**
+ * @brief Allocate from a default heap that has all of the requested capabilities.
+ *
+ * Only heaps in the default heap list whose capabilities include every bit of
+ * caps are tried, preferring those with the fewest capabilities beyond the
+ * requested ones (so e.g. a plain request does not use up DMA-capable memory
+ * while another heap still has room), and otherwise in the usual default-list
+ * order.
+ *
+ * @param size        Size of memory to allocate.
+ * @param caps        Bitwise OR of required DMHEAP_CAP_* bits (0 matches every heap).
+ * @param module_name Name of the module requesting allocation (for logging).
+ *
+ * @return Pointer to the allocated memory, or NULL if no matching heap can satisfy the request.
+ */
+DMOD_BUILTIN_API( dmheap, 1.0, void*            , _malloc_caps, ( size_t size, uint32_t caps, const char* module_name ) );
+/**
+ * @brief Allocate memory that will never be freed, without a per-allocation header.
+ *
+ * Meant for boot-time data that lives as long as the system does (driver tables,
+ * module descriptors). The memory is bump-allocated from a permanent region that
+ * grows down from the top of the general heap (below the large region, if any),
+ * so it carries no block_t and never sits between regular blocks. Only the
+ * owning module's running total is recorded (see dmheap_get_module_stats()).
+ *
+ * The memory cannot be passed to dmheap_free()/dmheap_realloc() and is not
+ * returned when the module is unregistered. If the region cannot grow - the
+ * block right below it is in use or too small - a regular block is allocated
+ * instead.
+ *
+ * @param ctx         Pointer to the heap context (NULL to use the primary default context).
+ * @param size        Size of memory to allocate.
+ * @param alignment   Alignment requirement (power of two), or 0 for the heap's own alignment.
+ * @param module_name Name of the module the memory is accounted to.
+ *
+ * @return Pointer to the allocated memory, or NULL if allocation fails.
+ */
+DMOD_BUILTIN_API( dmheap, 1.0, void*            , _malloc_permanent, ( dmheap_context_t* ctx, size_t size, size_t alignment, const char* module_name ) );
 /**
  * @brief Reallocate memory from the heap.
+ *
+ * Same as dmheap_aligned_realloc() with an alignment of 0: memory from
+ * dmheap_aligned_alloc() stays aligned as requested.
  * 
  * @param ctx         Pointer to the heap context (NULL to use default context).
  * @param ptr         Pointer to the previously allocated memory.
@@ -184,6 +594,75 @@ DMOD_BUILTIN_API( dmheap, 1.0, void             , _free, ( dmheap_context_t* ctx
  * @return Pointer to the allocated memory, or NULL if allocation fails.
  */
 DMOD_BUILTIN_API( dmheap, 1.0, void*            , _aligned_alloc, ( dmheap_context_t* ctx, size_t alignment, size_t size, const char* module_name) );
+/**
+ * @brief Reallocate memory from the heap, keeping or changing its alignment.
+ *
+ * Every block remembers the alignment it was allocated with. The block is
+ * resized in place when its address meets the alignment - growing into the
+ * free block right after it, if that is big enough - and otherwise moved to a
+ * new block with that alignment.
+ *
+ * @param ctx         Pointer to the heap context (NULL to use default context).
+ * @param ptr         Pointer to the previously allocated memory (NULL to allocate).
+ * @param alignment   New alignment requirement (power of two), or 0 to keep the block's.
+ * @param size        New size of memory to allocate.
+ * @param module_name Name of the module requesting reallocation (for logging).
+ *
+ * @return Pointer to the reallocated memory, or NULL if reallocation fails.
+ */
+DMOD_BUILTIN_API( dmheap, 1.0, void*            , _aligned_realloc, ( dmheap_context_t* ctx, void* ptr, size_t alignment, size_t size, const char* module_name) );
+/**
+ * @brief Opaque marker returned by dmheap_checkpoint().
+ */
+typedef uint32_t dmheap_checkpoint_t;
+
+/**
+ * @brief Mark the current point in the allocation history.
+ *
+ * Every allocation gets a sequence number from a counter shared by all heaps;
+ * the checkpoint is simply the next number to be handed out. Pass it to
+ * dmheap_rollback() to undo everything allocated since in one operation - e.g.
+ * when loading a module fails halfway through.
+ *
+ * @param ctx Pointer to the heap context (unused - checkpoints are valid on every heap).
+ *
+ * @return Checkpoint for dmheap_rollback().
+ */
+DMOD_BUILTIN_API( dmheap, 1.0, dmheap_checkpoint_t, _checkpoint, ( dmheap_context_t* ctx ) );
+
+/**
+ * @brief Free every allocation made at or after a checkpoint.
+ *
+ * Covers regular blocks and large-region extents, whichever module owns them.
+ * A block that was grown by dmheap_realloc() after the checkpoint counts as new
+ * (its old copy is already gone). Module registrations and permanent memory
+ * are left alone. The checkpoint stays valid for as long as fewer than 2^31
+ * allocations happen in between.
+ *
+ * @param ctx        Pointer to the heap context (NULL to roll back every default heap).
+ * @param checkpoint Value returned by dmheap_checkpoint().
+ *
+ * @return Number of allocations freed.
+ */
+DMOD_BUILTIN_API( dmheap, 1.0, size_t           , _rollback, ( dmheap_context_t* ctx, dmheap_checkpoint_t checkpoint ) );
+
+/**
+ * @brief Drop every allocation of a heap at once and start over.
+ *
+ * Regular blocks, large-region extents and permanent memory are all released
+ * without visiting them one by one, so the cost does not grow with the number
+ * of live allocations. With keep_modules the registered modules survive in
+ * place - their usage drops to zero, peaks and request histograms stay;
+ * otherwise the module table is emptied as well. The history ring and the
+ * heap's peaks are kept. Every pointer into the heap is invalid afterwards.
+ *
+ * @param ctx          Pointer to the heap context.
+ * @param keep_modules true to keep the registered modules.
+ *
+ * @return true on success, false if ctx is NULL.
+ */
+DMOD_BUILTIN_API( dmheap, 1.0, bool             , _reset, ( dmheap_context_t* ctx, bool keep_modules ) );
+
 /**
  * @brief Concatenate all adjacent free blocks in the heap.
  *
@@ -220,6 +699,15 @@ typedef struct dmheap_stats_t
     size_t used_block_count;       //!< Number of used blocks.
     size_t largest_free_block;     //!< Size (bytes) of the largest free block, 0 if none.
     size_t smallest_free_block;    //!< Size (bytes) of the smallest free block, 0 if none.
+    size_t large_used_bytes;       //!< Part of used_bytes held by large-region extents (see dmheap_set_large_region()).
+    size_t large_free_bytes;       //!< Part of free_bytes sitting in large-region extents.
+    size_t permanent_bytes;        //!< Part of used_bytes held by the permanent region (see dmheap_malloc_permanent()).
+    size_t peak_used_bytes;        //!< Highest used_bytes seen since init or dmheap_reset_peaks().
+    size_t peak_used_block_count;  //!< Highest used_block_count (blocks plus large extents) seen since init or dmheap_reset_peaks().
+    size_t min_largest_free_block; //!< Smallest largest_free_block seen since init or dmheap_reset_peaks().
+    size_t reserve_bytes;          //!< Free bytes held back for critical modules (see dmheap_set_reserve()).
+    size_t reserve_used_bytes;     //!< Part of reserve_bytes critical modules are using right now.
+    size_t peak_reserve_used_bytes; //!< Highest reserve_used_bytes seen since init or dmheap_reset_peaks().
 } dmheap_stats_t;
 
 /**
@@ -232,6 +720,224 @@ typedef struct dmheap_stats_t
  */
 DMOD_BUILTIN_API( dmheap, 1.0, bool             , _get_stats, ( dmheap_context_t* ctx, dmheap_stats_t* out_stats ) );
 
+/**
+ * @brief Get aggregate statistics without entering the heap's critical section.
+ *
+ * Served from running totals that every heap operation keeps up to date and
+ * publishes through a sequence lock, so monitoring threads and interrupts never
+ * block allocators or mask interrupts to call it. largest_free_block and
+ * smallest_free_block need a walk of the free blocks and are left 0 - use
+ * dmheap_get_stats() for those.
+ *
+ * @param ctx        Pointer to the heap context (NULL to sum every default heap).
+ * @param out_stats  Filled in with the current heap statistics.
+ *
+ * @return true on success, false if no context is available, out_stats is NULL,
+ *         or no consistent snapshot could be read (e.g. from an interrupt that
+ *         preempted an operation on the same heap).
+ */
+DMOD_BUILTIN_API( dmheap, 1.0, bool             , _peek_stats, ( dmheap_context_t* ctx, dmheap_stats_t* out_stats ) );
+
+/**
+ * @brief Statistics about a single module's memory on the heap.
+ */
+typedef struct dmheap_module_stats_t
+{
+    size_t used_bytes;             //!< Usable (data) bytes across the module's used blocks.
+    size_t used_block_count;       //!< Number of used blocks attributed to the module.
+    size_t permanent_bytes;        //!< Bytes the module got from dmheap_malloc_permanent().
+    size_t peak_used_bytes;        //!< Highest used_bytes seen since the module was registered or dmheap_reset_peaks().
+    size_t peak_used_block_count;  //!< Highest used_block_count seen since the module was registered or dmheap_reset_peaks().
+} dmheap_module_stats_t;
+
+/**
+ * @brief Get statistics about a single module's memory.
+ *
+ * @param ctx         Pointer to the heap context (NULL to aggregate across every default heap).
+ * @param module_name Name of the module.
+ * @param out_stats   Filled in with the module's statistics.
+ *
+ * @return true if the module is registered on ctx (or on any default heap), false otherwise.
+ */
+DMOD_BUILTIN_API( dmheap, 1.0, bool             , _get_module_stats, ( dmheap_context_t* ctx, const char* module_name, dmheap_module_stats_t* out_stats ) );
+
+/**
+ * @brief Callback invoked once per module by dmheap_for_each_module().
+ *
+ * Same rules as dmheap_block_visitor_t: it runs under the heap's lock.
+ *
+ * @param module_name Name of the module.
+ * @param stats       The module's statistics on the heap being walked.
+ * @param user_data   Opaque pointer passed through from dmheap_for_each_module().
+ */
+typedef void (*dmheap_module_visitor_t)( const char* module_name, const dmheap_module_stats_t* stats, void* user_data );
+
+/**
+ * @brief Walk every registered module with its statistics.
+ *
+ * Served from per-module running totals, so unlike a used-block walk it costs
+ * one visitor call per module however many blocks they hold. A module with
+ * memory on several heaps (or shards of a sharded heap) is visited once per
+ * heap.
+ *
+ * @param ctx        Pointer to the heap context (NULL for every default heap).
+ * @param visitor    Called once per module (see dmheap_module_visitor_t).
+ * @param user_data  Passed through to each visitor call.
+ */
+DMOD_BUILTIN_API( dmheap, 1.0, void             , _for_each_module, ( dmheap_context_t* ctx, dmheap_module_visitor_t visitor, void* user_data ) );
+
+/**
+ * @brief Start a new high-water mark window.
+ *
+ * The peak fields of dmheap_stats_t and dmheap_module_stats_t are sampled as
+ * every heap operation leaves the heap's critical section. This restarts them,
+ * for the heap and each of its modules, from the current values - e.g. to
+ * measure the footprint of a single phase of the application.
+ *
+ * When statistics span several heaps (a sharded heap or the NULL default-list
+ * aggregate) the heaps' peaks are summed, which is an upper bound since they
+ * may have been reached at different times, and min_largest_free_block is the
+ * biggest of the per-heap minima.
+ *
+ * @param ctx Pointer to the heap context (NULL to reset every default heap).
+ */
+DMOD_BUILTIN_API( dmheap, 1.0, void             , _reset_peaks, ( dmheap_context_t* ctx ) );
+
+/**
+ * @brief Number of size buckets in a dmheap_request_histogram_t.
+ */
+#define DMHEAP_REQUEST_SIZE_BUCKETS      32
+
+/**
+ * @brief Number of alignment buckets in a dmheap_request_histogram_t.
+ */
+#define DMHEAP_REQUEST_ALIGN_BUCKETS     16
+
+/**
+ * @brief Log2 histogram of allocation requests (see DMHEAP_REQUEST_HISTOGRAM).
+ *
+ * Bucket i counts requests of 2^i to 2^(i+1) - 1 bytes (or alignments of 2^i
+ * bytes); a 0-byte request counts as bucket 0 and the last bucket also takes
+ * everything beyond it. Allocations, callocs and reallocs that need a new
+ * block are counted; resizing in place and permanent allocations are not.
+ */
+typedef struct dmheap_request_histogram_t
+{
+    uint32_t size[DMHEAP_REQUEST_SIZE_BUCKETS];       //!< Requests per log2 size bucket.
+    uint32_t alignment[DMHEAP_REQUEST_ALIGN_BUCKETS]; //!< Requests per log2 alignment bucket.
+    uint32_t requests;                                //!< Total number of requests counted.
+} dmheap_request_histogram_t;
+
+/**
+ * @brief Get a request histogram of a module, or of the whole heap.
+ *
+ * @param ctx         Pointer to the heap context (NULL to add up every default heap).
+ * @param module_name Name of the module, or NULL for all requests (every module and untracked ones).
+ * @param out_histogram Filled in with the histogram.
+ *
+ * @return true if the histogram is kept (DMHEAP_REQUEST_HISTOGRAM) and the
+ *         module is registered, on ctx or any default heap; false otherwise.
+ */
+DMOD_BUILTIN_API( dmheap, 1.0, bool             , _get_request_histogram, ( dmheap_context_t* ctx, const char* module_name, dmheap_request_histogram_t* out_histogram ) );
+
+/**
+ * @brief Callback invoked once per histogram by dmheap_for_each_request_histogram().
+ *
+ * Same rules as dmheap_block_visitor_t: it runs under the heap's lock.
+ *
+ * @param module_name Name of the module, or NULL for untracked requests.
+ * @param histogram   The module's request histogram.
+ * @param user_data   Opaque pointer passed through from dmheap_for_each_request_histogram().
+ */
+typedef void (*dmheap_request_visitor_t)( const char* module_name, const dmheap_request_histogram_t* histogram, void* user_data );
+
+/**
+ * @brief Walk the request histogram of every registered module, and the one of
+ * untracked requests, of heaps that keep them (see DMHEAP_REQUEST_HISTOGRAM).
+ *
+ * A module with memory on several heaps is visited once per heap.
+ *
+ * @param ctx        Pointer to the heap context (NULL for every default heap).
+ * @param visitor    Called once per histogram (see dmheap_request_visitor_t).
+ * @param user_data  Passed through to each visitor call.
+ */
+DMOD_BUILTIN_API( dmheap, 1.0, void             , _for_each_request_histogram, ( dmheap_context_t* ctx, dmheap_request_visitor_t visitor, void* user_data ) );
+
+/**
+ * @brief Clear every request histogram of a heap.
+ *
+ * @param ctx Pointer to the heap context (NULL for every default heap).
+ */
+DMOD_BUILTIN_API( dmheap, 1.0, void             , _reset_request_histogram, ( dmheap_context_t* ctx ) );
+
+/**
+ * @brief One entry of a heap's occupancy history (see dmheap_set_history()).
+ *
+ * The same figures dmheap_peek_stats() reports, plus cumulative operation
+ * counts, so the rate of allocations between two samples is their difference.
+ */
+typedef struct dmheap_sample_t
+{
+    size_t used_bytes;             //!< Used bytes, large region and permanent region included.
+    size_t free_bytes;             //!< Free bytes, large region included.
+    size_t largest_free_block;     //!< Size (bytes) of the largest free block or extent.
+    size_t used_block_count;       //!< Number of used blocks and large extents.
+    size_t free_block_count;       //!< Number of free blocks and large extents.
+    size_t alloc_count;            //!< Blocks and extents handed out since the heap was initialized.
+    size_t free_count;             //!< Blocks and extents released since the heap was initialized.
+} dmheap_sample_t;
+
+/**
+ * @brief Keep a ring buffer of occupancy samples in the heap.
+ *
+ * Allocates room for capacity dmheap_sample_t entries from the heap itself (it
+ * shows up as one untracked used block) and from then on records a sample
+ * every interval allocations plus frees, as the operation that crosses the
+ * interval leaves the heap's critical section, plus whenever
+ * dmheap_record_sample() is called - e.g. from a periodic timer. Once the ring
+ * is full each new sample overwrites the oldest, so it always holds the most
+ * recent history, with no collector outside the heap.
+ *
+ * Calling it again replaces the ring (the recorded samples are dropped); a
+ * capacity of 0 switches the history off and frees the ring. A sharded heap
+ * gives every shard a ring of its own.
+ *
+ * @param ctx      Pointer to the heap context.
+ * @param capacity Number of samples the ring holds (0 to switch history off).
+ * @param interval Operations between automatic samples (0 to sample only on dmheap_record_sample()).
+ *
+ * @return true on success, false if ctx is NULL or the ring cannot be allocated.
+ */
+DMOD_BUILTIN_API( dmheap, 1.0, bool             , _set_history, ( dmheap_context_t* ctx, size_t capacity, size_t interval ) );
+
+/**
+ * @brief Record an occupancy sample now - the timer hook of dmheap_set_history().
+ *
+ * Cheap enough for a periodic timer: it only copies running totals. Heaps
+ * without a history ring are skipped.
+ *
+ * @param ctx Pointer to the heap context (NULL to sample every default heap).
+ *
+ * @return true if at least one sample was recorded.
+ */
+DMOD_BUILTIN_API( dmheap, 1.0, bool             , _record_sample, ( dmheap_context_t* ctx ) );
+
+/**
+ * @brief Copy the most recent occupancy samples of a heap, oldest first.
+ *
+ * For a sharded heap the shards' samples are combined position by position
+ * (sums, and the biggest of the largest free blocks), which lines up exactly
+ * when the samples come from dmheap_record_sample() and only approximately
+ * when they are taken every interval operations.
+ *
+ * @param ctx         Pointer to the heap context.
+ * @param out_samples Filled with up to max_samples samples.
+ * @param max_samples Number of entries out_samples can hold.
+ *
+ * @return Number of samples copied, 0 if the heap keeps no history.
+ */
+DMOD_BUILTIN_API( dmheap, 1.0, size_t           , _get_history, ( dmheap_context_t* ctx, dmheap_sample_t* out_samples, size_t max_samples ) );
+
 /**
  * @brief Callback invoked once per block by dmheap_for_each_free_block()/dmheap_for_each_used_block().
  *
@@ -266,4 +972,91 @@ DMOD_BUILTIN_API( dmheap, 1.0, void             , _for_each_free_block, ( dmheap
  */
 DMOD_BUILTIN_API( dmheap, 1.0, void             , _for_each_used_block, ( dmheap_context_t* ctx, dmheap_block_visitor_t visitor, void* user_data ) );
 
+/**
+ * @brief What a cursor walk does (see dmheap_walk_begin()).
+ */
+typedef enum dmheap_walk_kind_t
+{
+    DMHEAP_WALK_FREE_BLOCKS,    //!< Visit every free block, like dmheap_for_each_free_block().
+    DMHEAP_WALK_USED_BLOCKS,    //!< Visit every used block, like dmheap_for_each_used_block().
+    DMHEAP_WALK_STATS,          //!< Add up the heap statistics, like dmheap_get_stats().
+    DMHEAP_WALK_COALESCE,       //!< Merge adjacent free blocks, like dmheap_concatenate_free_blocks().
+} dmheap_walk_kind_t;
+
+/**
+ * @brief State of a walk that is done a slice at a time (see dmheap_walk_step()).
+ *
+ * Caller-owned and set up by dmheap_walk_begin(). Only kind, stats and restarts
+ * are meant to be read; the rest is the walk's position.
+ */
+typedef struct dmheap_walk_cursor_t
+{
+    dmheap_walk_kind_t kind;    //!< What the walk does.
+    dmheap_stats_t stats;       //!< DMHEAP_WALK_STATS: the totals, complete once the walk is over.
+    uint32_t restarts;          //!< Times the walk lost its place in a heap and started the current part over.
+    dmheap_context_t* ctx;      //!< Heap being walked, NULL for every default heap.
+    size_t heap;                //!< Default heaps already walked.
+    size_t shard;               //!< Shards of the current heap already walked.
+    size_t phase;               //!< Part of the current heap being walked.
+    void* position;             //!< Next block of the current part when the last step left the heap.
+    size_t slot;                //!< Engine-specific part of position.
+    dmheap_context_t* marked;   //!< Heap holding the walk's mark - where it keeps position up to date - or NULL.
+    size_t mark;                //!< Which of that heap's marks the walk holds.
+    uint32_t ticket;            //!< Ticket the mark was last handed out with - another walk that takes the mark over changes it.
+    uint32_t generation;        //!< Count of blocks that had left the heap's lists when the last step left it.
+    size_t visited;             //!< Blocks of the current part already visited.
+    size_t skip;                //!< Visited blocks still to pass over again after the walk lost its mark.
+    bool done;                  //!< The walk is over.
+} dmheap_walk_cursor_t;
+
+/**
+ * @brief Start a walk that dmheap_walk_step() carries out a slice at a time.
+ *
+ * dmheap_for_each_free_block(), dmheap_for_each_used_block(), dmheap_get_stats()
+ * and dmheap_concatenate_free_blocks() hold a heap's critical section for a
+ * whole walk of its blocks. A cursor walk does the same job in steps that each
+ * hold it for a bounded number of blocks, so allocations and interrupts get in
+ * between.
+ *
+ * @param cursor Cursor to set up.
+ * @param ctx    Pointer to the heap context (NULL to walk every default heap).
+ * @param kind   What the walk does.
+ *
+ * @return true on success, false if cursor is NULL or kind is unknown.
+ */
+DMOD_BUILTIN_API( dmheap, 1.0, bool             , _walk_begin, ( dmheap_walk_cursor_t* cursor, dmheap_context_t* ctx, dmheap_walk_kind_t kind ) );
+
+/**
+ * @brief Carry a cursor walk on by up to max_blocks blocks.
+ *
+ * Each heap is entered at most once per step (once per shard of a sharded
+ * heap) and left after at most max_blocks blocks; the large region, the
+ * permanent region and the running totals are bounded and are done in the
+ * step that finishes a heap.
+ *
+ * The heap keeps the walk's place in one of its DMHEAP_WALK_MARKS marks and
+ * moves it on whenever the block there leaves its list, so a step picks a busy
+ * heap up where the previous one left it without looking anything up. Only a
+ * walk whose mark was taken over - by more walks on the same heap than it has
+ * marks - or dropped by a heap reset, and whose heap has lost a block since,
+ * passes over as many blocks as it had already visited again (a coalescing
+ * walk starts a fresh pass instead), and those count against max_blocks like
+ * visited ones. After concurrent changes a
+ * block may be missed or seen twice - the same as two separate walks would
+ * see - and the totals of a statistics walk mix the heap's state over the
+ * time the walk took.
+ *
+ * @param cursor     Cursor set up by dmheap_walk_begin().
+ * @param max_blocks Maximum number of blocks to visit (or, for
+ *                   DMHEAP_WALK_COALESCE, free blocks to check) in this step;
+ *                   0 is taken as 1, so every step makes progress.
+ * @param visitor    Called once per block of a DMHEAP_WALK_FREE_BLOCKS or
+ *                   DMHEAP_WALK_USED_BLOCKS walk, under the heap's lock (see
+ *                   dmheap_block_visitor_t); ignored by the other kinds.
+ * @param user_data  Passed through to each visitor call.
+ *
+ * @return true while the walk has more to do, false once it is over.
+ */
+DMOD_BUILTIN_API( dmheap, 1.0, bool             , _walk_step, ( dmheap_walk_cursor_t* cursor, size_t max_blocks, dmheap_block_visitor_t visitor, void* user_data ) );
+
 #endif // DMHEAP_H
\ No newline at end of file
@@ -1,7 +1,147 @@
+#if defined(DMHEAP_SHARD_GETCPU) && defined(__linux__)
+    // sched_getcpu() is a GNU extension - this has to come before any libc header.
+#   ifndef _GNU_SOURCE
+#       define _GNU_SOURCE
+#   endif
+#   include <sched.h>
+#   define DMHEAP_SHARD_USE_GETCPU 1
+#else
+#   define DMHEAP_SHARD_USE_GETCPU 0
+#endif
+
 #include "dmheap.h"
 #include <string.h>
 #include <stdint.h>
 
+#if defined(__AVX2__)
+#   include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#   include <emmintrin.h>
+#   define DMHEAP_FREE_INDEX_SSE2 1
+#elif defined(__ARM_NEON)
+#   include <arm_neon.h>
+#endif
+
+#if defined(__linux__) && !defined(DMHEAP_CACHE_LINE_SIZE)
+#   include <unistd.h>
+#   define DMHEAP_CACHE_LINE_USE_SYSCONF 1
+#else
+#   define DMHEAP_CACHE_LINE_USE_SYSCONF 0
+#endif
+
+#if defined(DMHEAP_LARGE_MMAP) && defined(__linux__)
+#   include <sys/mman.h>
+#   define DMHEAP_LARGE_USE_MMAP 1
+#else
+#   define DMHEAP_LARGE_USE_MMAP 0
+#endif
+
+/**
+ * @brief Granularity (bytes) of the dedicated large-allocation region.
+ */
+#ifndef DMHEAP_LARGE_PAGE_SIZE
+#   define DMHEAP_LARGE_PAGE_SIZE 4096
+#endif
+
+/**
+ * @brief Number of entries in a large-allocation region's extent table.
+ */
+#ifndef DMHEAP_LARGE_MAX_EXTENTS
+#   define DMHEAP_LARGE_MAX_EXTENTS 32
+#endif
+
+/**
+ * @brief Number of free blocks the DMHEAP_FREE_INDEX side array can describe.
+ */
+#ifndef DMHEAP_FREE_INDEX_CAPACITY
+#   define DMHEAP_FREE_INDEX_CAPACITY 128
+#endif
+
+/**
+ * @brief Alignment of the free-block size index (one cache line).
+ */
+#define DMHEAP_FREE_INDEX_ALIGN 64
+
+/**
+ * @brief Cache-line size DMHEAP_HINT_ISOLATED rounds allocations to. On Linux
+ * hosts the size is read with sysconf() at init instead, unless this is
+ * defined at build time.
+ */
+#ifndef DMHEAP_CACHE_LINE_SIZE
+#   define DMHEAP_CACHE_LINE_SIZE 64
+#endif
+
+/**
+ * @brief Heap bytes per header slot reserved by DMHEAP_SEPARATE_METADATA.
+ */
+#ifndef DMHEAP_METADATA_GRANULE
+#   define DMHEAP_METADATA_GRANULE 64
+#endif
+
+/**
+ * @brief Smallest block the buddy engine hands out (power of two).
+ */
+#ifndef DMHEAP_BUDDY_MIN_BLOCK
+#   define DMHEAP_BUDDY_MIN_BLOCK 32
+#endif
+
+/**
+ * @brief Minimum alignment of the buddy arena, and so the largest natural
+ * alignment its blocks are guaranteed to have (the heap's own alignment, if larger).
+ */
+#ifndef DMHEAP_BUDDY_BASE_ALIGN
+#   define DMHEAP_BUDDY_BASE_ALIGN 256
+#endif
+
+/**
+ * @brief How many times dmheap_peek_stats() retries a torn read before giving up.
+ */
+#ifndef DMHEAP_STATS_READ_ATTEMPTS
+#   define DMHEAP_STATS_READ_ATTEMPTS 1000
+#endif
+
+/**
+ * @brief Free blocks an automatic coalescing pass checks per free (see
+ * dmheap_set_coalesce_threshold()).
+ */
+#ifndef DMHEAP_COALESCE_SLICE
+#   define DMHEAP_COALESCE_SLICE 4
+#endif
+
+/**
+ * @brief Fewest free blocks a heap must have before its fragmentation can
+ * start an automatic coalescing pass - a handful of blocks is no trouble.
+ */
+#ifndef DMHEAP_COALESCE_MIN_BLOCKS
+#   define DMHEAP_COALESCE_MIN_BLOCKS 8
+#endif
+
+/**
+ * @brief Cursor walks that can keep their place in one heap side by side (see
+ * dmheap_walk_step()) - one more takes the mark of the least recently stepped.
+ */
+#ifndef DMHEAP_WALK_MARKS
+#   define DMHEAP_WALK_MARKS 4
+#endif
+
+/**
+ * @brief Alignment of each sub-heap of a sharded heap (one cache line), so
+ * neighbouring shards never share a line of context or header data.
+ */
+#ifndef DMHEAP_SHARD_ALIGN
+#   define DMHEAP_SHARD_ALIGN 64
+#endif
+
+/**
+ * @brief Number of block orders the buddy engine tracks.
+ */
+#define DMHEAP_BUDDY_MAX_ORDERS 32
+
+/**
+ * @brief buddy_engine_t::orders value for minimum blocks that do not start a free block.
+ */
+#define BUDDY_NOT_FREE 0xFF
+
 /**
  * @brief Structure to represent a registered module.
  */
@@ -9,6 +149,15 @@ typedef struct module_t
 {
     char name[DMOD_MAX_MODULE_NAME_LENGTH];     //!< Name of the module.
     struct module_t* next;               //!< Pointer to the next module in the list.
+    size_t permanent_bytes;              //!< Bytes handed to this module by dmheap_malloc_permanent().
+    dmheap_request_histogram_t* requests; //!< Request histogram right behind the record, or NULL (see DMHEAP_REQUEST_HISTOGRAM).
+    size_t used_bytes;                   //!< Bytes of the module's used blocks and large extents.
+    size_t used_blocks;                  //!< Number of the module's used blocks and large extents.
+    size_t peak_used_bytes;              //!< Highest used_bytes since the last dmheap_reset_peaks().
+    size_t peak_used_blocks;             //!< Highest used_blocks since the last dmheap_reset_peaks().
+    struct block_t* block;               //!< Used block holding this record.
+    bool critical;                       //!< May draw on the heap's reserve (see dmheap_set_module_critical()).
+    bool detached;                       //!< Unregistered by dmheap_unregister_module_async(), blocks not yet all freed.
 } module_t;
 
 /**
@@ -20,8 +169,259 @@ typedef struct block_t
     void* address;              //!< Pointer to the memory block address.
     size_t size;                //!< Size of the memory block.
     module_t* owner;            //!< Pointer to the owning module.
+    uint32_t flags;             //!< BLOCK_FLAG_* bits.
+    uint32_t seq;               //!< Allocation sequence number (used blocks only, see dmheap_checkpoint()).
 } block_t;
 
+/**
+ * @brief block_t::flags bit: the block's data bytes are known to be all zero.
+ *
+ * Only ever set on free blocks carved from never-written space (see
+ * DMHEAP_BUFFER_ZEROED) - it is dropped as soon as a block is handed out, so a
+ * block freed back to the heap is never mistaken for clean memory.
+ */
+#define BLOCK_FLAG_ZEROED   (1u << 0)
+
+/**
+ * @brief block_t::flags bit: the block holds a module_t record.
+ *
+ * Module records are owned by no module, just like untracked allocations, so
+ * this is what keeps dmheap_rollback() from freeing them.
+ */
+#define BLOCK_FLAG_MODULE   (1u << 1)
+
+/**
+ * @brief block_t::flags bit: the block holds the heap's occupancy history ring
+ * (see dmheap_set_history()), which dmheap_rollback() must not free either.
+ */
+#define BLOCK_FLAG_HISTORY  (1u << 2)
+
+/**
+ * @brief block_t::flags bits holding the DMHEAP_HINT_* bits a used block was
+ * allocated with, so a realloc that has to move it keeps its placement.
+ */
+#define BLOCK_FLAG_HINT_SHIFT   3
+#define BLOCK_FLAG_HINTS        ((DMHEAP_HINT_SHORT_LIVED | DMHEAP_HINT_LONG_LIVED | DMHEAP_HINT_ISOLATED) << BLOCK_FLAG_HINT_SHIFT)
+
+/**
+ * @brief block_t::flags bits holding log2 of the alignment a used block was
+ * requested with, or 0 when that was no more than the heap's own - what
+ * dmheap_realloc() keeps when it has to move the block.
+ */
+#define BLOCK_FLAG_ALIGN_SHIFT  8
+#define BLOCK_FLAG_ALIGN        (0x3Fu << BLOCK_FLAG_ALIGN_SHIFT)
+
+/**
+ * @brief block_t::flags bit: set only while dmheap_reset() rebuilds the header
+ * pool, on the headers of the blocks it keeps.
+ */
+#define BLOCK_FLAG_KEEP         (1u << 6)
+
+/**
+ * @brief block_t::flags bit: the block is on the free list - set and cleared by
+ * free_list_insert() and free_list_remove(), so the block right above another
+ * one can be told free or used without a list walk (see find_free_neighbour()).
+ */
+#define BLOCK_FLAG_FREE         (1u << 7)
+
+/**
+ * @brief One entry of a large-allocation region's ownership table.
+ */
+typedef struct large_extent_t
+{
+    uint8_t* address;           //!< Page-aligned start of the extent.
+    size_t pages;               //!< Length of the extent in pages.
+    module_t* owner;            //!< Owning module (used extents only).
+    uint32_t seq;               //!< Allocation sequence number (used extents only).
+    bool used;                  //!< true if handed out, false if free.
+    bool zeroed;                //!< true if the extent's pages are known to be all zero.
+} large_extent_t;
+
+/**
+ * @brief Dedicated, page-granular region for allocations above a size threshold.
+ *
+ * The region header (and its ownership table) is carved off the top of the heap
+ * by dmheap_set_large_region(); the pages it manages follow right after it.
+ * Large allocations carry no inline block_t - the table is the only record of
+ * who owns which pages, so freeing one never merges into small-block space.
+ */
+typedef struct large_region_t
+{
+    size_t threshold;           //!< Requests of at least this many bytes are served here.
+    uint8_t* pages_start;       //!< First page of the region, NULL in mmap mode.
+    size_t page_count;          //!< Number of pages in the region, 0 in mmap mode.
+    size_t extent_count;        //!< Number of valid entries in extents[].
+    size_t largest_free;        //!< Bytes of the biggest free extent, kept by large_recount().
+    large_extent_t extents[DMHEAP_LARGE_MAX_EXTENTS]; //!< Ownership table, sorted by address in region mode.
+} large_region_t;
+
+
+/**
+ * @brief Dense structure-of-arrays copy of the free list (see DMHEAP_FREE_INDEX).
+ *
+ * Entries are kept sorted by size, like the free list itself, so a fit search
+ * is a vector compare over sizes[] followed by a short exact check using only
+ * blocks[] - the block headers scattered across the heap are never read.
+ */
+typedef struct free_index_t
+{
+    uint32_t sizes[DMHEAP_FREE_INDEX_CAPACITY];  //!< Free-block sizes, ascending, saturated at UINT32_MAX. First member, so it is cache-line aligned.
+    block_t* blocks[DMHEAP_FREE_INDEX_CAPACITY]; //!< blocks[i] is the free block described by sizes[i].
+    uint32_t count;             //!< Number of valid entries.
+    bool overflowed;            //!< More free blocks than entries - unused until the next rebuild.
+} free_index_t;
+
+/**
+ * @brief Running totals behind dmheap_peek_stats(), kept up to date by every
+ * operation that moves a block between states.
+ */
+typedef struct heap_counters_t
+{
+    size_t used_bytes;          //!< Data bytes of the blocks on the used list.
+    size_t used_blocks;         //!< Number of blocks on the used list.
+    size_t free_bytes;          //!< Data bytes of the engine's free blocks.
+    size_t free_blocks;         //!< Number of the engine's free blocks.
+    size_t large_used_bytes;    //!< Bytes of used large extents.
+    size_t large_used_extents;  //!< Number of used large extents.
+    size_t large_free_bytes;    //!< Bytes of free large extents.
+    size_t large_free_extents;  //!< Number of free large extents.
+    size_t allocs;              //!< Blocks and large extents handed out since init.
+    size_t frees;               //!< Blocks and large extents released since init.
+} heap_counters_t;
+
+/**
+ * @brief High-water marks behind dmheap_stats_t's peak fields, updated every
+ * time an operation leaves the heap's critical section.
+ */
+typedef struct heap_peaks_t
+{
+    size_t used_bytes;          //!< Highest used bytes (permanent and large included).
+    size_t used_blocks;         //!< Highest used block count (large extents included).
+    size_t min_largest_free;    //!< Smallest "largest free block" seen.
+    size_t reserve_used;        //!< Most of the reserve in use at once (see dmheap_set_reserve()).
+} heap_peaks_t;
+
+/**
+ * @brief Where a cursor walk carries on in a heap (see dmheap_walk_step()).
+ * Kept by the heap rather than the cursor, so a block leaving its list moves
+ * the mark on at once and a step never has to look its place up again.
+ */
+typedef struct walk_mark_t
+{
+    void* position;             //!< Next block to visit - moved to the one after it when it leaves its list.
+    uint32_t ticket;            //!< Ticket of the walk holding the mark, 0 while free - the lowest is the least recently stepped.
+} walk_mark_t;
+
+/**
+ * @brief Free-list link of the buddy engine, stored in the free block itself.
+ */
+typedef struct buddy_node_t
+{
+    struct buddy_node_t* next;  //!< Next free block of the same order.
+    struct buddy_node_t* prev;  //!< Previous free block of the same order.
+} buddy_node_t;
+
+/**
+ * @brief State of the binary buddy engine (see DMHEAP_ENGINE_BUDDY).
+ *
+ * The arena is split into power-of-two blocks of DMHEAP_BUDDY_MIN_BLOCK << order
+ * bytes, each aligned to its own size relative to base. Used blocks get an
+ * out-of-band block_t on the context's used list like in every other mode, so
+ * module tracking, stats and visitors need no special casing for them.
+ */
+typedef struct buddy_engine_t
+{
+    uint8_t* base;              //!< Start of the arena.
+    size_t block_count;         //!< Arena size in DMHEAP_BUDDY_MIN_BLOCK units.
+    size_t base_alignment;      //!< Alignment of base - the largest alignment a request may ask for.
+    buddy_node_t* free_lists[DMHEAP_BUDDY_MAX_ORDERS]; //!< Free blocks, per order.
+    uint8_t* orders;            //!< Per minimum block: order of the free block starting there, or BUDDY_NOT_FREE.
+} buddy_engine_t;
+
+/**
+ * @brief Allocator engine - the algorithm that manages a context's general heap.
+ *
+ * Chosen once per context by dmheap_init_ex(). Everything around it (module
+ * tracking, the used list, checkpoints, the large and permanent regions, the
+ * default heap list and the Dmod_*Ex wrappers) is shared, so an engine only
+ * deals in block_t records: it hands out blocks that are on no list yet and
+ * takes back blocks that have just left the used list. All callbacks run with
+ * the critical section held.
+ */
+typedef struct dmheap_engine_t
+{
+    const char* name;   //!< Engine name, for logs.
+
+    /**
+     * @brief Carve a block of at least size bytes whose data is aligned to alignment.
+     * hints are DMHEAP_HINT_* placement bits the engine may ignore.
+     * Sets *out_zeroed (if not NULL) to whether the data is known to be all zero.
+     * Returns NULL if the request cannot be satisfied.
+     */
+    block_t* (*alloc)( dmheap_context_t* ctx, size_t size, size_t alignment, uint32_t hints, bool* out_zeroed );
+
+    /**
+     * @brief Take back a block that has just been unlinked from the used list.
+     */
+    void (*free)( dmheap_context_t* ctx, block_t* block );
+
+    /**
+     * @brief Take back a block alloc has just handed out (on no list yet) and
+     * merge it with the free space it was carved from - without a full
+     * maintain pass.
+     */
+    void (*undo_alloc)( dmheap_context_t* ctx, block_t* block );
+
+    /**
+     * @brief Resize a used block in place - it stays on the used list.
+     * Returns true if the block now holds size bytes.
+     */
+    bool (*resize)( dmheap_context_t* ctx, block_t* block, size_t size );
+
+    /**
+     * @brief Call visitor once for every free block of the engine.
+     */
+    void (*walk)( dmheap_context_t* ctx, dmheap_block_visitor_t visitor, void* user_data );
+
+    /**
+     * @brief Like walk, but stop after max_blocks blocks. *position and *slot
+     * (both 0 for the first call) say where to carry on; visitor may be NULL to
+     * just move on. Returns the number of blocks passed - fewer than max_blocks
+     * once the walk is over. *position must be one of the walk marks (or
+     * coalesce_position), so a block leaving the list moves it on.
+     */
+    size_t (*walk_step)( dmheap_context_t* ctx, void** position, size_t* slot, size_t max_blocks,
+                         dmheap_block_visitor_t visitor, void* user_data );
+
+    /**
+     * @brief Add the engine's free space to a running statistics total.
+     */
+    void (*stats)( dmheap_context_t* ctx, dmheap_stats_t* out_stats );
+
+    /**
+     * @brief Housekeeping (coalescing) behind dmheap_concatenate_free_blocks().
+     */
+    void (*maintain)( dmheap_context_t* ctx );
+
+    /**
+     * @brief One slice of maintain, done for at most max_blocks free blocks.
+     * *position and *slot work as for walk_step. Returns the number of blocks
+     * done - fewer than max_blocks once the pass is over.
+     */
+    size_t (*maintain_step)( dmheap_context_t* ctx, void** position, size_t* slot, size_t max_blocks );
+
+    /**
+     * @brief Size of the engine's biggest free block - called after every
+     * operation, so it must not walk the heap.
+     */
+    size_t (*largest)( dmheap_context_t* ctx );
+
+    /**
+     * @brief Make the whole general heap free again, except for the blocks on
+     * the used list (sorted by address), which stay where they are.
+     */
+    void (*reset)( dmheap_context_t* ctx );
+} dmheap_engine_t;
 
 /**
  * @brief Structure to hold the context of the heap.
@@ -31,10 +431,56 @@ typedef struct dmheap_context_t
     void*  heap_start;      //!< Pointer to the start of the heap memory.
     size_t heap_size;       //!< Size of the heap memory.
     block_t* free_list;     //!< Pointer to the list of free memory blocks.
+    block_t* free_tail;     //!< Last (biggest) block of free_list.
     block_t* used_list;     //!< Pointer to the list of used memory blocks.
     size_t alignment;       //!< Alignment for allocations.
+    size_t cache_line;      //!< Cache-line size for DMHEAP_HINT_ISOLATED allocations.
     module_t* module_list; //!< Pointer to the list of registered modules.
+    module_t* pending_modules; //!< Detached modules waiting for the next teardown sweep (see dmheap_unregister_module_async()).
+    module_t* doomed_modules;  //!< Detached modules the current teardown sweep is freeing.
+    block_t* sweep_prev;    //!< Last used block the teardown sweep has kept, NULL to resume at the head.
+    block_t* dead_records;  //!< Records of doomed_modules already off the used list, freed when the sweep ends.
+    bool sweep_merge;       //!< A finished teardown sweep still owes the heap a coalescing pass (see teardown_step_locked()).
     char name[DMOD_MAX_MODULE_NAME_LENGTH]; //!< Optional name assigned via dmheap_set_context_name().
+    large_region_t* large;  //!< Dedicated large-allocation region, or NULL (see dmheap_set_large_region()).
+    uint32_t flags;         //!< DMHEAP_* flags passed to dmheap_init_ex().
+    uint32_t caps;          //!< DMHEAP_CAP_* bits assigned via dmheap_set_capabilities().
+    uint8_t* perm_floor;    //!< Lowest address of the permanent region, which grows down from the top of the general heap.
+    size_t permanent_bytes; //!< Size of the permanent region (see dmheap_malloc_permanent()).
+    size_t reserve_bytes;   //!< Free bytes only critical modules may allocate (see dmheap_set_reserve()).
+    uint32_t coalesce_threshold; //!< Fragmentation percentage that starts automatic coalescing, 0 for never (see dmheap_set_coalesce_threshold()).
+    void* coalesce_position; //!< Next free block of the running coalescing pass - free_list_remove() moves it on when that block leaves.
+    size_t coalesce_slot;   //!< maintain_step state of the running coalescing pass, 0 while none runs.
+    size_t coalesce_floor;  //!< Free blocks the last coalescing pass left - the next one waits until there are more.
+    free_index_t* free_index; //!< Free-block size index, or NULL (see DMHEAP_FREE_INDEX).
+    block_t* header_pool;   //!< Out-of-band block_t table, or NULL when headers are inline (see DMHEAP_SEPARATE_METADATA).
+    block_t* spare_headers; //!< Unused entries of header_pool, linked through next.
+    uint32_t* header_above; //!< Per header_pool entry: index + 1 of the block physically right above it, 0 for none (free-list engine only, see block_above()).
+    size_t header_count;    //!< Number of entries in header_pool.
+    buddy_engine_t* buddy;  //!< Buddy engine state, or NULL for the free-list engine (see DMHEAP_ENGINE_BUDDY).
+    const dmheap_engine_t* engine;  //!< Engine managing the general heap.
+    dmheap_lock_fn_t lock;  //!< Enters the heap's critical section (see dmheap_set_lock()).
+    dmheap_lock_fn_t unlock; //!< Leaves the heap's critical section.
+    void* lock_data;        //!< Passed to lock and unlock.
+    uint32_t spin;          //!< Lock word for DMHEAP_LOCK_SPIN.
+    heap_counters_t counters; //!< Running statistics (see dmheap_peek_stats()).
+    uint32_t stats_seq;     //!< Sequence lock over counters - odd while an operation is in progress.
+    walk_mark_t walk_marks[DMHEAP_WALK_MARKS]; //!< Places of the running cursor walks (see walk_mark_locked()).
+    uint32_t walk_ticket;   //!< Last ticket handed to a walk mark.
+    uint32_t generation;    //!< Bumped whenever a block leaves a list, so a walk that lost its mark can tell whether the place it saved still holds.
+    heap_peaks_t peaks;     //!< High-water marks (see dmheap_reset_peaks()).
+    dmheap_sample_t* history; //!< Occupancy sample ring, or NULL (see dmheap_set_history()).
+    block_t* history_block; //!< Used block holding history.
+    size_t history_capacity; //!< Number of entries in history.
+    size_t history_count;   //!< Samples recorded so far - the next one goes to history[history_count % history_capacity].
+    size_t history_interval; //!< Operations between automatic samples, 0 for dmheap_record_sample() only.
+    size_t history_due;     //!< Value of allocs + frees at which the next automatic sample is taken.
+    dmheap_request_histogram_t untracked_requests; //!< Request histogram of allocations with no module (see DMHEAP_REQUEST_HISTOGRAM).
+    struct dmheap_context_t** shards; //!< Sub-heaps of a sharded heap, or NULL (see dmheap_init_sharded()).
+    size_t shard_count;     //!< Number of entries in shards.
+    size_t shard_span;      //!< Bytes of the buffer given to each shard, its own context included.
+    dmheap_shard_selector_t shard_selector; //!< Picks the shard an allocation tries first.
+    void* shard_selector_data; //!< Passed to shard_selector.
 } dmheap_context_t;
 
 /**
@@ -42,9 +488,263 @@ typedef struct dmheap_context_t
  */
 #define DMHEAP_MAX_DEFAULT_CONTEXTS 8
 
+/**
+ * @brief Sequence number handed to the next allocation on any heap.
+ *
+ * Shared by all contexts so a single dmheap_checkpoint() value is meaningful on
+ * every heap of the default list.
+ */
+static uint32_t g_alloc_seq = 0;
+
 static dmheap_context_t* g_default_contexts[DMHEAP_MAX_DEFAULT_CONTEXTS];
 static int32_t g_default_context_count = 0;
 
+/**
+ * @brief Hand out the next allocation sequence number.
+ *
+ * Heaps with their own locks (DMHEAP_LOCK_SPIN, dmheap_set_lock()) can allocate
+ * concurrently, so the shared counter is bumped atomically where the compiler
+ * allows it, and under the global critical section elsewhere.
+ *
+ * @return The sequence number for the new allocation.
+ */
+static inline uint32_t next_alloc_seq( void )
+{
+#if defined(__GNUC__)
+    return __atomic_fetch_add( &g_alloc_seq, 1u, __ATOMIC_RELAXED );
+#else
+    Dmod_EnterCritical();
+    uint32_t seq = g_alloc_seq++;
+    Dmod_ExitCritical();
+    return seq;
+#endif
+}
+
+/**
+ * @brief Default lock: the global DMOD critical section.
+ *
+ * @param data Unused.
+ */
+static void critical_lock( void* data )
+{
+    (void)data;
+    Dmod_EnterCritical();
+}
+
+/**
+ * @brief Counterpart of critical_lock().
+ *
+ * @param data Unused.
+ */
+static void critical_unlock( void* data )
+{
+    (void)data;
+    Dmod_ExitCritical();
+}
+
+/**
+ * @brief Lock for DMHEAP_LOCK_NONE heaps - does nothing.
+ *
+ * @param data Unused.
+ */
+static void no_lock( void* data )
+{
+    (void)data;
+}
+
+/**
+ * @brief Lock for DMHEAP_LOCK_SPIN heaps: test-and-test-and-set on the context's lock word.
+ *
+ * @param data Pointer to the lock word.
+ */
+static void spin_lock( void* data )
+{
+#if defined(__GNUC__)
+    uint32_t* word = (uint32_t*)data;
+    while( __atomic_exchange_n( word, 1u, __ATOMIC_ACQUIRE ) != 0 )
+    {
+        // Wait on a plain load so the cache line stays shared until it is released.
+        while( __atomic_load_n( word, __ATOMIC_RELAXED ) != 0 )
+        {
+        }
+    }
+#else
+    (void)data;
+    Dmod_EnterCritical();
+#endif
+}
+
+/**
+ * @brief Counterpart of spin_lock().
+ *
+ * @param data Pointer to the lock word.
+ */
+static void spin_unlock( void* data )
+{
+#if defined(__GNUC__)
+    __atomic_store_n( (uint32_t*)data, 0u, __ATOMIC_RELEASE );
+#else
+    (void)data;
+    Dmod_ExitCritical();
+#endif
+}
+
+/**
+ * @brief Install the built-in lock selected by the context's DMHEAP_LOCK_* flags.
+ *
+ * @param ctx Pointer to the heap context.
+ */
+static void set_builtin_lock( dmheap_context_t* ctx )
+{
+    ctx->lock_data = NULL;
+    ctx->spin      = 0;
+    if( ctx->flags & DMHEAP_LOCK_NONE )
+    {
+        ctx->lock   = no_lock;
+        ctx->unlock = no_lock;
+    }
+    else if( ctx->flags & DMHEAP_LOCK_SPIN )
+    {
+        ctx->lock      = spin_lock;
+        ctx->unlock    = spin_unlock;
+        ctx->lock_data = &ctx->spin;
+    }
+    else
+    {
+        ctx->lock   = critical_lock;
+        ctx->unlock = critical_unlock;
+    }
+}
+
+/**
+ * @brief Enter a heap's own critical section.
+ *
+ * Guards everything inside one context. The default heap list and the context
+ * fields it is searched by (name, caps) stay under the global Dmod_EnterCritical();
+ * where both are needed, the global one is taken first.
+ *
+ * The critical section doubles as the write side of the statistics sequence
+ * lock: stats_seq is odd from here to context_unlock(), which is all a
+ * dmheap_peek_stats() reader needs to spot a torn read.
+ *
+ * @param ctx Pointer to the heap context.
+ */
+static inline void context_lock( dmheap_context_t* ctx )
+{
+    ctx->lock( ctx->lock_data );
+#if defined(__GNUC__)
+    __atomic_store_n( &ctx->stats_seq, ctx->stats_seq + 1u, __ATOMIC_RELAXED );
+    __atomic_thread_fence( __ATOMIC_RELEASE );
+#else
+    ((volatile dmheap_context_t*)ctx)->stats_seq++;
+#endif
+}
+
+/**
+ * @brief Size of the heap's biggest free block or large extent, without a walk.
+ *
+ * @param ctx Pointer to the heap context.
+ *
+ * @return Size in bytes, 0 if nothing is free.
+ */
+static inline size_t current_largest_free( dmheap_context_t* ctx )
+{
+    size_t largest = ctx->engine->largest( ctx );
+    if( ctx->large != NULL && ctx->large->largest_free > largest )
+    {
+        largest = ctx->large->largest_free;
+    }
+    return largest;
+}
+
+/**
+ * @brief Append the heap's current occupancy to its history ring. Caller must
+ * hold the heap's critical section and have a ring configured.
+ *
+ * @param ctx Pointer to the heap context.
+ */
+static void record_sample_locked( dmheap_context_t* ctx )
+{
+    const heap_counters_t* counters = &ctx->counters;
+    dmheap_sample_t* sample = &ctx->history[ctx->history_count % ctx->history_capacity];
+    sample->used_bytes         = counters->used_bytes + counters->large_used_bytes + ctx->permanent_bytes;
+    sample->free_bytes         = counters->free_bytes + counters->large_free_bytes;
+    sample->largest_free_block = current_largest_free( ctx );
+    sample->used_block_count   = counters->used_blocks + counters->large_used_extents;
+    sample->free_block_count   = counters->free_blocks + counters->large_free_extents;
+    sample->alloc_count        = counters->allocs;
+    sample->free_count         = counters->frees;
+    ctx->history_count++;
+}
+
+/**
+ * @brief Part of a heap's reserve that critical modules are currently using.
+ *
+ * @param reserve_bytes Size of the reserve (see dmheap_set_reserve()).
+ * @param free_bytes    Free bytes of the general heap.
+ *
+ * @return How far free_bytes has dropped below the reserve, 0 if it has not.
+ */
+static inline size_t reserve_used( size_t reserve_bytes, size_t free_bytes )
+{
+    return free_bytes < reserve_bytes ? reserve_bytes - free_bytes : 0;
+}
+
+/**
+ * @brief Fold the heap's current state into its high-water marks.
+ *
+ * Runs as every operation leaves the critical section, so it only reads running
+ * totals and the engine's O(1) largest-block query.
+ *
+ * @param ctx Pointer to the heap context.
+ */
+static inline void update_peaks( dmheap_context_t* ctx )
+{
+    const heap_counters_t* counters = &ctx->counters;
+    size_t used_bytes  = counters->used_bytes + counters->large_used_bytes + ctx->permanent_bytes;
+    size_t used_blocks = counters->used_blocks + counters->large_used_extents;
+    size_t largest     = current_largest_free( ctx );
+    size_t reserved    = reserve_used( ctx->reserve_bytes, counters->free_bytes );
+
+    if( used_bytes > ctx->peaks.used_bytes )
+    {
+        ctx->peaks.used_bytes = used_bytes;
+    }
+    if( used_blocks > ctx->peaks.used_blocks )
+    {
+        ctx->peaks.used_blocks = used_blocks;
+    }
+    if( largest < ctx->peaks.min_largest_free )
+    {
+        ctx->peaks.min_largest_free = largest;
+    }
+    if( reserved > ctx->peaks.reserve_used )
+    {
+        ctx->peaks.reserve_used = reserved;
+    }
+}
+
+/**
+ * @brief Leave a heap's own critical section.
+ *
+ * @param ctx Pointer to the heap context.
+ */
+static inline void context_unlock( dmheap_context_t* ctx )
+{
+    update_peaks( ctx );
+    if( ctx->history_interval != 0 && ctx->counters.allocs + ctx->counters.frees >= ctx->history_due )
+    {
+        record_sample_locked( ctx );
+        ctx->history_due = ctx->counters.allocs + ctx->counters.frees + ctx->history_interval;
+    }
+#if defined(__GNUC__)
+    __atomic_store_n( &ctx->stats_seq, ctx->stats_seq + 1u, __ATOMIC_RELEASE );
+#else
+    ((volatile dmheap_context_t*)ctx)->stats_seq++;
+#endif
+    ctx->unlock( ctx->lock_data );
+}
+
 /**
  * @brief Add a heap to the default heap list. Caller must hold the critical section.
  *
@@ -106,6 +806,24 @@ static bool remove_default_context_locked( dmheap_context_t* ctx )
     return false;
 }
 
+/**
+ * @brief Count the set bits of a capability mask.
+ *
+ * @param mask Bit mask.
+ *
+ * @return Number of bits set in mask.
+ */
+static uint32_t count_bits( uint32_t mask )
+{
+    uint32_t count = 0;
+    while( mask != 0 )
+    {
+        mask &= mask - 1;
+        count++;
+    }
+    return count;
+}
+
 /**
  * @brief Align a pointer to the specified alignment.
  * 
@@ -150,57 +868,206 @@ static void block_set_next( block_t* block, block_t* next )
 }
 
 /**
- * @brief Create a new memory block.
- * 
- * @param address Pointer to the start of the block.
- * @param size    Size of the block.
- * 
- * @return Pointer to the created block_t structure.
+ * @brief Number of heap bytes a block's header takes in front of its data.
+ *
+ * @param ctx Pointer to the heap context.
+ *
+ * @return sizeof(block_t), or 0 when headers live out of band.
  */
-static block_t* create_block( void* address, size_t size )
+static inline size_t block_header_size( const dmheap_context_t* ctx )
 {
-    block_t* block = (block_t*)address;
-    block_set_next(block, NULL);
-    block->address = (void*)((uintptr_t)address + sizeof(block_t));
-    block->size    = size - sizeof(block_t);
-    return block;
+    return ctx->header_pool != NULL ? 0 : sizeof(block_t);
 }
 
 /**
- * @brief Split a memory block into two if it's larger than the requested size.
- * 
+ * @brief Start of the heap memory a block covers (its header, when inline).
+ *
  * @param ctx   Pointer to the heap context.
- * @param block Pointer to the block to be split.
- * @param size  Size of the first block after splitting.
+ * @param block Pointer to the block.
+ *
+ * @return Address of the first heap byte belonging to the block.
+ */
+static inline uintptr_t block_region_start( const dmheap_context_t* ctx, const block_t* block )
+{
+    return ctx->header_pool != NULL ? (uintptr_t)block->address : (uintptr_t)block;
+}
+
+/**
+ * @brief DMHEAP_HINT_* bits a used block was allocated with.
+ *
+ * @param block Pointer to the block.
+ *
+ * @return Lifetime hints kept in the block's flags.
+ */
+static inline uint32_t block_hints( const block_t* block )
+{
+    return (block->flags & BLOCK_FLAG_HINTS) >> BLOCK_FLAG_HINT_SHIFT;
+}
+
+/**
+ * @brief Alignment a used block was requested with.
+ *
+ * @param ctx   Pointer to the heap context that owns block.
+ * @param block Pointer to the block.
+ *
+ * @return Alignment kept in the block's flags, or the heap's own alignment.
+ */
+static inline size_t block_alignment( const dmheap_context_t* ctx, const block_t* block )
+{
+    uint32_t shift = (block->flags & BLOCK_FLAG_ALIGN) >> BLOCK_FLAG_ALIGN_SHIFT;
+    return shift != 0 ? (size_t)1 << shift : ctx->alignment;
+}
+
+/**
+ * @brief Record which block sits physically right above another one. Inline
+ * headers need no record - the next header starts where a block ends.
+ *
+ * @param ctx   Pointer to the heap context.
+ * @param block Pointer to the block.
+ * @param above Block starting right where block ends, or NULL.
+ */
+static inline void set_block_above( dmheap_context_t* ctx, block_t* block, block_t* above )
+{
+    if( ctx->header_above != NULL )
+    {
+        ctx->header_above[block - ctx->header_pool] = above != NULL ? (uint32_t)(above - ctx->header_pool) + 1 : 0;
+    }
+}
+
+/**
+ * @brief Find the block that starts right where a block of the free-list engine
+ * ends, in O(1).
+ *
+ * Blocks tile the general heap from heap_start up to the permanent region, so
+ * with inline headers that block's header is simply the next bytes; out-of-band
+ * headers keep the link in header_above, checked against the block's address
+ * so a link left stale by a merged-away header is never followed.
+ *
+ * @param ctx   Pointer to the heap context.
+ * @param block Pointer to the block.
+ *
+ * @return The block right above, or NULL at the top of the general heap.
+ */
+static inline block_t* block_above( const dmheap_context_t* ctx, const block_t* block )
+{
+    uintptr_t end = (uintptr_t)block->address + block->size;
+    if( ctx->header_pool == NULL )
+    {
+        return end < (uintptr_t)ctx->perm_floor ? (block_t*)end : NULL;
+    }
+    uint32_t link = ctx->header_above != NULL ? ctx->header_above[block - ctx->header_pool] : 0;
+    block_t* above = link != 0 ? &ctx->header_pool[link - 1] : NULL;
+    return above != NULL && (uintptr_t)above->address == end ? above : NULL;
+}
+
+/**
+ * @brief Create a new memory block.
+ *
+ * With inline headers the block_t is written at the start of the region;
+ * with DMHEAP_SEPARATE_METADATA it is taken from the header pool instead and
+ * the whole region is data.
+ * 
+ * @param ctx     Pointer to the heap context.
+ * @param address Pointer to the start of the block.
+ * @param size    Size of the block.
  * 
+ * @return Pointer to the created block_t structure, or NULL if the header pool is exhausted.
+ */
+static block_t* create_block( dmheap_context_t* ctx, void* address, size_t size )
+{
+    block_t* block = (block_t*)address;
+    if( ctx->header_pool != NULL )
+    {
+        block = ctx->spare_headers;
+        if( block == NULL )
+        {
+            return NULL;
+        }
+        ctx->spare_headers = block->next;
+        set_block_above( ctx, block, NULL );
+    }
+    block_set_next(block, NULL);
+    block->address = (void*)((uintptr_t)address + block_header_size( ctx ));
+    block->size    = size - block_header_size( ctx );
+    block->owner   = NULL;
+    block->flags   = 0;
+    block->seq     = 0;
+    return block;
+}
+
+/**
+ * @brief Give the header of a block that has been merged away back to the pool.
+ * Nothing to do for inline headers - they simply become data.
+ *
+ * @param ctx   Pointer to the heap context.
+ * @param block Pointer to the block.
+ */
+static void release_header( dmheap_context_t* ctx, block_t* block )
+{
+    if( ctx->header_pool != NULL )
+    {
+        block->address = NULL;
+        block->size    = 0;
+        block->next    = ctx->spare_headers;
+        ctx->spare_headers = block;
+    }
+}
+
+/**
+ * @brief Split a memory block into two at an exact data offset.
+ *
+ * @param ctx    Pointer to the heap context.
+ * @param block  Pointer to the block to be split.
+ * @param offset Size of the first block after splitting (a multiple of the pointer size).
+ *
  * @return Pointer to the new block created after splitting, or NULL if not split.
  */
-static block_t* split_block( dmheap_context_t* ctx, block_t* block, size_t size )
+static block_t* split_block_at( dmheap_context_t* ctx, block_t* block, size_t offset )
 {
-    if( block->size < size + sizeof(block_t) + 1 )
+    if( block->size < offset + block_header_size( ctx ) + 1 )
     {
         return NULL;
     }
 
-    // Align the size to ensure the new block starts at an aligned address
-    size_t aligned_size = align_size( size, ctx->alignment );
-    
-    // Make sure we still have enough space after alignment
-    if( block->size < aligned_size + sizeof(block_t) + 1 )
+    void* new_block_address = (void*)((uintptr_t)block->address + offset);
+    block_t* new_block = create_block( ctx, new_block_address, block->size - offset );
+    if( new_block == NULL )
     {
         return NULL;
     }
-
-    void* new_block_address = (void*)((uintptr_t)block->address + aligned_size);
-    block_t* new_block = create_block( new_block_address, block->size - aligned_size );
     block_set_next(new_block, block->next);
+    set_block_above( ctx, new_block, block_above( ctx, block ) );
+    set_block_above( ctx, block, new_block );
     new_block->owner = block->owner;
+    // The new header lands in the parent's data area, but new_block's own data
+    // bytes are untouched - they are exactly as clean as the parent's were.
+    new_block->flags = block->flags & BLOCK_FLAG_ZEROED;
     block_set_next(block, new_block);
-    block->size = aligned_size;
+    block->size = offset;
 
     return new_block;
 }
 
+/**
+ * @brief Split a memory block into two if it's larger than the requested size.
+ * 
+ * @param ctx   Pointer to the heap context.
+ * @param block Pointer to the block to be split.
+ * @param size  Size of the first block after splitting (rounded up to the heap's alignment).
+ * 
+ * @return Pointer to the new block created after splitting, or NULL if not split.
+ */
+static block_t* split_block( dmheap_context_t* ctx, block_t* block, size_t size )
+{
+    if( block->size < size + block_header_size( ctx ) + 1 )
+    {
+        return NULL;
+    }
+
+    // Align the size to ensure the new block starts at an aligned address
+    return split_block_at( ctx, block, align_size( size, ctx->alignment ) );
+}
+
 /**
  * @brief Remove a block from a linked list of blocks.
  * 
@@ -286,1158 +1153,5670 @@ static void add_free_block( block_t** list_head, block_t* block_to_add )
 }
 
 /**
- * @brief Find a suitable free block for allocation.
- *
- * @param ctx       Pointer to the heap context.
- * @param size      Size of memory to allocate.
- * @param alignment Alignment requirement.
+ * @brief Count a used block or large extent against its owning module.
  *
- * @return Pointer to the suitable block, or NULL if none found.
+ * @param module Owning module, or NULL for untracked memory.
+ * @param bytes  Size of the block.
  */
-static block_t* find_suitable_block( dmheap_context_t* ctx, size_t size, size_t alignment )
+static void module_charge( module_t* module, size_t bytes )
 {
-    block_t* current = ctx->free_list;
-    while( current != NULL )
+    if( module == NULL )
     {
-        void* aligned_address = align_pointer( current->address, alignment );
-        size_t padding = (size_t)((uintptr_t)aligned_address - (uintptr_t)current->address);
-        size_t min_size = size;
-        if(padding > 0)
-        {
-            min_size += padding + sizeof(block_t);
-        }
-        if( current->size > min_size )
-        {
-            return current;
-        }
-        current = current->next;
+        return;
+    }
+    module->used_bytes += bytes;
+    module->used_blocks++;
+    if( module->used_bytes > module->peak_used_bytes )
+    {
+        module->peak_used_bytes = module->used_bytes;
+    }
+    if( module->used_blocks > module->peak_used_blocks )
+    {
+        module->peak_used_blocks = module->used_blocks;
     }
-    return NULL;
 }
 
 /**
- * @brief Merge every pair of adjacent free blocks in the free list.
- *
- * Caller must already hold the heap's critical section - this is the core of
- * _concatenate_free_blocks(), factored out so it can also be called from inside
- * an allocation that is already holding the lock (see dmheap_aligned_alloc's
- * retry-after-fragmentation path).
+ * @brief Undo module_charge() for a block or large extent leaving its module.
  *
- * @param ctx Pointer to the heap context.
+ * @param module Owning module, or NULL for untracked memory.
+ * @param bytes  Size of the block.
  */
-static void concatenate_free_blocks_locked( dmheap_context_t* ctx )
+static void module_uncharge( module_t* module, size_t bytes )
 {
-    block_t* current = ctx->free_list;
-    while( current != NULL )
-    {
-        // `next` scans ahead for any block physically adjacent to `current`, regardless
-        // of list order (the free list is not address-sorted). `prev` tracks next's real
-        // predecessor *in the list* so that, on a match, we unlink `next` from where it
-        // actually sits - not from current->next, which would silently drop every node
-        // in between from both the free and used lists (they'd become permanently
-        // unreachable, neither free nor allocated).
-        block_t* prev = current;
-        block_t* next = current->next;
-        while( next != NULL )
-        {
-            if( (uintptr_t)current->address + current->size == (uintptr_t)next )
-            {
-                current->size += sizeof(block_t) + next->size;
-                block_set_next( prev, next->next );
-                next = prev->next;
-            }
-            else
-            {
-                prev = next;
-                next = next->next;
-            }
-        }
-        current = current->next;
-    }
-
-    // Merging grows blocks in place without moving them, so the free list (kept
-    // sorted smallest-to-largest by add_free_block()) is likely out of order now -
-    // rebuild it in sorted order.
-    block_t* unsorted = ctx->free_list;
-    ctx->free_list = NULL;
-    while( unsorted != NULL )
+    if( module != NULL )
     {
-        block_t* next = unsorted->next;
-        add_free_block( &ctx->free_list, unsorted );
-        unsorted = next;
+        module->used_bytes -= bytes;
+        module->used_blocks--;
     }
 }
 
 /**
- * @brief Find a block by its address in the used list.
- * 
- * @param ctx     Pointer to the heap context.
- * @param address Pointer to the memory address.
- * 
- * @return Pointer to the block_t structure, or NULL if not found.
+ * @brief Move every cursor walk mark on a block that leaves its list on to the
+ * block that followed it - a handful of compares, so a walk never has to look
+ * its place up again (see walk_mark_locked()).
+ *
+ * @param ctx   Pointer to the heap context.
+ * @param block Block leaving its list.
+ * @param next  Block the walks carry on from instead.
  */
-static block_t* find_block_by_address( dmheap_context_t* ctx, void* address )
+static inline void walk_marks_pass( dmheap_context_t* ctx, void* block, void* next )
 {
-    block_t* current = ctx->used_list;
-    while( current != NULL )
+    ctx->generation++;
+    for( size_t i = 0; i < DMHEAP_WALK_MARKS; i++ )
     {
-        if( current->address == address )
+        if( ctx->walk_marks[i].position == block )
         {
-            return current;
+            ctx->walk_marks[i].position = next;
         }
-        current = current->next;
     }
-    return NULL;
 }
 
 /**
- * @brief Add a module to the module list.
- * 
- * @param list_head Pointer to the head of the module list.
- * @param module    Pointer to the module to be added.
+ * @brief Take every cursor walk mark of a heap back, after its lists have been
+ * rebuilt - the walks pass over what they already visited again.
+ *
+ * @param ctx Pointer to the heap context.
  */
-static void add_module_to_list( module_t** list_head, module_t* module )
+static void walk_marks_drop( dmheap_context_t* ctx )
 {
-    if( list_head == NULL || module == NULL )
-    {
-        return;
-    }
-
-    module->next = *list_head;
-    *list_head = module;
+    memset( ctx->walk_marks, 0, sizeof(ctx->walk_marks) );
+    ctx->generation++;
 }
 
 /**
- * @brief Find a module by its name.
- * 
- * @param ctx  Pointer to the heap context.
- * @param name Name of the module.
- * 
- * @return Pointer to the module_t structure, or NULL if not found.
+ * @brief Put a block on the context's used list.
+ *
+ * @param ctx   Pointer to the heap context.
+ * @param block Pointer to the block to be added.
  */
-static module_t* find_module_by_name( dmheap_context_t* ctx, const char* name )
+static void used_list_add( dmheap_context_t* ctx, block_t* block )
 {
-    module_t* current = ctx->module_list;
-    while( current != NULL )
-    {
-        if( strncmp( current->name, name, DMOD_MAX_MODULE_NAME_LENGTH ) == 0 )
-        {
-            return current;
-        }
-        current = current->next;
-    }
-    return NULL;
+    add_block( &ctx->used_list, block );
+    ctx->counters.used_bytes += block->size;
+    ctx->counters.used_blocks++;
+    ctx->counters.allocs++;
+    module_charge( block->owner, block->size );
 }
 
 /**
- * @brief Remove a module from the module list.
- * 
- * @param list_head Pointer to the head of the module list.
- * @param module_to_remove Pointer to the module to be removed.
+ * @brief Unlink a block from the used list, given the block in front of it.
+ * Counters are left to the caller.
+ *
+ * @param ctx   Pointer to the heap context.
+ * @param prev  Block in front of block, or NULL if block is the head.
+ * @param block Block to unlink.
  */
-static void remove_module_from_list( module_t** list_head, module_t* module_to_remove )
+static void used_list_unlink( dmheap_context_t* ctx, block_t* prev, block_t* block )
 {
-    if( *list_head == NULL || module_to_remove == NULL )
+    if( prev == NULL )
     {
-        return;
+        ctx->used_list = block->next;
     }
-
-    if( *list_head == module_to_remove )
+    else
     {
-        *list_head = module_to_remove->next;
-        return;
+        block_set_next( prev, block->next );
     }
-
-    module_t* current = *list_head;
-    while( current->next != NULL )
+    // A teardown sweep resumes after sweep_prev (see teardown_step_locked()),
+    // so it must never point at a block that has left the list.
+    if( ctx->sweep_prev == block )
     {
-        if( current->next == module_to_remove )
-        {
-            current->next = module_to_remove->next;
-            return;
-        }
-        current = current->next;
+        ctx->sweep_prev = prev;
     }
+    walk_marks_pass( ctx, block, block->next );
+    block_set_next( block, NULL );
 }
 
 /**
- * @brief Allocate aligned memory from the heap.
- * 
- * @param ctx         Pointer to the heap context.
- * @param alignment   Alignment requirement.
- * @param size        Size of memory to allocate.
- * @param module_name Name of the module requesting allocation (for logging).
- * 
- * @return Pointer to the allocated memory, or NULL if allocation fails.
+ * @brief Take a block off the context's used list.
+ *
+ * @param ctx   Pointer to the heap context.
+ * @param block Pointer to the block to be removed.
  */
-static module_t* create_module( dmheap_context_t* ctx, const char* name )
+static void used_list_remove( dmheap_context_t* ctx, block_t* block )
 {
-    block_t* block = find_suitable_block( ctx, sizeof(module_t), ctx->alignment );
-    if( block == NULL )
+    block_t* prev = NULL;
+    block_t* current = ctx->used_list;
+    while( current != NULL && current != block )
     {
-        DMOD_LOG_ERROR("dmheap: Unable to allocate memory for module %s.\n", name);
-        return NULL;
+        prev = current;
+        current = current->next;
     }
-    remove_block( &ctx->free_list, block );
-    block->owner = NULL;
-    if(block->size > (sizeof(module_t) + sizeof(block_t) + ctx->alignment))
+    if( current != NULL )
     {
-        block_t* new_block = split_block( ctx, block, sizeof(module_t) );
-        if( new_block != NULL )
-        {
-            add_free_block( &ctx->free_list, new_block );
-        }
+        used_list_unlink( ctx, prev, block );
     }
-    module_t* module = (module_t*)block->address;
-    strncpy( module->name, name, DMOD_MAX_MODULE_NAME_LENGTH - 1 );
-    module->name[DMOD_MAX_MODULE_NAME_LENGTH - 1] = '\0';
-    add_block( &ctx->used_list, block );
-    add_module_to_list( &ctx->module_list, module );
-    return module;
+    ctx->counters.used_bytes -= block->size;
+    ctx->counters.used_blocks--;
+    ctx->counters.frees++;
+    module_uncharge( block->owner, block->size );
 }
 
 /**
- * @brief Release all memory allocated by a specific module.
- * 
- * @param ctx    Pointer to the heap context.
- * @param module Pointer to the module whose memory is to be released.
+ * @brief Saturate a block size to the 32-bit lanes of the free index.
  */
-static void release_memory_of_module( dmheap_context_t* ctx, module_t* module )
+static inline uint32_t free_index_key( size_t size )
 {
-    if( module == NULL )
-    {
-        return;
+    return size >= UINT32_MAX ? UINT32_MAX : (uint32_t)size;
+}
+
+/**
+ * @brief Find the first entry of a sorted size array that is larger than value.
+ *
+ * Compares 8 (AVX2) or 4 (SSE2, NEON) sizes at a time until a vector holds a
+ * match, then finishes with the scalar loop, which is also the whole search on
+ * other targets. SSE2/AVX2 only compare signed integers, so both sides are
+ * biased by 0x80000000 first.
+ *
+ * @param sizes Array of sizes, sorted ascending.
+ * @param count Number of entries in sizes.
+ * @param value Value to compare against.
+ *
+ * @return Index of the first entry > value, or count if there is none.
+ */
+static uint32_t free_index_first_above( const uint32_t* sizes, uint32_t count, uint32_t value )
+{
+    uint32_t i = 0;
+#if defined(__AVX2__)
+    const __m256i bias = _mm256_set1_epi32( (int)0x80000000u );
+    const __m256i key  = _mm256_xor_si256( _mm256_set1_epi32( (int)value ), bias );
+    for( ; i + 8 <= count; i += 8 )
+    {
+        __m256i lanes = _mm256_xor_si256( _mm256_loadu_si256( (const __m256i*)&sizes[i] ), bias );
+        if( _mm256_movemask_epi8( _mm256_cmpgt_epi32( lanes, key ) ) != 0 )
+        {
+            break;
+        }
+    }
+#elif defined(DMHEAP_FREE_INDEX_SSE2)
+    const __m128i bias = _mm_set1_epi32( (int)0x80000000u );
+    const __m128i key  = _mm_xor_si128( _mm_set1_epi32( (int)value ), bias );
+    for( ; i + 4 <= count; i += 4 )
+    {
+        __m128i lanes = _mm_xor_si128( _mm_loadu_si128( (const __m128i*)&sizes[i] ), bias );
+        if( _mm_movemask_epi8( _mm_cmpgt_epi32( lanes, key ) ) != 0 )
+        {
+            break;
+        }
+    }
+#elif defined(__ARM_NEON)
+    const uint32x4_t key = vdupq_n_u32( value );
+    for( ; i + 4 <= count; i += 4 )
+    {
+        uint32x4_t above = vcgtq_u32( vld1q_u32( &sizes[i] ), key );
+        uint32x2_t any   = vorr_u32( vget_low_u32( above ), vget_high_u32( above ) );
+        if( (vget_lane_u32( any, 0 ) | vget_lane_u32( any, 1 )) != 0 )
+        {
+            break;
+        }
+    }
+#endif
+    while( i < count && sizes[i] <= value )
+    {
+        i++;
     }
+    return i;
+}
 
-    block_t* current = ctx->used_list;
+/**
+ * @brief Find where a size belongs in the free index.
+ *
+ * @return Index of the first entry >= key - which, since the index mirrors the
+ * free list, is also where add_free_block() would put a block of that size.
+ */
+static inline uint32_t free_index_lower_bound( const free_index_t* index, uint32_t key )
+{
+    return key > 0 ? free_index_first_above( index->sizes, index->count, key - 1 ) : 0;
+}
+
+/**
+ * @brief Record a block that has just joined the free list in the free index.
+ *
+ * @param index Pointer to the free index.
+ * @param block Pointer to the block.
+ */
+static void free_index_insert( free_index_t* index, block_t* block )
+{
+    if( index->overflowed )
+    {
+        return;
+    }
+    if( index->count >= DMHEAP_FREE_INDEX_CAPACITY )
+    {
+        index->overflowed = true;
+        return;
+    }
+
+    uint32_t key = free_index_key( block->size );
+    uint32_t pos = free_index_lower_bound( index, key );
+    memmove( &index->sizes[pos + 1], &index->sizes[pos], (index->count - pos) * sizeof(uint32_t) );
+    memmove( &index->blocks[pos + 1], &index->blocks[pos], (index->count - pos) * sizeof(block_t*) );
+    index->sizes[pos]  = key;
+    index->blocks[pos] = block;
+    index->count++;
+}
+
+/**
+ * @brief Find a free block's entry in the free index.
+ *
+ * @param index Pointer to the free index.
+ * @param block Pointer to the block (its size must not have changed since it was inserted).
+ *
+ * @return Index of the block's entry, or index->count if it is not there.
+ */
+static uint32_t free_index_find( const free_index_t* index, block_t* block )
+{
+    uint32_t key = free_index_key( block->size );
+    uint32_t pos = free_index_lower_bound( index, key );
+    while( pos < index->count && index->sizes[pos] == key )
+    {
+        if( index->blocks[pos] == block )
+        {
+            return pos;
+        }
+        pos++;
+    }
+    return index->count;
+}
+
+/**
+ * @brief Insert a block into the context's free list (and free index, if any).
+ *
+ * While the index is usable its entries are in exactly the free list's order,
+ * so the entry just before the block's slot is its list predecessor and the
+ * sorted insert needs no list walk. Blocks of 4 GiB and up, whose sizes are
+ * saturated in the index, still take the walk.
+ *
+ * @param ctx   Pointer to the heap context.
+ * @param block Pointer to the block to be added.
+ */
+static void free_list_insert( dmheap_context_t* ctx, block_t* block )
+{
+    if( block != NULL )
+    {
+        ctx->counters.free_bytes += block->size;
+        ctx->counters.free_blocks++;
+        block->flags |= BLOCK_FLAG_FREE;
+    }
+
+    free_index_t* index = ctx->free_index;
+    if( index == NULL || block == NULL || index->overflowed ||
+        index->count >= DMHEAP_FREE_INDEX_CAPACITY || block->size >= UINT32_MAX )
+    {
+        add_free_block( &ctx->free_list, block );
+        if( index != NULL && block != NULL )
+        {
+            free_index_insert( index, block );
+        }
+    }
+    else
+    {
+        uint32_t pos = free_index_lower_bound( index, (uint32_t)block->size );
+        if( pos == 0 )
+        {
+            block_set_next( block, ctx->free_list );
+            ctx->free_list = block;
+        }
+        else
+        {
+            block_t* prev = index->blocks[pos - 1];
+            block_set_next( block, prev->next );
+            block_set_next( prev, block );
+        }
+        free_index_insert( index, block );
+    }
+
+    if( block != NULL && block->next == NULL )
+    {
+        ctx->free_tail = block;
+    }
+}
+
+/**
+ * @brief Remove a block from the context's free list (and free index, if any).
+ *
+ * Like free_list_insert(), takes the list predecessor from the index when it can.
+ *
+ * @param ctx   Pointer to the heap context.
+ * @param block Pointer to the block to be removed.
+ */
+static void free_list_remove( dmheap_context_t* ctx, block_t* block )
+{
+    if( block != NULL )
+    {
+        ctx->counters.free_bytes -= block->size;
+        ctx->counters.free_blocks--;
+        block->flags &= ~BLOCK_FLAG_FREE;
+        // An automatic coalescing pass and the cursor walks carry on from
+        // whatever followed.
+        if( ctx->coalesce_position == block )
+        {
+            ctx->coalesce_position = block->next;
+        }
+        walk_marks_pass( ctx, block, block->next );
+    }
+
+    // Dropping the tail makes its list predecessor the new tail - known right
+    // away through the index, found by a walk otherwise.
+    bool was_tail = block != NULL && block == ctx->free_tail;
+    bool tail_known = false;
     block_t* prev = NULL;
 
-    while( current != NULL )
+    free_index_t* index = ctx->free_index;
+    if( index == NULL || block == NULL || index->overflowed )
     {
-        if( current->owner == module )
+        remove_block( &ctx->free_list, block );
+    }
+    else
+    {
+        uint32_t pos = free_index_find( index, block );
+        if( pos >= index->count || index->sizes[pos] == UINT32_MAX )
         {
-            block_t* to_free = current;
+            remove_block( &ctx->free_list, block );
+        }
+        else
+        {
+            prev = pos == 0 ? NULL : index->blocks[pos - 1];
+            tail_known = true;
             if( prev == NULL )
             {
-                ctx->used_list = current->next;
-                current = ctx->used_list;
+                ctx->free_list = block->next;
             }
             else
             {
-                block_set_next(prev, current->next);
-                current = prev->next;
+                block_set_next( prev, block->next );
+            }
+            block_set_next( block, NULL );
+        }
+
+        if( pos < index->count )
+        {
+            memmove( &index->sizes[pos], &index->sizes[pos + 1], (index->count - pos - 1) * sizeof(uint32_t) );
+            memmove( &index->blocks[pos], &index->blocks[pos + 1], (index->count - pos - 1) * sizeof(block_t*) );
+            index->count--;
+        }
+    }
+
+    if( was_tail )
+    {
+        if( !tail_known )
+        {
+            for( prev = ctx->free_list; prev != NULL && prev->next != NULL; prev = prev->next )
+            {
+            }
+        }
+        ctx->free_tail = prev;
+    }
+}
+
+/**
+ * @brief Put a free block on its buddy free list.
+ *
+ * @param ctx   Pointer to the heap context.
+ * @param index Position of the block, in minimum blocks from the arena base.
+ * @param order Order of the block.
+ */
+static void buddy_push( dmheap_context_t* ctx, size_t index, uint8_t order )
+{
+    buddy_engine_t* buddy = ctx->buddy;
+    buddy_node_t* node = (buddy_node_t*)(buddy->base + index * DMHEAP_BUDDY_MIN_BLOCK);
+    node->prev = NULL;
+    node->next = buddy->free_lists[order];
+    if( node->next != NULL )
+    {
+        node->next->prev = node;
+    }
+    buddy->free_lists[order] = node;
+    buddy->orders[index] = order;
+    ctx->counters.free_bytes += (size_t)DMHEAP_BUDDY_MIN_BLOCK << order;
+    ctx->counters.free_blocks++;
+}
+
+/**
+ * @brief Take a free block off its buddy free list.
+ *
+ * @param ctx   Pointer to the heap context.
+ * @param index Position of the block, in minimum blocks from the arena base.
+ */
+static void buddy_unlink( dmheap_context_t* ctx, size_t index )
+{
+    buddy_engine_t* buddy = ctx->buddy;
+    ctx->counters.free_bytes -= (size_t)DMHEAP_BUDDY_MIN_BLOCK << buddy->orders[index];
+    ctx->counters.free_blocks--;
+    buddy_node_t* node = (buddy_node_t*)(buddy->base + index * DMHEAP_BUDDY_MIN_BLOCK);
+    walk_marks_pass( ctx, node, node->next );
+    if( node->prev != NULL )
+    {
+        node->prev->next = node->next;
+    }
+    else
+    {
+        buddy->free_lists[buddy->orders[index]] = node->next;
+    }
+    if( node->next != NULL )
+    {
+        node->next->prev = node->prev;
+    }
+    buddy->orders[index] = BUDDY_NOT_FREE;
+}
+
+/**
+ * @brief Carve the buddy arena into the largest possible naturally aligned blocks.
+ *
+ * @param ctx Pointer to the heap context (buddy base and block_count already set).
+ */
+static void buddy_init_arena( dmheap_context_t* ctx )
+{
+    buddy_engine_t* buddy = ctx->buddy;
+    memset( buddy->free_lists, 0, sizeof(buddy->free_lists) );
+    memset( buddy->orders, BUDDY_NOT_FREE, buddy->block_count );
+
+    // Greedy binary decomposition: every piece starts at a multiple of its own
+    // size, so it is a valid buddy block. A piece's buddy position is always the
+    // start of a smaller piece, which can never be free at the same order.
+    size_t index = 0;
+    for( int order = DMHEAP_BUDDY_MAX_ORDERS - 1; order >= 0; order-- )
+    {
+        size_t blocks = (size_t)1 << order;
+        if( blocks <= buddy->block_count - index )
+        {
+            buddy_push( ctx, index, (uint8_t)order );
+            index += blocks;
+        }
+    }
+}
+
+/**
+ * @brief Allocate a block from the buddy engine. Caller must hold the critical section.
+ *
+ * @param ctx       Pointer to the heap context.
+ * @param size      Size of memory to allocate.
+ * @param alignment Alignment requirement (power of two).
+ *
+ * @return Out-of-band header of the new block (on no list yet), or NULL on failure.
+ */
+static block_t* buddy_take_block( dmheap_context_t* ctx, size_t size, size_t alignment )
+{
+    buddy_engine_t* buddy = ctx->buddy;
+    if( alignment > buddy->base_alignment )
+    {
+        DMOD_LOG_ERROR("dmheap: buddy heap %p cannot honour a %zu-byte alignment.\n", ctx, alignment);
+        return NULL;
+    }
+
+    // A block is aligned to its own size, so asking for at least `alignment`
+    // bytes is all it takes to get an aligned block.
+    size_t needed = size > alignment ? size : alignment;
+    uint8_t order = 0;
+    while( order < DMHEAP_BUDDY_MAX_ORDERS && ((size_t)DMHEAP_BUDDY_MIN_BLOCK << order) < needed )
+    {
+        order++;
+    }
+    uint8_t found = order;
+    while( found < DMHEAP_BUDDY_MAX_ORDERS && buddy->free_lists[found] == NULL )
+    {
+        found++;
+    }
+    if( found >= DMHEAP_BUDDY_MAX_ORDERS || ctx->spare_headers == NULL )
+    {
+        return NULL;
+    }
+
+    size_t index = (size_t)((uint8_t*)buddy->free_lists[found] - buddy->base) / DMHEAP_BUDDY_MIN_BLOCK;
+    buddy_unlink( ctx, index );
+    while( found > order )
+    {
+        found--;
+        buddy_push( ctx, index + ((size_t)1 << found), found );
+    }
+
+    return create_block( ctx, buddy->base + index * DMHEAP_BUDDY_MIN_BLOCK, (size_t)DMHEAP_BUDDY_MIN_BLOCK << order );
+}
+
+/**
+ * @brief Return a used block to the buddy engine, merging it with free buddies.
+ * Caller must hold the critical section.
+ *
+ * @param ctx   Pointer to the heap context.
+ * @param block Block to release (already unlinked from the used list).
+ */
+static void buddy_release_block( dmheap_context_t* ctx, block_t* block )
+{
+    buddy_engine_t* buddy = ctx->buddy;
+    size_t index = (size_t)((uint8_t*)block->address - buddy->base) / DMHEAP_BUDDY_MIN_BLOCK;
+    uint8_t order = 0;
+    while( ((size_t)DMHEAP_BUDDY_MIN_BLOCK << order) < block->size )
+    {
+        order++;
+    }
+    release_header( ctx, block );
+
+    while( order + 1 < DMHEAP_BUDDY_MAX_ORDERS )
+    {
+        size_t buddy_index = index ^ ((size_t)1 << order);
+        if( buddy_index + ((size_t)1 << order) > buddy->block_count || buddy->orders[buddy_index] != order )
+        {
+            break;
+        }
+        buddy_unlink( ctx, buddy_index );
+        index = index < buddy_index ? index : buddy_index;
+        order++;
+    }
+    buddy_push( ctx, index, order );
+}
+
+/**
+ * @brief Padding aligned_alloc_in_context() will put in front of data carved
+ * from a free block.
+ *
+ * When the gap up to the aligned address is too small for the header that
+ * splits it off, the data moves on to the next aligned address past that
+ * header - the search has to count that bigger gap, or it picks blocks the
+ * allocation then cannot use.
+ *
+ * @param ctx       Pointer to the heap context.
+ * @param address   Data address of the free block.
+ * @param alignment Alignment requirement.
+ *
+ * @return Number of bytes between address and the allocation's data.
+ */
+static size_t fit_padding( const dmheap_context_t* ctx, void* address, size_t alignment )
+{
+    size_t padding = (size_t)((uintptr_t)align_pointer( address, alignment ) - (uintptr_t)address);
+    if( padding > 0 && padding < block_header_size( ctx ) )
+    {
+        void* past_header = (void*)((uintptr_t)address + block_header_size( ctx ));
+        padding = (size_t)((uintptr_t)align_pointer( past_header, alignment ) - (uintptr_t)address);
+    }
+    return padding;
+}
+
+/**
+ * @brief Which end of the heap a combination of DMHEAP_HINT_* bits asks for.
+ *
+ * @param hints DMHEAP_HINT_* bits of the request.
+ *
+ * @return 1 for the top (long-lived), -1 for the bottom (short-lived), or 0
+ *         for plain best fit - no hint, or both at once.
+ */
+static int hint_placement( uint32_t hints )
+{
+    switch( hints & (DMHEAP_HINT_SHORT_LIVED | DMHEAP_HINT_LONG_LIVED) )
+    {
+        case DMHEAP_HINT_LONG_LIVED:  return 1;
+        case DMHEAP_HINT_SHORT_LIVED: return -1;
+        default:                      return 0;
+    }
+}
+
+/**
+ * @brief Find a suitable free block for allocation.
+ *
+ * Without a placement this is the first fit of the size-sorted free list, i.e.
+ * the best fit. With one, every fitting block is looked at and the one highest
+ * (placement > 0) or lowest (placement < 0) in the heap wins.
+ *
+ * @param ctx       Pointer to the heap context.
+ * @param size      Size of memory to allocate.
+ * @param alignment Alignment requirement.
+ * @param placement Result of hint_placement() for the request.
+ *
+ * @return Pointer to the suitable block, or NULL if none found.
+ */
+static block_t* find_suitable_block( dmheap_context_t* ctx, size_t size, size_t alignment, int placement )
+{
+    block_t* best = NULL;
+    uintptr_t best_address = 0;
+    free_index_t* index = ctx->free_index;
+    if( index != NULL && !index->overflowed && size < UINT32_MAX )
+    {
+        // Same best-fit walk as below, over the side array - an inline block's data
+        // starts right after its header, so padding needs no header read either.
+        for( uint32_t i = free_index_first_above( index->sizes, index->count, (uint32_t)size ); i < index->count; i++ )
+        {
+            block_t* candidate = index->blocks[i];
+            void* address = ctx->header_pool != NULL ? candidate->address : (void*)((uintptr_t)candidate + sizeof(block_t));
+            size_t padding = fit_padding( ctx, address, alignment );
+            size_t min_size = padding > 0 ? size + padding + block_header_size( ctx ) : size;
+            size_t candidate_size = index->sizes[i] == UINT32_MAX ? candidate->size : index->sizes[i];
+            if( candidate_size > min_size )
+            {
+                if( placement == 0 )
+                {
+                    return candidate;
+                }
+                if( best == NULL || (placement > 0) == ((uintptr_t)address > best_address) )
+                {
+                    best = candidate;
+                    best_address = (uintptr_t)address;
+                }
+            }
+        }
+        return best;
+    }
+
+    block_t* current = ctx->free_list;
+    while( current != NULL )
+    {
+        size_t padding = fit_padding( ctx, current->address, alignment );
+        size_t min_size = size;
+        if(padding > 0)
+        {
+            min_size += padding + block_header_size( ctx );
+        }
+        if( current->size > min_size )
+        {
+            if( placement == 0 )
+            {
+                return current;
+            }
+            if( best == NULL || (placement > 0) == ((uintptr_t)current->address > best_address) )
+            {
+                best = current;
+                best_address = (uintptr_t)current->address;
+            }
+        }
+        current = current->next;
+    }
+    return best;
+}
+
+/**
+ * @brief Split a free block so that an aligned allocation sits at its very end.
+ *
+ * @param ctx       Pointer to the heap context.
+ * @param block     Free block, already taken off the free list.
+ * @param size      Size of the allocation (aligned).
+ * @param alignment Alignment requirement.
+ *
+ * @return The new top part of the block, whose data is aligned and holds at
+ *         least size bytes, or NULL when the part left below it would be too
+ *         small to stay a block of its own.
+ */
+static block_t* split_block_top( dmheap_context_t* ctx, block_t* block, size_t size, size_t alignment )
+{
+    uintptr_t start = (uintptr_t)block->address;
+    uintptr_t data  = (start + block->size - size) & ~(uintptr_t)(alignment - 1);
+    if( data < start + block_header_size( ctx ) + ctx->alignment )
+    {
+        return NULL;
+    }
+    return split_block_at( ctx, block, data - block_header_size( ctx ) - start );
+}
+
+/**
+ * @brief Grow a block over the free block right above it and give that block's
+ * header back. Neither may be on the free list.
+ *
+ * @param ctx       Pointer to the heap context.
+ * @param block     Lower block, which grows.
+ * @param neighbour Block starting right where block ends.
+ */
+static void absorb_free_block( dmheap_context_t* ctx, block_t* block, block_t* neighbour )
+{
+    set_block_above( ctx, block, block_above( ctx, neighbour ) );
+    // A walk still marking neighbour (concatenate_free_blocks_locked() takes
+    // the blocks off the list wholesale) carries on from the merged block.
+    walk_marks_pass( ctx, neighbour, block );
+    block->size += block_header_size( ctx ) + neighbour->size;
+    // An inline header of neighbour becomes part of block's data - wipe it if
+    // that keeps the merged block known-zero, otherwise the block is no longer
+    // clean.
+    if( (block->flags & neighbour->flags & BLOCK_FLAG_ZEROED) == 0 )
+    {
+        block->flags &= ~BLOCK_FLAG_ZEROED;
+    }
+    else if( ctx->header_pool == NULL )
+    {
+        memset( neighbour, 0, sizeof(block_t) );
+    }
+    release_header( ctx, neighbour );
+}
+
+/**
+ * @brief Merge-sort a list of blocks, either by address or from largest to
+ * smallest size.
+ *
+ * @param ctx        Pointer to the heap context.
+ * @param list       Head of the list, linked through next.
+ * @param by_address true to sort by address, false to put the largest first.
+ *
+ * @return Head of the sorted list.
+ */
+static block_t* sort_blocks( const dmheap_context_t* ctx, block_t* list, bool by_address )
+{
+    if( list == NULL || list->next == NULL )
+    {
+        return list;
+    }
+
+    // Split the list in halves, sort each and merge them back.
+    block_t* middle = list;
+    for( block_t* fast = list->next; fast != NULL && fast->next != NULL; fast = fast->next->next )
+    {
+        middle = middle->next;
+    }
+    block_t* second = middle->next;
+    middle->next = NULL;
+    block_t* first = sort_blocks( ctx, list, by_address );
+    second = sort_blocks( ctx, second, by_address );
+
+    block_t** link = &list;
+    while( first != NULL && second != NULL )
+    {
+        bool first_wins = by_address ? block_region_start( ctx, first ) < block_region_start( ctx, second )
+                                     : first->size >= second->size;
+        block_t** taken = first_wins ? &first : &second;
+        *link = *taken;
+        link  = &(*taken)->next;
+        *taken = (*taken)->next;
+    }
+    *link = first != NULL ? first : second;
+    return list;
+}
+
+/**
+ * @brief Merge every pair of adjacent free blocks in the free list.
+ *
+ * Caller must already hold the heap's critical section - this is the core of
+ * _concatenate_free_blocks(), factored out so it can also be called from inside
+ * an allocation that is already holding the lock (see dmheap_aligned_alloc's
+ * retry-after-fragmentation path).
+ *
+ * The free list is sorted by size, not address, so it is put in address order
+ * first - then physical neighbours are list neighbours too and one pass merges
+ * them all, O(n log n) in total.
+ *
+ * @param ctx Pointer to the heap context.
+ */
+static void concatenate_free_blocks_locked( dmheap_context_t* ctx )
+{
+    block_t* blocks = sort_blocks( ctx, ctx->free_list, true );
+    block_t* current = blocks;
+    while( current != NULL && current->next != NULL )
+    {
+        block_t* next = current->next;
+        if( (uintptr_t)current->address + current->size != block_region_start( ctx, next ) )
+        {
+            current = next;
+            continue;
+        }
+
+        // current stays put, so it can swallow the next one too.
+        current->next = next->next;
+        absorb_free_block( ctx, current, next );
+    }
+
+    // Rebuild the size-sorted free list. Inserting the blocks largest first puts
+    // each one at the head, so no insert has to walk the list.
+    // The free index is rebuilt along with it, which is also what recovers it
+    // after an overflow.
+    block_t* unsorted = sort_blocks( ctx, blocks, false );
+    ctx->free_list = NULL;
+    ctx->free_tail = NULL;
+    ctx->counters.free_bytes  = 0;
+    ctx->counters.free_blocks = 0;
+    if( ctx->free_index != NULL )
+    {
+        ctx->free_index->count = 0;
+        ctx->free_index->overflowed = false;
+    }
+    while( unsorted != NULL )
+    {
+        block_t* next = unsorted->next;
+        free_list_insert( ctx, unsorted );
+        unsorted = next;
+    }
+
+    // Nothing is left for a running pass to do.
+    ctx->coalesce_position = NULL;
+    ctx->coalesce_slot     = 0;
+    ctx->coalesce_floor    = ctx->counters.free_blocks;
+    ctx->sweep_merge       = false;
+}
+
+/**
+ * @brief Add one free block to a running statistics total.
+ *
+ * @param out_stats Statistics accumulator, updated in place.
+ * @param bytes     Size of the free block.
+ */
+static void count_free_block( dmheap_stats_t* out_stats, size_t bytes )
+{
+    out_stats->free_bytes += bytes;
+    out_stats->free_block_count++;
+    if( out_stats->largest_free_block == 0 || bytes > out_stats->largest_free_block )
+    {
+        out_stats->largest_free_block = bytes;
+    }
+    if( out_stats->smallest_free_block == 0 || bytes < out_stats->smallest_free_block )
+    {
+        out_stats->smallest_free_block = bytes;
+    }
+}
+
+/**
+ * @brief Free-list engine: best fit from the size-sorted free list.
+ *
+ * Lifetime hints trade the best fit for placement instead: long-lived blocks
+ * go to the top end of the highest fitting block, short-lived ones to the
+ * bottom of the lowest.
+ *
+ * @param ctx        Pointer to the heap context.
+ * @param size       Size of memory to allocate.
+ * @param alignment  Alignment requirement.
+ * @param hints      DMHEAP_HINT_* bits of the request.
+ * @param out_zeroed Set to whether the block's data is known to be zero (may be NULL).
+ *
+ * @return Block on no list, whose address is aligned, or NULL on failure.
+ */
+static block_t* list_engine_alloc( dmheap_context_t* ctx, size_t size, size_t alignment, uint32_t hints, bool* out_zeroed )
+{
+    size_t aligned_size = align_size( size, alignment );
+    int placement = hint_placement( hints );
+    block_t* block = find_suitable_block( ctx, aligned_size, alignment, placement );
+    if( block == NULL )
+    {
+        // Dmod_Free() never coalesces on its own (Concatenate=false) - a request can
+        // fail here purely from fragmentation even when the aggregate free memory is
+        // more than enough. Before giving up, try to merge adjacent free blocks and
+        // search once more - this only pays the O(n) coalescing cost on the rare
+        // allocation that actually needs it, instead of on every single free.
+        concatenate_free_blocks_locked( ctx );
+        block = find_suitable_block( ctx, aligned_size, alignment, placement );
+    }
+    if( block == NULL )
+    {
+        return NULL;
+    }
+
+    size_t padding = fit_padding( ctx, block->address, alignment );
+
+    // First remove the block from free_list before splitting
+    free_list_remove( ctx, block );
+
+    // Long-lived data is carved from the top end of the block, so it piles up at
+    // the top of the heap and what stays free below it remains one piece.
+    block_t* top = placement > 0 ? split_block_top( ctx, block, aligned_size, alignment ) : NULL;
+    if( top != NULL )
+    {
+        free_list_insert( ctx, block );
+        block = top;
+    }
+    // If there's any padding, we need to handle it
+    else if( padding > 0 )
+    {
+        // Split the padding off as a free block of its own, exactly where the new
+        // block's header has to go for its data to land at the aligned address
+        // (out-of-band headers take no room, so there the split is at that address).
+        // fit_padding() already made sure the header fits in the padding.
+        block_t* usable_block = split_block_at( ctx, block, padding - block_header_size( ctx ) );
+        if( usable_block == NULL )
+        {
+            // If split failed, put the block back to free_list
+            free_list_insert( ctx, block );
+            // If we are here with inline headers, something went wrong,
+            // because find_suitable_block should have ensured enough space
+            // for splitting if padding was needed. Out-of-band headers can
+            // simply run out.
+            DMOD_ASSERT_MSG(ctx->header_pool != NULL, "Unexpected error - check find_suitable_block logic.");
+            return NULL;
+        }
+        // block now contains the padding area, add it to free list
+        free_list_insert( ctx, block );
+        // usable_block is what we'll actually use for allocation
+        block = usable_block;
+    }
+
+    if(block->size > aligned_size + block_header_size( ctx ) + 1)
+    {
+        block_t* new_block = split_block( ctx, block, aligned_size );
+        if( new_block != NULL )
+        {
+            free_list_insert( ctx, new_block );
+        }
+    }
+
+    if( out_zeroed != NULL )
+    {
+        *out_zeroed = (block->flags & BLOCK_FLAG_ZEROED) != 0;
+    }
+    return block;
+}
+
+/**
+ * @brief Find the free block that starts right where a block ends - O(1),
+ * see block_above().
+ *
+ * @param ctx   Pointer to the heap context.
+ * @param block Pointer to the block.
+ *
+ * @return The free block physically following block, or NULL if that one is not free.
+ */
+static block_t* find_free_neighbour( dmheap_context_t* ctx, block_t* block )
+{
+    block_t* above = block_above( ctx, block );
+    return above != NULL && (above->flags & BLOCK_FLAG_FREE) != 0 ? above : NULL;
+}
+
+/**
+ * @brief Free-list engine: take back a block list_engine_alloc() has just
+ * carved, merging it with the free blocks right above and below it - the
+ * leftovers of that carve - so the free space is one piece again.
+ *
+ * @param ctx   Pointer to the heap context.
+ * @param block Block on no list.
+ */
+static void list_engine_undo_alloc( dmheap_context_t* ctx, block_t* block )
+{
+    block_t* above = find_free_neighbour( ctx, block );
+    if( above != NULL )
+    {
+        free_list_remove( ctx, above );
+        absorb_free_block( ctx, block, above );
+    }
+    for( block_t* below = ctx->free_list; below != NULL; below = below->next )
+    {
+        if( (uintptr_t)below->address + below->size == block_region_start( ctx, block ) )
+        {
+            free_list_remove( ctx, below );
+            absorb_free_block( ctx, below, block );
+            block = below;
+            break;
+        }
+    }
+    free_list_insert( ctx, block );
+}
+
+/**
+ * @brief Free-list engine: one slice of concatenate_free_blocks_locked() - merge
+ * the next free blocks of the free list with the free blocks right above them.
+ *
+ * The neighbour of a block is found in O(1) (see find_free_neighbour()), so a
+ * check that merges nothing costs no list walk. Each check merges at most one
+ * neighbour and puts the grown block back at its sorted place - the free-list
+ * insert and removes any free does - so the list stays sorted between slices.
+ * A grown block may land behind the check position with more to merge, so
+ * passes repeat until one merges nothing.
+ *
+ * @param ctx        Pointer to the heap context.
+ * @param position   Next block to check, updated in place.
+ * @param slot       0 before the first call, then 1 during a pass that has
+ *                   merged nothing yet and 2 during one that has.
+ * @param max_blocks Maximum number of blocks to check.
+ *
+ * @return Number of blocks checked - fewer than max_blocks once done.
+ */
+static size_t list_engine_maintain_step( dmheap_context_t* ctx, void** position, size_t* slot, size_t max_blocks )
+{
+    block_t* block = (block_t*)*position;
+    if( *slot == 0 )
+    {
+        block = ctx->free_list;
+        *slot = 1;
+    }
+    size_t count = 0;
+    while( count < max_blocks )
+    {
+        if( block == NULL )
+        {
+            if( *slot == 1 )
+            {
+                break;
+            }
+            block = ctx->free_list;
+            *slot = 1;
+            continue;
+        }
+
+        block_t* next = block->next;
+        block_t* neighbour = find_free_neighbour( ctx, block );
+        count++;
+        if( neighbour != NULL )
+        {
+            if( neighbour == next )
+            {
+                next = neighbour->next;
+            }
+            free_list_remove( ctx, block );
+            free_list_remove( ctx, neighbour );
+            absorb_free_block( ctx, block, neighbour );
+            free_list_insert( ctx, block );
+            *slot = 2;
+        }
+        block = next;
+    }
+    *position = block;
+    return count;
+}
+
+/**
+ * @brief Free-list engine: resize a used block in place.
+ *
+ * A shrink returns the tail to the free list. A grow takes over the free block
+ * right after this one, if it is big enough, and returns what it does not need.
+ *
+ * @param ctx   Pointer to the heap context.
+ * @param block Pointer to the used block.
+ * @param size  Requested new size.
+ *
+ * @return true when the block now holds size bytes.
+ */
+static bool list_engine_resize( dmheap_context_t* ctx, block_t* block, size_t size )
+{
+    // split_block() links the tail in after block - keep block's own place on the
+    // used list by restoring its link afterwards.
+    block_t* next = block->next;
+    size_t old_size = block->size;
+    if( size > block->size )
+    {
+        block_t* neighbour = find_free_neighbour( ctx, block );
+        if( neighbour == NULL || block->size + block_header_size( ctx ) + neighbour->size < size )
+        {
+            return false;
+        }
+        free_list_remove( ctx, neighbour );
+        absorb_free_block( ctx, block, neighbour );
+    }
+    block_t* new_block = split_block( ctx, block, size );
+    block->next = next;
+    ctx->counters.used_bytes = ctx->counters.used_bytes - old_size + block->size;
+    module_uncharge( block->owner, old_size );
+    module_charge( block->owner, block->size );
+    if( new_block != NULL )
+    {
+        free_list_insert( ctx, new_block );
+    }
+    return true;
+}
+
+/**
+ * @brief Free-list engine: visit every block of the free list.
+ *
+ * @param ctx       Pointer to the heap context.
+ * @param visitor   Called once per free block.
+ * @param user_data Passed through to each visitor call.
+ */
+static void list_engine_walk( dmheap_context_t* ctx, dmheap_block_visitor_t visitor, void* user_data )
+{
+    for( block_t* block = ctx->free_list; block != NULL; block = block->next )
+    {
+        visitor( block->address, block->size, NULL, user_data );
+    }
+}
+
+/**
+ * @brief Free-list engine: visit the next free blocks of the free list.
+ *
+ * @param ctx        Pointer to the heap context.
+ * @param position   Next block to visit, updated in place.
+ * @param slot       0 before the first call (start at the head), updated in place.
+ * @param max_blocks Maximum number of blocks to pass.
+ * @param visitor    Called once per free block, or NULL to just skip them.
+ * @param user_data  Passed through to each visitor call.
+ *
+ * @return Number of blocks passed.
+ */
+static size_t list_engine_walk_step( dmheap_context_t* ctx, void** position, size_t* slot, size_t max_blocks,
+                                     dmheap_block_visitor_t visitor, void* user_data )
+{
+    block_t* block = *slot == 0 ? ctx->free_list : (block_t*)*position;
+    size_t count = 0;
+    for( ; block != NULL && count < max_blocks; block = block->next, count++ )
+    {
+        if( visitor != NULL )
+        {
+            visitor( block->address, block->size, NULL, user_data );
+        }
+    }
+    *position = block;
+    *slot = 1;
+    return count;
+}
+
+/**
+ * @brief Free-list engine: size of the biggest free block - the list is sorted
+ * by size, so that is its tail.
+ *
+ * @param ctx Pointer to the heap context.
+ *
+ * @return Size of the last free block, 0 if none.
+ */
+static size_t list_engine_largest( dmheap_context_t* ctx )
+{
+    return ctx->free_tail != NULL ? ctx->free_tail->size : 0;
+}
+
+/**
+ * @brief Free-list engine: drop the free list and put one free block in each
+ * gap between the kept used blocks, up to the bottom of the permanent region.
+ *
+ * @param ctx Pointer to the heap context.
+ */
+static void list_engine_reset( dmheap_context_t* ctx )
+{
+    ctx->free_list = NULL;
+    ctx->free_tail = NULL;
+    ctx->counters.free_bytes  = 0;
+    ctx->counters.free_blocks = 0;
+    if( ctx->free_index != NULL )
+    {
+        ctx->free_index->count = 0;
+        ctx->free_index->overflowed = false;
+    }
+
+    // Going up in address order, every block is linked to the one above it.
+    uintptr_t cursor = (uintptr_t)ctx->heap_start;
+    block_t* below = NULL;
+    for( block_t* kept = ctx->used_list; ; kept = kept->next )
+    {
+        uintptr_t end = kept != NULL ? block_region_start( ctx, kept ) : (uintptr_t)ctx->perm_floor;
+        if( end > cursor + block_header_size( ctx ) )
+        {
+            block_t* gap = create_block( ctx, (void*)cursor, end - cursor );
+            free_list_insert( ctx, gap );
+            if( below != NULL )
+            {
+                set_block_above( ctx, below, gap );
+            }
+            below = gap;
+        }
+        if( below != NULL )
+        {
+            set_block_above( ctx, below, kept );
+        }
+        if( kept == NULL )
+        {
+            break;
+        }
+        below  = kept;
+        cursor = (uintptr_t)kept->address + kept->size;
+    }
+}
+
+/**
+ * @brief Free-list engine: count the free list into a statistics total.
+ *
+ * @param ctx       Pointer to the heap context.
+ * @param out_stats Statistics accumulator, updated in place.
+ */
+static void list_engine_stats( dmheap_context_t* ctx, dmheap_stats_t* out_stats )
+{
+    for( block_t* block = ctx->free_list; block != NULL; block = block->next )
+    {
+        count_free_block( out_stats, block->size );
+    }
+}
+
+/**
+ * @brief Buddy engine: take the smallest fitting power-of-two block.
+ *
+ * @param ctx        Pointer to the heap context.
+ * @param size       Size of memory to allocate.
+ * @param alignment  Alignment requirement.
+ * @param hints      Ignored - every block has a fixed place in the buddy tree.
+ * @param out_zeroed Set to false - buddy blocks are never tracked as zeroed (may be NULL).
+ *
+ * @return Block on no list, or NULL on failure.
+ */
+static block_t* buddy_engine_alloc( dmheap_context_t* ctx, size_t size, size_t alignment, uint32_t hints, bool* out_zeroed )
+{
+    (void)hints;
+    if( out_zeroed != NULL )
+    {
+        *out_zeroed = false;
+    }
+    return buddy_take_block( ctx, size, alignment );
+}
+
+/**
+ * @brief Buddy engine: blocks keep their power-of-two size, so any shrink stays in place.
+ *
+ * @param ctx   Pointer to the heap context.
+ * @param block Pointer to the used block.
+ * @param size  Requested new size.
+ *
+ * @return true if size still fits the block.
+ */
+static bool buddy_engine_resize( dmheap_context_t* ctx, block_t* block, size_t size )
+{
+    (void)ctx;
+    return size <= block->size;
+}
+
+/**
+ * @brief Buddy engine: visit every block of the order free lists.
+ *
+ * @param ctx       Pointer to the heap context.
+ * @param visitor   Called once per free block.
+ * @param user_data Passed through to each visitor call.
+ */
+static void buddy_engine_walk( dmheap_context_t* ctx, dmheap_block_visitor_t visitor, void* user_data )
+{
+    for( int order = 0; order < DMHEAP_BUDDY_MAX_ORDERS; order++ )
+    {
+        for( buddy_node_t* node = ctx->buddy->free_lists[order]; node != NULL; node = node->next )
+        {
+            visitor( node, (size_t)DMHEAP_BUDDY_MIN_BLOCK << order, NULL, user_data );
+        }
+    }
+}
+
+/**
+ * @brief Buddy engine: visit the next free blocks of the order free lists.
+ *
+ * @param ctx        Pointer to the heap context.
+ * @param position   Next node to visit, updated in place.
+ * @param slot       0 before the first call, then one past the order position is on.
+ * @param max_blocks Maximum number of blocks to pass.
+ * @param visitor    Called once per free block, or NULL to just skip them.
+ * @param user_data  Passed through to each visitor call.
+ *
+ * @return Number of blocks passed.
+ */
+static size_t buddy_engine_walk_step( dmheap_context_t* ctx, void** position, size_t* slot, size_t max_blocks,
+                                      dmheap_block_visitor_t visitor, void* user_data )
+{
+    buddy_node_t* node = (buddy_node_t*)*position;
+    if( *slot == 0 )
+    {
+        node = ctx->buddy->free_lists[0];
+        *slot = 1;
+    }
+    size_t count = 0;
+    while( count < max_blocks )
+    {
+        if( node == NULL )
+        {
+            if( *slot >= DMHEAP_BUDDY_MAX_ORDERS )
+            {
+                break;
+            }
+            node = ctx->buddy->free_lists[*slot];
+            (*slot)++;
+            continue;
+        }
+        if( visitor != NULL )
+        {
+            visitor( node, (size_t)DMHEAP_BUDDY_MIN_BLOCK << (*slot - 1), NULL, user_data );
+        }
+        node = node->next;
+        count++;
+    }
+    *position = node;
+    return count;
+}
+
+/**
+ * @brief Buddy engine: count the order free lists into a statistics total.
+ *
+ * @param ctx       Pointer to the heap context.
+ * @param out_stats Statistics accumulator, updated in place.
+ */
+static void buddy_engine_stats( dmheap_context_t* ctx, dmheap_stats_t* out_stats )
+{
+    for( int order = 0; order < DMHEAP_BUDDY_MAX_ORDERS; order++ )
+    {
+        size_t bytes = (size_t)DMHEAP_BUDDY_MIN_BLOCK << order;
+        for( buddy_node_t* node = ctx->buddy->free_lists[order]; node != NULL; node = node->next )
+        {
+            count_free_block( out_stats, bytes );
+        }
+    }
+}
+
+/**
+ * @brief Buddy engine: size of the biggest free block.
+ *
+ * @param ctx Pointer to the heap context.
+ *
+ * @return The block size of the highest order with a free block, 0 if none.
+ */
+static size_t buddy_engine_largest( dmheap_context_t* ctx )
+{
+    for( int order = DMHEAP_BUDDY_MAX_ORDERS - 1; order >= 0; order-- )
+    {
+        if( ctx->buddy->free_lists[order] != NULL )
+        {
+            return (size_t)DMHEAP_BUDDY_MIN_BLOCK << order;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Buddy engine: freed blocks merge as they go - nothing left to do.
+ *
+ * @param ctx Pointer to the heap context.
+ */
+static void buddy_engine_maintain( dmheap_context_t* ctx )
+{
+    (void)ctx;
+}
+
+/**
+ * @brief Buddy engine: a slice of buddy_engine_maintain() - done at once.
+ *
+ * @param ctx        Pointer to the heap context.
+ * @param position   Unused.
+ * @param slot       Unused.
+ * @param max_blocks Unused.
+ *
+ * @return 0 - the pass is always over.
+ */
+static size_t buddy_engine_maintain_step( dmheap_context_t* ctx, void** position, size_t* slot, size_t max_blocks )
+{
+    (void)position;
+    (void)slot;
+    (void)max_blocks;
+    buddy_engine_maintain( ctx );
+    return 0;
+}
+
+/**
+ * @brief Buddy engine: carve the space between the kept used blocks into free
+ * blocks.
+ *
+ * @param ctx Pointer to the heap context.
+ */
+static void buddy_engine_reset( dmheap_context_t* ctx )
+{
+    buddy_engine_t* buddy = ctx->buddy;
+    memset( buddy->free_lists, 0, sizeof(buddy->free_lists) );
+    memset( buddy->orders, BUDDY_NOT_FREE, buddy->block_count );
+    ctx->counters.free_bytes  = 0;
+    ctx->counters.free_blocks = 0;
+
+    // Each gap gets the same greedy decomposition buddy_init_arena() gives the
+    // whole arena - done gap by gap, so no free-list node lands in a kept block.
+    size_t index = 0;
+    for( block_t* kept = ctx->used_list; ; kept = kept->next )
+    {
+        size_t end = kept != NULL ? (size_t)((uint8_t*)kept->address - buddy->base) / DMHEAP_BUDDY_MIN_BLOCK : buddy->block_count;
+        while( index < end )
+        {
+            uint8_t order = 0;
+            while( order + 1 < DMHEAP_BUDDY_MAX_ORDERS && (index & (((size_t)2 << order) - 1)) == 0 &&
+                   index + ((size_t)2 << order) <= end )
+            {
+                order++;
+            }
+            buddy_push( ctx, index, order );
+            index += (size_t)1 << order;
+        }
+        if( kept == NULL )
+        {
+            break;
+        }
+        index = end + kept->size / DMHEAP_BUDDY_MIN_BLOCK;
+    }
+}
+
+static const dmheap_engine_t g_list_engine =
+{
+    .name          = "list",
+    .alloc         = list_engine_alloc,
+    .free          = free_list_insert,
+    .undo_alloc    = list_engine_undo_alloc,
+    .resize        = list_engine_resize,
+    .walk          = list_engine_walk,
+    .walk_step     = list_engine_walk_step,
+    .stats         = list_engine_stats,
+    .maintain      = concatenate_free_blocks_locked,
+    .maintain_step = list_engine_maintain_step,
+    .largest       = list_engine_largest,
+    .reset         = list_engine_reset,
+};
+
+static const dmheap_engine_t g_buddy_engine =
+{
+    .name          = "buddy",
+    .alloc         = buddy_engine_alloc,
+    .free          = buddy_release_block,
+    .undo_alloc    = buddy_release_block,
+    .resize        = buddy_engine_resize,
+    .walk          = buddy_engine_walk,
+    .walk_step     = buddy_engine_walk_step,
+    .stats         = buddy_engine_stats,
+    .maintain      = buddy_engine_maintain,
+    .maintain_step = buddy_engine_maintain_step,
+    .largest       = buddy_engine_largest,
+    .reset         = buddy_engine_reset,
+};
+
+/**
+ * @brief Find a block by its address in the used list.
+ * 
+ * @param ctx     Pointer to the heap context.
+ * @param address Pointer to the memory address.
+ * 
+ * @return Pointer to the block_t structure, or NULL if not found.
+ */
+static block_t* find_block_by_address( dmheap_context_t* ctx, void* address )
+{
+    block_t* current = ctx->used_list;
+    while( current != NULL )
+    {
+        if( current->address == address )
+        {
+            return current;
+        }
+        current = current->next;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Add a module to the module list.
+ * 
+ * @param list_head Pointer to the head of the module list.
+ * @param module    Pointer to the module to be added.
+ */
+static void add_module_to_list( module_t** list_head, module_t* module )
+{
+    if( list_head == NULL || module == NULL )
+    {
+        return;
+    }
+
+    module->next = *list_head;
+    *list_head = module;
+}
+
+/**
+ * @brief Find a module by its name.
+ * 
+ * @param ctx  Pointer to the heap context.
+ * @param name Name of the module.
+ * 
+ * @return Pointer to the module_t structure, or NULL if not found.
+ */
+static module_t* find_module_by_name( dmheap_context_t* ctx, const char* name )
+{
+    module_t* current = ctx->module_list;
+    while( current != NULL )
+    {
+        if( strncmp( current->name, name, DMOD_MAX_MODULE_NAME_LENGTH ) == 0 )
+        {
+            return current;
+        }
+        current = current->next;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Remove a module from the module list.
+ * 
+ * @param list_head Pointer to the head of the module list.
+ * @param module_to_remove Pointer to the module to be removed.
+ */
+static void remove_module_from_list( module_t** list_head, module_t* module_to_remove )
+{
+    if( *list_head == NULL || module_to_remove == NULL )
+    {
+        return;
+    }
+
+    if( *list_head == module_to_remove )
+    {
+        *list_head = module_to_remove->next;
+        return;
+    }
+
+    module_t* current = *list_head;
+    while( current->next != NULL )
+    {
+        if( current->next == module_to_remove )
+        {
+            current->next = module_to_remove->next;
+            return;
+        }
+        current = current->next;
+    }
+}
+
+/**
+ * @brief Check whether taking size more bytes of the general heap would eat
+ * into its reserve without the module being allowed to.
+ *
+ * Only meant to be called when the heap has a reserve - the module lookup is
+ * skipped whenever enough free space sits above it.
+ *
+ * @param ctx         Pointer to the heap context.
+ * @param size        Bytes the operation is about to take.
+ * @param module_name Name of the module asking (may be NULL).
+ *
+ * @return true if the operation must fail.
+ */
+static bool reserve_denies( dmheap_context_t* ctx, size_t size, const char* module_name )
+{
+    size_t free_bytes = ctx->counters.free_bytes;
+    if( free_bytes >= ctx->reserve_bytes && free_bytes - ctx->reserve_bytes >= size )
+    {
+        return false;
+    }
+    module_t* module = module_name != NULL ? find_module_by_name( ctx, module_name ) : NULL;
+    return module == NULL || !module->critical;
+}
+
+/**
+ * @brief Size of a module record - the request histogram, if kept, shares the
+ * record's block.
+ *
+ * @param ctx Pointer to the heap context.
+ *
+ * @return Bytes create_module() takes from the general heap, header aside.
+ */
+static size_t module_record_size( const dmheap_context_t* ctx )
+{
+    return sizeof(module_t) + ((ctx->flags & DMHEAP_REQUEST_HISTOGRAM) ? sizeof(dmheap_request_histogram_t) : 0);
+}
+
+/**
+ * @brief Allocate and register the record of a new module.
+ *
+ * A record is general-heap memory like any other, so only one for a module
+ * that is to be critical may come out of the reserve.
+ *
+ * @param ctx      Pointer to the heap context.
+ * @param name     Name of the module.
+ * @param critical true to create the module critical (see dmheap_set_module_critical()).
+ *
+ * @return Pointer to the new module, or NULL if its record cannot be allocated.
+ */
+static module_t* create_module( dmheap_context_t* ctx, const char* name, bool critical )
+{
+    size_t record_size = module_record_size( ctx );
+    bool guarded = !critical && ctx->reserve_bytes != 0;
+    block_t* block = guarded && reserve_denies( ctx, record_size, NULL ) ? NULL
+                   : ctx->engine->alloc( ctx, record_size, ctx->alignment, 0, NULL );
+    if( block != NULL && guarded && reserve_denies( ctx, 0, NULL ) )
+    {
+        // Header or engine rounding took the carve past the reserve line.
+        ctx->engine->undo_alloc( ctx, block );
+        block = NULL;
+    }
+    if( block == NULL )
+    {
+        DMOD_LOG_ERROR("dmheap: Unable to allocate memory for module %s.\n", name);
+        return NULL;
+    }
+    block->flags = BLOCK_FLAG_MODULE;
+    block->owner = NULL;
+    module_t* module = (module_t*)block->address;
+    strncpy( module->name, name, DMOD_MAX_MODULE_NAME_LENGTH - 1 );
+    module->name[DMOD_MAX_MODULE_NAME_LENGTH - 1] = '\0';
+    module->permanent_bytes = 0;
+    module->used_bytes = 0;
+    module->used_blocks = 0;
+    module->peak_used_bytes = 0;
+    module->peak_used_blocks = 0;
+    module->block = block;
+    module->critical = critical;
+    module->detached = false;
+    module->requests = NULL;
+    if( ctx->flags & DMHEAP_REQUEST_HISTOGRAM )
+    {
+        module->requests = (dmheap_request_histogram_t*)(module + 1);
+        memset( module->requests, 0, sizeof(*module->requests) );
+    }
+    used_list_add( ctx, block );
+    add_module_to_list( &ctx->module_list, module );
+    return module;
+}
+
+/**
+ * @brief Find the used large extent that starts at a given address.
+ *
+ * @param ctx     Pointer to the heap context.
+ * @param address Pointer previously returned by an allocation function.
+ *
+ * @return Pointer to the extent's ownership table entry, or NULL if address is not
+ *         a large allocation of this context.
+ */
+static large_extent_t* large_find_extent( dmheap_context_t* ctx, void* address )
+{
+    large_region_t* large = ctx->large;
+    if( large == NULL )
+    {
+        return NULL;
+    }
+
+    for( size_t i = 0; i < large->extent_count; i++ )
+    {
+        if( large->extents[i].used && large->extents[i].address == (uint8_t*)address )
+        {
+            return &large->extents[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Drop an entry from a large region's ownership table.
+ *
+ * @param large Pointer to the large region.
+ * @param index Index of the entry to drop.
+ */
+static void large_remove_extent_at( large_region_t* large, size_t index )
+{
+    memmove( &large->extents[index], &large->extents[index + 1],
+             (large->extent_count - index - 1) * sizeof(large_extent_t) );
+    large->extent_count--;
+}
+
+/**
+ * @brief Recount the large-region part of the context's running statistics.
+ *
+ * The ownership table is small and bounded (DMHEAP_LARGE_MAX_EXTENTS), so a
+ * recount after each change is simpler than following every split and merge.
+ *
+ * @param ctx Pointer to the heap context.
+ */
+static void large_recount( dmheap_context_t* ctx )
+{
+    heap_counters_t* counters = &ctx->counters;
+    counters->large_used_bytes   = 0;
+    counters->large_used_extents = 0;
+    counters->large_free_bytes   = 0;
+    counters->large_free_extents = 0;
+
+    large_region_t* large = ctx->large;
+    if( large != NULL )
+    {
+        large->largest_free = 0;
+    }
+    for( size_t i = 0; large != NULL && i < large->extent_count; i++ )
+    {
+        size_t bytes = large->extents[i].pages * DMHEAP_LARGE_PAGE_SIZE;
+        if( large->extents[i].used )
+        {
+            counters->large_used_bytes += bytes;
+            counters->large_used_extents++;
+        }
+        else
+        {
+            counters->large_free_bytes += bytes;
+            counters->large_free_extents++;
+            if( bytes > large->largest_free )
+            {
+                large->largest_free = bytes;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Return a large extent to its region. Caller must hold the critical section.
+ *
+ * In region mode the freed pages are merged with free neighbouring extents right
+ * away - they are address-adjacent by construction, so this is O(1) apart from
+ * the table shuffle. In mmap mode the pages are unmapped.
+ *
+ * @param ctx    Pointer to the heap context.
+ * @param extent Used extent to free (invalid after this call).
+ */
+static void large_free_extent_locked( dmheap_context_t* ctx, large_extent_t* extent )
+{
+    large_region_t* large = ctx->large;
+    size_t index = (size_t)(extent - large->extents);
+    ctx->counters.frees++;
+
+#if DMHEAP_LARGE_USE_MMAP
+    if( large->pages_start == NULL )
+    {
+        module_uncharge( extent->owner, extent->pages * DMHEAP_LARGE_PAGE_SIZE );
+        munmap( extent->address, extent->pages * DMHEAP_LARGE_PAGE_SIZE );
+        large_remove_extent_at( large, index );
+        large_recount( ctx );
+        return;
+    }
+#endif
+
+    module_uncharge( extent->owner, extent->pages * DMHEAP_LARGE_PAGE_SIZE );
+    extent->used   = false;
+    extent->owner  = NULL;
+    extent->zeroed = false;
+
+    if( index + 1 < large->extent_count && !large->extents[index + 1].used )
+    {
+        extent->pages += large->extents[index + 1].pages;
+        large_remove_extent_at( large, index + 1 );
+    }
+    if( index > 0 && !large->extents[index - 1].used )
+    {
+        large->extents[index - 1].pages  += extent->pages;
+        large->extents[index - 1].zeroed  = false;
+        large_remove_extent_at( large, index );
+    }
+    large_recount( ctx );
+}
+
+/**
+ * @brief Free every large extent owned by a module. Caller must hold the critical section.
+ *
+ * @param ctx    Pointer to the heap context.
+ * @param module Module whose large extents are to be released.
+ */
+static void large_release_module( dmheap_context_t* ctx, module_t* module )
+{
+    large_region_t* large = ctx->large;
+    if( large == NULL )
+    {
+        return;
+    }
+
+    size_t i = 0;
+    while( i < large->extent_count )
+    {
+        if( large->extents[i].used && large->extents[i].owner == module )
+        {
+            large_free_extent_locked( ctx, &large->extents[i] );
+            // Freeing may have merged entry i into entry i-1 - look at it again.
+            i = i > 0 ? i - 1 : 0;
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+/**
+ * @brief Release all memory allocated by a specific module.
+ * 
+ * @param ctx    Pointer to the heap context.
+ * @param module Pointer to the module whose memory is to be released.
+ */
+static void release_memory_of_module( dmheap_context_t* ctx, module_t* module )
+{
+    if( module == NULL )
+    {
+        return;
+    }
+
+    large_release_module( ctx, module );
+
+    block_t* current = ctx->used_list;
+    block_t* prev = NULL;
+
+    while( current != NULL )
+    {
+        if( current->owner == module )
+        {
+            block_t* to_free = current;
+            current = current->next;
+            used_list_unlink( ctx, prev, to_free );
+            ctx->counters.used_bytes -= to_free->size;
+            ctx->counters.used_blocks--;
+            ctx->counters.frees++;
+            module_uncharge( to_free->owner, to_free->size );
+            ctx->engine->free( ctx, to_free );
+        }
+        else
+        {
+            prev = current;
+            current = current->next;
+        }
+    }
+}
+
+/**
+ * @brief Delete a registered module and free its memory.
+ * 
+ * @param ctx    Pointer to the heap context.
+ * @param module Pointer to the module to be deleted.
+ */
+static void delete_module( dmheap_context_t* ctx, module_t* module )
+{
+    if( module == NULL )
+    {
+        return;
+    }
+
+    release_memory_of_module( ctx, module );
+    remove_module_from_list( &ctx->module_list, module );
+
+    used_list_remove( ctx, module->block );
+    ctx->engine->free( ctx, module->block );
+}
+
+/**
+ * @brief Check whether a module is on a module list.
+ *
+ * @param list   Head of the list.
+ * @param module Module to look for.
+ *
+ * @return true if module is on the list.
+ */
+static bool module_on_list( module_t* list, module_t* module )
+{
+    for( ; list != NULL; list = list->next )
+    {
+        if( list == module )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Carry the heap's coalescing pass - the one automatic coalescing and
+ * the end of a teardown sweep share - on by up to max_blocks free blocks,
+ * starting one if none runs. Caller must already hold the critical section.
+ *
+ * @param ctx        Pointer to the heap context.
+ * @param max_blocks Maximum number of free blocks to check (not 0).
+ *
+ * @return true once the pass is over and nothing is left to merge.
+ */
+static bool coalesce_step_locked( dmheap_context_t* ctx, size_t max_blocks )
+{
+    if( ctx->engine->maintain_step( ctx, &ctx->coalesce_position, &ctx->coalesce_slot, max_blocks ) == max_blocks )
+    {
+        return false;
+    }
+    ctx->coalesce_position = NULL;
+    ctx->coalesce_slot     = 0;
+    ctx->coalesce_floor    = ctx->counters.free_blocks;
+    ctx->sweep_merge       = false;
+    return true;
+}
+
+/**
+ * @brief Carry the running teardown sweep on (see teardown_step_locked()).
+ * Caller must hold the critical section.
+ *
+ * @param ctx    Pointer to the heap context.
+ * @param budget Maximum number of used blocks to look at, decremented for each.
+ *
+ * @return true once the sweep is through and its records are freed.
+ */
+static bool teardown_sweep_locked( dmheap_context_t* ctx, size_t* budget )
+{
+    block_t* current = ctx->sweep_prev != NULL ? ctx->sweep_prev->next : ctx->used_list;
+    for( ; *budget > 0 && current != NULL; (*budget)-- )
+    {
+        block_t* next = current->next;
+        if( current->owner != NULL && current->owner->detached )
+        {
+            used_list_unlink( ctx, ctx->sweep_prev, current );
+            ctx->counters.used_bytes -= current->size;
+            ctx->counters.used_blocks--;
+            ctx->counters.frees++;
+            module_uncharge( current->owner, current->size );
+            ctx->engine->free( ctx, current );
+        }
+        else if( (current->flags & BLOCK_FLAG_MODULE) && module_on_list( ctx->doomed_modules, (module_t*)current->address ) )
+        {
+            used_list_unlink( ctx, ctx->sweep_prev, current );
+            ctx->counters.used_bytes -= current->size;
+            ctx->counters.used_blocks--;
+            ctx->counters.frees++;
+            current->next = ctx->dead_records;
+            ctx->dead_records = current;
+        }
+        else
+        {
+            ctx->sweep_prev = current;
+        }
+        current = next;
+    }
+    if( current != NULL )
+    {
+        return false;
+    }
+
+    while( ctx->dead_records != NULL )
+    {
+        block_t* record = ctx->dead_records;
+        ctx->dead_records = record->next;
+        ctx->engine->free( ctx, record );
+    }
+    ctx->doomed_modules = NULL;
+    ctx->sweep_prev     = NULL;
+    ctx->sweep_merge    = true;
+    return true;
+}
+
+/**
+ * @brief Do one bounded slice of the teardown of detached modules. Caller must
+ * hold the critical section.
+ *
+ * A sweep walks the used list once, picking up after sweep_prev where the last
+ * slice stopped, and frees every block a detached module owns. New blocks only
+ * ever go to the head of the list and detached modules allocate nothing, so
+ * nothing is missed; modules detached while a sweep runs wait for the next one.
+ * Their records are only unlinked on the way - the blocks further down still
+ * point at them - and go back to the engine once the sweep is through. The
+ * free space is then merged by a coalescing pass (see coalesce_step_locked())
+ * that the following slices carry on out of the same budget.
+ *
+ * @param ctx    Pointer to the heap context.
+ * @param budget Maximum number of used blocks to look at, plus free blocks to
+ *               check once the sweep is through.
+ *
+ * @return true if teardown work is still pending.
+ */
+static bool teardown_step_locked( dmheap_context_t* ctx, size_t budget )
+{
+    if( ctx->doomed_modules == NULL && !ctx->sweep_merge )
+    {
+        if( ctx->pending_modules == NULL || budget == 0 )
+        {
+            return ctx->pending_modules != NULL;
+        }
+        ctx->doomed_modules  = ctx->pending_modules;
+        ctx->pending_modules = NULL;
+        ctx->sweep_prev      = NULL;
+        // The large-extent table is small and bounded - no need to slice it.
+        for( module_t* module = ctx->doomed_modules; module != NULL; module = module->next )
+        {
+            large_release_module( ctx, module );
+        }
+    }
+
+    if( ctx->doomed_modules != NULL && !teardown_sweep_locked( ctx, &budget ) )
+    {
+        return true;
+    }
+    if( budget == 0 || !coalesce_step_locked( ctx, budget ) )
+    {
+        return true;
+    }
+    return ctx->pending_modules != NULL;
+}
+
+/**
+ * @brief Get or create a module by its name.
+ * 
+ * @param ctx         Pointer to the heap context.
+ * @param module_name Name of the module.
+ * 
+ * @return Pointer to the module_t structure.
+ */
+static module_t* get_or_create_module( dmheap_context_t* ctx, const char* module_name )
+{
+    module_t* module = find_module_by_name( ctx, module_name );
+    if( module == NULL )
+    {
+        module = create_module( ctx, module_name, false );
+    }
+    return module;
+}
+
+/**
+ * @brief Hand out whole pages from the large region. Caller must hold the
+ * critical section.
+ *
+ * First-fit over the (address-sorted) ownership table; any leftover pages of the
+ * chosen extent stay behind as a new free entry. When the table has no room left
+ * for that leftover, only an exact fit is accepted.
+ *
+ * @param ctx         Pointer to the heap context (ctx->large must not be NULL).
+ * @param size        Size of memory to allocate.
+ * @param module_name Name of the module requesting allocation, recorded as the owner.
+ * @param out_zeroed  If not NULL, set to whether the returned pages are known to be all zero.
+ *
+ * @return Pointer to the allocated memory, or NULL if the region cannot satisfy it.
+ */
+static void* large_alloc_locked( dmheap_context_t* ctx, size_t size, const char* module_name, bool* out_zeroed )
+{
+    large_region_t* large = ctx->large;
+    size_t pages = (size + DMHEAP_LARGE_PAGE_SIZE - 1) / DMHEAP_LARGE_PAGE_SIZE;
+    if( pages == 0 )
+    {
+        pages = 1;
+    }
+
+    large_extent_t* extent = NULL;
+#if DMHEAP_LARGE_USE_MMAP
+    if( large->pages_start == NULL )
+    {
+        if( large->extent_count >= DMHEAP_LARGE_MAX_EXTENTS )
+        {
+            return NULL;
+        }
+        void* mapping = mmap( NULL, pages * DMHEAP_LARGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+        if( mapping == MAP_FAILED )
+        {
+            return NULL;
+        }
+        extent = &large->extents[large->extent_count++];
+        extent->address = (uint8_t*)mapping;
+        extent->pages   = pages;
+        extent->zeroed  = true;  // anonymous mappings always start out zero-filled
+    }
+#endif
+
+    for( size_t i = 0; extent == NULL && i < large->extent_count; i++ )
+    {
+        large_extent_t* candidate = &large->extents[i];
+        if( candidate->used || candidate->pages < pages )
+        {
+            continue;
+        }
+        if( candidate->pages > pages )
+        {
+            if( large->extent_count >= DMHEAP_LARGE_MAX_EXTENTS )
+            {
+                continue;
+            }
+            memmove( &large->extents[i + 2], &large->extents[i + 1],
+                     (large->extent_count - i - 1) * sizeof(large_extent_t) );
+            large->extent_count++;
+
+            large_extent_t* rest = &large->extents[i + 1];
+            rest->address = candidate->address + pages * DMHEAP_LARGE_PAGE_SIZE;
+            rest->pages   = candidate->pages - pages;
+            rest->owner   = NULL;
+            rest->used    = false;
+            rest->zeroed  = candidate->zeroed;
+            candidate->pages = pages;
+        }
+        extent = candidate;
+    }
+
+    if( extent == NULL )
+    {
+        return NULL;
+    }
+
+    // get_or_create_module() may allocate a module_t from the general heap, which
+    // never touches the ownership table - the extent pointer stays valid.
+    if( out_zeroed != NULL )
+    {
+        *out_zeroed = extent->zeroed;
+    }
+    extent->used   = true;
+    extent->zeroed = false;
+    extent->seq    = next_alloc_seq();
+    extent->owner  = module_name != NULL ? get_or_create_module( ctx, module_name ) : NULL;
+    module_charge( extent->owner, extent->pages * DMHEAP_LARGE_PAGE_SIZE );
+    ctx->counters.allocs++;
+    large_recount( ctx );
+    return extent->address;
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, dmheap_context_t*,  _init, ( void* buffer, size_t size, size_t alignment ) )
+{
+    return dmheap_init_ex( buffer, size, alignment, 0 );
+}
+
+/**
+ * @brief Restart the high-water marks of a heap and its modules from their
+ * current values. Caller must hold the heap's critical section.
+ *
+ * @param ctx Pointer to the heap context.
+ */
+static void reset_peaks_locked( dmheap_context_t* ctx )
+{
+    ctx->peaks.used_bytes       = 0;
+    ctx->peaks.used_blocks      = 0;
+    ctx->peaks.min_largest_free = SIZE_MAX;
+    ctx->peaks.reserve_used     = 0;
+    update_peaks( ctx );
+    for( module_t* module = ctx->module_list; module != NULL; module = module->next )
+    {
+        module->peak_used_bytes  = module->used_bytes;
+        module->peak_used_blocks = module->used_blocks;
+    }
+}
+
+/**
+ * @brief Cache-line size of the machine, for DMHEAP_HINT_ISOLATED.
+ *
+ * @return The L1 data cache line size sysconf() reports on Linux hosts, or
+ *         DMHEAP_CACHE_LINE_SIZE when it is not known.
+ */
+static size_t detect_cache_line_size( void )
+{
+#if DMHEAP_CACHE_LINE_USE_SYSCONF && defined(_SC_LEVEL1_DCACHE_LINESIZE)
+    long line = sysconf( _SC_LEVEL1_DCACHE_LINESIZE );
+    if( line > 0 && (line & (line - 1)) == 0 )
+    {
+        return (size_t)line;
+    }
+#endif
+    return DMHEAP_CACHE_LINE_SIZE;
+}
+
+/**
+ * @brief Set up a heap context at the start of a buffer, without adding it to
+ * the default heap list.
+ *
+ * @param buffer    Pointer to the memory buffer to be used as heap.
+ * @param size      Size of the memory buffer.
+ * @param alignment Alignment for allocations.
+ * @param flags     Bitwise OR of DMHEAP_* flags.
+ *
+ * @return Pointer to the heap context, or NULL if initialization fails.
+ */
+static dmheap_context_t* init_context( void* buffer, size_t size, size_t alignment, uint32_t flags )
+{
+    if(buffer == NULL || size == 0)
+    {
+        DMOD_LOG_ERROR("dmheap: _init called with invalid parameters.\n");
+        return NULL;
+    }
+    
+    // Check buffer alignment for context structure
+    if(((uintptr_t)buffer % sizeof(void*)) != 0)
+    {
+        DMOD_LOG_ERROR("dmheap: buffer is not properly aligned (must be aligned to pointer size).\n");
+        return NULL;
+    }
+    
+    // The context structure is stored at the beginning of the buffer
+    // Align context size to ensure heap starts at a proper boundary
+    size_t context_size = align_size(sizeof(dmheap_context_t), alignment > sizeof(void*) ? alignment : sizeof(void*));
+    if( flags & DMHEAP_ENGINE_BUDDY )
+    {
+        // Buddy blocks carry no inline header, and the size index has nothing to index.
+        flags = (flags | DMHEAP_SEPARATE_METADATA) & ~DMHEAP_FREE_INDEX;
+    }
+    size_t index_offset = 0;
+    if( flags & DMHEAP_FREE_INDEX )
+    {
+        // The free index follows the context, on its own cache line.
+        index_offset = (size_t)((uintptr_t)align_pointer( (void*)((uintptr_t)buffer + context_size), DMHEAP_FREE_INDEX_ALIGN ) - (uintptr_t)buffer);
+        context_size = align_size(index_offset + sizeof(free_index_t), alignment > sizeof(void*) ? alignment : sizeof(void*));
+    }
+    size_t pool_offset = context_size;
+    size_t header_count = 0;
+    if( flags & DMHEAP_SEPARATE_METADATA )
+    {
+        // The header pool comes next - one block_t per DMHEAP_METADATA_GRANULE
+        // bytes of what is left for the heap, or per DMHEAP_BUDDY_MIN_BLOCK for
+        // the buddy engine, which can hand out blocks that small. The free-list
+        // engine adds one header_above link per entry.
+        size_t granule = (flags & DMHEAP_ENGINE_BUDDY) ? DMHEAP_BUDDY_MIN_BLOCK : DMHEAP_METADATA_GRANULE;
+        size_t entry_size = sizeof(block_t) + ((flags & DMHEAP_ENGINE_BUDDY) ? 0 : sizeof(uint32_t));
+        header_count = size > pool_offset ? (size - pool_offset) / (granule + entry_size) : 0;
+        context_size = align_size(pool_offset + header_count * entry_size, alignment > sizeof(void*) ? alignment : sizeof(void*));
+    }
+    size_t buddy_offset = context_size;
+    size_t buddy_blocks = 0;
+    size_t buddy_alignment = alignment > DMHEAP_BUDDY_BASE_ALIGN ? alignment : DMHEAP_BUDDY_BASE_ALIGN;
+    if( flags & DMHEAP_ENGINE_BUDDY )
+    {
+        // Then the buddy state and its one-byte-per-minimum-block order map, and
+        // the arena itself, aligned so every block is aligned to its own size.
+        size_t map_offset = buddy_offset + sizeof(buddy_engine_t);
+        size_t map_size = size > map_offset ? (size - map_offset) / (DMHEAP_BUDDY_MIN_BLOCK + 1) : 0;
+        uintptr_t arena = (uintptr_t)align_pointer( (void*)((uintptr_t)buffer + map_offset + map_size), buddy_alignment );
+        buddy_blocks = arena < (uintptr_t)buffer + size ? ((uintptr_t)buffer + size - arena) / DMHEAP_BUDDY_MIN_BLOCK : 0;
+        context_size = (size_t)(arena - (uintptr_t)buffer);
+    }
+    if(size < context_size + sizeof(block_t) + alignment || ((flags & DMHEAP_SEPARATE_METADATA) && header_count < 2) ||
+       ((flags & DMHEAP_ENGINE_BUDDY) && buddy_blocks == 0))
+    {
+        DMOD_LOG_ERROR("dmheap: buffer too small for context and minimum allocation.\n");
+        return NULL;
+    }
+    
+    dmheap_context_t* ctx = (dmheap_context_t*)buffer;
+    
+    // Calculate the start of the heap (after the aligned context structure)
+    void* heap_buffer = (void*)((uintptr_t)buffer + context_size);
+    size_t heap_size = (flags & DMHEAP_ENGINE_BUDDY) ? buddy_blocks * DMHEAP_BUDDY_MIN_BLOCK : size - context_size;
+    
+    ctx->heap_start = heap_buffer;
+    ctx->heap_size  = heap_size;
+    ctx->header_pool   = NULL;
+    ctx->header_above  = NULL;
+    ctx->spare_headers = NULL;
+    ctx->header_count  = header_count;
+    if( flags & DMHEAP_SEPARATE_METADATA )
+    {
+        ctx->header_pool = (block_t*)((uintptr_t)buffer + pool_offset);
+        if( !(flags & DMHEAP_ENGINE_BUDDY) )
+        {
+            ctx->header_above = (uint32_t*)(ctx->header_pool + header_count);
+        }
+        for( size_t i = header_count; i > 0; i-- )
+        {
+            ctx->header_pool[i - 1].next  = ctx->spare_headers;
+            ctx->header_pool[i - 1].flags = 0;
+            ctx->spare_headers = &ctx->header_pool[i - 1];
+        }
+    }
+    memset( &ctx->counters, 0, sizeof(ctx->counters) );
+    ctx->stats_seq = 0;
+    memset( ctx->walk_marks, 0, sizeof(ctx->walk_marks) );
+    ctx->walk_ticket = 0;
+    ctx->generation  = 0;
+    memset( &ctx->untracked_requests, 0, sizeof(ctx->untracked_requests) );
+    ctx->buddy = NULL;
+    ctx->engine = &g_list_engine;
+    if( flags & DMHEAP_ENGINE_BUDDY )
+    {
+        ctx->buddy = (buddy_engine_t*)((uintptr_t)buffer + buddy_offset);
+        ctx->buddy->base           = (uint8_t*)heap_buffer;
+        ctx->buddy->block_count    = buddy_blocks;
+        ctx->buddy->base_alignment = buddy_alignment;
+        ctx->buddy->orders         = (uint8_t*)ctx->buddy + sizeof(buddy_engine_t);
+        buddy_init_arena( ctx );
+        ctx->engine = &g_buddy_engine;
+        ctx->free_list = NULL;
+        ctx->free_tail = NULL;
+    }
+    else
+    {
+        ctx->free_list = create_block( ctx, heap_buffer, heap_size );
+        ctx->free_tail = ctx->free_list;
+        ctx->counters.free_bytes  = ctx->free_list->size;
+        ctx->counters.free_blocks = 1;
+    }
+    ctx->used_list  = NULL;
+    ctx->flags      = flags;
+    set_builtin_lock( ctx );
+    ctx->caps       = 0;
+    ctx->perm_floor = (uint8_t*)heap_buffer + heap_size;
+    ctx->permanent_bytes = 0;
+    ctx->reserve_bytes = 0;
+    ctx->coalesce_threshold = 0;
+    ctx->coalesce_position  = NULL;
+    ctx->coalesce_slot      = 0;
+    ctx->coalesce_floor     = 0;
+    ctx->sweep_merge        = false;
+    if( (flags & DMHEAP_BUFFER_ZEROED) && ctx->free_list != NULL )
+    {
+        // Everything past the first header has never been written - remember that
+        // so dmheap_calloc() can skip clearing it.
+        ctx->free_list->flags |= BLOCK_FLAG_ZEROED;
+    }
+    ctx->alignment  = alignment;
+    ctx->cache_line = detect_cache_line_size();
+    ctx->module_list = NULL;  // Reset module list on initialization
+    ctx->pending_modules = NULL;
+    ctx->doomed_modules = NULL;
+    ctx->sweep_prev = NULL;
+    ctx->dead_records = NULL;
+    ctx->name[0] = '\0';      // No name assigned until dmheap_set_context_name() is called
+    ctx->large = NULL;        // No large region until dmheap_set_large_region() is called
+    ctx->free_index = NULL;
+    if( flags & DMHEAP_FREE_INDEX )
+    {
+        ctx->free_index = (free_index_t*)((uintptr_t)buffer + index_offset);
+        ctx->free_index->count = 0;
+        ctx->free_index->overflowed = false;
+        free_index_insert( ctx->free_index, ctx->free_list );
+    }
+    ctx->shards = NULL;
+    ctx->shard_count = 0;
+    ctx->shard_span = 0;
+    ctx->shard_selector = NULL;
+    ctx->shard_selector_data = NULL;
+    ctx->history = NULL;
+    ctx->history_block = NULL;
+    ctx->history_capacity = 0;
+    ctx->history_count = 0;
+    ctx->history_interval = 0;
+    ctx->history_due = 0;
+    reset_peaks_locked( ctx );
+    return ctx;
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, dmheap_context_t*,  _init_ex, ( void* buffer, size_t size, size_t alignment, uint32_t flags ) )
+{
+    dmheap_context_t* ctx = init_context( buffer, size, alignment, flags );
+    if( ctx == NULL )
+    {
+        return NULL;
+    }
+
+    Dmod_EnterCritical();
+    add_default_context_locked( ctx );
+    Dmod_ExitCritical();
+
+    DMOD_LOG_INFO("== dmheap ver. %s ==\n", DMHEAP_VERSION);
+    DMOD_LOG_INFO("dmheap: Initialized with buffer %p of size %lu.\n", ctx->heap_start, (unsigned long)ctx->heap_size);
+    return ctx;
+}
+
+/**
+ * @brief Default shard selector: the CPU the caller runs on.
+ *
+ * Without sched_getcpu() (see DMHEAP_SHARD_GETCPU) the caller's stack address
+ * stands in for the thread id - threads have separate stacks, so they spread
+ * over the shards, while one thread keeps coming back to the same shard.
+ *
+ * @param user_data Unused.
+ *
+ * @return A number the shard index is derived from (modulo the shard count).
+ */
+static size_t default_shard_selector( void* user_data )
+{
+#if DMHEAP_SHARD_USE_GETCPU
+    int cpu = sched_getcpu();
+    if( cpu >= 0 )
+    {
+        return (size_t)cpu;
+    }
+#endif
+    uintptr_t stack = (uintptr_t)&user_data;
+    return (size_t)((stack >> 16) ^ (stack >> 24));
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, dmheap_context_t*,  _init_sharded, ( void* buffer, size_t size, size_t alignment, size_t shard_count, uint32_t flags ) )
+{
+    if( buffer == NULL || size == 0 || shard_count == 0 || ((uintptr_t)buffer % sizeof(void*)) != 0 )
+    {
+        DMOD_LOG_ERROR("dmheap: init_sharded called with invalid parameters.\n");
+        return NULL;
+    }
+
+    // The parent context and its shard table come first, then shard_count equal,
+    // cache-line aligned slices, each set up as an ordinary heap of its own.
+    size_t slice_alignment = alignment > DMHEAP_SHARD_ALIGN ? alignment : DMHEAP_SHARD_ALIGN;
+    size_t table_offset = align_size( sizeof(dmheap_context_t), sizeof(void*) );
+    uintptr_t first = (uintptr_t)align_pointer( (void*)((uintptr_t)buffer + table_offset + shard_count * sizeof(dmheap_context_t*)), slice_alignment );
+    uintptr_t end = (uintptr_t)buffer + size;
+    size_t span = first < end ? ((end - first) / shard_count) & ~(uintptr_t)(slice_alignment - 1) : 0;
+    if( span == 0 )
+    {
+        DMOD_LOG_ERROR("dmheap: buffer too small for %zu shards.\n", shard_count);
+        return NULL;
+    }
+
+    dmheap_context_t* ctx = (dmheap_context_t*)buffer;
+    memset( ctx, 0, sizeof(*ctx) );
+    ctx->shards = (dmheap_context_t**)((uintptr_t)buffer + table_offset);
+    for( size_t i = 0; i < shard_count; i++ )
+    {
+        ctx->shards[i] = init_context( (void*)(first + i * span), span, alignment, flags );
+        if( ctx->shards[i] == NULL )
+        {
+            DMOD_LOG_ERROR("dmheap: buffer too small for %zu shards.\n", shard_count);
+            return NULL;
+        }
+        ctx->heap_size += ctx->shards[i]->heap_size;
+    }
+    ctx->shard_count = shard_count;
+    ctx->shard_span  = span;
+    ctx->shard_selector = default_shard_selector;
+    ctx->heap_start  = ctx->shards[0]->heap_start;
+    ctx->alignment   = alignment;
+    ctx->flags       = flags;
+    ctx->engine      = &g_list_engine;
+    set_builtin_lock( ctx );
+
+    Dmod_EnterCritical();
+    add_default_context_locked( ctx );
+    Dmod_ExitCritical();
+
+    DMOD_LOG_INFO("== dmheap ver. %s ==\n", DMHEAP_VERSION);
+    DMOD_LOG_INFO("dmheap: Initialized with buffer %p of size %lu as %zu shards.\n", buffer, (unsigned long)size, shard_count);
+    return ctx;
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, bool,  _set_shard_selector, ( dmheap_context_t* ctx, dmheap_shard_selector_t selector, void* user_data ) )
+{
+    if( ctx == NULL || ctx->shards == NULL )
+    {
+        DMOD_LOG_ERROR("dmheap: set_shard_selector called on a heap without shards.\n");
+        return false;
+    }
+
+    ctx->shard_selector      = selector != NULL ? selector : default_shard_selector;
+    ctx->shard_selector_data = selector != NULL ? user_data : NULL;
+    return true;
+}
+
+/**
+ * @brief Find the shard of a sharded heap whose slice of the buffer holds ptr.
+ *
+ * @param ctx Pointer to a sharded heap context.
+ * @param ptr Any address.
+ *
+ * @return The shard, or NULL if ptr lies outside every slice.
+ */
+static dmheap_context_t* shard_of( dmheap_context_t* ctx, void* ptr )
+{
+    uintptr_t first = (uintptr_t)ctx->shards[0];
+    if( (uintptr_t)ptr < first || ((uintptr_t)ptr - first) / ctx->shard_span >= ctx->shard_count )
+    {
+        return NULL;
+    }
+    return ctx->shards[((uintptr_t)ptr - first) / ctx->shard_span];
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, bool,  _set_lock, ( dmheap_context_t* ctx, dmheap_lock_fn_t lock, dmheap_lock_fn_t unlock, void* user_data ) )
+{
+    if( ctx == NULL || (lock == NULL) != (unlock == NULL) )
+    {
+        DMOD_LOG_ERROR("dmheap: set_lock called with invalid parameters.\n");
+        return false;
+    }
+
+    for( size_t i = 0; i < ctx->shard_count; i++ )
+    {
+        dmheap_set_lock( ctx->shards[i], lock, unlock, user_data );
+    }
+    if( lock == NULL )
+    {
+        set_builtin_lock( ctx );
+        return true;
+    }
+    ctx->lock      = lock;
+    ctx->unlock    = unlock;
+    ctx->lock_data = user_data;
+    return true;
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, bool,  _set_context_name, ( dmheap_context_t* ctx, const char* name ) )
+{
+    if( ctx == NULL )
+    {
+        DMOD_LOG_ERROR("dmheap: set_context_name called with NULL context.\n");
+        return false;
+    }
+
+    Dmod_EnterCritical();
+    if( name != NULL )
+    {
+        strncpy( ctx->name, name, sizeof(ctx->name) - 1 );
+        ctx->name[sizeof(ctx->name) - 1] = '\0';
+    }
+    else
+    {
+        ctx->name[0] = '\0';
+    }
+    Dmod_ExitCritical();
+    return true;
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, const char*,  _get_context_name, ( dmheap_context_t* ctx ) )
+{
+    if( ctx == NULL )
+    {
+        ctx = g_default_context_count > 0 ? g_default_contexts[0] : NULL;
+    }
+    return ctx != NULL ? ctx->name : "";
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, void,  _set_default_context, ( dmheap_context_t* ctx ) )
+{
+    Dmod_EnterCritical();
+    g_default_context_count = 0;
+    if( ctx != NULL )
+    {
+        add_default_context_locked( ctx );
+    }
+    Dmod_ExitCritical();
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, bool,  _add_default_context, ( dmheap_context_t* ctx ) )
+{
+    Dmod_EnterCritical();
+    bool added = add_default_context_locked( ctx );
+    Dmod_ExitCritical();
+    return added;
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, bool,  _remove_default_context, ( dmheap_context_t* ctx ) )
+{
+    Dmod_EnterCritical();
+    bool removed = remove_default_context_locked( ctx );
+    Dmod_ExitCritical();
+    return removed;
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, dmheap_context_t*,  _get_default_context, ( void ) )
+{
+    return g_default_context_count > 0 ? g_default_contexts[0] : NULL;
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, size_t,  _get_default_context_count, ( void ) )
+{
+    return g_default_context_count;
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, dmheap_context_t*,  _get_default_context_at, ( size_t index ) )
+{
+    return index < g_default_context_count ? g_default_contexts[index] : NULL;
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, dmheap_context_t*,  _get_context_by_name, ( const char* name ) )
+{
+    if( name == NULL )
+    {
+        return NULL;
+    }
+
+    dmheap_context_t* found = NULL;
+    Dmod_EnterCritical();
+    for( size_t i = 0; i < g_default_context_count; i++ )
+    {
+        if( g_default_contexts[i]->name[0] != '\0' &&
+            strncmp( g_default_contexts[i]->name, name, DMOD_MAX_MODULE_NAME_LENGTH ) == 0 )
+        {
+            found = g_default_contexts[i];
+            break;
+        }
+    }
+    Dmod_ExitCritical();
+    return found;
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, bool,  _is_initialized, ( dmheap_context_t* ctx ) )
+{
+    if( ctx != NULL )
+    {
+        return ctx->heap_start != NULL;
+    }
+    return g_default_context_count > 0;
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, bool,  _set_large_region, ( dmheap_context_t* ctx, size_t threshold, size_t region_size ) )
+{
+    if( ctx == NULL || threshold == 0 )
+    {
+        DMOD_LOG_ERROR("dmheap: set_large_region called with invalid parameters.\n");
+        return false;
+    }
+    if( ctx->shards != NULL )
+    {
+        DMOD_LOG_ERROR("dmheap: large regions are not supported on sharded heaps.\n");
+        return false;
+    }
+
+    size_t page_count = region_size / DMHEAP_LARGE_PAGE_SIZE;
+#if !DMHEAP_LARGE_USE_MMAP
+    if( page_count == 0 )
+    {
+        DMOD_LOG_ERROR("dmheap: large region must span at least one %d-byte page (mmap-backed mode not built in).\n", DMHEAP_LARGE_PAGE_SIZE);
+        return false;
+    }
+#endif
+
+    context_lock( ctx );
+    if( ctx->large != NULL )
+    {
+        context_unlock( ctx );
+        DMOD_LOG_ERROR("dmheap: large region is already configured for heap %p.\n", ctx);
+        return false;
+    }
+
+    // The region is carved off the top of the heap, so the block that ends there
+    // must still be free (normally true right after dmheap_init()).
+    uintptr_t heap_end = (uintptr_t)ctx->heap_start + ctx->heap_size;
+    block_t* top = ctx->free_list;
+    while( top != NULL && (uintptr_t)top->address + top->size != heap_end )
+    {
+        top = top->next;
+    }
+
+    uintptr_t pages_end   = heap_end & ~(uintptr_t)(DMHEAP_LARGE_PAGE_SIZE - 1);
+    uintptr_t pages_start = pages_end - page_count * DMHEAP_LARGE_PAGE_SIZE;
+    uintptr_t header      = (pages_start - sizeof(large_region_t)) & ~(uintptr_t)(sizeof(void*) - 1);
+    if( top == NULL || pages_end < page_count * DMHEAP_LARGE_PAGE_SIZE + sizeof(large_region_t) ||
+        header < (uintptr_t)top->address + ctx->alignment )
+    {
+        context_unlock( ctx );
+        DMOD_LOG_ERROR("dmheap: not enough free space at the top of heap %p for a %zu-byte large region.\n", ctx, region_size);
+        return false;
+    }
+
+    free_list_remove( ctx, top );
+    top->size = (size_t)(header - (uintptr_t)top->address);
+    free_list_insert( ctx, top );
+
+    large_region_t* large = (large_region_t*)header;
+    memset( large, 0, sizeof(*large) );
+    large->threshold = threshold;
+    if( page_count > 0 )
+    {
+        large->pages_start  = (uint8_t*)pages_start;
+        large->page_count   = page_count;
+        large->extent_count = 1;
+        large->extents[0].address = (uint8_t*)pages_start;
+        large->extents[0].pages   = page_count;
+        large->extents[0].zeroed  = (top->flags & BLOCK_FLAG_ZEROED) != 0;
+    }
+    ctx->large = large;
+    ctx->perm_floor = (uint8_t*)header;
+    large_recount( ctx );
+    context_unlock( ctx );
+
+    DMOD_LOG_INFO("dmheap: Large region of %zu pages for allocations >= %zu bytes.\n", page_count, threshold);
+    return true;
+}
+
+/**
+ * @brief Set the reserve of one heap context under its lock - a sharded heap
+ * gives each shard an even share.
+ *
+ * @param ctx           Pointer to the heap context.
+ * @param reserve_bytes Bytes to hold back.
+ *
+ * @return true if every reserve was set.
+ */
+static bool set_reserve_in_context( dmheap_context_t* ctx, size_t reserve_bytes )
+{
+    if( ctx->shards != NULL )
+    {
+        bool all_succeeded = true;
+        for( size_t i = 0; i < ctx->shard_count; i++ )
+        {
+            all_succeeded &= set_reserve_in_context( ctx->shards[i], reserve_bytes / ctx->shard_count );
+        }
+        return all_succeeded;
+    }
+
+    context_lock( ctx );
+    bool fits = reserve_bytes <= ctx->counters.free_bytes;
+    if( fits )
+    {
+        ctx->reserve_bytes = reserve_bytes;
+    }
+    context_unlock( ctx );
+    return fits;
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, bool,  _set_reserve, ( dmheap_context_t* ctx, size_t reserve_bytes ) )
+{
+    if( ctx == NULL )
+    {
+        DMOD_LOG_ERROR("dmheap: set_reserve called with NULL context.\n");
+        return false;
+    }
+    if( !set_reserve_in_context( ctx, reserve_bytes ) )
+    {
+        DMOD_LOG_ERROR("dmheap: heap %p has less than %zu free bytes to reserve.\n", ctx, reserve_bytes);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Set the automatic coalescing threshold of one heap context under its
+ * lock - every shard of a sharded one.
+ *
+ * @param ctx     Pointer to the heap context.
+ * @param percent Fragmentation percentage that starts a pass, 0 for never.
+ */
+static void set_coalesce_threshold_in_context( dmheap_context_t* ctx, uint32_t percent )
+{
+    if( ctx->shards != NULL )
+    {
+        for( size_t i = 0; i < ctx->shard_count; i++ )
+        {
+            set_coalesce_threshold_in_context( ctx->shards[i], percent );
+        }
+        return;
+    }
+
+    context_lock( ctx );
+    ctx->coalesce_threshold = percent;
+    ctx->coalesce_position  = NULL;
+    ctx->coalesce_slot      = 0;
+    ctx->coalesce_floor     = 0;
+    context_unlock( ctx );
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, bool,  _set_coalesce_threshold, ( dmheap_context_t* ctx, uint32_t percent ) )
+{
+    if( ctx == NULL )
+    {
+        DMOD_LOG_ERROR("dmheap: set_coalesce_threshold called with NULL context.\n");
+        return false;
+    }
+    if( percent > 100 )
+    {
+        DMOD_LOG_ERROR("dmheap: coalesce threshold %u%% is out of range.\n", (unsigned)percent);
+        return false;
+    }
+    set_coalesce_threshold_in_context( ctx, percent );
+    return true;
+}
+
+/**
+ * @brief Register a module on a single, already-resolved heap context.
+ *
+ * @param ctx         Pointer to the heap context (must not be NULL).
+ * @param module_name Name of the module to register.
+ *
+ * @return true if the module is registered (either just now or already), false on failure.
+ */
+static bool register_module_in_context( dmheap_context_t* ctx, const char* module_name )
+{
+    if( ctx->shards != NULL )
+    {
+        // Allocations may land on any shard, so every shard needs the module.
+        bool all_succeeded = true;
+        for( size_t i = 0; i < ctx->shard_count; i++ )
+        {
+            if( !register_module_in_context( ctx->shards[i], module_name ) )
+            {
+                all_succeeded = false;
+            }
+        }
+        return all_succeeded;
+    }
+
+    context_lock( ctx );
+    module_t* module = find_module_by_name( ctx, module_name );
+    if( module != NULL )
+    {
+        context_unlock( ctx );
+        DMOD_LOG_WARN("dmheap: Module %s is already registered.\n", module_name);
+        return true;
+    }
+    module = create_module( ctx, module_name, false );
+    context_unlock( ctx );
+    if( module == NULL )
+    {
+        DMOD_LOG_ERROR("dmheap: Failed to register module %s.\n", module_name);
+        return false;
+    }
+    DMOD_LOG_INFO("dmheap: Module %s registered successfully.\n", module_name);
+    return true;
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, bool,  _register_module, ( dmheap_context_t* ctx, const char* module_name ) )
+{
+    if( ctx != NULL )
+    {
+        return register_module_in_context( ctx, module_name );
+    }
+
+    if( g_default_context_count == 0 )
+    {
+        DMOD_LOG_ERROR("dmheap: No context available for register_module.\n");
+        return false;
+    }
+
+    // A NULL context registers the module on every default heap, since a later
+    // allocation with a NULL context (see dmheap_malloc) may land on any of them.
+    bool all_succeeded = true;
+    for( size_t i = 0; i < g_default_context_count; i++ )
+    {
+        if( !register_module_in_context( g_default_contexts[i], module_name ) )
+        {
+            all_succeeded = false;
+        }
+    }
+    return all_succeeded;
+}
+
+/**
+ * @brief Mark a module critical (or not) on a single, already-resolved heap
+ * context, registering it if needed.
+ *
+ * @param ctx         Pointer to the heap context (must not be NULL).
+ * @param module_name Name of the module.
+ * @param critical    true to let the module use the reserve.
+ *
+ * @return true on success, false if the module could not be registered.
+ */
+static bool set_module_critical_in_context( dmheap_context_t* ctx, const char* module_name, bool critical )
+{
+    if( ctx->shards != NULL )
+    {
+        bool all_succeeded = true;
+        for( size_t i = 0; i < ctx->shard_count; i++ )
+        {
+            all_succeeded &= set_module_critical_in_context( ctx->shards[i], module_name, critical );
+        }
+        return all_succeeded;
+    }
+
+    context_lock( ctx );
+    // A module made critical may take its record from the reserve it is being
+    // let into.
+    module_t* module = find_module_by_name( ctx, module_name );
+    if( module == NULL )
+    {
+        module = create_module( ctx, module_name, critical );
+    }
+    if( module != NULL )
+    {
+        module->critical = critical;
+    }
+    context_unlock( ctx );
+    return module != NULL;
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, bool,  _set_module_critical, ( dmheap_context_t* ctx, const char* module_name, bool critical ) )
+{
+    if( module_name == NULL || (ctx == NULL && g_default_context_count == 0) )
+    {
+        DMOD_LOG_ERROR("dmheap: set_module_critical called with invalid parameters.\n");
+        return false;
+    }
+    if( ctx != NULL )
+    {
+        return set_module_critical_in_context( ctx, module_name, critical );
+    }
+
+    bool all_succeeded = true;
+    for( size_t i = 0; i < g_default_context_count; i++ )
+    {
+        all_succeeded &= set_module_critical_in_context( g_default_contexts[i], module_name, critical );
+    }
+    return all_succeeded;
+}
+
+/**
+ * @brief Unregister a module (if present) on a single, already-resolved heap context.
+ *
+ * @param ctx         Pointer to the heap context (must not be NULL).
+ * @param module_name Name of the module to unregister.
+ */
+static void unregister_module_in_context( dmheap_context_t* ctx, const char* module_name )
+{
+    if( ctx->shards != NULL )
+    {
+        for( size_t i = 0; i < ctx->shard_count; i++ )
+        {
+            unregister_module_in_context( ctx->shards[i], module_name );
+        }
+        return;
+    }
+
+    context_lock( ctx );
+    module_t* module = find_module_by_name( ctx, module_name );
+    if( module == NULL )
+    {
+        context_unlock( ctx );
+        return;
+    }
+    delete_module( ctx, module );
+    // Coalesce right away: a module's freed blocks otherwise sit as isolated,
+    // module-shaped fragments that a differently-sized/aligned future allocation
+    // can't reuse, permanently eating into the largest contiguous free region one
+    // load/unload cycle at a time (see Dmod_Context_Delete for the same reasoning).
+    ctx->engine->maintain( ctx );
+    context_unlock( ctx );
+    DMOD_LOG_INFO("dmheap: Module %s unregistered successfully.\n", module_name);
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, void,  _unregister_module, ( dmheap_context_t* ctx, const char* module_name ) )
+{
+    // it is very likely, that module_name is inside a buffer we will free, so we need to copy it first
+    char module_name_copy[DMOD_MAX_MODULE_NAME_LENGTH];
+    strncpy( module_name_copy, module_name, DMOD_MAX_MODULE_NAME_LENGTH - 1 );
+    module_name_copy[DMOD_MAX_MODULE_NAME_LENGTH - 1] = '\0';
+
+    if( ctx != NULL )
+    {
+        unregister_module_in_context( ctx, module_name_copy );
+        return;
+    }
+
+    if( g_default_context_count == 0 )
+    {
+        DMOD_LOG_ERROR("dmheap: No context available for unregister_module.\n");
+        return;
+    }
+
+    // A module registered with a NULL context may have ended up with blocks on any
+    // default heap (see dmheap_malloc) - unregister it everywhere so nothing leaks.
+    for( size_t i = 0; i < g_default_context_count; i++ )
+    {
+        unregister_module_in_context( g_default_contexts[i], module_name_copy );
+    }
+}
+
+/**
+ * @brief Detach a module (if present) from a single, already-resolved heap
+ * context, leaving its memory to teardown_step_locked().
+ *
+ * @param ctx         Pointer to the heap context (must not be NULL).
+ * @param module_name Name of the module to unregister.
+ */
+static void unregister_module_async_in_context( dmheap_context_t* ctx, const char* module_name )
+{
+    if( ctx->shards != NULL )
+    {
+        for( size_t i = 0; i < ctx->shard_count; i++ )
+        {
+            unregister_module_async_in_context( ctx->shards[i], module_name );
+        }
+        return;
+    }
+
+    context_lock( ctx );
+    module_t* module = find_module_by_name( ctx, module_name );
+    if( module != NULL )
+    {
+        remove_module_from_list( &ctx->module_list, module );
+        module->detached = true;
+        add_module_to_list( &ctx->pending_modules, module );
+    }
+    context_unlock( ctx );
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, void,  _unregister_module_async, ( dmheap_context_t* ctx, const char* module_name ) )
+{
+    if( module_name == NULL || (ctx == NULL && g_default_context_count == 0) )
+    {
+        DMOD_LOG_ERROR("dmheap: unregister_module_async called with invalid parameters.\n");
+        return;
+    }
+    if( ctx != NULL )
+    {
+        unregister_module_async_in_context( ctx, module_name );
+        return;
+    }
+
+    for( size_t i = 0; i < g_default_context_count; i++ )
+    {
+        unregister_module_async_in_context( g_default_contexts[i], module_name );
+    }
+}
+
+/**
+ * @brief Do one slice of deferred work on one heap context (every shard of a
+ * sharded one) under its lock.
+ *
+ * @param ctx    Pointer to the heap context.
+ * @param budget Passed to teardown_step_locked().
+ *
+ * @return true if work is still pending.
+ */
+static bool maintain_slice_in_context( dmheap_context_t* ctx, size_t budget )
+{
+    if( ctx->shards != NULL )
+    {
+        bool pending = false;
+        for( size_t i = 0; i < ctx->shard_count; i++ )
+        {
+            pending |= maintain_slice_in_context( ctx->shards[i], budget );
+        }
+        return pending;
+    }
+
+    context_lock( ctx );
+    bool pending = teardown_step_locked( ctx, budget );
+    context_unlock( ctx );
+    return pending;
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, bool,  _maintain, ( dmheap_context_t* ctx, size_t budget ) )
+{
+    if( ctx != NULL )
+    {
+        return maintain_slice_in_context( ctx, budget );
+    }
+
+    bool pending = false;
+    for( int32_t i = 0; ; i++ )
+    {
+        // Only the lookup needs the default list to hold still - each heap's
+        // own lock covers the slice done on it.
+        Dmod_EnterCritical();
+        dmheap_context_t* heap = i < g_default_context_count ? g_default_contexts[g_default_context_count - 1 - i] : NULL;
+        Dmod_ExitCritical();
+        if( heap == NULL )
+        {
+            break;
+        }
+        pending |= maintain_slice_in_context( heap, budget );
+    }
+    return pending;
+}
+
+/**
+ * @brief Log2 histogram bucket of a size or alignment.
+ *
+ * @param value        Requested size or alignment.
+ * @param bucket_count Number of buckets - the last one takes everything beyond.
+ *
+ * @return floor(log2(value)), capped at bucket_count - 1 (0 for 0 and 1).
+ */
+static uint32_t request_bucket( size_t value, uint32_t bucket_count )
+{
+    uint32_t bucket = 0;
+    while( value > 1 && bucket < bucket_count - 1 )
+    {
+        value >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+/**
+ * @brief Count an allocation request in its module's histogram (see
+ * DMHEAP_REQUEST_HISTOGRAM). Caller must hold the heap's critical section.
+ *
+ * @param ctx       Pointer to the heap context.
+ * @param module    Module the allocation went to, or NULL if untracked.
+ * @param size      Requested size.
+ * @param alignment Requested alignment.
+ */
+static void record_request( dmheap_context_t* ctx, module_t* module, size_t size, size_t alignment )
+{
+    if( (ctx->flags & DMHEAP_REQUEST_HISTOGRAM) == 0 )
+    {
+        return;
+    }
+    dmheap_request_histogram_t* histogram = module != NULL ? module->requests : &ctx->untracked_requests;
+    histogram->size[request_bucket( size, DMHEAP_REQUEST_SIZE_BUCKETS )]++;
+    histogram->alignment[request_bucket( alignment, DMHEAP_REQUEST_ALIGN_BUCKETS )]++;
+    histogram->requests++;
+}
+
+/**
+ * @brief Allocate aligned memory from a single, already-resolved heap context.
+ *
+ * This is the core allocation algorithm, factored out so it can be reused both
+ * for an explicit context and, per-heap, when searching the default heap list.
+ *
+ * @param ctx         Pointer to the heap context (must not be NULL).
+ * @param alignment   Alignment requirement.
+ * @param size        Size of memory to allocate.
+ * @param hints       DMHEAP_HINT_* bits, see dmheap_malloc_hint().
+ * @param module_name Name of the module requesting allocation, recorded as the
+ *                    block's owner on success. Failures are not logged here -
+ *                    only the caller knows whether this is a final failure or
+ *                    one heap out of several being tried in a default-heap
+ *                    fallback search, so it logs (or not) accordingly.
+ * @param out_zeroed  If not NULL, set to whether the returned memory is known to
+ *                    be all zero already (see dmheap_calloc()).
+ *
+ * @return Pointer to the allocated memory, or NULL if allocation fails.
+ */
+static void* aligned_alloc_locked( dmheap_context_t* ctx, size_t alignment, size_t size, uint32_t hints, const char* module_name, bool* out_zeroed )
+{
+    // Big requests are served from the dedicated large region first, so they never
+    // carve up (or, once freed, merge into) small-block space. If the region can't
+    // take one, it still falls back to the general heap below.
+    if( ctx->large != NULL && size >= ctx->large->threshold && alignment <= DMHEAP_LARGE_PAGE_SIZE )
+    {
+        void* ptr = large_alloc_locked( ctx, size, module_name, out_zeroed );
+        if( ptr != NULL )
+        {
+            record_request( ctx, large_find_extent( ctx, ptr )->owner, size, alignment );
+            return ptr;
+        }
+    }
+
+    size_t block_size = size;
+    size_t block_alignment = alignment;
+    if( hints & DMHEAP_HINT_ISOLATED )
+    {
+        // Both ends on a line boundary - an inline header then sits at the end of
+        // the line before, and whatever follows starts on the next one.
+        block_size = align_size( size, ctx->cache_line );
+        block_alignment = alignment > ctx->cache_line ? alignment : ctx->cache_line;
+    }
+    // A module seen for the first time also takes its record - count it in, so
+    // the reserve line is not crossed once the block is carved.
+    size_t record_size = 0;
+    if( ctx->reserve_bytes != 0 && module_name != NULL && find_module_by_name( ctx, module_name ) == NULL )
+    {
+        record_size = module_record_size( ctx );
+    }
+    if( ctx->reserve_bytes != 0 && reserve_denies( ctx, block_size + record_size, module_name ) )
+    {
+        return NULL;
+    }
+    block_t* block = ctx->engine->alloc( ctx, block_size, block_alignment, hints, out_zeroed );
+    if( block == NULL && (ctx->pending_modules != NULL || ctx->doomed_modules != NULL || ctx->sweep_merge) )
+    {
+        // Detached modules still hold memory dmheap_maintain() has not got to,
+        // or have left it unmerged - finish their teardown before giving up.
+        while( teardown_step_locked( ctx, SIZE_MAX ) )
+        {
+        }
+        block = ctx->engine->alloc( ctx, block_size, block_alignment, hints, out_zeroed );
+    }
+    if( block == NULL )
+    {
+        return NULL;
+    }
+    if( ctx->reserve_bytes != 0 && reserve_denies( ctx, 0, module_name ) )
+    {
+        // Header, padding or engine rounding took the carve past the reserve line.
+        ctx->engine->undo_alloc( ctx, block );
+        return NULL;
+    }
+    module_t* module = module_name != NULL ? get_or_create_module( ctx, module_name ) : NULL;
+    if( module == NULL && record_size != 0 )
+    {
+        // The record's own header or rounding reached the reserve line.
+        ctx->engine->undo_alloc( ctx, block );
+        return NULL;
+    }
+    block->flags = (hints << BLOCK_FLAG_HINT_SHIFT) & BLOCK_FLAG_HINTS;
+    if( alignment > ctx->alignment )
+    {
+        block->flags |= request_bucket( alignment, 64 ) << BLOCK_FLAG_ALIGN_SHIFT;
+    }
+    block->seq   = next_alloc_seq();
+    block->owner = module;
+    record_request( ctx, module, size, alignment );
+
+    used_list_add( ctx, block );
+    return block->address;
+}
+
+/**
+ * @brief Allocate aligned memory from a single, already-resolved heap context.
+ *
+ * Takes the heap's lock around aligned_alloc_locked(); see there for the parameters.
+ * A sharded heap tries the shard its selector picks first, then steals from the
+ * others in turn.
+ *
+ * @return Pointer to the allocated memory, or NULL if allocation fails.
+ */
+static void* aligned_alloc_in_context( dmheap_context_t* ctx, size_t alignment, size_t size, uint32_t hints, const char* module_name, bool* out_zeroed )
+{
+    if( ctx->shards != NULL )
+    {
+        size_t home = ctx->shard_selector( ctx->shard_selector_data ) % ctx->shard_count;
+        for( size_t i = 0; i < ctx->shard_count; i++ )
+        {
+            void* ptr = aligned_alloc_in_context( ctx->shards[(home + i) % ctx->shard_count], alignment, size, hints, module_name, out_zeroed );
+            if( ptr != NULL )
+            {
+                return ptr;
+            }
+        }
+        return NULL;
+    }
+
+    context_lock( ctx );
+    void* ptr = aligned_alloc_locked( ctx, alignment, size, hints, module_name, out_zeroed );
+    context_unlock( ctx );
+    return ptr;
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, void*, _aligned_alloc, ( dmheap_context_t* ctx, size_t alignment, size_t size, const char* module_name) )
+{
+    if( ctx != NULL )
+    {
+        void* ptr = aligned_alloc_in_context( ctx, alignment, size, 0, module_name, NULL );
+        if( ptr == NULL )
+        {
+            DMOD_LOG_ERROR("dmheap: Unable to allocate %zu bytes with alignment %zu for module %s.\n", size, alignment, module_name);
+        }
+        return ptr;
+    }
+
+    if( g_default_context_count == 0 )
+    {
+        DMOD_LOG_ERROR("dmheap: No context available for aligned_alloc.\n");
+        return NULL;
+    }
+
+    // Try every default heap in the order it was added, until one can satisfy the request.
+    // Failing on any one heap along the way is expected, not an error - only log if every
+    // heap in the search comes up empty (below).
+    for( int32_t i = (g_default_context_count - 1); i >= 0; i-- )
+    {
+        void* ptr = aligned_alloc_in_context( g_default_contexts[i], alignment, size, 0, module_name, NULL );
+        if( ptr != NULL )
+        {
+            return ptr;
+        }
+    }
+
+    DMOD_LOG_ERROR("dmheap: Unable to allocate %zu bytes with alignment %zu for module %s in any default heap.\n", size, alignment, module_name);
+    return NULL;
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, void*, _malloc, ( dmheap_context_t* ctx, size_t size, const char* module_name ) )
+{
+    if( ctx != NULL )
+    {
+        void* ptr = aligned_alloc_in_context( ctx, ctx->alignment, size, 0, module_name, NULL );
+        if( ptr == NULL )
+        {
+            DMOD_LOG_ERROR("dmheap: Unable to allocate %zu bytes for module %s.\n", size, module_name);
+        }
+        return ptr;
+    }
+
+    if( g_default_context_count == 0 )
+    {
+        DMOD_LOG_ERROR("dmheap: No context available for malloc.\n");
+        return NULL;
+    }
+
+    // Try every default heap in the order it was added, using each heap's own
+    // alignment, until one can satisfy the request. Failing on any one heap along
+    // the way is expected, not an error - only log if every heap comes up empty.
+    for( int32_t i = (g_default_context_count - 1); i >= 0; i-- )
+    {
+        dmheap_context_t* heap = g_default_contexts[i];
+        void* ptr = aligned_alloc_in_context( heap, heap->alignment, size, 0, module_name, NULL );
+        if( ptr != NULL )
+        {
+            return ptr;
+        }
+    }
+
+    DMOD_LOG_ERROR("dmheap: Unable to allocate %zu bytes for module %s in any default heap.\n", size, module_name);
+    return NULL;
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, void*, _malloc_hint, ( dmheap_context_t* ctx, size_t size, uint32_t hints, const char* module_name ) )
+{
+    if( ctx != NULL )
+    {
+        void* ptr = aligned_alloc_in_context( ctx, ctx->alignment, size, hints, module_name, NULL );
+        if( ptr == NULL )
+        {
+            DMOD_LOG_ERROR("dmheap: Unable to allocate %zu bytes (hints 0x%x) for module %s.\n", size, (unsigned)hints, module_name);
+        }
+        return ptr;
+    }
+
+    if( g_default_context_count == 0 )
+    {
+        DMOD_LOG_ERROR("dmheap: No context available for malloc_hint.\n");
+        return NULL;
+    }
+
+    // Same default-list search as dmheap_malloc() - the hints only steer where in
+    // the chosen heap the block goes, not which heap is chosen.
+    for( int32_t i = (g_default_context_count - 1); i >= 0; i-- )
+    {
+        dmheap_context_t* heap = g_default_contexts[i];
+        void* ptr = aligned_alloc_in_context( heap, heap->alignment, size, hints, module_name, NULL );
+        if( ptr != NULL )
+        {
+            return ptr;
+        }
+    }
+
+    DMOD_LOG_ERROR("dmheap: Unable to allocate %zu bytes (hints 0x%x) for module %s in any default heap.\n", size, (unsigned)hints, module_name);
+    return NULL;
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, size_t, _get_cache_line_size, ( dmheap_context_t* ctx ) )
+{
+    if( ctx == NULL )
+    {
+        ctx = g_default_context_count > 0 ? g_default_contexts[0] : NULL;
+    }
+    return ctx != NULL ? ctx->cache_line : detect_cache_line_size();
+}
+
+/**
+ * @brief Allocate zero-filled memory from a single, already-resolved heap context.
+ *
+ * The memset is skipped when the block handed out is still known to be all zero
+ * (never-used space of a DMHEAP_BUFFER_ZEROED heap, fresh large-region pages), and
+ * otherwise done outside the critical section.
+ *
+ * @param ctx         Pointer to the heap context (must not be NULL).
+ * @param size        Size of memory to allocate.
+ * @param module_name Name of the module requesting allocation.
+ *
+ * @return Pointer to the allocated memory, or NULL if allocation fails.
+ */
+static void* calloc_in_context( dmheap_context_t* ctx, size_t size, const char* module_name )
+{
+    bool zeroed = false;
+    void* ptr = aligned_alloc_in_context( ctx, ctx->alignment, size, 0, module_name, &zeroed );
+    if( ptr != NULL && !zeroed )
+    {
+        memset( ptr, 0, size );
+    }
+    return ptr;
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, void*, _calloc, ( dmheap_context_t* ctx, size_t count, size_t size, const char* module_name ) )
+{
+    if( size != 0 && count > SIZE_MAX / size )
+    {
+        DMOD_LOG_ERROR("dmheap: calloc of %zu x %zu bytes overflows for module %s.\n", count, size, module_name);
+        return NULL;
+    }
+    size_t total = count * size;
+
+    if( ctx != NULL )
+    {
+        void* ptr = calloc_in_context( ctx, total, module_name );
+        if( ptr == NULL )
+        {
+            DMOD_LOG_ERROR("dmheap: Unable to allocate %zu zeroed bytes for module %s.\n", total, module_name);
+        }
+        return ptr;
+    }
+
+    if( g_default_context_count == 0 )
+    {
+        DMOD_LOG_ERROR("dmheap: No context available for calloc.\n");
+        return NULL;
+    }
+
+    for( int32_t i = (g_default_context_count - 1); i >= 0; i-- )
+    {
+        void* ptr = calloc_in_context( g_default_contexts[i], total, module_name );
+        if( ptr != NULL )
+        {
+            return ptr;
+        }
+    }
+
+    DMOD_LOG_ERROR("dmheap: Unable to allocate %zu zeroed bytes for module %s in any default heap.\n", total, module_name);
+    return NULL;
+}
+
+/**
+ * @brief Bump-allocate headerless memory from the permanent region. Caller must
+ * hold the critical section.
+ *
+ * The permanent region grows down from the top of the general heap by shrinking
+ * the free block that sits right below it, so it only succeeds while that block
+ * is free and big enough. Nothing records the individual allocations - only the
+ * owning module's running total grows.
+ *
+ * @param ctx         Pointer to the heap context.
+ * @param size        Size of memory to allocate.
+ * @param alignment   Alignment requirement (power of two).
+ * @param module_name Name of the module the memory is accounted to (may be NULL).
+ *
+ * @return Pointer to the allocated memory, or NULL if the region cannot grow.
+ */
+static void* permanent_alloc_locked( dmheap_context_t* ctx, size_t size, size_t alignment, const char* module_name )
+{
+    block_t* below = ctx->free_list;
+    while( below != NULL && (uint8_t*)below->address + below->size != ctx->perm_floor )
+    {
+        below = below->next;
+    }
+    if( below == NULL || size > (size_t)((uintptr_t)ctx->perm_floor - block_region_start( ctx, below )) )
+    {
+        return NULL;
+    }
+
+    uintptr_t new_floor = ((uintptr_t)ctx->perm_floor - size) & ~(uintptr_t)(alignment - 1);
+    if( new_floor < block_region_start( ctx, below ) ||
+        (ctx->reserve_bytes != 0 && reserve_denies( ctx, (size_t)((uintptr_t)ctx->perm_floor - new_floor), module_name )) )
+    {
+        return NULL;
+    }
+
+    free_list_remove( ctx, below );
+    if( new_floor >= (uintptr_t)below->address + ctx->alignment )
+    {
+        below->size = (size_t)(new_floor - (uintptr_t)below->address);
+        free_list_insert( ctx, below );
+    }
+    else
+    {
+        // Too little would be left for a usable free block - absorb it, header and
+        // all, into the permanent region. Everything from `below` upward is permanent.
+        new_floor = block_region_start( ctx, below );
+        release_header( ctx, below );
+    }
+
+    size_t grown = (size_t)((uintptr_t)ctx->perm_floor - new_floor);
+    void* ptr = align_pointer( (void*)new_floor, alignment );
+    ctx->perm_floor = (uint8_t*)new_floor;
+    ctx->permanent_bytes += grown;
+
+    module_t* module = module_name != NULL ? get_or_create_module( ctx, module_name ) : NULL;
+    if( module != NULL )
+    {
+        module->permanent_bytes += grown;
+    }
+    return ptr;
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, void*, _malloc_permanent, ( dmheap_context_t* ctx, size_t size, size_t alignment, const char* module_name ) )
+{
+    if( ctx == NULL )
+    {
+        ctx = g_default_context_count > 0 ? g_default_contexts[0] : NULL;
+    }
+    if( ctx == NULL || size == 0 )
+    {
+        DMOD_LOG_ERROR("dmheap: malloc_permanent called with invalid parameters.\n");
+        return NULL;
+    }
+    if( alignment == 0 )
+    {
+        alignment = ctx->alignment;
+    }
+    if( ctx->shards != NULL )
+    {
+        // Boot-time data is never freed, so which shard holds it does not matter.
+        ctx = ctx->shards[0];
+    }
+
+    context_lock( ctx );
+    void* ptr = permanent_alloc_locked( ctx, size, alignment, module_name );
+    context_unlock( ctx );
+    if( ptr != NULL )
+    {
+        return ptr;
+    }
+
+    // The region can't grow (the block below it is in use or too small) - a regular
+    // block still beats failing a boot-time allocation. It is never freed either,
+    // so it goes with the other long-lived blocks.
+    DMOD_LOG_WARN("dmheap: permanent region of heap %p is exhausted, using a regular block for %zu bytes.\n", ctx, size);
+    ptr = aligned_alloc_in_context( ctx, alignment, size, DMHEAP_HINT_LONG_LIVED, module_name, NULL );
+    if( ptr == NULL )
+    {
+        DMOD_LOG_ERROR("dmheap: Unable to allocate %zu permanent bytes for module %s.\n", size, module_name);
+    }
+    return ptr;
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, bool, _set_capabilities, ( dmheap_context_t* ctx, uint32_t caps ) )
+{
+    if( ctx == NULL )
+    {
+        DMOD_LOG_ERROR("dmheap: set_capabilities called with NULL context.\n");
+        return false;
+    }
+
+    Dmod_EnterCritical();
+    ctx->caps = caps;
+    Dmod_ExitCritical();
+    return true;
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, uint32_t, _get_capabilities, ( dmheap_context_t* ctx ) )
+{
+    if( ctx == NULL )
+    {
+        ctx = g_default_context_count > 0 ? g_default_contexts[0] : NULL;
+    }
+    return ctx != NULL ? ctx->caps : 0;
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, void*, _malloc_caps, ( size_t size, uint32_t caps, const char* module_name ) )
+{
+    // Route in a single pass over the default heap list: keep only heaps that have
+    // every requested capability, ordered by how few capabilities they have on top
+    // of those - so a plain request doesn't eat scarce DMA/fast RAM while a slower,
+    // less special heap still has room. Ties keep the usual default-list order.
+    dmheap_context_t* candidates[DMHEAP_MAX_DEFAULT_CONTEXTS];
+    uint32_t surplus[DMHEAP_MAX_DEFAULT_CONTEXTS];
+    size_t candidate_count = 0;
+
+    Dmod_EnterCritical();
+    for( int32_t i = (g_default_context_count - 1); i >= 0; i-- )
+    {
+        dmheap_context_t* heap = g_default_contexts[i];
+        if( (heap->caps & caps) != caps )
+        {
+            continue;
+        }
+        uint32_t extra = count_bits( heap->caps & ~caps );
+        size_t j = candidate_count++;
+        while( j > 0 && surplus[j - 1] > extra )
+        {
+            candidates[j] = candidates[j - 1];
+            surplus[j]    = surplus[j - 1];
+            j--;
+        }
+        candidates[j] = heap;
+        surplus[j]    = extra;
+    }
+    Dmod_ExitCritical();
+
+    for( size_t i = 0; i < candidate_count; i++ )
+    {
+        void* ptr = aligned_alloc_in_context( candidates[i], candidates[i]->alignment, size, 0, module_name, NULL );
+        if( ptr != NULL )
+        {
+            return ptr;
+        }
+    }
+
+    DMOD_LOG_ERROR("dmheap: Unable to allocate %zu bytes with capabilities 0x%x for module %s (%zu matching heap%s).\n",
+        size, (unsigned)caps, module_name, candidate_count, candidate_count == 1 ? "" : "s");
+    return NULL;
+}
+
+/**
+ * @brief Size to resize a used block to so it holds size bytes.
+ *
+ * @param ctx   Pointer to the heap context that owns block.
+ * @param block The block being resized.
+ * @param size  Requested new size.
+ *
+ * @return size, rounded up to whole cache lines for a DMHEAP_HINT_ISOLATED block.
+ */
+static size_t resize_target( const dmheap_context_t* ctx, const block_t* block, size_t size )
+{
+    return (block_hints( block ) & DMHEAP_HINT_ISOLATED) ? align_size( size, ctx->cache_line ) : size;
+}
+
+/**
+ * @brief Check whether growing a used block to size bytes would eat into its
+ * heap's reserve without the module being allowed to (see reserve_denies()).
+ *
+ * @param ctx         Pointer to the heap context that owns block.
+ * @param block       The block to grow.
+ * @param size        New size of the block.
+ * @param module_name Name of the module asking (may be NULL).
+ *
+ * @return true if the block must not grow in this heap.
+ */
+static bool reserve_denies_growth( dmheap_context_t* ctx, const block_t* block, size_t size, const char* module_name )
+{
+    return size > block->size && ctx->reserve_bytes != 0 && reserve_denies( ctx, size - block->size, module_name );
+}
+
+/**
+ * @brief Grow/shrink/no-op an already-located block in place, allocating a
+ * replacement in the same context when it needs to grow. Caller must already
+ * hold the heap's critical section.
+ *
+ * The block keeps the alignment it was allocated with unless a new one is
+ * given; a block whose address does not meet the new alignment is always moved.
+ *
+ * @param ctx         Pointer to the heap context that owns block/ptr.
+ * @param block       The block currently backing ptr.
+ * @param ptr         Pointer previously returned by an allocation function.
+ * @param alignment   New alignment requirement, or 0 to keep the block's.
+ * @param size        New size of memory to allocate.
+ * @param module_name Name of the module requesting reallocation (for logging).
+ *
+ * @return Pointer to the reallocated memory, or NULL if growing failed.
+ */
+static void* realloc_block_locked( dmheap_context_t* ctx, block_t* block, void* ptr, size_t alignment, size_t size, const char* module_name )
+{
+    void* new_ptr = NULL;
+    if( alignment == 0 )
+    {
+        alignment = block_alignment( ctx, block );
+    }
+    if( reserve_denies_growth( ctx, block, size, module_name ) )
+    {
+        DMOD_LOG_ERROR("dmheap: Growing allocation to %zu bytes for module %s would use the heap's reserve.\n", size, module_name);
+        return NULL;
+    }
+    if( ((uintptr_t)ptr & (alignment - 1)) == 0 && ctx->engine->resize( ctx, block, resize_target( ctx, block, size ) ) )
+    {
+        new_ptr = ptr;
+        block->flags &= ~BLOCK_FLAG_ALIGN;
+        if( alignment > ctx->alignment )
+        {
+            block->flags |= request_bucket( alignment, 64 ) << BLOCK_FLAG_ALIGN_SHIFT;
+        }
+    }
+    else
+    {
+        new_ptr = aligned_alloc_locked( ctx, alignment, size, block_hints( block ), module_name, NULL );
+        if( new_ptr != NULL )
+        {
+            memcpy( new_ptr, ptr, block->size < size ? block->size : size );
+            used_list_remove( ctx, block );
+            ctx->engine->free( ctx, block );
+        }
+        else
+        {
+            DMOD_LOG_ERROR("dmheap: Unable to grow allocation to %zu bytes for module %s.\n", size, module_name);
+        }
+    }
+    return new_ptr;
+}
+
+/**
+ * @brief Resize a large allocation. Caller must already hold the heap's critical section.
+ *
+ * Sizes that still fit the extent's pages are handled in place; anything bigger is
+ * moved to a fresh allocation (large or general, whichever succeeds).
+ *
+ * Extents are page aligned, which already meets every alignment up to a page.
+ *
+ * @param ctx         Pointer to the heap context that owns ptr.
+ * @param extent      The large extent currently backing ptr.
+ * @param ptr         Pointer previously returned by an allocation function.
+ * @param alignment   New alignment requirement, or 0 for the heap's own.
+ * @param size        New size of memory to allocate.
+ * @param module_name Name of the module requesting reallocation (for logging).
+ *
+ * @return Pointer to the reallocated memory, or NULL if growing failed.
+ */
+static void* realloc_large_locked( dmheap_context_t* ctx, large_extent_t* extent, void* ptr, size_t alignment, size_t size, const char* module_name )
+{
+    size_t capacity = extent->pages * DMHEAP_LARGE_PAGE_SIZE;
+    if( alignment == 0 )
+    {
+        alignment = ctx->alignment;
+    }
+    if( size <= capacity && ((uintptr_t)ptr & (alignment - 1)) == 0 )
+    {
+        return ptr;
+    }
+
+    void* new_ptr = aligned_alloc_locked( ctx, alignment, size, 0, module_name, NULL );
+    if( new_ptr == NULL )
+    {
+        DMOD_LOG_ERROR("dmheap: Unable to grow allocation to %zu bytes for module %s.\n", size, module_name);
+        return NULL;
+    }
+    memcpy( new_ptr, ptr, capacity < size ? capacity : size );
+    // The allocation above may have reshuffled the ownership table.
+    large_free_extent_locked( ctx, large_find_extent( ctx, ptr ) );
+    return new_ptr;
+}
+
+/**
+ * @brief Reallocate ptr if it belongs to the given, already-resolved heap context.
+ * Caller must already hold the heap's critical section.
+ *
+ * @param ctx         Pointer to the heap context to search (must not be NULL).
+ * @param ptr         Pointer previously returned by an allocation function.
+ * @param alignment   New alignment requirement, or 0 to keep the block's.
+ * @param size        New size of memory to allocate.
+ * @param module_name Name of the module requesting reallocation (for logging).
+ * @param out_ptr     Receives the reallocated pointer (NULL if growing failed).
+ *
+ * @return true if ptr was found in ctx, false otherwise.
+ */
+static bool realloc_in_context_locked( dmheap_context_t* ctx, void* ptr, size_t alignment, size_t size, const char* module_name, void** out_ptr )
+{
+    block_t* block = find_block_by_address( ctx, ptr );
+    if( block != NULL )
+    {
+        *out_ptr = realloc_block_locked( ctx, block, ptr, alignment, size, module_name );
+        return true;
+    }
+
+    large_extent_t* extent = large_find_extent( ctx, ptr );
+    if( extent != NULL )
+    {
+        *out_ptr = realloc_large_locked( ctx, extent, ptr, alignment, size, module_name );
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief How fragmented a heap's free memory is: the share of its free bytes
+ * that lies outside the largest free block, in percent. Cheap - it only reads
+ * the running counters and the engine's largest block.
+ *
+ * @param ctx Pointer to the heap context.
+ *
+ * @return 0 for no free memory or a single free block, up to 100.
+ */
+static uint32_t fragmentation_percent( dmheap_context_t* ctx )
+{
+    size_t free_bytes = ctx->counters.free_bytes;
+    size_t largest = ctx->engine->largest( ctx );
+    if( free_bytes == 0 || largest >= free_bytes )
+    {
+        return 0;
+    }
+    return (uint32_t)( (uint64_t)(free_bytes - largest) * 100u / free_bytes );
+}
+
+/**
+ * @brief Automatic coalescing, run after each free that does not merge: start
+ * a pass once the heap is fragmented past its threshold, and carry a running
+ * pass on by DMHEAP_COALESCE_SLICE free blocks. Caller must already hold the
+ * heap's critical section.
+ *
+ * @param ctx Pointer to the heap context.
+ */
+static void coalesce_auto_locked( dmheap_context_t* ctx )
+{
+    if( ctx->coalesce_threshold == 0 )
+    {
+        return;
+    }
+    // A pass that found nothing to merge would find nothing again - wait for
+    // the heap to break up further than it left.
+    if( ctx->coalesce_slot == 0 &&
+        ( ctx->counters.free_blocks < DMHEAP_COALESCE_MIN_BLOCKS ||
+          ctx->counters.free_blocks <= ctx->coalesce_floor ||
+          fragmentation_percent( ctx ) < ctx->coalesce_threshold ) )
+    {
+        return;
+    }
+
+    coalesce_step_locked( ctx, DMHEAP_COALESCE_SLICE );
+}
+
+/**
+ * @brief Free a block if it belongs to the given, already-resolved heap context.
+ *
+ * @param ctx         Pointer to the heap context to search (must not be NULL).
+ * @param ptr         Pointer to the memory to free.
+ * @param concatenate If true, attempt to merge adjacent free blocks after freeing.
+ *
+ * @return true if ptr was found in ctx (and freed), false otherwise.
+ */
+static bool free_block_in_context( dmheap_context_t* ctx, void* ptr, bool concatenate )
+{
+    if( ctx->shards != NULL )
+    {
+        dmheap_context_t* shard = shard_of( ctx, ptr );
+        return shard != NULL && free_block_in_context( shard, ptr, concatenate );
+    }
+
+    context_lock( ctx );
+    block_t* block = find_block_by_address( ctx, ptr );
+    if( block == NULL )
+    {
+        large_extent_t* extent = large_find_extent( ctx, ptr );
+        if( extent != NULL )
+        {
+            large_free_extent_locked( ctx, extent );
+        }
+        context_unlock( ctx );
+        return extent != NULL;
+    }
+
+    used_list_remove( ctx, block );
+    ctx->engine->free( ctx, block );
+
+    if(concatenate)
+    {
+        ctx->engine->maintain( ctx );
+    }
+    else
+    {
+        coalesce_auto_locked( ctx );
+    }
+
+    context_unlock( ctx );
+    return true;
+}
+
+/**
+ * @brief Reallocate ptr if it belongs to the given, already-resolved heap context.
+ *
+ * Takes the heap's lock around realloc_in_context_locked(); see there for the
+ * parameters. On a sharded heap the owning shard resizes the block in place if
+ * it can, otherwise the data moves to a new block from any shard.
+ *
+ * @return true if ptr was found in ctx, false otherwise.
+ */
+static bool realloc_in_context( dmheap_context_t* ctx, void* ptr, size_t alignment, size_t size, const char* module_name, void** out_ptr )
+{
+    if( ctx->shards == NULL )
+    {
+        context_lock( ctx );
+        bool found = realloc_in_context_locked( ctx, ptr, alignment, size, module_name, out_ptr );
+        context_unlock( ctx );
+        return found;
+    }
+
+    dmheap_context_t* shard = shard_of( ctx, ptr );
+    if( shard == NULL )
+    {
+        return false;
+    }
+    context_lock( shard );
+    block_t* block = find_block_by_address( shard, ptr );
+    if( block != NULL && alignment == 0 )
+    {
+        alignment = block_alignment( shard, block );
+    }
+    // Growth the shard's reserve refuses may still move to a shard with room.
+    bool resized = block != NULL && ((uintptr_t)ptr & (alignment - 1)) == 0 &&
+                   !reserve_denies_growth( shard, block, size, module_name ) &&
+                   shard->engine->resize( shard, block, resize_target( shard, block, size ) );
+    size_t old_size = block != NULL ? block->size : 0;
+    uint32_t hints = block != NULL ? block_hints( block ) : 0;
+    context_unlock( shard );
+    if( block == NULL || resized )
+    {
+        *out_ptr = resized ? ptr : NULL;
+        return block != NULL;
+    }
+
+    // Taking the new block from another shard may need that shard's lock, so the
+    // owning shard's lock is not held across the move.
+    *out_ptr = aligned_alloc_in_context( ctx, alignment, size, hints, module_name, NULL );
+    if( *out_ptr == NULL )
+    {
+        DMOD_LOG_ERROR("dmheap: Unable to grow allocation to %zu bytes for module %s.\n", size, module_name);
+        return true;
+    }
+    memcpy( *out_ptr, ptr, old_size < size ? old_size : size );
+    free_block_in_context( shard, ptr, false );
+    return true;
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, void*, _realloc, ( dmheap_context_t* ctx, void* ptr, size_t size, const char* module_name) )
+{
+    return dmheap_aligned_realloc( ctx, ptr, 0, size, module_name );
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, void*, _aligned_realloc, ( dmheap_context_t* ctx, void* ptr, size_t alignment, size_t size, const char* module_name) )
+{
+    if( (alignment & (alignment - 1)) != 0 )
+    {
+        DMOD_LOG_ERROR("dmheap: aligned_realloc called with alignment %zu, which is not a power of two.\n", alignment);
+        return NULL;
+    }
+    if( ptr == NULL )
+    {
+        return alignment == 0 ? dmheap_malloc( ctx, size, module_name ) : dmheap_aligned_alloc( ctx, alignment, size, module_name );
+    }
+
+    void* new_ptr = NULL;
+    if( ctx != NULL )
+    {
+        bool found = realloc_in_context( ctx, ptr, alignment, size, module_name, &new_ptr );
+        if( !found )
+        {
+            DMOD_LOG_ERROR("dmheap: _realloc called with invalid pointer %p from module %s.\n", ptr, module_name);
+        }
+        return new_ptr;
+    }
+
+    if( g_default_context_count == 0 )
+    {
+        DMOD_LOG_ERROR("dmheap: No context available for realloc.\n");
+        return NULL;
+    }
+
+    // ptr may have been handed out by any default heap (see dmheap_malloc) - find
+    // whichever one actually owns it.
+    for( int32_t i = (g_default_context_count - 1); i >= 0 ; i-- )
+    {
+        if( realloc_in_context( g_default_contexts[i], ptr, alignment, size, module_name, &new_ptr ) )
+        {
+            return new_ptr;
+        }
+    }
+
+    DMOD_LOG_ERROR("dmheap: _realloc called with invalid pointer %p from module %s.\n", ptr, module_name);
+    return NULL;
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, void , _free, ( dmheap_context_t* ctx, void* ptr, bool concatenate ) )
+{
+    if( ptr == NULL )
+    {
+        return;
+    }
+
+    if( ctx != NULL )
+    {
+        if( !free_block_in_context( ctx, ptr, concatenate ) )
+        {
+            DMOD_LOG_ERROR("dmheap: _free called with invalid pointer %p.\n", ptr);
+        }
+        return;
+    }
+
+    if( g_default_context_count == 0 )
+    {
+        DMOD_LOG_ERROR("dmheap: No context available for free.\n");
+        return;
+    }
+
+    // ptr may have been handed out by any default heap (see dmheap_malloc) - find
+    // whichever one actually owns it.
+    for( int32_t i = (g_default_context_count - 1); i >= 0; i-- )
+    {
+        if( free_block_in_context( g_default_contexts[i], ptr, concatenate ) )
+        {
+            return;
+        }
+    }
+
+    DMOD_LOG_ERROR("dmheap: _free called with invalid pointer %p.\n", ptr);
+}
+
+/**
+ * @brief Check whether an allocation sequence number was handed out at or after
+ * a checkpoint. Serial-number arithmetic, so it survives the counter wrapping.
+ */
+static inline bool seq_is_after( uint32_t seq, dmheap_checkpoint_t checkpoint )
+{
+    return (int32_t)(seq - checkpoint) >= 0;
+}
+
+/**
+ * @brief Free every block and large extent of a context allocated at or after a
+ * checkpoint. Caller must already hold the heap's critical section.
+ *
+ * @param ctx        Pointer to the heap context.
+ * @param checkpoint Value returned by dmheap_checkpoint().
+ *
+ * @return Number of allocations freed.
+ */
+static size_t rollback_locked( dmheap_context_t* ctx, dmheap_checkpoint_t checkpoint )
+{
+    size_t freed = 0;
+
+    large_region_t* large = ctx->large;
+    size_t i = 0;
+    while( large != NULL && i < large->extent_count )
+    {
+        if( large->extents[i].used && seq_is_after( large->extents[i].seq, checkpoint ) )
+        {
+            large_free_extent_locked( ctx, &large->extents[i] );
+            freed++;
+            // Freeing may have merged entry i into entry i-1 - look at it again.
+            i = i > 0 ? i - 1 : 0;
+        }
+        else
+        {
+            i++;
+        }
+    }
+
+    block_t* current = ctx->used_list;
+    block_t* prev = NULL;
+    while( current != NULL )
+    {
+        if( (current->flags & (BLOCK_FLAG_MODULE | BLOCK_FLAG_HISTORY)) == 0 && seq_is_after( current->seq, checkpoint ) )
+        {
+            block_t* to_free = current;
+            current = current->next;
+            used_list_unlink( ctx, prev, to_free );
+            ctx->counters.used_bytes -= to_free->size;
+            ctx->counters.used_blocks--;
+            ctx->counters.frees++;
+            module_uncharge( to_free->owner, to_free->size );
+            ctx->engine->free( ctx, to_free );
+            freed++;
+        }
+        else
+        {
+            prev = current;
+            current = current->next;
+        }
+    }
+
+    if( freed > 0 )
+    {
+        ctx->engine->maintain( ctx );
+    }
+    return freed;
+}
+
+/**
+ * @brief Roll back one heap context (every shard of a sharded one) under its lock.
+ *
+ * @param ctx        Pointer to the heap context.
+ * @param checkpoint Value returned by dmheap_checkpoint().
+ *
+ * @return Number of allocations freed.
+ */
+static size_t rollback_in_context( dmheap_context_t* ctx, dmheap_checkpoint_t checkpoint )
+{
+    if( ctx->shards != NULL )
+    {
+        size_t freed = 0;
+        for( size_t i = 0; i < ctx->shard_count; i++ )
+        {
+            freed += rollback_in_context( ctx->shards[i], checkpoint );
+        }
+        return freed;
+    }
+
+    context_lock( ctx );
+    size_t freed = rollback_locked( ctx, checkpoint );
+    context_unlock( ctx );
+    return freed;
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, dmheap_checkpoint_t, _checkpoint, ( dmheap_context_t* ctx ) )
+{
+    (void)ctx; // the sequence counter is shared, see g_alloc_seq
+    Dmod_EnterCritical();
+#if defined(__GNUC__)
+    dmheap_checkpoint_t checkpoint = __atomic_load_n( &g_alloc_seq, __ATOMIC_RELAXED );
+#else
+    dmheap_checkpoint_t checkpoint = g_alloc_seq;
+#endif
+    Dmod_ExitCritical();
+    return checkpoint;
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, size_t, _rollback, ( dmheap_context_t* ctx, dmheap_checkpoint_t checkpoint ) )
+{
+    size_t freed = 0;
+    if( ctx != NULL )
+    {
+        return rollback_in_context( ctx, checkpoint );
+    }
+
+    Dmod_EnterCritical();
+    for( int32_t i = (g_default_context_count - 1); i >= 0; i-- )
+    {
+        freed += rollback_in_context( g_default_contexts[i], checkpoint );
+    }
+    Dmod_ExitCritical();
+    return freed;
+}
+
+/**
+ * @brief Put a block on the used list, keeping the list sorted by address.
+ *
+ * @param ctx   Pointer to the heap context.
+ * @param block Block to keep.
+ */
+static void reset_keep_block( dmheap_context_t* ctx, block_t* block )
+{
+    block_t** link = &ctx->used_list;
+    while( *link != NULL && (uintptr_t)(*link)->address < (uintptr_t)block->address )
+    {
+        link = &(*link)->next;
+    }
+    block_set_next( block, *link );
+    *link = block;
+    ctx->counters.used_bytes += block->size;
+    ctx->counters.used_blocks++;
+    if( ctx->header_pool != NULL )
+    {
+        block->flags |= BLOCK_FLAG_KEEP;
+    }
+}
+
+/**
+ * @brief Drop every allocation of a heap context. Caller must hold the
+ * critical section.
+ *
+ * Nothing is walked per allocation: the used list is simply forgotten and the
+ * engine rebuilds its free space around the few blocks that survive - the
+ * history ring and, with keep_modules, the module records.
+ *
+ * @param ctx          Pointer to the heap context.
+ * @param keep_modules true to keep the registered modules (with their usage
+ *                     zeroed), false to drop them as well.
+ */
+static void reset_locked( dmheap_context_t* ctx, bool keep_modules )
+{
+    ctx->counters.frees += ctx->counters.used_blocks + ctx->counters.large_used_extents;
+    ctx->used_list = NULL;
+    walk_marks_drop( ctx );
+    ctx->counters.used_bytes  = 0;
+    ctx->counters.used_blocks = 0;
+    if( ctx->history_block != NULL )
+    {
+        reset_keep_block( ctx, ctx->history_block );
+    }
+    if( keep_modules )
+    {
+        for( module_t* module = ctx->module_list; module != NULL; module = module->next )
+        {
+            module->used_bytes      = 0;
+            module->used_blocks     = 0;
+            module->permanent_bytes = 0;
+            reset_keep_block( ctx, module->block );
+        }
+    }
+    else
+    {
+        ctx->module_list = NULL;
+    }
+    ctx->counters.frees -= ctx->counters.used_blocks;
+    // Detached modules went down with everything else.
+    ctx->pending_modules = NULL;
+    ctx->doomed_modules  = NULL;
+    ctx->sweep_prev      = NULL;
+    ctx->dead_records    = NULL;
+
+    // The header pool has no used/free marking of its own, so the spare list is
+    // relinked from scratch around the kept headers.
+    if( ctx->header_pool != NULL )
+    {
+        ctx->spare_headers = NULL;
+        for( size_t i = ctx->header_count; i > 0; i-- )
+        {
+            block_t* header = &ctx->header_pool[i - 1];
+            if( header->flags & BLOCK_FLAG_KEEP )
+            {
+                header->flags &= ~BLOCK_FLAG_KEEP;
+                continue;
+            }
+            header->address = NULL;
+            header->size    = 0;
+            header->flags   = 0;
+            header->next    = ctx->spare_headers;
+            ctx->spare_headers = header;
+        }
+    }
+
+    ctx->perm_floor += ctx->permanent_bytes;
+    ctx->permanent_bytes = 0;
+    ctx->engine->reset( ctx );
+    ctx->coalesce_position = NULL;
+    ctx->coalesce_slot     = 0;
+    ctx->coalesce_floor    = 0;
+    ctx->sweep_merge       = false;
+
+    large_region_t* large = ctx->large;
+    if( large != NULL )
+    {
+#if DMHEAP_LARGE_USE_MMAP
+        if( large->pages_start == NULL )
+        {
+            for( size_t i = 0; i < large->extent_count; i++ )
+            {
+                munmap( large->extents[i].address, large->extents[i].pages * DMHEAP_LARGE_PAGE_SIZE );
+            }
+            large->extent_count = 0;
+        }
+        else
+#endif
+        {
+            large->extent_count = 1;
+            large->extents[0].address = large->pages_start;
+            large->extents[0].pages   = large->page_count;
+            large->extents[0].owner   = NULL;
+            large->extents[0].seq     = 0;
+            large->extents[0].used    = false;
+            large->extents[0].zeroed  = false;
+        }
+        large_recount( ctx );
+    }
+}
+
+/**
+ * @brief Reset one heap context (every shard of a sharded one) under its lock.
+ *
+ * @param ctx          Pointer to the heap context.
+ * @param keep_modules Passed to reset_locked().
+ */
+static void reset_in_context( dmheap_context_t* ctx, bool keep_modules )
+{
+    if( ctx->shards != NULL )
+    {
+        for( size_t i = 0; i < ctx->shard_count; i++ )
+        {
+            reset_in_context( ctx->shards[i], keep_modules );
+        }
+        return;
+    }
+
+    context_lock( ctx );
+    reset_locked( ctx, keep_modules );
+    context_unlock( ctx );
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, bool, _reset, ( dmheap_context_t* ctx, bool keep_modules ) )
+{
+    if( ctx == NULL )
+    {
+        DMOD_LOG_ERROR("dmheap: reset called with invalid parameters.\n");
+        return false;
+    }
+
+    reset_in_context( ctx, keep_modules );
+    return true;
+}
+
+/**
+ * @brief Run engine housekeeping on one heap context (every shard of a sharded one).
+ *
+ * @param ctx Pointer to the heap context.
+ */
+static void maintain_in_context( dmheap_context_t* ctx )
+{
+    if( ctx->shards != NULL )
+    {
+        for( size_t i = 0; i < ctx->shard_count; i++ )
+        {
+            maintain_in_context( ctx->shards[i] );
+        }
+        return;
+    }
+
+    context_lock( ctx );
+    ctx->engine->maintain( ctx );
+    context_unlock( ctx );
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, void , _concatenate_free_blocks, ( dmheap_context_t* ctx ) )
+{
+    if( ctx != NULL )
+    {
+        maintain_in_context( ctx );
+        return;
+    }
+
+    if( g_default_context_count == 0 )
+    {
+        DMOD_LOG_ERROR("dmheap: No context available for concatenate_free_blocks.\n");
+        return;
+    }
+
+    for( int32_t i = (g_default_context_count - 1); i >= 0; i-- )
+    {
+        maintain_in_context( g_default_contexts[i] );
+    }
+}
+
+/**
+ * @brief Result of attempting to retag a pointer against a single heap context.
+ */
+typedef enum retag_result_t
+{
+    RETAG_NOT_FOUND,    //!< ptr does not belong to this context.
+    RETAG_FAILED,       //!< ptr belongs to this context, but the target module could not be created.
+    RETAG_OK,           //!< ptr was found and retagged successfully.
+} retag_result_t;
+
+/**
+ * @brief Retag a block if it belongs to the given, already-resolved heap context.
+ *
+ * @param ctx             Pointer to the heap context to search (must not be NULL).
+ * @param ptr             Pointer previously returned by an allocation function.
+ * @param new_module_name Name of the module to attribute the block to from now on.
+ */
+static retag_result_t retag_block_in_context( dmheap_context_t* ctx, void* ptr, const char* new_module_name )
+{
+    if( ctx->shards != NULL )
+    {
+        dmheap_context_t* shard = shard_of( ctx, ptr );
+        return shard != NULL ? retag_block_in_context( shard, ptr, new_module_name ) : RETAG_NOT_FOUND;
+    }
+
+    context_lock( ctx );
+    block_t* block = find_block_by_address( ctx, ptr );
+    if( block == NULL && large_find_extent( ctx, ptr ) == NULL )
+    {
+        context_unlock( ctx );
+        return RETAG_NOT_FOUND;
+    }
+
+    module_t* module = get_or_create_module( ctx, new_module_name );
+    if( module == NULL )
+    {
+        context_unlock( ctx );
+        return RETAG_FAILED;
+    }
+
+    if( block != NULL )
+    {
+        module_uncharge( block->owner, block->size );
+        block->owner = module;
+        module_charge( module, block->size );
+    }
+    else
+    {
+        large_extent_t* extent = large_find_extent( ctx, ptr );
+        module_uncharge( extent->owner, extent->pages * DMHEAP_LARGE_PAGE_SIZE );
+        extent->owner = module;
+        module_charge( module, extent->pages * DMHEAP_LARGE_PAGE_SIZE );
+    }
+    context_unlock( ctx );
+    return RETAG_OK;
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, bool, _retag, ( dmheap_context_t* ctx, void* ptr, const char* new_module_name ) )
+{
+    if( ptr == NULL || new_module_name == NULL )
+    {
+        DMOD_LOG_ERROR("dmheap: retag called with invalid arguments.\n");
+        return false;
+    }
+
+    if( ctx != NULL )
+    {
+        retag_result_t result = retag_block_in_context( ctx, ptr, new_module_name );
+        if( result == RETAG_NOT_FOUND )
+        {
+            DMOD_LOG_ERROR("dmheap: retag called with unknown pointer %p.\n", ptr);
+        }
+        else if( result == RETAG_FAILED )
+        {
+            DMOD_LOG_ERROR("dmheap: Unable to retag %p - failed to get/create module %s.\n", ptr, new_module_name);
+        }
+        return result == RETAG_OK;
+    }
+
+    if( g_default_context_count == 0 )
+    {
+        DMOD_LOG_ERROR("dmheap: No context available for retag.\n");
+        return false;
+    }
+
+    // ptr may have been handed out by any default heap (see dmheap_malloc) - find
+    // whichever one actually owns it.
+    for( int32_t i = (g_default_context_count - 1); i >= 0; i-- )
+    {
+        retag_result_t result = retag_block_in_context( g_default_contexts[i], ptr, new_module_name );
+        if( result == RETAG_OK )
+        {
+            return true;
+        }
+        if( result == RETAG_FAILED )
+        {
+            DMOD_LOG_ERROR("dmheap: Unable to retag %p - failed to get/create module %s.\n", ptr, new_module_name);
+            return false;
+        }
+        // RETAG_NOT_FOUND: keep searching the remaining default heaps.
+    }
+
+    DMOD_LOG_ERROR("dmheap: retag called with unknown pointer %p.\n", ptr);
+    return false;
+}
+
+/**
+ * @brief Add one heap's high-water marks to a running statistics total.
+ *
+ * Peaks of separate heaps are reached at different times, so the sums are an
+ * upper bound, and the combined minimum largest free block (the biggest of
+ * the heaps' minima) is a lower bound.
+ *
+ * @param peaks     The heap's high-water marks.
+ * @param out_stats Statistics accumulator, updated in place.
+ */
+static void accumulate_peaks( const heap_peaks_t* peaks, dmheap_stats_t* out_stats )
+{
+    out_stats->peak_used_bytes       += peaks->used_bytes;
+    out_stats->peak_used_block_count += peaks->used_blocks;
+    out_stats->peak_reserve_used_bytes += peaks->reserve_used;
+    if( peaks->min_largest_free > out_stats->min_largest_free_block )
+    {
+        out_stats->min_largest_free_block = peaks->min_largest_free;
+    }
+}
+
+/**
+ * @brief Accumulate the parts of one heap context's statistics that need no
+ * walk of its block lists (peaks, permanent region, reserve, large extents)
+ * into a running total. Caller must already hold the heap's critical section.
+ *
+ * @param ctx       Pointer to the heap context.
+ * @param out_stats Statistics accumulator, updated in place.
+ */
+static void accumulate_totals_locked( dmheap_context_t* ctx, dmheap_stats_t* out_stats )
+{
+    accumulate_peaks( &ctx->peaks, out_stats );
+    out_stats->heap_size += ctx->heap_size;
+    out_stats->used_bytes += ctx->permanent_bytes;
+    out_stats->permanent_bytes += ctx->permanent_bytes;
+    out_stats->reserve_bytes += ctx->reserve_bytes;
+    out_stats->reserve_used_bytes += reserve_used( ctx->reserve_bytes, ctx->counters.free_bytes );
+
+    large_region_t* large = ctx->large;
+    for( size_t i = 0; large != NULL && i < large->extent_count; i++ )
+    {
+        size_t bytes = large->extents[i].pages * DMHEAP_LARGE_PAGE_SIZE;
+        if( large->extents[i].used )
+        {
+            out_stats->used_bytes += bytes;
+            out_stats->used_block_count++;
+            out_stats->large_used_bytes += bytes;
+            continue;
+        }
+        out_stats->free_bytes += bytes;
+        out_stats->free_block_count++;
+        out_stats->large_free_bytes += bytes;
+        if( out_stats->largest_free_block == 0 || bytes > out_stats->largest_free_block )
+        {
+            out_stats->largest_free_block = bytes;
+        }
+        if( out_stats->smallest_free_block == 0 || bytes < out_stats->smallest_free_block )
+        {
+            out_stats->smallest_free_block = bytes;
+        }
+    }
+}
+
+/**
+ * @brief Accumulate one heap context's statistics into a running total. Caller
+ * must already hold the heap's critical section.
+ *
+ * @param ctx       Pointer to the heap context.
+ * @param out_stats Statistics accumulator, updated in place.
+ */
+static void accumulate_stats_locked( dmheap_context_t* ctx, dmheap_stats_t* out_stats )
+{
+    accumulate_totals_locked( ctx, out_stats );
+    ctx->engine->stats( ctx, out_stats );
+
+    for( block_t* block = ctx->used_list; block != NULL; block = block->next )
+    {
+        out_stats->used_bytes += block->size;
+        out_stats->used_block_count++;
+    }
+}
+
+/**
+ * @brief Accumulate one heap context's statistics (every shard of a sharded one)
+ * under its lock.
+ *
+ * @param ctx       Pointer to the heap context.
+ * @param out_stats Statistics accumulator, updated in place.
+ */
+static void accumulate_stats_in_context( dmheap_context_t* ctx, dmheap_stats_t* out_stats )
+{
+    if( ctx->shards != NULL )
+    {
+        for( size_t i = 0; i < ctx->shard_count; i++ )
+        {
+            accumulate_stats_in_context( ctx->shards[i], out_stats );
+        }
+        return;
+    }
+
+    context_lock( ctx );
+    accumulate_stats_locked( ctx, out_stats );
+    context_unlock( ctx );
+}
+
+/**
+ * @brief Restart the high-water marks of one heap context (every shard of a
+ * sharded one) under its lock.
+ *
+ * @param ctx Pointer to the heap context.
+ */
+static void reset_peaks_in_context( dmheap_context_t* ctx )
+{
+    if( ctx->shards != NULL )
+    {
+        for( size_t i = 0; i < ctx->shard_count; i++ )
+        {
+            reset_peaks_in_context( ctx->shards[i] );
+        }
+        return;
+    }
+
+    context_lock( ctx );
+    reset_peaks_locked( ctx );
+    context_unlock( ctx );
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, void, _reset_peaks, ( dmheap_context_t* ctx ) )
+{
+    if( ctx != NULL )
+    {
+        reset_peaks_in_context( ctx );
+        return;
+    }
+
+    Dmod_EnterCritical();
+    for( size_t i = 0; i < g_default_context_count; i++ )
+    {
+        reset_peaks_in_context( g_default_contexts[i] );
+    }
+    Dmod_ExitCritical();
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, bool, _get_stats, ( dmheap_context_t* ctx, dmheap_stats_t* out_stats ) )
+{
+    if( out_stats == NULL )
+    {
+        DMOD_LOG_ERROR("dmheap: get_stats called with invalid arguments.\n");
+        return false;
+    }
+
+    memset( out_stats, 0, sizeof(*out_stats) );
+
+    if( ctx != NULL )
+    {
+        accumulate_stats_in_context( ctx, out_stats );
+        return true;
+    }
+
+    if( g_default_context_count == 0 )
+    {
+        DMOD_LOG_ERROR("dmheap: get_stats called with invalid arguments.\n");
+        return false;
+    }
+
+    // Aggregate across every default heap.
+    Dmod_EnterCritical();
+    for( int32_t i = (g_default_context_count - 1); i >= 0; i-- )
+    {
+        accumulate_stats_in_context( g_default_contexts[i], out_stats );
+    }
+    Dmod_ExitCritical();
+    return true;
+}
+
+/**
+ * @brief Read one heap's running statistics through its sequence lock and add
+ * them to a running total. Takes no lock.
+ *
+ * @param ctx       Pointer to the heap context.
+ * @param out_stats Statistics accumulator, updated in place.
+ *
+ * @return true if a consistent snapshot was read, false after DMHEAP_STATS_READ_ATTEMPTS torn reads.
+ */
+static bool peek_stats( dmheap_context_t* ctx, dmheap_stats_t* out_stats )
+{
+    if( ctx->shards != NULL )
+    {
+        // Each shard is consistent on its own; together they are read one after another.
+        for( size_t i = 0; i < ctx->shard_count; i++ )
+        {
+            if( !peek_stats( ctx->shards[i], out_stats ) )
+            {
+                return false;
             }
-            add_free_block( &ctx->free_list, to_free );
         }
-        else
+        return true;
+    }
+
+    for( int attempt = 0; attempt < DMHEAP_STATS_READ_ATTEMPTS; attempt++ )
+    {
+#if defined(__GNUC__)
+        uint32_t seq = __atomic_load_n( &ctx->stats_seq, __ATOMIC_ACQUIRE );
+#else
+        uint32_t seq = ((volatile dmheap_context_t*)ctx)->stats_seq;
+#endif
+        if( seq & 1u )
         {
-            prev = current;
-            current = current->next;
+            continue;
         }
+        heap_counters_t counters = *(volatile heap_counters_t*)&ctx->counters;
+        heap_peaks_t peaks = *(volatile heap_peaks_t*)&ctx->peaks;
+        size_t permanent_bytes = *(volatile size_t*)&ctx->permanent_bytes;
+        size_t reserve_bytes = *(volatile size_t*)&ctx->reserve_bytes;
+#if defined(__GNUC__)
+        __atomic_thread_fence( __ATOMIC_ACQUIRE );
+        if( __atomic_load_n( &ctx->stats_seq, __ATOMIC_RELAXED ) != seq )
+#else
+        if( ((volatile dmheap_context_t*)ctx)->stats_seq != seq )
+#endif
+        {
+            continue;
+        }
+
+        out_stats->heap_size        += ctx->heap_size;
+        out_stats->used_bytes       += counters.used_bytes + counters.large_used_bytes + permanent_bytes;
+        out_stats->used_block_count += counters.used_blocks + counters.large_used_extents;
+        out_stats->free_bytes       += counters.free_bytes + counters.large_free_bytes;
+        out_stats->free_block_count += counters.free_blocks + counters.large_free_extents;
+        out_stats->large_used_bytes += counters.large_used_bytes;
+        out_stats->large_free_bytes += counters.large_free_bytes;
+        out_stats->permanent_bytes  += permanent_bytes;
+        out_stats->reserve_bytes    += reserve_bytes;
+        out_stats->reserve_used_bytes += reserve_used( reserve_bytes, counters.free_bytes );
+        accumulate_peaks( &peaks, out_stats );
+        return true;
     }
+    return false;
 }
 
-/**
- * @brief Delete a registered module and free its memory.
- * 
- * @param ctx    Pointer to the heap context.
- * @param module Pointer to the module to be deleted.
- */
-static void delete_module( dmheap_context_t* ctx, module_t* module )
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, bool, _peek_stats, ( dmheap_context_t* ctx, dmheap_stats_t* out_stats ) )
 {
-    if( module == NULL )
+    if( out_stats == NULL || (ctx == NULL && g_default_context_count == 0) )
     {
-        return;
+        DMOD_LOG_ERROR("dmheap: peek_stats called with invalid arguments.\n");
+        return false;
     }
 
-    release_memory_of_module( ctx, module );
-    remove_module_from_list( &ctx->module_list, module );
+    memset( out_stats, 0, sizeof(*out_stats) );
+    if( ctx != NULL )
+    {
+        return peek_stats( ctx, out_stats );
+    }
 
-    block_t* block = find_block_by_address( ctx, (void*)module );
-    if( block != NULL )
+    // Sums every default heap; each one is consistent on its own, but they are
+    // read one after another, not as a single snapshot.
+    for( int32_t i = (g_default_context_count - 1); i >= 0; i-- )
     {
-        remove_block( &ctx->used_list, block );
-        add_free_block( &ctx->free_list, block );
+        if( !peek_stats( g_default_contexts[i], out_stats ) )
+        {
+            return false;
+        }
     }
+    return true;
 }
 
 /**
- * @brief Get or create a module by its name.
- * 
+ * @brief Accumulate one module's usage on one heap context into a running total.
+ * Caller must already hold the heap's critical section.
+ *
  * @param ctx         Pointer to the heap context.
  * @param module_name Name of the module.
- * 
- * @return Pointer to the module_t structure.
+ * @param out_stats   Statistics accumulator, updated in place.
+ *
+ * @return true if the module is registered on ctx, false otherwise.
  */
-static module_t* get_or_create_module( dmheap_context_t* ctx, const char* module_name )
+static bool accumulate_module_stats_locked( dmheap_context_t* ctx, const char* module_name, dmheap_module_stats_t* out_stats )
 {
     module_t* module = find_module_by_name( ctx, module_name );
     if( module == NULL )
     {
-        module = create_module( ctx, module_name );
+        return false;
     }
-    return module;
-}
 
-DMOD_INPUT_API_DECLARATION( dmheap, 1.0, dmheap_context_t*,  _init, ( void* buffer, size_t size, size_t alignment ) )
-{
-    if(buffer == NULL || size == 0)
-    {
-        DMOD_LOG_ERROR("dmheap: _init called with invalid parameters.\n");
-        return NULL;
-    }
-    
-    // Check buffer alignment for context structure
-    if(((uintptr_t)buffer % sizeof(void*)) != 0)
+    for( block_t* block = ctx->used_list; block != NULL; block = block->next )
     {
-        DMOD_LOG_ERROR("dmheap: buffer is not properly aligned (must be aligned to pointer size).\n");
-        return NULL;
+        if( block->owner == module )
+        {
+            out_stats->used_bytes += block->size;
+            out_stats->used_block_count++;
+        }
     }
-    
-    // The context structure is stored at the beginning of the buffer
-    // Align context size to ensure heap starts at a proper boundary
-    size_t context_size = align_size(sizeof(dmheap_context_t), alignment > sizeof(void*) ? alignment : sizeof(void*));
-    if(size < context_size + sizeof(block_t) + alignment)
+
+    large_region_t* large = ctx->large;
+    for( size_t i = 0; large != NULL && i < large->extent_count; i++ )
     {
-        DMOD_LOG_ERROR("dmheap: buffer too small for context and minimum allocation.\n");
-        return NULL;
+        if( large->extents[i].used && large->extents[i].owner == module )
+        {
+            out_stats->used_bytes += large->extents[i].pages * DMHEAP_LARGE_PAGE_SIZE;
+            out_stats->used_block_count++;
+        }
     }
-    
-    Dmod_EnterCritical();
-    dmheap_context_t* ctx = (dmheap_context_t*)buffer;
-    
-    // Calculate the start of the heap (after the aligned context structure)
-    void* heap_buffer = (void*)((uintptr_t)buffer + context_size);
-    size_t heap_size = size - context_size;
-    
-    ctx->heap_start = heap_buffer;
-    ctx->heap_size  = heap_size;
-    ctx->free_list  = create_block( heap_buffer, heap_size );
-    ctx->used_list  = NULL;
-    ctx->alignment  = alignment;
-    ctx->module_list = NULL;  // Reset module list on initialization
-    ctx->name[0] = '\0';      // No name assigned until dmheap_set_context_name() is called
-
-    add_default_context_locked( ctx );
 
-    Dmod_ExitCritical();
-    DMOD_LOG_INFO("== dmheap ver. %s ==\n", DMHEAP_VERSION);
-    DMOD_LOG_INFO("dmheap: Initialized with buffer %p of size %lu.\n", heap_buffer, (unsigned long)heap_size);
-    return ctx;
+    out_stats->permanent_bytes += module->permanent_bytes;
+    out_stats->peak_used_bytes += module->peak_used_bytes;
+    out_stats->peak_used_block_count += module->peak_used_blocks;
+    return true;
 }
 
-DMOD_INPUT_API_DECLARATION( dmheap, 1.0, bool,  _set_context_name, ( dmheap_context_t* ctx, const char* name ) )
+/**
+ * @brief Accumulate one module's usage on one heap context (every shard of a
+ * sharded one) under its lock.
+ *
+ * @param ctx         Pointer to the heap context.
+ * @param module_name Name of the module.
+ * @param out_stats   Statistics accumulator, updated in place.
+ *
+ * @return true if the module is registered on ctx (any shard), false otherwise.
+ */
+static bool accumulate_module_stats_in_context( dmheap_context_t* ctx, const char* module_name, dmheap_module_stats_t* out_stats )
 {
-    if( ctx == NULL )
+    if( ctx->shards != NULL )
     {
-        DMOD_LOG_ERROR("dmheap: set_context_name called with NULL context.\n");
-        return false;
+        bool found = false;
+        for( size_t i = 0; i < ctx->shard_count; i++ )
+        {
+            if( accumulate_module_stats_in_context( ctx->shards[i], module_name, out_stats ) )
+            {
+                found = true;
+            }
+        }
+        return found;
     }
 
-    Dmod_EnterCritical();
-    if( name != NULL )
-    {
-        strncpy( ctx->name, name, sizeof(ctx->name) - 1 );
-        ctx->name[sizeof(ctx->name) - 1] = '\0';
-    }
-    else
-    {
-        ctx->name[0] = '\0';
-    }
-    Dmod_ExitCritical();
-    return true;
+    context_lock( ctx );
+    bool found = accumulate_module_stats_locked( ctx, module_name, out_stats );
+    context_unlock( ctx );
+    return found;
 }
 
-DMOD_INPUT_API_DECLARATION( dmheap, 1.0, const char*,  _get_context_name, ( dmheap_context_t* ctx ) )
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, bool, _get_module_stats, ( dmheap_context_t* ctx, const char* module_name, dmheap_module_stats_t* out_stats ) )
 {
-    if( ctx == NULL )
+    if( module_name == NULL || out_stats == NULL )
     {
-        ctx = g_default_context_count > 0 ? g_default_contexts[0] : NULL;
+        DMOD_LOG_ERROR("dmheap: get_module_stats called with invalid arguments.\n");
+        return false;
     }
-    return ctx != NULL ? ctx->name : "";
-}
 
-DMOD_INPUT_API_DECLARATION( dmheap, 1.0, void,  _set_default_context, ( dmheap_context_t* ctx ) )
-{
-    Dmod_EnterCritical();
-    g_default_context_count = 0;
+    memset( out_stats, 0, sizeof(*out_stats) );
+
     if( ctx != NULL )
     {
-        add_default_context_locked( ctx );
+        return accumulate_module_stats_in_context( ctx, module_name, out_stats );
     }
-    Dmod_ExitCritical();
-}
-
-DMOD_INPUT_API_DECLARATION( dmheap, 1.0, bool,  _add_default_context, ( dmheap_context_t* ctx ) )
-{
-    Dmod_EnterCritical();
-    bool added = add_default_context_locked( ctx );
-    Dmod_ExitCritical();
-    return added;
-}
 
-DMOD_INPUT_API_DECLARATION( dmheap, 1.0, bool,  _remove_default_context, ( dmheap_context_t* ctx ) )
-{
+    // Aggregate across every default heap the module is registered on.
+    bool found = false;
     Dmod_EnterCritical();
-    bool removed = remove_default_context_locked( ctx );
+    for( int32_t i = (g_default_context_count - 1); i >= 0; i-- )
+    {
+        if( accumulate_module_stats_in_context( g_default_contexts[i], module_name, out_stats ) )
+        {
+            found = true;
+        }
+    }
     Dmod_ExitCritical();
-    return removed;
+    return found;
 }
 
-DMOD_INPUT_API_DECLARATION( dmheap, 1.0, dmheap_context_t*,  _get_default_context, ( void ) )
+/**
+ * @brief Visit the modules of one heap context (every shard of a sharded one)
+ * under its lock.
+ *
+ * @param ctx       Pointer to the heap context.
+ * @param visitor   Called once per module.
+ * @param user_data Passed through to each visitor call.
+ */
+static void visit_modules_in_context( dmheap_context_t* ctx, dmheap_module_visitor_t visitor, void* user_data )
 {
-    return g_default_context_count > 0 ? g_default_contexts[0] : NULL;
-}
+    if( ctx->shards != NULL )
+    {
+        for( size_t i = 0; i < ctx->shard_count; i++ )
+        {
+            visit_modules_in_context( ctx->shards[i], visitor, user_data );
+        }
+        return;
+    }
 
-DMOD_INPUT_API_DECLARATION( dmheap, 1.0, size_t,  _get_default_context_count, ( void ) )
-{
-    return g_default_context_count;
+    context_lock( ctx );
+    for( module_t* module = ctx->module_list; module != NULL; module = module->next )
+    {
+        dmheap_module_stats_t stats;
+        stats.used_bytes            = module->used_bytes;
+        stats.used_block_count      = module->used_blocks;
+        stats.permanent_bytes       = module->permanent_bytes;
+        stats.peak_used_bytes       = module->peak_used_bytes;
+        stats.peak_used_block_count = module->peak_used_blocks;
+        visitor( module->name, &stats, user_data );
+    }
+    context_unlock( ctx );
 }
 
-DMOD_INPUT_API_DECLARATION( dmheap, 1.0, dmheap_context_t*,  _get_default_context_at, ( size_t index ) )
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, void, _for_each_module, ( dmheap_context_t* ctx, dmheap_module_visitor_t visitor, void* user_data ) )
 {
-    return index < g_default_context_count ? g_default_contexts[index] : NULL;
-}
+    if( visitor == NULL )
+    {
+        return;
+    }
 
-DMOD_INPUT_API_DECLARATION( dmheap, 1.0, dmheap_context_t*,  _get_context_by_name, ( const char* name ) )
-{
-    if( name == NULL )
+    if( ctx != NULL )
     {
-        return NULL;
+        visit_modules_in_context( ctx, visitor, user_data );
+        return;
     }
 
-    dmheap_context_t* found = NULL;
     Dmod_EnterCritical();
     for( size_t i = 0; i < g_default_context_count; i++ )
     {
-        if( g_default_contexts[i]->name[0] != '\0' &&
-            strncmp( g_default_contexts[i]->name, name, DMOD_MAX_MODULE_NAME_LENGTH ) == 0 )
-        {
-            found = g_default_contexts[i];
-            break;
-        }
+        visit_modules_in_context( g_default_contexts[i], visitor, user_data );
     }
     Dmod_ExitCritical();
-    return found;
 }
 
-DMOD_INPUT_API_DECLARATION( dmheap, 1.0, bool,  _is_initialized, ( dmheap_context_t* ctx ) )
+/**
+ * @brief Add one request histogram to a running total.
+ *
+ * @param total     Histogram accumulator, updated in place.
+ * @param histogram Histogram to add.
+ */
+static void add_request_histogram( dmheap_request_histogram_t* total, const dmheap_request_histogram_t* histogram )
 {
-    if( ctx != NULL )
+    for( size_t i = 0; i < DMHEAP_REQUEST_SIZE_BUCKETS; i++ )
     {
-        return ctx->heap_start != NULL;
+        total->size[i] += histogram->size[i];
     }
-    return g_default_context_count > 0;
+    for( size_t i = 0; i < DMHEAP_REQUEST_ALIGN_BUCKETS; i++ )
+    {
+        total->alignment[i] += histogram->alignment[i];
+    }
+    total->requests += histogram->requests;
 }
 
 /**
- * @brief Register a module on a single, already-resolved heap context.
+ * @brief Add up the request histograms of one heap context (every shard of a
+ * sharded one) under its lock.
  *
- * @param ctx         Pointer to the heap context (must not be NULL).
- * @param module_name Name of the module to register.
+ * @param ctx           Pointer to the heap context.
+ * @param module_name   Name of the module, or NULL for every histogram.
+ * @param out_histogram Histogram accumulator, updated in place.
  *
- * @return true if the module is registered (either just now or already), false on failure.
+ * @return true if ctx keeps histograms and the module is registered on it.
  */
-static bool register_module_in_context( dmheap_context_t* ctx, const char* module_name )
+static bool accumulate_requests_in_context( dmheap_context_t* ctx, const char* module_name, dmheap_request_histogram_t* out_histogram )
 {
-    Dmod_EnterCritical();
-    module_t* module = find_module_by_name( ctx, module_name );
-    if( module != NULL )
+    if( ctx->shards != NULL )
     {
-        Dmod_ExitCritical();
-        DMOD_LOG_WARN("dmheap: Module %s is already registered.\n", module_name);
-        return true;
+        bool found = false;
+        for( size_t i = 0; i < ctx->shard_count; i++ )
+        {
+            if( accumulate_requests_in_context( ctx->shards[i], module_name, out_histogram ) )
+            {
+                found = true;
+            }
+        }
+        return found;
     }
-    module = create_module( ctx, module_name );
-    Dmod_ExitCritical();
-    if( module == NULL )
+    if( (ctx->flags & DMHEAP_REQUEST_HISTOGRAM) == 0 )
     {
-        DMOD_LOG_ERROR("dmheap: Failed to register module %s.\n", module_name);
         return false;
     }
-    DMOD_LOG_INFO("dmheap: Module %s registered successfully.\n", module_name);
-    return true;
+
+    context_lock( ctx );
+    bool found = module_name == NULL;
+    if( module_name == NULL )
+    {
+        add_request_histogram( out_histogram, &ctx->untracked_requests );
+    }
+    for( module_t* module = ctx->module_list; module != NULL; module = module->next )
+    {
+        if( module_name == NULL || strncmp( module->name, module_name, DMOD_MAX_MODULE_NAME_LENGTH ) == 0 )
+        {
+            add_request_histogram( out_histogram, module->requests );
+            found = true;
+        }
+    }
+    context_unlock( ctx );
+    return found;
 }
 
-DMOD_INPUT_API_DECLARATION( dmheap, 1.0, bool,  _register_module, ( dmheap_context_t* ctx, const char* module_name ) )
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, bool, _get_request_histogram, ( dmheap_context_t* ctx, const char* module_name, dmheap_request_histogram_t* out_histogram ) )
 {
-    if( ctx != NULL )
+    if( out_histogram == NULL )
     {
-        return register_module_in_context( ctx, module_name );
+        DMOD_LOG_ERROR("dmheap: get_request_histogram called with invalid arguments.\n");
+        return false;
     }
 
-    if( g_default_context_count == 0 )
+    memset( out_histogram, 0, sizeof(*out_histogram) );
+
+    if( ctx != NULL )
     {
-        DMOD_LOG_ERROR("dmheap: No context available for register_module.\n");
-        return false;
+        return accumulate_requests_in_context( ctx, module_name, out_histogram );
     }
 
-    // A NULL context registers the module on every default heap, since a later
-    // allocation with a NULL context (see dmheap_malloc) may land on any of them.
-    bool all_succeeded = true;
-    for( size_t i = 0; i < g_default_context_count; i++ )
+    bool found = false;
+    Dmod_EnterCritical();
+    for( int32_t i = (g_default_context_count - 1); i >= 0; i-- )
     {
-        if( !register_module_in_context( g_default_contexts[i], module_name ) )
+        if( accumulate_requests_in_context( g_default_contexts[i], module_name, out_histogram ) )
         {
-            all_succeeded = false;
+            found = true;
         }
     }
-    return all_succeeded;
+    Dmod_ExitCritical();
+    return found;
 }
 
 /**
- * @brief Unregister a module (if present) on a single, already-resolved heap context.
+ * @brief Visit the request histograms of one heap context (every shard of a
+ * sharded one) under its lock.
  *
- * @param ctx         Pointer to the heap context (must not be NULL).
- * @param module_name Name of the module to unregister.
+ * @param ctx       Pointer to the heap context.
+ * @param visitor   Called once per histogram.
+ * @param user_data Passed through to each visitor call.
  */
-static void unregister_module_in_context( dmheap_context_t* ctx, const char* module_name )
+static void visit_requests_in_context( dmheap_context_t* ctx, dmheap_request_visitor_t visitor, void* user_data )
 {
-    Dmod_EnterCritical();
-    module_t* module = find_module_by_name( ctx, module_name );
-    if( module == NULL )
+    if( ctx->shards != NULL )
+    {
+        for( size_t i = 0; i < ctx->shard_count; i++ )
+        {
+            visit_requests_in_context( ctx->shards[i], visitor, user_data );
+        }
+        return;
+    }
+    if( (ctx->flags & DMHEAP_REQUEST_HISTOGRAM) == 0 )
     {
-        Dmod_ExitCritical();
         return;
     }
-    delete_module( ctx, module );
-    // Coalesce right away: a module's freed blocks otherwise sit as isolated,
-    // module-shaped fragments that a differently-sized/aligned future allocation
-    // can't reuse, permanently eating into the largest contiguous free region one
-    // load/unload cycle at a time (see Dmod_Context_Delete for the same reasoning).
-    concatenate_free_blocks_locked( ctx );
-    Dmod_ExitCritical();
-    DMOD_LOG_INFO("dmheap: Module %s unregistered successfully.\n", module_name);
+
+    context_lock( ctx );
+    visitor( NULL, &ctx->untracked_requests, user_data );
+    for( module_t* module = ctx->module_list; module != NULL; module = module->next )
+    {
+        visitor( module->name, module->requests, user_data );
+    }
+    context_unlock( ctx );
 }
 
-DMOD_INPUT_API_DECLARATION( dmheap, 1.0, void,  _unregister_module, ( dmheap_context_t* ctx, const char* module_name ) )
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, void, _for_each_request_histogram, ( dmheap_context_t* ctx, dmheap_request_visitor_t visitor, void* user_data ) )
 {
-    // it is very likely, that module_name is inside a buffer we will free, so we need to copy it first
-    char module_name_copy[DMOD_MAX_MODULE_NAME_LENGTH];
-    strncpy( module_name_copy, module_name, DMOD_MAX_MODULE_NAME_LENGTH - 1 );
-    module_name_copy[DMOD_MAX_MODULE_NAME_LENGTH - 1] = '\0';
-
-    if( ctx != NULL )
+    if( visitor == NULL )
     {
-        unregister_module_in_context( ctx, module_name_copy );
         return;
     }
 
-    if( g_default_context_count == 0 )
+    if( ctx != NULL )
     {
-        DMOD_LOG_ERROR("dmheap: No context available for unregister_module.\n");
+        visit_requests_in_context( ctx, visitor, user_data );
         return;
     }
 
-    // A module registered with a NULL context may have ended up with blocks on any
-    // default heap (see dmheap_malloc) - unregister it everywhere so nothing leaks.
-    for( size_t i = 0; i < g_default_context_count; i++ )
+    Dmod_EnterCritical();
+    for( int32_t i = (g_default_context_count - 1); i >= 0; i-- )
     {
-        unregister_module_in_context( g_default_contexts[i], module_name_copy );
+        visit_requests_in_context( g_default_contexts[i], visitor, user_data );
     }
+    Dmod_ExitCritical();
 }
 
 /**
- * @brief Allocate aligned memory from a single, already-resolved heap context.
+ * @brief Clear the request histograms of one heap context (every shard of a
+ * sharded one) under its lock.
  *
- * This is the core allocation algorithm, factored out so it can be reused both
- * for an explicit context and, per-heap, when searching the default heap list.
- *
- * @param ctx         Pointer to the heap context (must not be NULL).
- * @param alignment   Alignment requirement.
- * @param size        Size of memory to allocate.
- * @param module_name Name of the module requesting allocation, recorded as the
- *                    block's owner on success. Failures are not logged here -
- *                    only the caller knows whether this is a final failure or
- *                    one heap out of several being tried in a default-heap
- *                    fallback search, so it logs (or not) accordingly.
- *
- * @return Pointer to the allocated memory, or NULL if allocation fails.
+ * @param ctx Pointer to the heap context.
  */
-static void* aligned_alloc_in_context( dmheap_context_t* ctx, size_t alignment, size_t size, const char* module_name )
+static void reset_requests_in_context( dmheap_context_t* ctx )
 {
-    Dmod_EnterCritical();
-    size_t aligned_size = align_size( size, alignment );
-    block_t* block = find_suitable_block( ctx, aligned_size, alignment );
-    if( block == NULL )
+    if( ctx->shards != NULL )
     {
-        // Dmod_Free() never coalesces on its own (Concatenate=false) - a request can
-        // fail here purely from fragmentation even when the aggregate free memory is
-        // more than enough. Before giving up, try to merge adjacent free blocks and
-        // search once more - this only pays the O(n) coalescing cost on the rare
-        // allocation that actually needs it, instead of on every single free.
-        concatenate_free_blocks_locked( ctx );
-        block = find_suitable_block( ctx, aligned_size, alignment );
+        for( size_t i = 0; i < ctx->shard_count; i++ )
+        {
+            reset_requests_in_context( ctx->shards[i] );
+        }
+        return;
     }
-    if( block == NULL )
+    if( (ctx->flags & DMHEAP_REQUEST_HISTOGRAM) == 0 )
     {
-        Dmod_ExitCritical();
-        return NULL;
+        return;
+    }
+
+    context_lock( ctx );
+    memset( &ctx->untracked_requests, 0, sizeof(ctx->untracked_requests) );
+    for( module_t* module = ctx->module_list; module != NULL; module = module->next )
+    {
+        memset( module->requests, 0, sizeof(*module->requests) );
     }
+    context_unlock( ctx );
+}
 
-    void* aligned_address = align_pointer( block->address, alignment );
-    size_t padding = (size_t)((uintptr_t)aligned_address - (uintptr_t)block->address);
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, void, _reset_request_histogram, ( dmheap_context_t* ctx ) )
+{
+    if( ctx != NULL )
+    {
+        reset_requests_in_context( ctx );
+        return;
+    }
 
-    // First remove the block from free_list before splitting
-    remove_block( &ctx->free_list, block );
+    Dmod_EnterCritical();
+    for( int32_t i = (g_default_context_count - 1); i >= 0; i-- )
+    {
+        reset_requests_in_context( g_default_contexts[i] );
+    }
+    Dmod_ExitCritical();
+}
 
-    // If there's any padding, we need to handle it
-    if( padding > 0 )
-    {
-        // Check if we have enough padding to place a block structure before the aligned address
-        if( padding >= sizeof(block_t) )
-        {
-            // Calculate the split point to position the new block's data at aligned_address
-            // The new block structure will be at aligned_address - sizeof(block_t)
-            // So we need to split at: (aligned_address - sizeof(block_t)) - block->address
-            size_t split_at = padding - sizeof(block_t);
-            
-            // Create a new block for the usable part
-            block_t* usable_block = split_block( ctx, block, split_at );
-            if( usable_block != NULL )
-            {
-                // block now contains the padding area, add it to free list
-                add_free_block( &ctx->free_list, block );
-                // usable_block is what we'll actually use for allocation
-                block = usable_block;
-                // The usable_block's data (block->address) should now be at aligned_address
-            }
-            else
-            {
-                // If split failed, put the block back to free_list
-                add_free_block( &ctx->free_list, block );
-                // If we are here, something went wrong, 
-                // because find_suitable_block should have ensured enough space
-                // for splitting if padding was needed.
-                DMOD_ASSERT_MSG(false, "Unexpected error - check find_suitable_block logic.");
-                // Split failed, can't use this block efficiently
-                Dmod_ExitCritical();
-                return NULL;
-            }
+/**
+ * @brief Replace a heap's occupancy history ring. Caller must already hold the
+ * heap's critical section.
+ *
+ * @param ctx      Pointer to the heap context.
+ * @param capacity Number of samples in the new ring (0 to drop the history).
+ * @param interval Operations between automatic samples (0 for none).
+ *
+ * @return true on success, false if the new ring cannot be allocated (the old
+ *         one is kept).
+ */
+static bool set_history_locked( dmheap_context_t* ctx, size_t capacity, size_t interval )
+{
+    dmheap_sample_t* history = NULL;
+    block_t* history_block = NULL;
+    if( capacity > 0 )
+    {
+        if( capacity > SIZE_MAX / sizeof(dmheap_sample_t) )
+        {
+            return false;
         }
-        else
+        block_t* block = ctx->engine->alloc( ctx, capacity * sizeof(dmheap_sample_t), ctx->alignment, 0, NULL );
+        if( block == NULL )
         {
-            // Padding is too small to fit a block structure.
-            // In this case, we skip ahead to the next aligned position that can accommodate
-            // both the block structure and be properly aligned.
-            // Calculate the next suitable aligned position
-            size_t needed_space = sizeof(block_t) + aligned_size;
-            void* search_start = (void*)((uintptr_t)block->address + sizeof(block_t));
-            void* next_aligned = align_pointer( search_start, alignment );
-            size_t new_padding = (size_t)((uintptr_t)next_aligned - (uintptr_t)block->address);
-            
-            if( new_padding >= sizeof(block_t) && block->size >= new_padding - sizeof(block_t) + aligned_size )
-            {
-                // Split at the position before the next aligned address
-                size_t split_at = new_padding - sizeof(block_t);
-                block_t* usable_block = split_block( ctx, block, split_at );
-                if( usable_block != NULL )
-                {
-                    add_free_block( &ctx->free_list, block );
-                    block = usable_block;
-                    aligned_address = block->address;  // Update aligned_address to the actual position
-                }
-                else
-                {
-                    // Can't split, return the block to free list and fail
-                    add_free_block( &ctx->free_list, block );
-                    Dmod_ExitCritical();
-                    return NULL;
-                }
-            }
-            else
-            {
-                // Not enough space, return the block and fail
-                add_free_block( &ctx->free_list, block );
-                Dmod_ExitCritical();
-                return NULL;
-            }
+            return false;
         }
+        block->flags = BLOCK_FLAG_HISTORY;
+        block->owner = NULL;
+        used_list_add( ctx, block );
+        history = (dmheap_sample_t*)block->address;
+        history_block = block;
     }
 
-    if(block->size > aligned_size + sizeof(block_t) + 1)
+    if( ctx->history_block != NULL )
     {
-        block_t* new_block = split_block( ctx, block, aligned_size );
-        if( new_block != NULL )
-        {
-            add_free_block( &ctx->free_list, new_block );
-        }
+        used_list_remove( ctx, ctx->history_block );
+        ctx->engine->free( ctx, ctx->history_block );
     }
 
-    module_t* module = module_name != NULL ? get_or_create_module( ctx, module_name ) : NULL;
-    block->owner = module;
-
-    add_block( &ctx->used_list, block );
-
-    Dmod_ExitCritical();
-    return aligned_address;
+    ctx->history          = history;
+    ctx->history_block    = history_block;
+    ctx->history_capacity = capacity;
+    ctx->history_count    = 0;
+    ctx->history_interval = capacity > 0 ? interval : 0;
+    // Due right away, so the ring starts with a baseline sample.
+    ctx->history_due      = ctx->counters.allocs + ctx->counters.frees;
+    return true;
 }
 
-DMOD_INPUT_API_DECLARATION( dmheap, 1.0, void*, _aligned_alloc, ( dmheap_context_t* ctx, size_t alignment, size_t size, const char* module_name) )
+/**
+ * @brief Replace the history ring of one heap context (every shard of a
+ * sharded one) under its lock.
+ *
+ * @return true if every ring was replaced.
+ */
+static bool set_history_in_context( dmheap_context_t* ctx, size_t capacity, size_t interval )
 {
-    if( ctx != NULL )
+    if( ctx->shards != NULL )
     {
-        void* ptr = aligned_alloc_in_context( ctx, alignment, size, module_name );
-        if( ptr == NULL )
+        bool all_succeeded = true;
+        for( size_t i = 0; i < ctx->shard_count; i++ )
         {
-            DMOD_LOG_ERROR("dmheap: Unable to allocate %zu bytes with alignment %zu for module %s.\n", size, alignment, module_name);
+            all_succeeded &= set_history_in_context( ctx->shards[i], capacity, interval );
         }
-        return ptr;
+        return all_succeeded;
     }
 
-    if( g_default_context_count == 0 )
+    context_lock( ctx );
+    bool succeeded = set_history_locked( ctx, capacity, interval );
+    context_unlock( ctx );
+    return succeeded;
+}
+
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, bool, _set_history, ( dmheap_context_t* ctx, size_t capacity, size_t interval ) )
+{
+    if( ctx == NULL )
     {
-        DMOD_LOG_ERROR("dmheap: No context available for aligned_alloc.\n");
-        return NULL;
+        DMOD_LOG_ERROR("dmheap: set_history called with invalid parameters.\n");
+        return false;
+    }
+    if( !set_history_in_context( ctx, capacity, interval ) )
+    {
+        DMOD_LOG_ERROR("dmheap: Unable to allocate a %zu-sample history for heap %p.\n", capacity, ctx);
+        return false;
     }
+    return true;
+}
 
-    // Try every default heap in the order it was added, until one can satisfy the request.
-    // Failing on any one heap along the way is expected, not an error - only log if every
-    // heap in the search comes up empty (below).
-    for( int32_t i = (g_default_context_count - 1); i >= 0; i-- )
+/**
+ * @brief Record a sample on one heap context (every shard of a sharded one)
+ * under its lock.
+ *
+ * @return true if at least one sample was recorded.
+ */
+static bool record_sample_in_context( dmheap_context_t* ctx )
+{
+    if( ctx->shards != NULL )
     {
-        void* ptr = aligned_alloc_in_context( g_default_contexts[i], alignment, size, module_name );
-        if( ptr != NULL )
+        bool recorded = false;
+        for( size_t i = 0; i < ctx->shard_count; i++ )
         {
-            return ptr;
+            recorded |= record_sample_in_context( ctx->shards[i] );
         }
+        return recorded;
     }
 
-    DMOD_LOG_ERROR("dmheap: Unable to allocate %zu bytes with alignment %zu for module %s in any default heap.\n", size, alignment, module_name);
-    return NULL;
+    context_lock( ctx );
+    bool recorded = ctx->history != NULL;
+    if( recorded )
+    {
+        record_sample_locked( ctx );
+    }
+    context_unlock( ctx );
+    return recorded;
 }
 
-DMOD_INPUT_API_DECLARATION( dmheap, 1.0, void*, _malloc, ( dmheap_context_t* ctx, size_t size, const char* module_name ) )
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, bool, _record_sample, ( dmheap_context_t* ctx ) )
 {
     if( ctx != NULL )
     {
-        void* ptr = aligned_alloc_in_context( ctx, ctx->alignment, size, module_name );
-        if( ptr == NULL )
-        {
-            DMOD_LOG_ERROR("dmheap: Unable to allocate %zu bytes for module %s.\n", size, module_name);
-        }
-        return ptr;
+        return record_sample_in_context( ctx );
     }
 
-    if( g_default_context_count == 0 )
+    bool recorded = false;
+    Dmod_EnterCritical();
+    for( size_t i = 0; i < g_default_context_count; i++ )
     {
-        DMOD_LOG_ERROR("dmheap: No context available for malloc.\n");
-        return NULL;
+        recorded |= record_sample_in_context( g_default_contexts[i] );
     }
+    Dmod_ExitCritical();
+    return recorded;
+}
 
-    // Try every default heap in the order it was added, using each heap's own
-    // alignment, until one can satisfy the request. Failing on any one heap along
-    // the way is expected, not an error - only log if every heap comes up empty.
-    for( int32_t i = (g_default_context_count - 1); i >= 0; i-- )
+/**
+ * @brief Number of samples a heap context can hand out - for a sharded heap the
+ * fewest any shard holds, since they are combined position by position.
+ *
+ * @param ctx Pointer to the heap context.
+ *
+ * @return Number of samples held.
+ */
+static size_t history_length_in_context( dmheap_context_t* ctx )
+{
+    if( ctx->shards != NULL )
     {
-        dmheap_context_t* heap = g_default_contexts[i];
-        void* ptr = aligned_alloc_in_context( heap, heap->alignment, size, module_name );
-        if( ptr != NULL )
+        size_t length = SIZE_MAX;
+        for( size_t i = 0; i < ctx->shard_count; i++ )
         {
-            return ptr;
+            size_t shard_length = history_length_in_context( ctx->shards[i] );
+            length = shard_length < length ? shard_length : length;
         }
+        return length;
     }
 
-    DMOD_LOG_ERROR("dmheap: Unable to allocate %zu bytes for module %s in any default heap.\n", size, module_name);
-    return NULL;
+    context_lock( ctx );
+    size_t length = ctx->history_count < ctx->history_capacity ? ctx->history_count : ctx->history_capacity;
+    context_unlock( ctx );
+    return length;
 }
 
 /**
- * @brief Grow/shrink/no-op an already-located block in place, allocating a
- * replacement in the same context when it needs to grow. Caller must already
- * hold the heap's critical section.
+ * @brief Add the newest count samples of one heap context (every shard of a
+ * sharded one) into out_samples, oldest first.
  *
- * @param ctx         Pointer to the heap context that owns block/ptr.
- * @param block       The block currently backing ptr.
- * @param ptr         Pointer previously returned by an allocation function.
- * @param size        New size of memory to allocate.
- * @param module_name Name of the module requesting reallocation (for logging).
+ * If the ring holds fewer than count samples by now (it was replaced in the
+ * meantime), the leading entries are left as they are.
  *
- * @return Pointer to the reallocated memory, or NULL if growing failed.
+ * @param ctx         Pointer to the heap context.
+ * @param out_samples Accumulator of count samples, updated in place.
+ * @param count       Number of samples to add.
  */
-static void* realloc_block_locked( dmheap_context_t* ctx, block_t* block, void* ptr, size_t size, const char* module_name )
+static void add_history_in_context( dmheap_context_t* ctx, dmheap_sample_t* out_samples, size_t count )
 {
-    void* new_ptr = NULL;
-    if(size < block->size)
+    if( ctx->shards != NULL )
     {
-        remove_block( &ctx->used_list, block );
-        block_t* new_block = split_block( ctx, block, size );
-        if( new_block != NULL )
+        for( size_t i = 0; i < ctx->shard_count; i++ )
         {
-            add_free_block( &ctx->free_list, new_block );
+            add_history_in_context( ctx->shards[i], out_samples, count );
         }
-        add_block( &ctx->used_list, block );
-        new_ptr = ptr;
+        return;
     }
-    else if(size > block->size)
+
+    context_lock( ctx );
+    size_t length = ctx->history_count < ctx->history_capacity ? ctx->history_count : ctx->history_capacity;
+    for( size_t i = count > length ? count - length : 0; i < count; i++ )
     {
-        new_ptr = aligned_alloc_in_context( ctx, ctx->alignment, size, module_name );
-        if( new_ptr != NULL )
-        {
-            memcpy( new_ptr, ptr, block->size );
-            remove_block( &ctx->used_list, block );
-            add_free_block( &ctx->free_list, block );
-        }
-        else
+        const dmheap_sample_t* sample = &ctx->history[(ctx->history_count - count + i) % ctx->history_capacity];
+        dmheap_sample_t* out = &out_samples[i];
+        out->used_bytes       += sample->used_bytes;
+        out->free_bytes       += sample->free_bytes;
+        out->used_block_count += sample->used_block_count;
+        out->free_block_count += sample->free_block_count;
+        out->alloc_count      += sample->alloc_count;
+        out->free_count       += sample->free_count;
+        if( sample->largest_free_block > out->largest_free_block )
         {
-            DMOD_LOG_ERROR("dmheap: Unable to grow allocation to %zu bytes for module %s.\n", size, module_name);
+            out->largest_free_block = sample->largest_free_block;
         }
     }
-    else
-    {
-        new_ptr = ptr;
-    }
-    return new_ptr;
+    context_unlock( ctx );
 }
 
-DMOD_INPUT_API_DECLARATION( dmheap, 1.0, void*, _realloc, ( dmheap_context_t* ctx, void* ptr, size_t size, const char* module_name) )
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, size_t, _get_history, ( dmheap_context_t* ctx, dmheap_sample_t* out_samples, size_t max_samples ) )
 {
-    if( ptr == NULL )
-    {
-        return dmheap_malloc( ctx, size, module_name );
-    }
-
-    if( ctx != NULL )
+    if( ctx == NULL || out_samples == NULL )
     {
-        Dmod_EnterCritical();
-        block_t* block = find_block_by_address( ctx, ptr );
-        if( block == NULL )
-        {
-            Dmod_ExitCritical();
-            DMOD_LOG_ERROR("dmheap: _realloc called with invalid pointer %p from module %s.\n", ptr, module_name);
-            return NULL;
-        }
-        void* new_ptr = realloc_block_locked( ctx, block, ptr, size, module_name );
-        Dmod_ExitCritical();
-        return new_ptr;
+        DMOD_LOG_ERROR("dmheap: get_history called with invalid parameters.\n");
+        return 0;
     }
 
-    if( g_default_context_count == 0 )
+    size_t count = history_length_in_context( ctx );
+    if( count > max_samples )
     {
-        DMOD_LOG_ERROR("dmheap: No context available for realloc.\n");
-        return NULL;
+        count = max_samples;
     }
+    memset( out_samples, 0, count * sizeof(*out_samples) );
+    add_history_in_context( ctx, out_samples, count );
+    return count;
+}
 
-    // ptr may have been handed out by any default heap (see dmheap_malloc) - find
-    // whichever one actually owns it.
-    for( int32_t i = (g_default_context_count - 1); i >= 0 ; i-- )
+/**
+ * @brief Visit the free or used extents of one heap context's large region.
+ * Caller must already hold the heap's critical section.
+ *
+ * @param ctx       Pointer to the heap context.
+ * @param used      true to visit used extents, false to visit free ones.
+ * @param visitor   Called once per extent.
+ * @param user_data Passed through to each visitor call.
+ */
+static void visit_large_extents_locked( dmheap_context_t* ctx, bool used, dmheap_block_visitor_t visitor, void* user_data )
+{
+    large_region_t* large = ctx->large;
+    for( size_t i = 0; large != NULL && i < large->extent_count; i++ )
     {
-        dmheap_context_t* heap = g_default_contexts[i];
-        Dmod_EnterCritical();
-        block_t* block = find_block_by_address( heap, ptr );
-        if( block != NULL )
+        large_extent_t* extent = &large->extents[i];
+        if( extent->used == used )
         {
-            void* new_ptr = realloc_block_locked( heap, block, ptr, size, module_name );
-            Dmod_ExitCritical();
-            return new_ptr;
+            visitor( extent->address, extent->pages * DMHEAP_LARGE_PAGE_SIZE,
+                     used && extent->owner != NULL ? extent->owner->name : NULL, user_data );
         }
-        Dmod_ExitCritical();
     }
+}
 
-    DMOD_LOG_ERROR("dmheap: _realloc called with invalid pointer %p from module %s.\n", ptr, module_name);
-    return NULL;
+/**
+ * @brief Visit every free block (and free large extent) of one heap context.
+ * Caller must already hold the heap's critical section.
+ *
+ * @param ctx       Pointer to the heap context.
+ * @param visitor   Called once per free block.
+ * @param user_data Passed through to each visitor call.
+ */
+static void visit_free_blocks_locked( dmheap_context_t* ctx, dmheap_block_visitor_t visitor, void* user_data )
+{
+    ctx->engine->walk( ctx, visitor, user_data );
+    visit_large_extents_locked( ctx, false, visitor, user_data );
 }
 
 /**
- * @brief Free a block if it belongs to the given, already-resolved heap context.
+ * @brief Visit every used block (and used large extent) of one heap context.
+ * Caller must already hold the heap's critical section.
  *
- * @param ctx         Pointer to the heap context to search (must not be NULL).
- * @param ptr         Pointer to the memory to free.
- * @param concatenate If true, attempt to merge adjacent free blocks after freeing.
+ * @param ctx       Pointer to the heap context.
+ * @param visitor   Called once per used block.
+ * @param user_data Passed through to each visitor call.
+ */
+static void visit_used_blocks_locked( dmheap_context_t* ctx, dmheap_block_visitor_t visitor, void* user_data )
+{
+    for( block_t* block = ctx->used_list; block != NULL; block = block->next )
+    {
+        visitor( block->address, block->size, block->owner != NULL ? block->owner->name : NULL, user_data );
+    }
+    visit_large_extents_locked( ctx, true, visitor, user_data );
+}
+
+/**
+ * @brief Visit every free or used block of one heap context (every shard of a
+ * sharded one), taking each heap's lock in turn.
  *
- * @return true if ptr was found in ctx (and freed), false otherwise.
+ * @param ctx       Pointer to the heap context.
+ * @param used      true to visit used blocks, false to visit free ones.
+ * @param visitor   Called once per block.
+ * @param user_data Passed through to each visitor call.
  */
-static bool free_block_in_context( dmheap_context_t* ctx, void* ptr, bool concatenate )
+static void visit_blocks_in_context( dmheap_context_t* ctx, bool used, dmheap_block_visitor_t visitor, void* user_data )
 {
-    Dmod_EnterCritical();
-    block_t* block = find_block_by_address( ctx, ptr );
-    if( block == NULL )
+    if( ctx->shards != NULL )
     {
-        Dmod_ExitCritical();
-        return false;
+        for( size_t i = 0; i < ctx->shard_count; i++ )
+        {
+            visit_blocks_in_context( ctx->shards[i], used, visitor, user_data );
+        }
+        return;
     }
 
-    remove_block( &ctx->used_list, block );
-    add_free_block( &ctx->free_list, block );
-
-    if(concatenate)
+    context_lock( ctx );
+    if( used )
     {
-        concatenate_free_blocks_locked( ctx );
+        visit_used_blocks_locked( ctx, visitor, user_data );
     }
-
-    Dmod_ExitCritical();
-    return true;
+    else
+    {
+        visit_free_blocks_locked( ctx, visitor, user_data );
+    }
+    context_unlock( ctx );
 }
 
-DMOD_INPUT_API_DECLARATION( dmheap, 1.0, void , _free, ( dmheap_context_t* ctx, void* ptr, bool concatenate ) )
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, void, _for_each_free_block, ( dmheap_context_t* ctx, dmheap_block_visitor_t visitor, void* user_data ) )
 {
-    if( ptr == NULL )
+    if( visitor == NULL )
     {
         return;
     }
 
     if( ctx != NULL )
     {
-        if( !free_block_in_context( ctx, ptr, concatenate ) )
-        {
-            DMOD_LOG_ERROR("dmheap: _free called with invalid pointer %p.\n", ptr);
-        }
-        return;
-    }
-
-    if( g_default_context_count == 0 )
-    {
-        DMOD_LOG_ERROR("dmheap: No context available for free.\n");
+        visit_blocks_in_context( ctx, false, visitor, user_data );
         return;
     }
 
-    // ptr may have been handed out by any default heap (see dmheap_malloc) - find
-    // whichever one actually owns it.
+    Dmod_EnterCritical();
     for( int32_t i = (g_default_context_count - 1); i >= 0; i-- )
     {
-        if( free_block_in_context( g_default_contexts[i], ptr, concatenate ) )
-        {
-            return;
-        }
+        visit_blocks_in_context( g_default_contexts[i], false, visitor, user_data );
     }
-
-    DMOD_LOG_ERROR("dmheap: _free called with invalid pointer %p.\n", ptr);
+    Dmod_ExitCritical();
 }
 
-DMOD_INPUT_API_DECLARATION( dmheap, 1.0, void , _concatenate_free_blocks, ( dmheap_context_t* ctx ) )
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, void, _for_each_used_block, ( dmheap_context_t* ctx, dmheap_block_visitor_t visitor, void* user_data ) )
 {
-    if( ctx != NULL )
+    if( visitor == NULL )
     {
-        Dmod_EnterCritical();
-        concatenate_free_blocks_locked( ctx );
-        Dmod_ExitCritical();
         return;
     }
 
-    if( g_default_context_count == 0 )
+    if( ctx != NULL )
     {
-        DMOD_LOG_ERROR("dmheap: No context available for concatenate_free_blocks.\n");
+        visit_blocks_in_context( ctx, true, visitor, user_data );
         return;
     }
 
+    Dmod_EnterCritical();
     for( int32_t i = (g_default_context_count - 1); i >= 0; i-- )
     {
-        Dmod_EnterCritical();
-        concatenate_free_blocks_locked( g_default_contexts[i] );
-        Dmod_ExitCritical();
+        visit_blocks_in_context( g_default_contexts[i], true, visitor, user_data );
     }
+    Dmod_ExitCritical();
 }
 
 /**
- * @brief Result of attempting to retag a pointer against a single heap context.
- */
-typedef enum retag_result_t
-{
-    RETAG_NOT_FOUND,    //!< ptr does not belong to this context.
-    RETAG_FAILED,       //!< ptr belongs to this context, but the target module could not be created.
-    RETAG_OK,           //!< ptr was found and retagged successfully.
-} retag_result_t;
-
-/**
- * @brief Retag a block if it belongs to the given, already-resolved heap context.
+ * @brief Used-list counterpart of dmheap_engine_t::walk_step - visit the next
+ * blocks of the used list.
  *
- * @param ctx             Pointer to the heap context to search (must not be NULL).
- * @param ptr             Pointer previously returned by an allocation function.
- * @param new_module_name Name of the module to attribute the block to from now on.
+ * @param ctx        Pointer to the heap context.
+ * @param position   Next block to visit, updated in place.
+ * @param slot       0 before the first call (start at the head), updated in place.
+ * @param max_blocks Maximum number of blocks to pass.
+ * @param visitor    Called once per used block, or NULL to just skip them.
+ * @param user_data  Passed through to each visitor call.
+ *
+ * @return Number of blocks passed - fewer than max_blocks once the list is over.
  */
-static retag_result_t retag_block_in_context( dmheap_context_t* ctx, void* ptr, const char* new_module_name )
+static size_t used_list_walk_step( dmheap_context_t* ctx, void** position, size_t* slot, size_t max_blocks,
+                                   dmheap_block_visitor_t visitor, void* user_data )
 {
-    Dmod_EnterCritical();
-    block_t* block = find_block_by_address( ctx, ptr );
-    if( block == NULL )
-    {
-        Dmod_ExitCritical();
-        return RETAG_NOT_FOUND;
-    }
-
-    module_t* module = get_or_create_module( ctx, new_module_name );
-    if( module == NULL )
+    block_t* block = *slot == 0 ? ctx->used_list : (block_t*)*position;
+    size_t count = 0;
+    for( ; block != NULL && count < max_blocks; block = block->next, count++ )
     {
-        Dmod_ExitCritical();
-        return RETAG_FAILED;
+        if( visitor != NULL )
+        {
+            visitor( block->address, block->size, block->owner != NULL ? block->owner->name : NULL, user_data );
+        }
     }
+    *position = block;
+    *slot = 1;
+    return count;
+}
 
-    block->owner = module;
-    Dmod_ExitCritical();
-    return RETAG_OK;
+/**
+ * @brief Block visitor of a statistics walk: count a free block.
+ */
+static void walk_count_free( void* address, size_t size, const char* owner_name, void* user_data )
+{
+    (void)address;
+    (void)owner_name;
+    count_free_block( (dmheap_stats_t*)user_data, size );
 }
 
-DMOD_INPUT_API_DECLARATION( dmheap, 1.0, bool, _retag, ( dmheap_context_t* ctx, void* ptr, const char* new_module_name ) )
+/**
+ * @brief Block visitor of a statistics walk: count a used block.
+ */
+static void walk_count_used( void* address, size_t size, const char* owner_name, void* user_data )
 {
-    if( ptr == NULL || new_module_name == NULL )
-    {
-        DMOD_LOG_ERROR("dmheap: retag called with invalid arguments.\n");
-        return false;
-    }
+    (void)address;
+    (void)owner_name;
+    dmheap_stats_t* stats = (dmheap_stats_t*)user_data;
+    stats->used_bytes += size;
+    stats->used_block_count++;
+}
 
-    if( ctx != NULL )
+/**
+ * @brief Find the heap a cursor walk is on - a default heap or the given one,
+ * or one of its shards - moving past heaps that no longer exist.
+ * Caller must be inside Dmod_EnterCritical() when walking the default heaps.
+ *
+ * @param cursor The walk.
+ *
+ * @return The heap, or NULL once every heap is done.
+ */
+static dmheap_context_t* walk_current_heap( dmheap_walk_cursor_t* cursor )
+{
+    while( true )
     {
-        retag_result_t result = retag_block_in_context( ctx, ptr, new_module_name );
-        if( result == RETAG_NOT_FOUND )
+        dmheap_context_t* ctx = NULL;
+        if( cursor->ctx != NULL )
         {
-            DMOD_LOG_ERROR("dmheap: retag called with unknown pointer %p.\n", ptr);
+            ctx = cursor->heap == 0 ? cursor->ctx : NULL;
         }
-        else if( result == RETAG_FAILED )
+        else if( cursor->heap < (size_t)g_default_context_count )
         {
-            DMOD_LOG_ERROR("dmheap: Unable to retag %p - failed to get/create module %s.\n", ptr, new_module_name);
+            ctx = g_default_contexts[g_default_context_count - 1 - (int32_t)cursor->heap];
+        }
+        if( ctx == NULL )
+        {
+            return NULL;
         }
-        return result == RETAG_OK;
-    }
-
-    if( g_default_context_count == 0 )
-    {
-        DMOD_LOG_ERROR("dmheap: No context available for retag.\n");
-        return false;
-    }
 
-    // ptr may have been handed out by any default heap (see dmheap_malloc) - find
-    // whichever one actually owns it.
-    for( int32_t i = (g_default_context_count - 1); i >= 0; i-- )
-    {
-        retag_result_t result = retag_block_in_context( g_default_contexts[i], ptr, new_module_name );
-        if( result == RETAG_OK )
+        if( ctx->shards == NULL && cursor->shard == 0 )
         {
-            return true;
+            return ctx;
         }
-        if( result == RETAG_FAILED )
+        if( ctx->shards != NULL && cursor->shard < ctx->shard_count )
         {
-            DMOD_LOG_ERROR("dmheap: Unable to retag %p - failed to get/create module %s.\n", ptr, new_module_name);
-            return false;
+            return ctx->shards[cursor->shard];
         }
-        // RETAG_NOT_FOUND: keep searching the remaining default heaps.
+        cursor->heap++;
+        cursor->shard = 0;
     }
-
-    DMOD_LOG_ERROR("dmheap: retag called with unknown pointer %p.\n", ptr);
-    return false;
 }
 
 /**
- * @brief Accumulate one heap context's statistics into a running total. Caller
- * must already hold the heap's critical section.
+ * @brief Forget a cursor walk's position in the current heap.
  *
- * @param ctx       Pointer to the heap context.
- * @param out_stats Statistics accumulator, updated in place.
+ * @param cursor The walk.
  */
-static void accumulate_stats_locked( dmheap_context_t* ctx, dmheap_stats_t* out_stats )
+static void walk_rewind_heap( dmheap_walk_cursor_t* cursor )
 {
-    out_stats->heap_size += ctx->heap_size;
+    cursor->phase    = 0;
+    cursor->position = NULL;
+    cursor->slot     = 0;
+    cursor->visited  = 0;
+    cursor->skip     = 0;
+}
 
-    for( block_t* block = ctx->free_list; block != NULL; block = block->next )
+/**
+ * @brief Find the mark a cursor walk keeps its place in a heap with, or hand it
+ * one. Caller must already hold the heap's critical section.
+ *
+ * A mark the walk still holds is checked by its ticket alone: the heap moves
+ * its marks on as blocks leave the lists (see walk_marks_pass()), so however
+ * much changed since the previous step, the walk carries on where it was. A
+ * walk without one - more than DMHEAP_WALK_MARKS walks took turns on the heap,
+ * or the heap was reset - takes over the free or least recently stepped mark.
+ * If no block has left a list since its previous step, the position it saved
+ * then still holds; otherwise it starts the current part over: a block walk
+ * passes over as many blocks as it had already visited, charged to its steps
+ * (see walk_heap_locked()), and a coalescing walk starts a fresh pass.
+ *
+ * @param ctx    Pointer to the heap context.
+ * @param cursor The walk.
+ *
+ * @return The walk's mark.
+ */
+static walk_mark_t* walk_mark_locked( dmheap_context_t* ctx, dmheap_walk_cursor_t* cursor )
+{
+    walk_mark_t* mark = &ctx->walk_marks[cursor->mark];
+    if( cursor->marked != ctx || mark->ticket != cursor->ticket )
     {
-        out_stats->free_bytes += block->size;
-        out_stats->free_block_count++;
-        if( out_stats->largest_free_block == 0 || block->size > out_stats->largest_free_block )
+        size_t oldest = 0;
+        for( size_t i = 1; i < DMHEAP_WALK_MARKS; i++ )
         {
-            out_stats->largest_free_block = block->size;
+            if( ctx->walk_marks[i].ticket < ctx->walk_marks[oldest].ticket )
+            {
+                oldest = i;
+            }
         }
-        if( out_stats->smallest_free_block == 0 || block->size < out_stats->smallest_free_block )
+        mark = &ctx->walk_marks[oldest];
+        mark->position = cursor->position;
+        bool kept = cursor->marked == ctx && cursor->generation == ctx->generation;
+        cursor->marked = ctx;
+        cursor->mark   = oldest;
+        if( !kept && ( cursor->phase != 0 || cursor->slot != 0 ) )
         {
-            out_stats->smallest_free_block = block->size;
+            mark->position = NULL;
+            cursor->restarts++;
+            cursor->slot = 0;
+            cursor->skip = cursor->kind == DMHEAP_WALK_COALESCE ? 0 : cursor->visited;
         }
     }
 
-    for( block_t* block = ctx->used_list; block != NULL; block = block->next )
+    if( ++ctx->walk_ticket == 0 )
     {
-        out_stats->used_bytes += block->size;
-        out_stats->used_block_count++;
+        ctx->walk_ticket = 1;
     }
+    mark->ticket   = ctx->walk_ticket;
+    cursor->ticket = ctx->walk_ticket;
+    return mark;
 }
 
-DMOD_INPUT_API_DECLARATION( dmheap, 1.0, bool, _get_stats, ( dmheap_context_t* ctx, dmheap_stats_t* out_stats ) )
+/**
+ * @brief Pass the next blocks of the part of a heap a block or statistics walk
+ * is on - its free blocks or its used list. Caller must already hold the heap's
+ * critical section.
+ *
+ * @param ctx       Pointer to the heap context.
+ * @param cursor    The walk.
+ * @param mark      The walk's mark.
+ * @param limit     Maximum number of blocks to pass.
+ * @param visitor   Called once per block, or NULL to just pass them.
+ * @param user_data Passed through to each visitor call.
+ *
+ * @return Number of blocks passed - fewer than limit once the part is over.
+ */
+static size_t walk_part_step( dmheap_context_t* ctx, dmheap_walk_cursor_t* cursor, walk_mark_t* mark, size_t limit,
+                              dmheap_block_visitor_t visitor, void* user_data )
 {
-    if( out_stats == NULL )
+    bool used = cursor->kind == DMHEAP_WALK_USED_BLOCKS || ( cursor->kind == DMHEAP_WALK_STATS && cursor->phase == 1 );
+    return used ? used_list_walk_step( ctx, &mark->position, &cursor->slot, limit, visitor, user_data )
+                : ctx->engine->walk_step( ctx, &mark->position, &cursor->slot, limit, visitor, user_data );
+}
+
+/**
+ * @brief Carry a free- or used-block walk on through one heap. Caller must
+ * already hold the heap's critical section.
+ *
+ * @param ctx       Pointer to the heap context.
+ * @param cursor    The walk.
+ * @param mark      The walk's mark.
+ * @param limit     Maximum number of blocks to pass.
+ * @param passed    Set to the number of blocks passed.
+ * @param visitor   Called once per block.
+ * @param user_data Passed through to each visitor call.
+ *
+ * @return true once the heap is done.
+ */
+static bool walk_blocks_locked( dmheap_context_t* ctx, dmheap_walk_cursor_t* cursor, walk_mark_t* mark, size_t limit,
+                                size_t* passed, dmheap_block_visitor_t visitor, void* user_data )
+{
+    *passed = walk_part_step( ctx, cursor, mark, limit, visitor, user_data );
+    cursor->visited += *passed;
+    if( *passed == limit )
     {
-        DMOD_LOG_ERROR("dmheap: get_stats called with invalid arguments.\n");
         return false;
     }
 
-    memset( out_stats, 0, sizeof(*out_stats) );
-
-    if( ctx != NULL )
+    if( visitor != NULL )
     {
-        Dmod_EnterCritical();
-        accumulate_stats_locked( ctx, out_stats );
-        Dmod_ExitCritical();
-        return true;
+        visit_large_extents_locked( ctx, cursor->kind == DMHEAP_WALK_USED_BLOCKS, visitor, user_data );
     }
+    return true;
+}
 
-    if( g_default_context_count == 0 )
+/**
+ * @brief Carry a statistics walk on through one heap: its free blocks, then its
+ * used blocks, then the rest of its totals. Caller must already hold the heap's
+ * critical section.
+ *
+ * @param ctx    Pointer to the heap context.
+ * @param cursor The walk.
+ * @param mark   The walk's mark.
+ * @param limit  Maximum number of blocks to pass.
+ * @param passed Set to the number of blocks passed.
+ *
+ * @return true once the heap is done.
+ */
+static bool walk_stats_locked( dmheap_context_t* ctx, dmheap_walk_cursor_t* cursor, walk_mark_t* mark, size_t limit,
+                               size_t* passed )
+{
+    *passed = 0;
+    if( cursor->phase == 0 )
     {
-        DMOD_LOG_ERROR("dmheap: get_stats called with invalid arguments.\n");
-        return false;
+        *passed = walk_part_step( ctx, cursor, mark, limit, walk_count_free, &cursor->stats );
+        cursor->visited += *passed;
+        if( *passed == limit )
+        {
+            return false;
+        }
+        cursor->phase   = 1;
+        cursor->slot    = 0;
+        cursor->visited = 0;
+        mark->position  = NULL;
     }
 
-    // Aggregate across every default heap.
-    Dmod_EnterCritical();
-    for( int32_t i = (g_default_context_count - 1); i >= 0; i-- )
+    size_t want = limit - *passed;
+    size_t count = walk_part_step( ctx, cursor, mark, want, walk_count_used, &cursor->stats );
+    cursor->visited += count;
+    *passed += count;
+    if( count == want )
     {
-        accumulate_stats_locked( g_default_contexts[i], out_stats );
+        return false;
     }
-    Dmod_ExitCritical();
+
+    accumulate_totals_locked( ctx, &cursor->stats );
     return true;
 }
 
-DMOD_INPUT_API_DECLARATION( dmheap, 1.0, void, _for_each_free_block, ( dmheap_context_t* ctx, dmheap_block_visitor_t visitor, void* user_data ) )
+/**
+ * @brief Carry a cursor walk on through one heap. Caller must already hold the
+ * heap's critical section.
+ *
+ * @param ctx       Pointer to the heap context.
+ * @param cursor    The walk.
+ * @param budget    Blocks the step may still pass, updated in place.
+ * @param visitor   Called once per block of a block walk.
+ * @param user_data Passed through to each visitor call.
+ *
+ * @return true once the heap is done.
+ */
+static bool walk_heap_locked( dmheap_context_t* ctx, dmheap_walk_cursor_t* cursor, size_t* budget,
+                              dmheap_block_visitor_t visitor, void* user_data )
 {
-    if( visitor == NULL )
+    walk_mark_t* mark = walk_mark_locked( ctx, cursor );
+    if( cursor->skip > 0 )
     {
-        return;
+        // The walk lost its mark - passing over what it already visited counts
+        // against the step like any other block.
+        size_t limit = cursor->skip < *budget ? cursor->skip : *budget;
+        size_t passed = walk_part_step( ctx, cursor, mark, limit, NULL, NULL );
+        *budget -= passed;
+        cursor->skip = passed < limit ? 0 : cursor->skip - passed;
+        if( *budget == 0 )
+        {
+            cursor->position   = mark->position;
+            cursor->generation = ctx->generation;
+            return false;
+        }
     }
 
-    if( ctx != NULL )
+    size_t limit = *budget;
+    size_t passed = 0;
+    bool done;
+    switch( cursor->kind )
     {
-        Dmod_EnterCritical();
-        for( block_t* block = ctx->free_list; block != NULL; block = block->next )
-        {
-            visitor( block->address, block->size, NULL, user_data );
-        }
-        Dmod_ExitCritical();
-        return;
+        case DMHEAP_WALK_STATS:
+            done = walk_stats_locked( ctx, cursor, mark, limit, &passed );
+            break;
+        case DMHEAP_WALK_COALESCE:
+            passed = ctx->engine->maintain_step( ctx, &mark->position, &cursor->slot, limit );
+            done   = passed < limit;
+            break;
+        default:
+            done = walk_blocks_locked( ctx, cursor, mark, limit, &passed, visitor, user_data );
+            break;
+    }
+    *budget -= passed;
+    if( done )
+    {
+        mark->position = NULL;
+        mark->ticket   = 0;
+        cursor->marked = NULL;
     }
+    cursor->position   = mark->position;
+    cursor->generation = ctx->generation;
+    return done;
+}
 
-    Dmod_EnterCritical();
-    for( int32_t i = (g_default_context_count - 1); i >= 0; i-- )
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, bool, _walk_begin, ( dmheap_walk_cursor_t* cursor, dmheap_context_t* ctx, dmheap_walk_kind_t kind ) )
+{
+    if( cursor == NULL || kind > DMHEAP_WALK_COALESCE )
     {
-        for( block_t* block = g_default_contexts[i]->free_list; block != NULL; block = block->next )
-        {
-            visitor( block->address, block->size, NULL, user_data );
-        }
+        return false;
     }
-    Dmod_ExitCritical();
+
+    memset( cursor, 0, sizeof(*cursor) );
+    cursor->kind = kind;
+    cursor->ctx  = ctx;
+    return true;
 }
 
-DMOD_INPUT_API_DECLARATION( dmheap, 1.0, void, _for_each_used_block, ( dmheap_context_t* ctx, dmheap_block_visitor_t visitor, void* user_data ) )
+DMOD_INPUT_API_DECLARATION( dmheap, 1.0, bool, _walk_step, ( dmheap_walk_cursor_t* cursor, size_t max_blocks, dmheap_block_visitor_t visitor, void* user_data ) )
 {
-    if( visitor == NULL )
+    if( cursor == NULL || cursor->done )
     {
-        return;
+        return false;
     }
 
-    if( ctx != NULL )
+    // A step always makes progress - no budget counts as one block.
+    size_t budget = max_blocks > 0 ? max_blocks : 1;
+    while( budget > 0 )
     {
+        // Only the lookup needs the default list to hold still - each heap's
+        // own lock covers the slice done on it.
         Dmod_EnterCritical();
-        for( block_t* block = ctx->used_list; block != NULL; block = block->next )
+        dmheap_context_t* ctx = walk_current_heap( cursor );
+        Dmod_ExitCritical();
+        if( ctx == NULL )
         {
-            visitor( block->address, block->size, block->owner != NULL ? block->owner->name : NULL, user_data );
+            cursor->done = true;
+            return false;
         }
-        Dmod_ExitCritical();
-        return;
-    }
 
-    Dmod_EnterCritical();
-    for( int32_t i = (g_default_context_count - 1); i >= 0; i-- )
-    {
-        for( block_t* block = g_default_contexts[i]->used_list; block != NULL; block = block->next )
+        context_lock( ctx );
+        bool heap_done = walk_heap_locked( ctx, cursor, &budget, visitor, user_data );
+        context_unlock( ctx );
+        if( heap_done )
         {
-            visitor( block->address, block->size, block->owner != NULL ? block->owner->name : NULL, user_data );
+            walk_rewind_heap( cursor );
+            cursor->shard++;
         }
     }
-    Dmod_ExitCritical();
+    return true;
 }
 
 #ifndef DMHEAP_DONT_IMPLEMENT_DMOD_API
@@ -1446,6 +6825,11 @@ DMOD_INPUT_API_DECLARATION(Dmod, 1.0, void*, _MallocEx, ( size_t Size, const cha
     return dmheap_malloc( NULL, Size, ModuleName );
 }
 
+DMOD_INPUT_API_DECLARATION(Dmod, 1.0, void*, _CallocEx, ( size_t Count, size_t Size, const char* ModuleName ))
+{
+    return dmheap_calloc( NULL, Count, Size, ModuleName );
+}
+
 DMOD_INPUT_API_DECLARATION(Dmod, 1.0, void*, _ReallocEx, ( void* Ptr, size_t Size, const char* ModuleName ))
 {
     return dmheap_realloc( NULL, Ptr, Size, ModuleName );
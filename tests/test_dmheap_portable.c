@@ -0,0 +1,96 @@
+/**
+ * @file test_dmheap_portable.c
+ * @brief Builds dmheap.c with __GNUC__ hidden, so the fallbacks it keeps for
+ * other compilers (sequence counter, spinlock, statistics sequence lock) are
+ * compiled and run on a GNU toolchain too.
+ *
+ * The library is compiled into this translation unit, so this test links
+ * against the DMOD libraries but not against dmheap itself. Every header
+ * dmheap.c pulls in is included first, while __GNUC__ is still defined -
+ * the system headers depend on it.
+ */
+#if defined(DMHEAP_SHARD_GETCPU) && defined(__linux__)
+#   ifndef _GNU_SOURCE
+#       define _GNU_SOURCE
+#   endif
+#   include <sched.h>
+#endif
+
+#include "dmheap.h"
+#include "test_common.h"
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#   include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#   include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#   include <arm_neon.h>
+#endif
+
+#if defined(__linux__)
+#   include <unistd.h>
+#endif
+
+#if defined(DMHEAP_LARGE_MMAP) && defined(__linux__)
+#   include <sys/mman.h>
+#endif
+
+#undef __GNUC__
+#include "../src/dmheap.c"
+
+int tests_passed = 0;
+int tests_failed = 0;
+
+#define PORTABLE_HEAP_SIZE (32 * 1024)
+
+static char portable_heap[PORTABLE_HEAP_SIZE] __attribute__((aligned(64)));
+static char spin_heap[PORTABLE_HEAP_SIZE] __attribute__((aligned(64)));
+
+// Test: Allocation sequence numbers without compiler atomics
+static void test_sequence_numbers(void) {
+    TEST_SECTION("Portable Sequence Counter");
+
+    dmheap_context_t* ctx = dmheap_init(portable_heap, PORTABLE_HEAP_SIZE, 8);
+    ASSERT_TEST(ctx != NULL, "Heap initialized");
+
+    dmheap_checkpoint_t checkpoint = dmheap_checkpoint(ctx);
+    void* ptrs[16];
+    bool all_allocated = true;
+    for (int i = 0; i < 16; i++) {
+        ptrs[i] = dmheap_malloc(ctx, 64, "portable");
+        all_allocated = all_allocated && ptrs[i] != NULL;
+    }
+    ASSERT_TEST(all_allocated, "Allocations succeed");
+    ASSERT_TEST(dmheap_checkpoint(ctx) - checkpoint == 16, "Each allocation takes one sequence number");
+    ASSERT_TEST(dmheap_rollback(ctx, checkpoint) == 16, "Rollback finds the allocations by sequence number");
+    dmheap_remove_default_context(ctx);
+}
+
+// Test: Spinlock and peek statistics fall back to the global critical section
+static void test_spin_and_peek(void) {
+    TEST_SECTION("Portable Spinlock and Statistics");
+
+    dmheap_context_t* ctx = dmheap_init_ex(spin_heap, PORTABLE_HEAP_SIZE, 8, DMHEAP_LOCK_SPIN);
+    ASSERT_TEST(ctx != NULL, "Spin-locked heap initialized");
+    void* ptr = dmheap_malloc(ctx, 128, "portable");
+    dmheap_stats_t stats, running;
+    dmheap_get_stats(ctx, &stats);
+    ASSERT_TEST(ptr != NULL && dmheap_peek_stats(ctx, &running), "Peek statistics read a consistent snapshot");
+    ASSERT_TEST(running.used_bytes == stats.used_bytes && running.free_bytes == stats.free_bytes,
+                "Peeked statistics match the locked ones");
+    dmheap_free(ctx, ptr, true);
+    dmheap_remove_default_context(ctx);
+}
+
+int main(void) {
+    printf("=== DMHEAP Portable Build Tests ===\n");
+
+    test_sequence_numbers();
+    test_spin_and_peek();
+
+    printf("\nTests Passed: %d\n", tests_passed);
+    printf("Tests Failed: %d\n", tests_failed);
+    return tests_failed == 0 ? 0 : 1;
+}
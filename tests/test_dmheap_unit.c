@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <time.h>
 #include <assert.h>
+#include <pthread.h>
 
 // Test counters
 int tests_passed = 0;
@@ -596,6 +597,648 @@ static void test_context_naming(void) {
     TEST_INFO("Context naming test completed");
 }
 
+// Test: Dedicated large-allocation region
+static void test_large_region(void) {
+    TEST_SECTION("Large Allocation Region");
+
+    #define LARGE_HEAP_SIZE (256 * 1024)
+    #define LARGE_REGION_SIZE (128 * 1024)
+    static char large_heap[LARGE_HEAP_SIZE] __attribute__((aligned(16)));
+    dmheap_context_t* ctx = dmheap_init(large_heap, LARGE_HEAP_SIZE, 8);
+    ASSERT_TEST(ctx != NULL, "Initialize heap for large region");
+
+    ASSERT_TEST(dmheap_set_large_region(ctx, 0, LARGE_REGION_SIZE) == false, "Zero threshold is rejected");
+    ASSERT_TEST(dmheap_set_large_region(ctx, 16 * 1024, LARGE_REGION_SIZE) == true, "Configure large region");
+    ASSERT_TEST(dmheap_set_large_region(ctx, 16 * 1024, LARGE_REGION_SIZE) == false, "Large region can only be configured once");
+
+    dmheap_stats_t stats;
+    dmheap_get_stats(ctx, &stats);
+    ASSERT_TEST(stats.large_free_bytes == LARGE_REGION_SIZE, "Whole region starts out free");
+
+    void* small = dmheap_malloc(ctx, 64, "small");
+    void* big = dmheap_malloc(ctx, 40 * 1024, "big");
+    ASSERT_TEST(small != NULL && big != NULL, "Allocate small and large blocks");
+    ASSERT_TEST(((uintptr_t)big % 4096) == 0, "Large allocation is page aligned");
+    dmheap_get_stats(ctx, &stats);
+    ASSERT_TEST(stats.large_used_bytes == 40 * 1024, "Large allocation landed in the region");
+    ASSERT_TEST(stats.large_free_bytes == LARGE_REGION_SIZE - 40 * 1024, "Region free space shrank accordingly");
+
+    memset(big, 0x5A, 40 * 1024);
+    void* grown = dmheap_realloc(ctx, big, 40 * 1024 - 100, "big");
+    ASSERT_TEST(grown == big, "Realloc within the extent's pages stays in place");
+    ASSERT_TEST(dmheap_retag(ctx, big, "owner2") == true, "Large allocation can be retagged");
+
+    // Region holds 32 pages: 10 + 12 fit, the next 12-page request falls back to the general heap.
+    void* second = dmheap_malloc(ctx, 48 * 1024, "big");
+    void* third = dmheap_malloc(ctx, 48 * 1024, "big");
+    ASSERT_TEST(second != NULL && third != NULL, "Overflowing the region falls back to the general heap");
+    dmheap_get_stats(ctx, &stats);
+    ASSERT_TEST(stats.large_used_bytes == 88 * 1024, "Only two allocations fit in the region");
+
+    dmheap_free(ctx, big, false);
+    dmheap_free(ctx, third, false);
+    dmheap_unregister_module(ctx, "big");
+    dmheap_get_stats(ctx, &stats);
+    ASSERT_TEST(stats.large_used_bytes == 0, "Freeing and unregistering releases every extent");
+    ASSERT_TEST(stats.large_free_bytes == LARGE_REGION_SIZE, "Freed extents merged back into one");
+
+    dmheap_free(ctx, small, false);
+    dmheap_remove_default_context(ctx);
+}
+
+// Test: Zeroing allocation with known-zero tracking
+static void test_calloc(void) {
+    TEST_SECTION("Calloc and Known-Zero Tracking");
+
+    #define CALLOC_HEAP_SIZE (64 * 1024)
+    static char calloc_heap[CALLOC_HEAP_SIZE] __attribute__((aligned(16)));
+    memset(calloc_heap, 0, CALLOC_HEAP_SIZE);
+
+    // Deliberately break the DMHEAP_BUFFER_ZEROED promise in the middle of the
+    // buffer: if calloc trusts the known-zero bit, this byte shows through.
+    calloc_heap[CALLOC_HEAP_SIZE / 2] = 0x7E;
+    dmheap_context_t* ctx = dmheap_init_ex(calloc_heap, CALLOC_HEAP_SIZE, 8, DMHEAP_BUFFER_ZEROED);
+    ASSERT_TEST(ctx != NULL, "Initialize zeroed heap");
+
+    unsigned char* fresh = dmheap_calloc(ctx, 1, CALLOC_HEAP_SIZE - 4096, "calloc");
+    ASSERT_TEST(fresh != NULL, "Calloc from never-used space");
+    bool skipped = false;
+    for (size_t i = 0; fresh != NULL && i < CALLOC_HEAP_SIZE - 4096; i++) {
+        if (fresh[i] == 0x7E) {
+            skipped = true;
+        }
+    }
+    ASSERT_TEST(skipped, "Memset skipped for never-used space");
+
+    memset(fresh, 0xFF, CALLOC_HEAP_SIZE - 4096);
+    dmheap_free(ctx, fresh, true);
+
+    unsigned char* reused = dmheap_calloc(ctx, 16, 64, "calloc");
+    ASSERT_TEST(reused != NULL, "Calloc from previously used space");
+    bool all_zero = true;
+    for (size_t i = 0; reused != NULL && i < 16 * 64; i++) {
+        if (reused[i] != 0) {
+            all_zero = false;
+        }
+    }
+    ASSERT_TEST(all_zero, "Previously used space is cleared");
+
+    ASSERT_TEST(dmheap_calloc(ctx, SIZE_MAX / 2, 4, "calloc") == NULL, "Overflowing count * size is rejected");
+
+    dmheap_free(ctx, reused, false);
+    dmheap_remove_default_context(ctx);
+}
+
+// Test: Capability-tagged heaps
+static void test_capabilities(void) {
+    TEST_SECTION("Heap Capabilities");
+    reset_heap(); // test_heap is now the sole default heap, with no capabilities
+
+    #define CAPS_HEAP_SIZE (8 * 1024)
+    static char fast_heap[CAPS_HEAP_SIZE] __attribute__((aligned(16)));
+    static char dma_heap[CAPS_HEAP_SIZE] __attribute__((aligned(16)));
+    dmheap_context_t* fast = dmheap_init(fast_heap, CAPS_HEAP_SIZE, 8);
+    dmheap_context_t* dma = dmheap_init(dma_heap, CAPS_HEAP_SIZE, 8);
+    dmheap_add_default_context(fast);
+    dmheap_add_default_context(dma);
+
+    ASSERT_TEST(dmheap_set_capabilities(NULL, DMHEAP_CAP_FAST) == false, "Tagging a NULL context fails");
+    ASSERT_TEST(dmheap_set_capabilities(fast, DMHEAP_CAP_FAST | DMHEAP_CAP_DMA) == true, "Tag the fast heap");
+    ASSERT_TEST(dmheap_set_capabilities(dma, DMHEAP_CAP_DMA | DMHEAP_CAP_EXTERNAL) == true, "Tag the DMA heap");
+    ASSERT_TEST(dmheap_get_capabilities(fast) == (DMHEAP_CAP_FAST | DMHEAP_CAP_DMA), "Capabilities read back");
+
+    #define IN_HEAP(p, heap) ((char*)(p) >= (heap) && (char*)(p) < (heap) + CAPS_HEAP_SIZE)
+    void* hot = dmheap_malloc_caps(256, DMHEAP_CAP_FAST, "caps");
+    ASSERT_TEST(hot != NULL && IN_HEAP(hot, fast_heap), "FAST request lands in the fast heap");
+
+    void* plain = dmheap_malloc_caps(256, 0, "caps");
+    ASSERT_TEST(plain != NULL && (char*)plain >= test_heap && (char*)plain < test_heap + TEST_HEAP_SIZE,
+                "Plain request prefers the heap without special capabilities");
+
+    void* ext_dma = dmheap_malloc_caps(256, DMHEAP_CAP_DMA | DMHEAP_CAP_EXTERNAL, "caps");
+    ASSERT_TEST(ext_dma != NULL && IN_HEAP(ext_dma, dma_heap), "DMA|EXTERNAL request lands in the DMA heap");
+
+    ASSERT_TEST(dmheap_malloc_caps(256, DMHEAP_CAP_EXEC, "caps") == NULL, "No heap has EXEC - request fails");
+    ASSERT_TEST(dmheap_malloc_caps(16 * 1024, DMHEAP_CAP_DMA, "caps") == NULL, "DMA request never spills into non-DMA heaps");
+
+    dmheap_free(NULL, hot, false);
+    dmheap_free(NULL, plain, false);
+    dmheap_free(NULL, ext_dma, false);
+    dmheap_remove_default_context(fast);
+    dmheap_remove_default_context(dma);
+}
+
+static void test_permanent_alloc(void) {
+    TEST_SECTION("Permanent Allocations");
+
+    #define PERM_HEAP_SIZE (8 * 1024)
+    static char perm_heap[PERM_HEAP_SIZE] __attribute__((aligned(16)));
+    dmheap_context_t* ctx = dmheap_init(perm_heap, PERM_HEAP_SIZE, 8);
+    ASSERT_TEST(ctx != NULL, "Init heap for permanent allocations");
+
+    dmheap_stats_t before;
+    dmheap_get_stats(ctx, &before);
+
+    void* table = dmheap_malloc_permanent(ctx, 100, 0, "boot");
+    void* desc = dmheap_malloc_permanent(ctx, 24, 64, "boot");
+    ASSERT_TEST(table != NULL && desc != NULL, "Permanent allocations succeed");
+    ASSERT_TEST(((uintptr_t)desc % 64) == 0, "Permanent allocation honours alignment");
+    ASSERT_TEST((char*)table + 100 <= perm_heap + PERM_HEAP_SIZE && (char*)desc + 24 <= (char*)table,
+                "Permanent region grows down from the top of the heap");
+    memset(table, 0xA5, 100);
+    memset(desc, 0x5A, 24);
+
+    dmheap_module_stats_t mstats;
+    ASSERT_TEST(dmheap_get_module_stats(ctx, "boot", &mstats) == true, "Module stats found for owner");
+    ASSERT_TEST(mstats.permanent_bytes >= 124 && mstats.used_block_count == 0,
+                "Permanent bytes accounted to the module without any block");
+
+    dmheap_stats_t after;
+    dmheap_get_stats(ctx, &after);
+    ASSERT_TEST(after.permanent_bytes == mstats.permanent_bytes, "Heap stats report the permanent region");
+    ASSERT_TEST(after.used_block_count == before.used_block_count + 1, "Only the module record became a new block");
+
+    void* regular = dmheap_malloc(ctx, 128, "boot");
+    ASSERT_TEST(regular != NULL && (char*)regular + 128 <= (char*)desc, "Regular blocks stay below the permanent region");
+    ASSERT_TEST(dmheap_get_module_stats(ctx, "boot", &mstats) && mstats.used_block_count == 1 && mstats.used_bytes >= 128,
+                "Module stats count regular blocks too");
+
+    dmheap_unregister_module(ctx, "boot");
+    ASSERT_TEST(((unsigned char*)table)[99] == 0xA5 && ((unsigned char*)desc)[0] == 0x5A,
+                "Unregistering the module leaves permanent memory alone");
+    ASSERT_TEST(dmheap_get_module_stats(ctx, "boot", &mstats) == false, "No stats after the module is unregistered");
+    dmheap_get_stats(ctx, &after);
+    ASSERT_TEST(after.permanent_bytes >= 124, "Permanent region survives module unregistration");
+
+    void* big = dmheap_malloc_permanent(ctx, PERM_HEAP_SIZE, 0, "boot");
+    ASSERT_TEST(big == NULL, "Oversized permanent request fails");
+    ASSERT_TEST(dmheap_malloc_permanent(ctx, 0, 0, "boot") == NULL, "Zero-size permanent request fails");
+}
+
+static void test_checkpoint_rollback(void) {
+    TEST_SECTION("Checkpoint and Rollback");
+    reset_heap();
+
+    void* keep = dmheap_malloc(NULL, 64, "loader");
+    ASSERT_TEST(keep != NULL, "Allocate block before the checkpoint");
+
+    dmheap_stats_t before;
+    dmheap_get_stats(NULL, &before);
+
+    dmheap_checkpoint_t cp = dmheap_checkpoint(NULL);
+    void* a = dmheap_malloc(NULL, 128, "loader");
+    void* b = dmheap_malloc(NULL, 256, "other");
+    void* c = dmheap_malloc(NULL, 32, NULL);
+    void* d = dmheap_malloc(NULL, 48, "newmod");
+    ASSERT_TEST(a != NULL && b != NULL && c != NULL && d != NULL, "Allocate blocks after the checkpoint");
+    dmheap_free(NULL, b, false);
+
+    size_t freed = dmheap_rollback(NULL, cp);
+    ASSERT_TEST(freed == 3, "Rollback frees the three live blocks allocated since the checkpoint");
+    dmheap_module_stats_t mstats;
+    ASSERT_TEST(dmheap_get_module_stats(NULL, "newmod", &mstats) && mstats.used_block_count == 0,
+                "Modules registered since the checkpoint stay registered, without their blocks");
+
+    dmheap_stats_t after;
+    dmheap_get_stats(NULL, &after);
+    ASSERT_TEST(after.used_block_count == before.used_block_count + 2, "Only the two new module records remain in use");
+
+    memset(keep, 0x11, 64);
+    ASSERT_TEST(dmheap_realloc(NULL, keep, 32, "loader") == keep, "Block from before the checkpoint is still usable");
+    ASSERT_TEST(dmheap_rollback(NULL, cp) == 0, "Second rollback has nothing to free");
+
+    dmheap_free(NULL, keep, false);
+}
+
+static void test_free_index(void) {
+    TEST_SECTION("Free-Block Size Index");
+
+    #define INDEX_HEAP_SIZE (64 * 1024)
+    #define INDEX_BLOCKS 200
+    static char list_heap[INDEX_HEAP_SIZE] __attribute__((aligned(64)));
+    static char index_heap[INDEX_HEAP_SIZE] __attribute__((aligned(64)));
+    static void* list_ptrs[INDEX_BLOCKS];
+    static void* index_ptrs[INDEX_BLOCKS];
+    dmheap_context_t* list_ctx = dmheap_init(list_heap, INDEX_HEAP_SIZE, 8);
+    dmheap_context_t* index_ctx = dmheap_init_ex(index_heap, INDEX_HEAP_SIZE, 8, DMHEAP_FREE_INDEX);
+    ASSERT_TEST(list_ctx != NULL && index_ctx != NULL, "Init heaps with and without the free index");
+
+    // Fragment both heaps the same way: ~100 free holes of assorted sizes.
+    bool ok = true;
+    for (int i = 0; i < INDEX_BLOCKS; i++) {
+        size_t size = 16 + (size_t)((i * 37) % 160);
+        list_ptrs[i] = dmheap_malloc(list_ctx, size, "idx");
+        index_ptrs[i] = dmheap_malloc(index_ctx, size, "idx");
+        ok = ok && list_ptrs[i] != NULL && index_ptrs[i] != NULL;
+    }
+    for (int i = 0; i < INDEX_BLOCKS; i += 2) {
+        dmheap_free(list_ctx, list_ptrs[i], false);
+        dmheap_free(index_ctx, index_ptrs[i], false);
+    }
+    ASSERT_TEST(ok, "Fragment both heaps");
+
+    // Best fit must pick the same block either way. The heaps start at different
+    // offsets (the index lives in front), so compare positions relative to a
+    // block that stays allocated.
+    bool same = true;
+    for (int i = 0; i < INDEX_BLOCKS; i += 2) {
+        size_t size = 8 + (size_t)((i * 53) % 200);
+        list_ptrs[i] = dmheap_malloc(list_ctx, size, "idx");
+        index_ptrs[i] = dmheap_malloc(index_ctx, size, "idx");
+        if ((list_ptrs[i] == NULL) != (index_ptrs[i] == NULL) ||
+            (list_ptrs[i] != NULL && (char*)list_ptrs[i] - (char*)list_ptrs[1] != (char*)index_ptrs[i] - (char*)index_ptrs[1])) {
+            same = false;
+        }
+    }
+    ASSERT_TEST(same, "Indexed heap picks the same blocks as the plain free list");
+
+    void* aligned = dmheap_aligned_alloc(index_ctx, 64, 40, "idx");
+    ASSERT_TEST(aligned != NULL && ((uintptr_t)aligned % 64) == 0, "Indexed search accounts for alignment padding");
+    dmheap_free(index_ctx, aligned, false);
+
+    for (int i = 0; i < INDEX_BLOCKS; i += 2) {
+        dmheap_free(list_ctx, list_ptrs[i], false);
+        dmheap_free(index_ctx, index_ptrs[i], false);
+    }
+
+    // Leave one hole just above all the others: every request below then has to
+    // skip ~100 smaller holes before it finds it.
+    dmheap_free(list_ctx, dmheap_malloc(list_ctx, 192, "idx"), false);
+    dmheap_free(index_ctx, dmheap_malloc(index_ctx, 192, "idx"), false);
+    const int rounds = 20000;
+    clock_t start = clock();
+    for (int i = 0; i < rounds; i++) {
+        dmheap_free(list_ctx, dmheap_malloc(list_ctx, 184, "idx"), false);
+    }
+    double list_us = ((double)(clock() - start)) / CLOCKS_PER_SEC * 1000000.0;
+    start = clock();
+    for (int i = 0; i < rounds; i++) {
+        dmheap_free(index_ctx, dmheap_malloc(index_ctx, 184, "idx"), false);
+    }
+    double index_us = ((double)(clock() - start)) / CLOCKS_PER_SEC * 1000000.0;
+    TEST_BENCH("malloc+free past ~100 holes: list %.3f us/op, index %.3f us/op",
+               list_us / rounds, index_us / rounds);
+
+    dmheap_concatenate_free_blocks(index_ctx);
+    void* big = dmheap_malloc(index_ctx, INDEX_HEAP_SIZE / 4, "idx");
+    ASSERT_TEST(big != NULL, "Index survives concatenation");
+    dmheap_free(index_ctx, big, false);
+
+    dmheap_remove_default_context(list_ctx);
+    dmheap_remove_default_context(index_ctx);
+}
+
+static void test_separate_metadata(void) {
+    TEST_SECTION("Out-of-Band Metadata");
+
+    #define OOB_HEAP_SIZE (16 * 1024)
+    static char oob_heap[OOB_HEAP_SIZE] __attribute__((aligned(16)));
+    dmheap_context_t* ctx = dmheap_init_ex(oob_heap, OOB_HEAP_SIZE, 8, DMHEAP_SEPARATE_METADATA);
+    ASSERT_TEST(ctx != NULL, "Init heap with out-of-band metadata");
+    ASSERT_TEST(dmheap_register_module(ctx, "oob"), "Register the module up front");
+
+    dmheap_stats_t before;
+    dmheap_get_stats(ctx, &before);
+
+    char* a = dmheap_malloc(ctx, 64, "oob");
+    char* b = dmheap_malloc(ctx, 64, "oob");
+    ASSERT_TEST(a != NULL && b != NULL, "Allocate two blocks");
+    ASSERT_TEST(b == a + 64, "Neighbouring allocations are contiguous - no header in between");
+
+    // Overrun a into b: with inline headers this would clobber b's block_t.
+    memset(a, 0xFF, 96);
+    dmheap_free(ctx, b, false);
+    dmheap_free(ctx, a, true);
+
+    dmheap_stats_t after;
+    dmheap_get_stats(ctx, &after);
+    ASSERT_TEST(after.free_bytes == before.free_bytes && after.used_block_count == before.used_block_count,
+                "Overrun left the allocator intact");
+    ASSERT_TEST(after.free_block_count == 1, "Coalescing still merges everything back");
+
+    void* aligned = dmheap_aligned_alloc(ctx, 128, 100, "oob");
+    ASSERT_TEST(aligned != NULL && ((uintptr_t)aligned % 128) == 0, "Aligned allocation without header room");
+    dmheap_free(ctx, aligned, true);
+
+    // A block per 16 bytes needs more headers than the table has (one per 64).
+    static void* ptrs[1024];
+    int count = 0;
+    while (count < 1024 && (ptrs[count] = dmheap_malloc(ctx, 8, "oob")) != NULL) {
+        count++;
+    }
+    ASSERT_TEST(count > 0 && count < 1024, "Allocations stop cleanly when the header table is full");
+    for (int i = 0; i < count; i++) {
+        dmheap_free(ctx, ptrs[i], false);
+    }
+    dmheap_concatenate_free_blocks(ctx);
+    void* big = dmheap_malloc(ctx, OOB_HEAP_SIZE / 2, "oob");
+    ASSERT_TEST(big != NULL, "Headers are recycled when blocks merge");
+    dmheap_free(ctx, big, false);
+
+    dmheap_remove_default_context(ctx);
+}
+
+static size_t count_blocks_visitor_calls;
+static void count_blocks_visitor(void* address, size_t size, const char* owner, void* user_data) {
+    (void)address; (void)size; (void)owner; (void)user_data;
+    count_blocks_visitor_calls++;
+}
+
+static void test_buddy_engine(void) {
+    TEST_SECTION("Buddy Engine");
+
+    #define BUDDY_HEAP_SIZE (64 * 1024)
+    static char buddy_heap[BUDDY_HEAP_SIZE] __attribute__((aligned(256)));
+    dmheap_context_t* ctx = dmheap_init_ex(buddy_heap, BUDDY_HEAP_SIZE, 8, DMHEAP_ENGINE_BUDDY);
+    ASSERT_TEST(ctx != NULL, "Init heap with the buddy engine");
+    ASSERT_TEST(dmheap_register_module(ctx, "pkt"), "Register module on buddy heap");
+
+    dmheap_stats_t initial;
+    dmheap_get_stats(ctx, &initial);
+
+    void* a = dmheap_malloc(ctx, 100, "pkt");
+    void* b = dmheap_malloc(ctx, 1024, "pkt");
+    void* c = dmheap_aligned_alloc(ctx, 256, 40, "pkt");
+    ASSERT_TEST(a != NULL && b != NULL && c != NULL, "Allocate from buddy heap");
+    ASSERT_TEST(((uintptr_t)a % 128) == 0 && ((uintptr_t)b % 256) == 0, "Buddy blocks are aligned to their own size");
+    ASSERT_TEST(((uintptr_t)c % 256) == 0, "Aligned request gets a naturally aligned block");
+    ASSERT_TEST(dmheap_aligned_alloc(ctx, 4096, 40, "pkt") == NULL, "Alignment above the heap's own is refused");
+
+    dmheap_module_stats_t mstats;
+    ASSERT_TEST(dmheap_get_module_stats(ctx, "pkt", &mstats) && mstats.used_block_count == 3 &&
+                mstats.used_bytes == 128 + 1024 + 256, "Module tracking sees power-of-two blocks");
+
+    ASSERT_TEST(dmheap_realloc(ctx, a, 120, "pkt") == a, "Realloc within the block stays in place");
+    void* grown = dmheap_realloc(ctx, a, 600, "pkt");
+    ASSERT_TEST(grown != NULL && ((uintptr_t)grown % 256) == 0, "Realloc beyond the block moves it");
+
+    count_blocks_visitor_calls = 0;
+    dmheap_for_each_used_block(ctx, count_blocks_visitor, NULL);
+    ASSERT_TEST(count_blocks_visitor_calls == 4, "Used-block visitor sees module record plus three blocks");
+
+    dmheap_free(ctx, grown, false);
+    dmheap_free(ctx, b, false);
+    dmheap_free(ctx, c, false);
+
+    dmheap_stats_t after;
+    dmheap_get_stats(ctx, &after);
+    ASSERT_TEST(after.free_bytes == initial.free_bytes && after.free_block_count == initial.free_block_count &&
+                after.largest_free_block == initial.largest_free_block, "Freed buddies merge back completely");
+
+    count_blocks_visitor_calls = 0;
+    dmheap_for_each_free_block(ctx, count_blocks_visitor, NULL);
+    ASSERT_TEST(count_blocks_visitor_calls == after.free_block_count, "Free-block visitor walks the buddy lists");
+
+    dmheap_unregister_module(ctx, "pkt");
+    dmheap_get_stats(ctx, &after);
+    ASSERT_TEST(after.used_block_count == 0 && after.free_block_count <= initial.free_block_count,
+                "Unregistering the module returns its record too");
+
+    // Every block needs a header from the pool - even the smallest ones.
+    size_t filled = 0;
+    while (dmheap_malloc(ctx, 1, NULL) != NULL) {
+        filled++;
+    }
+    dmheap_get_stats(ctx, &initial);
+    ASSERT_TEST(filled == initial.used_block_count && initial.used_bytes >= after.free_bytes - after.free_bytes / 100,
+                "A buddy heap of minimum-size blocks fills almost all of its arena");
+
+    dmheap_remove_default_context(ctx);
+}
+
+// Lock callbacks that count calls and catch nested locking
+typedef struct {
+    int locks;
+    int unlocks;
+    int depth;
+    int max_depth;
+} lock_counter_t;
+
+static void counting_lock(void* user_data) {
+    lock_counter_t* counter = (lock_counter_t*)user_data;
+    counter->locks++;
+    if (++counter->depth > counter->max_depth) {
+        counter->max_depth = counter->depth;
+    }
+}
+
+static void counting_unlock(void* user_data) {
+    lock_counter_t* counter = (lock_counter_t*)user_data;
+    counter->unlocks++;
+    counter->depth--;
+}
+
+#define LOCK_THREADS 4
+#define LOCK_HEAP_SIZE (64 * 1024)
+static char lock_heaps[LOCK_THREADS][LOCK_HEAP_SIZE] __attribute__((aligned(64)));
+
+typedef struct {
+    dmheap_context_t* ctx;
+    int rounds;
+    int failures;
+} lock_worker_t;
+
+// Allocation churn run by every thread of the lock tests and benchmarks
+static void* lock_worker(void* arg) {
+    lock_worker_t* worker = (lock_worker_t*)arg;
+    void* slots[16] = { 0 };
+    for (int i = 0; i < worker->rounds; i++) {
+        int slot = i % 16;
+        if (slots[slot] != NULL) {
+            dmheap_free(worker->ctx, slots[slot], false);
+        }
+        slots[slot] = dmheap_malloc(worker->ctx, 16 + (size_t)(i % 7) * 24, "locks");
+        worker->failures += slots[slot] == NULL;
+    }
+    for (int i = 0; i < 16; i++) {
+        if (slots[i] != NULL) {
+            dmheap_free(worker->ctx, slots[i], false);
+        }
+    }
+    return NULL;
+}
+
+// Run lock_worker on LOCK_THREADS threads, all on ctx or each on its own heap
+static double run_lock_workers(dmheap_context_t** heaps, int heap_count, int rounds, int* failures) {
+    pthread_t threads[LOCK_THREADS];
+    lock_worker_t workers[LOCK_THREADS];
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < LOCK_THREADS; i++) {
+        workers[i].ctx = heaps[i % heap_count];
+        workers[i].rounds = rounds;
+        workers[i].failures = 0;
+        pthread_create(&threads[i], NULL, lock_worker, &workers[i]);
+    }
+    *failures = 0;
+    for (int i = 0; i < LOCK_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+        *failures += workers[i].failures;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start.tv_sec) * 1000000.0 + (end.tv_nsec - start.tv_nsec) / 1000.0;
+}
+
+// Test: Per-context lock strategies
+static void test_lock_strategies(void) {
+    TEST_SECTION("Lock Strategies");
+
+    dmheap_context_t* ctx = dmheap_init_ex(lock_heaps[0], LOCK_HEAP_SIZE, 8, 0);
+    lock_counter_t counter = { 0 };
+    ASSERT_TEST(!dmheap_set_lock(ctx, counting_lock, NULL, &counter), "set_lock rejects a lock without unlock");
+    ASSERT_TEST(dmheap_set_lock(ctx, counting_lock, counting_unlock, &counter), "Install counting lock callbacks");
+
+    dmheap_register_module(ctx, "locks");
+    void* a = dmheap_malloc(ctx, 64, "locks");
+    a = dmheap_realloc(ctx, a, 4096, "locks");
+    dmheap_stats_t stats;
+    dmheap_get_stats(ctx, &stats);
+    dmheap_free(ctx, a, true);
+    dmheap_rollback(ctx, dmheap_checkpoint(ctx));
+    ASSERT_TEST(a != NULL && counter.locks >= 5, "Heap calls go through the lock callbacks");
+    ASSERT_TEST(counter.locks == counter.unlocks, "Every lock is paired with an unlock");
+    ASSERT_TEST(counter.max_depth == 1, "Heap never takes its own lock twice");
+
+    int locks_before = counter.locks;
+    ASSERT_TEST(dmheap_set_lock(ctx, NULL, NULL, NULL), "set_lock(NULL) restores the built-in lock");
+    dmheap_free(ctx, dmheap_malloc(ctx, 32, "locks"), false);
+    ASSERT_TEST(counter.locks == locks_before, "Callbacks no longer called after restore");
+    dmheap_remove_default_context(ctx);
+
+    ctx = dmheap_init_ex(lock_heaps[0], LOCK_HEAP_SIZE, 8, DMHEAP_LOCK_NONE);
+    a = dmheap_malloc(ctx, 128, "locks");
+    ASSERT_TEST(a != NULL && dmheap_realloc(ctx, a, 256, "locks") != NULL, "Unlocked heap allocates and reallocates");
+    dmheap_remove_default_context(ctx);
+
+    // Four threads hammering one spin-locked heap must leave it intact.
+    ctx = dmheap_init_ex(lock_heaps[0], LOCK_HEAP_SIZE, 8, DMHEAP_LOCK_SPIN);
+    dmheap_register_module(ctx, "locks");
+    dmheap_stats_t before, after;
+    dmheap_get_stats(ctx, &before);
+    int failures = 0;
+    run_lock_workers(&ctx, 1, 5000, &failures);
+    dmheap_get_stats(ctx, &after);
+    ASSERT_TEST(failures == 0, "Spin-locked heap serves every thread");
+    ASSERT_TEST(after.used_block_count == before.used_block_count, "Spin-locked heap has no leaked or lost blocks");
+    dmheap_remove_default_context(ctx);
+}
+
+// Running statistics agree with a full walk (largest/smallest are walk-only)
+static bool peek_matches_walk(dmheap_context_t* ctx) {
+    dmheap_stats_t walked, peeked;
+    if (!dmheap_get_stats(ctx, &walked) || !dmheap_peek_stats(ctx, &peeked)) {
+        return false;
+    }
+    return walked.heap_size == peeked.heap_size &&
+           walked.free_bytes == peeked.free_bytes &&
+           walked.used_bytes == peeked.used_bytes &&
+           walked.free_block_count == peeked.free_block_count &&
+           walked.used_block_count == peeked.used_block_count &&
+           walked.large_used_bytes == peeked.large_used_bytes &&
+           walked.large_free_bytes == peeked.large_free_bytes &&
+           walked.permanent_bytes == peeked.permanent_bytes &&
+           peeked.largest_free_block == 0 && peeked.smallest_free_block == 0;
+}
+
+// Mixed workload touching every path that moves blocks between states
+static bool peek_workload(dmheap_context_t* ctx) {
+    bool ok = true;
+    void* slots[24] = { 0 };
+    dmheap_checkpoint_t checkpoint = dmheap_checkpoint(ctx);
+    for (int i = 0; i < 24; i++) {
+        slots[i] = (i % 5 == 0) ? dmheap_aligned_alloc(ctx, 64, 40 + i * 8, "peek")
+                                : dmheap_malloc(ctx, 24 + i * 16, i % 2 ? "peek" : "peek2");
+    }
+    ok = ok && peek_matches_walk(ctx);
+    for (int i = 0; i < 24; i += 3) {
+        dmheap_free(ctx, slots[i], false);
+        slots[i] = NULL;
+    }
+    slots[1] = dmheap_realloc(ctx, slots[1], 8, "peek");
+    slots[2] = dmheap_realloc(ctx, slots[2], 2048, "peek");
+    ok = ok && peek_matches_walk(ctx);
+    dmheap_unregister_module(ctx, "peek2");
+    ok = ok && peek_matches_walk(ctx);
+    dmheap_rollback(ctx, checkpoint);
+    dmheap_concatenate_free_blocks(ctx);
+    return ok && peek_matches_walk(ctx);
+}
+
+typedef struct {
+    dmheap_context_t* ctx;
+    volatile int stop;
+} peek_writer_t;
+
+static void* peek_writer(void* arg) {
+    peek_writer_t* writer = (peek_writer_t*)arg;
+    void* slots[16] = { 0 };
+    for (int i = 0; !writer->stop; i++) {
+        int slot = i % 16;
+        if (slots[slot] != NULL) {
+            dmheap_free(writer->ctx, slots[slot], (i % 64) == 0);
+        }
+        slots[slot] = dmheap_malloc(writer->ctx, 16 + (size_t)(i % 9) * 40, "peek");
+    }
+    for (int i = 0; i < 16; i++) {
+        if (slots[i] != NULL) {
+            dmheap_free(writer->ctx, slots[i], false);
+        }
+    }
+    return NULL;
+}
+
+// Test: Lock-free statistics
+static void test_peek_stats(void) {
+    TEST_SECTION("Lock-Free Statistics");
+
+    #define PEEK_HEAP_SIZE (128 * 1024)
+    static char peek_heap[PEEK_HEAP_SIZE] __attribute__((aligned(256)));
+    const char* names[4] = { "plain", "free index", "out-of-band", "buddy" };
+    const uint32_t flags[4] = { 0, DMHEAP_FREE_INDEX, DMHEAP_SEPARATE_METADATA, DMHEAP_ENGINE_BUDDY };
+    char message[96];
+
+    dmheap_stats_t stats;
+    ASSERT_TEST(!dmheap_peek_stats(NULL, NULL), "peek_stats rejects a NULL output");
+
+    for (int mode = 0; mode < 4; mode++) {
+        dmheap_context_t* ctx = dmheap_init_ex(peek_heap, PEEK_HEAP_SIZE, 8, flags[mode]);
+        snprintf(message, sizeof(message), "%s heap: counters match a walk right after init", names[mode]);
+        ASSERT_TEST(peek_matches_walk(ctx), message);
+        if (mode == 0) {
+            dmheap_set_large_region(ctx, 16 * 1024, 32 * 1024);
+            dmheap_malloc_permanent(ctx, 200, 0, "peek");
+            void* big = dmheap_malloc(ctx, 20 * 1024, "peek");
+            ASSERT_TEST(big != NULL && peek_matches_walk(ctx), "Counters follow large and permanent allocations");
+        }
+        snprintf(message, sizeof(message), "%s heap: counters match a walk through a mixed workload", names[mode]);
+        ASSERT_TEST(peek_workload(ctx), message);
+        dmheap_remove_default_context(ctx);
+    }
+
+    // A reader racing a writer never sees a torn snapshot: on a plain heap with
+    // no large or permanent region, data plus headers always add up to the heap.
+    dmheap_context_t* ctx = dmheap_init_ex(peek_heap, PEEK_HEAP_SIZE, 8, DMHEAP_LOCK_SPIN);
+    dmheap_peek_stats(ctx, &stats);
+    size_t header = stats.heap_size - stats.free_bytes;
+    peek_writer_t writer = { ctx, 0 };
+    pthread_t thread;
+    pthread_create(&thread, NULL, peek_writer, &writer);
+    int reads = 0, torn = 0;
+    for (int i = 0; i < 200000; i++) {
+        if (dmheap_peek_stats(ctx, &stats)) {
+            reads++;
+            size_t blocks = stats.used_block_count + stats.free_block_count;
+            torn += stats.used_bytes + stats.free_bytes + blocks * header != stats.heap_size;
+        }
+    }
+    writer.stop = 1;
+    pthread_join(thread, NULL);
+    TEST_INFO("%d consistent reads while another thread allocated", reads);
+    ASSERT_TEST(reads > 0 && torn == 0, "Concurrent readers never see a torn snapshot");
+    ASSERT_TEST(peek_matches_walk(ctx), "Counters match a walk after the race");
+    dmheap_remove_default_context(ctx);
+}
+
 // Performance benchmark
 static void benchmark_allocations(void) {
     TEST_SECTION("Performance Benchmark");
@@ -687,6 +1330,1306 @@ static void benchmark_allocations(void) {
     }
 }
 
+// Buddy vs free-list engine on power-of-two workloads (packet buffers)
+static void benchmark_buddy_engine(void) {
+    TEST_SECTION("Buddy Engine Benchmark");
+
+    #define ENGINE_HEAP_SIZE (256 * 1024)
+    #define ENGINE_SLOTS 128
+    static char engine_heap[ENGINE_HEAP_SIZE] __attribute__((aligned(64)));
+    static void* slots[ENGINE_SLOTS];
+    const char* names[2] = { "list", "buddy" };
+    const uint32_t flags[2] = { 0, DMHEAP_ENGINE_BUDDY };
+    const int rounds = 20000;
+
+    for (int engine = 0; engine < 2; engine++) {
+        dmheap_context_t* ctx = dmheap_init_ex(engine_heap, ENGINE_HEAP_SIZE, 64, flags[engine]);
+        dmheap_register_module(ctx, "bench");
+        memset(slots, 0, sizeof(slots));
+
+        // Random replacement of power-of-two buffers from 64 to 2048 bytes.
+        uint32_t seed = 12345;
+        int failures = 0;
+        clock_t start = clock();
+        for (int i = 0; i < rounds; i++) {
+            seed = seed * 1103515245u + 12345u;
+            int slot = (int)((seed >> 8) % ENGINE_SLOTS);
+            size_t size = (size_t)64 << ((seed >> 20) % 6);
+            if (slots[slot] != NULL) {
+                dmheap_free(ctx, slots[slot], false);
+            }
+            slots[slot] = dmheap_malloc(ctx, size, "bench");
+            failures += slots[slot] == NULL;
+        }
+        double us = ((double)(clock() - start)) / CLOCKS_PER_SEC * 1000000.0;
+        TEST_BENCH("%s engine: %d power-of-two free+malloc pairs: %.2f us (%.3f us per pair, %d failed)",
+                   names[engine], rounds, us, us / rounds, failures);
+
+        // 64-byte aligned requests: the list engine has to carve padding.
+        for (int i = 0; i < ENGINE_SLOTS; i++) {
+            if (slots[i] != NULL) {
+                dmheap_free(ctx, slots[i], false);
+                slots[i] = NULL;
+            }
+        }
+        start = clock();
+        int allocated = 0;
+        for (int i = 0; i < ENGINE_SLOTS; i++) {
+            slots[i] = dmheap_aligned_alloc(ctx, 64, 200, "bench");
+            allocated += slots[i] != NULL;
+        }
+        us = ((double)(clock() - start)) / CLOCKS_PER_SEC * 1000000.0;
+        TEST_BENCH("%s engine: %d aligned_alloc(64, 200): %.2f us (%.3f us per operation)",
+                   names[engine], allocated, us, allocated > 0 ? us / allocated : 0.0);
+
+        dmheap_remove_default_context(ctx);
+    }
+}
+
+// Shard selector that moves on to the next shard on every allocation
+static size_t rotating_selector(void* user_data) {
+    return (*(size_t*)user_data)++;
+}
+
+static void count_block(void* address, size_t size, const char* module_name, void* user_data) {
+    (void)address; (void)size; (void)module_name;
+    (*(size_t*)user_data)++;
+}
+
+// Test: Sharded heap presents several sub-heaps as one context
+static void test_sharded_heap(void) {
+    TEST_SECTION("Sharded Heap");
+
+    ASSERT_TEST(dmheap_init_sharded(lock_heaps, sizeof(lock_heaps), 8, 0, 0) == NULL, "Zero shards rejected");
+    ASSERT_TEST(dmheap_init_sharded(lock_heaps, 256, 8, 4, 0) == NULL, "Buffer too small for the shards rejected");
+
+    dmheap_context_t* ctx = dmheap_init_sharded(lock_heaps, sizeof(lock_heaps), 8, LOCK_THREADS, DMHEAP_LOCK_SPIN);
+    ASSERT_TEST(ctx != NULL, "Initialize a four-shard heap");
+    ASSERT_TEST(!dmheap_set_large_region(ctx, 4096, 16384), "Large region refused on a sharded heap");
+    ASSERT_TEST(!dmheap_set_shard_selector(NULL, rotating_selector, NULL), "Shard selector needs a sharded heap");
+
+    dmheap_stats_t stats;
+    dmheap_get_stats(ctx, &stats);
+    ASSERT_TEST(stats.heap_size > sizeof(lock_heaps) / 8 * 7 && stats.free_block_count == LOCK_THREADS,
+                "Stats cover every shard");
+
+    // Everything goes to shard 0 first, so this only fits by stealing from the others.
+    dmheap_register_module(ctx, "shard");
+    void* big[12] = { 0 };
+    int failures = 0;
+    for (int i = 0; i < 12; i++) {
+        big[i] = dmheap_malloc(ctx, 16 * 1024, "shard");
+        failures += big[i] == NULL;
+    }
+    ASSERT_TEST(failures == 0, "Full home shard steals from its siblings");
+    for (int i = 0; i < 12; i++) {
+        dmheap_free(NULL, big[i], false);
+    }
+    dmheap_concatenate_free_blocks(ctx);
+    dmheap_module_stats_t module_stats;
+    dmheap_get_module_stats(ctx, "shard", &module_stats);
+    ASSERT_TEST(module_stats.used_block_count == 0, "Frees through the default list reach the owning shard");
+
+    size_t next = 0;
+    ASSERT_TEST(dmheap_set_shard_selector(ctx, rotating_selector, &next), "Install a rotating shard selector");
+    char* a = dmheap_malloc(ctx, 100, "shard");
+    next = 0;
+    void* b = dmheap_malloc(ctx, 100, "shard");  // right behind a, so a cannot grow in place
+    memset(a, 0x5A, 100);
+    char* moved = dmheap_realloc(ctx, a, 40 * 1024, "shard");
+    bool intact = moved != NULL && moved != a;
+    for (int i = 0; intact && i < 100; i++) {
+        intact = moved[i] == 0x5A;
+    }
+    ASSERT_TEST(intact, "Realloc moves a block between shards with its data");
+    ASSERT_TEST(dmheap_retag(ctx, b, "shard2"), "Retag finds the owning shard");
+
+    size_t visited = 0;
+    dmheap_for_each_used_block(ctx, count_block, &visited);
+    dmheap_get_stats(ctx, &stats);
+    ASSERT_TEST(visited == stats.used_block_count, "Visitors walk every shard");
+    ASSERT_TEST(peek_matches_walk(ctx), "Peeked stats match the walk across shards");
+
+    dmheap_unregister_module(ctx, "shard");
+    dmheap_unregister_module(ctx, "shard2");
+    ASSERT_TEST(!dmheap_get_module_stats(ctx, "shard", &module_stats), "Unregister removes the module from every shard");
+    dmheap_set_shard_selector(ctx, NULL, NULL);
+
+    dmheap_stats_t before, after;
+    dmheap_register_module(ctx, "locks");
+    dmheap_get_stats(ctx, &before);
+    run_lock_workers(&ctx, 1, 5000, &failures);
+    dmheap_get_stats(ctx, &after);
+    ASSERT_TEST(failures == 0, "Sharded heap serves every thread");
+    ASSERT_TEST(after.used_block_count == before.used_block_count, "Sharded heap has no leaked or lost blocks");
+    dmheap_remove_default_context(ctx);
+}
+
+// Counts histograms and requests seen by dmheap_for_each_request_histogram()
+typedef struct {
+    int histograms;
+    int untracked;
+    uint32_t requests;
+} request_tally_t;
+
+static void tally_requests(const char* module_name, const dmheap_request_histogram_t* histogram, void* user_data) {
+    request_tally_t* tally = (request_tally_t*)user_data;
+    tally->histograms++;
+    tally->untracked += module_name == NULL;
+    tally->requests += histogram->requests;
+}
+
+// Test: Request-size histogram
+static void test_request_histogram(void) {
+    TEST_SECTION("Request Histogram");
+
+    dmheap_request_histogram_t histogram;
+    dmheap_context_t* ctx = dmheap_init_ex(lock_heaps[0], LOCK_HEAP_SIZE, 8, 0);
+    dmheap_malloc(ctx, 64, "req_a");
+    ASSERT_TEST(!dmheap_get_request_histogram(ctx, NULL, &histogram), "No histogram without DMHEAP_REQUEST_HISTOGRAM");
+    dmheap_remove_default_context(ctx);
+
+    ctx = dmheap_init_ex(lock_heaps[0], LOCK_HEAP_SIZE, 8, DMHEAP_REQUEST_HISTOGRAM);
+    dmheap_malloc(ctx, 1, "req_a");
+    dmheap_malloc(ctx, 24, "req_a");
+    dmheap_calloc(ctx, 10, 10, "req_a");
+    dmheap_malloc(ctx, 100, "req_b");
+    dmheap_aligned_alloc(ctx, 64, 40, "req_b");
+    dmheap_malloc(ctx, 300, NULL);
+
+    ASSERT_TEST(dmheap_get_request_histogram(ctx, "req_a", &histogram) && histogram.requests == 3, "Module histogram counts its requests");
+    ASSERT_TEST(histogram.size[0] == 1 && histogram.size[4] == 1 && histogram.size[6] == 1, "Sizes land in their log2 buckets");
+    ASSERT_TEST(histogram.alignment[3] == 3, "Default alignment counted");
+    ASSERT_TEST(dmheap_get_request_histogram(ctx, "req_b", &histogram) && histogram.requests == 2 &&
+                histogram.size[5] == 1 && histogram.alignment[6] == 1, "Aligned request counted with its alignment");
+    ASSERT_TEST(dmheap_get_request_histogram(ctx, NULL, &histogram) && histogram.requests == 6 && histogram.size[8] == 1,
+                "Heap histogram includes untracked requests");
+    ASSERT_TEST(!dmheap_get_request_histogram(ctx, "req_missing", &histogram), "Unknown module has no histogram");
+    ASSERT_TEST(dmheap_get_request_histogram(NULL, "req_a", &histogram) && histogram.requests == 3, "Default heaps are searched");
+
+    request_tally_t tally = { 0 };
+    dmheap_for_each_request_histogram(ctx, tally_requests, &tally);
+    ASSERT_TEST(tally.histograms == 3 && tally.untracked == 1 && tally.requests == 6, "Visitor sees every module and untracked requests");
+
+    dmheap_reset_request_histogram(ctx);
+    ASSERT_TEST(dmheap_get_request_histogram(ctx, NULL, &histogram) && histogram.requests == 0, "Reset clears every histogram");
+    dmheap_malloc(ctx, 1 << 20, "req_a");
+    dmheap_get_request_histogram(ctx, NULL, &histogram);
+    ASSERT_TEST(histogram.requests == 0, "Failed requests are not counted");
+    dmheap_remove_default_context(ctx);
+}
+
+static void test_peaks(void) {
+    TEST_SECTION("High-Water Marks");
+
+    dmheap_stats_t stats;
+    dmheap_module_stats_t module_stats;
+    dmheap_context_t* ctx = dmheap_init_ex(lock_heaps[0], LOCK_HEAP_SIZE, 8, 0);
+    dmheap_get_stats(ctx, &stats);
+    size_t initial_largest = stats.largest_free_block;
+    ASSERT_TEST(stats.peak_used_bytes == 0 && stats.peak_used_block_count == 0 &&
+                stats.min_largest_free_block == initial_largest, "Fresh heap peaks match its current state");
+
+    void* a = dmheap_malloc(ctx, 1000, "peak_a");
+    void* b = dmheap_malloc(ctx, 2000, "peak_a");
+    void* c = dmheap_malloc(ctx, 500, "peak_b");
+    dmheap_get_stats(ctx, &stats);
+    size_t busy_bytes = stats.used_bytes;
+    size_t busy_blocks = stats.used_block_count;
+    size_t busy_largest = stats.largest_free_block;
+    dmheap_free(ctx, a, false);
+    dmheap_free(ctx, b, false);
+
+    dmheap_get_stats(ctx, &stats);
+    ASSERT_TEST(stats.peak_used_bytes == busy_bytes && stats.peak_used_block_count == busy_blocks, "Peaks survive frees");
+    ASSERT_TEST(stats.min_largest_free_block == busy_largest && busy_largest < initial_largest, "Minimum largest free block recorded");
+    ASSERT_TEST(dmheap_peek_stats(ctx, &stats) && stats.peak_used_bytes == busy_bytes &&
+                stats.min_largest_free_block == busy_largest, "Peek reports the same peaks");
+    ASSERT_TEST(dmheap_get_module_stats(ctx, "peak_a", &module_stats) && module_stats.used_bytes == 0 &&
+                module_stats.peak_used_bytes >= 3000 && module_stats.peak_used_block_count == 2, "Module peaks survive frees");
+
+    dmheap_reset_peaks(ctx);
+    dmheap_get_stats(ctx, &stats);
+    ASSERT_TEST(stats.peak_used_bytes == stats.used_bytes && stats.peak_used_block_count == stats.used_block_count &&
+                stats.min_largest_free_block == stats.largest_free_block, "Reset restarts heap peaks from current values");
+    dmheap_get_module_stats(ctx, "peak_a", &module_stats);
+    ASSERT_TEST(module_stats.peak_used_bytes == 0 && module_stats.peak_used_block_count == 0, "Reset restarts module peaks");
+    dmheap_get_module_stats(ctx, "peak_b", &module_stats);
+    ASSERT_TEST(module_stats.peak_used_bytes == module_stats.used_bytes && module_stats.peak_used_block_count == 1,
+                "Reset keeps live module usage as its peak");
+
+    a = dmheap_realloc(ctx, c, 4000, "peak_b");
+    dmheap_get_module_stats(ctx, "peak_b", &module_stats);
+    ASSERT_TEST(a != NULL && module_stats.peak_used_bytes >= 4000 && module_stats.used_block_count == 1, "Realloc growth raises the module peak");
+    dmheap_free(ctx, a, false);
+    dmheap_remove_default_context(ctx);
+
+    ctx = dmheap_init_ex(lock_heaps[0], LOCK_HEAP_SIZE, 8, DMHEAP_ENGINE_BUDDY);
+    dmheap_get_stats(ctx, &stats);
+    initial_largest = stats.largest_free_block;
+    dmheap_free(ctx, dmheap_malloc(ctx, initial_largest / 2 + 1, NULL), false);
+    dmheap_get_stats(ctx, &stats);
+    ASSERT_TEST(stats.largest_free_block == initial_largest && stats.min_largest_free_block < initial_largest,
+                "Buddy heap records the split it merged back");
+    dmheap_remove_default_context(ctx);
+
+    ctx = dmheap_init_sharded(lock_heaps, sizeof(lock_heaps), 8, LOCK_THREADS, 0);
+    for (int i = 0; i < LOCK_THREADS; i++) {
+        dmheap_free(ctx, dmheap_malloc(ctx, 256, "peak_a"), false);
+    }
+    dmheap_get_stats(ctx, &stats);
+    ASSERT_TEST(stats.peak_used_bytes >= stats.used_bytes + 256 && stats.min_largest_free_block > 0,
+                "Sharded heap aggregates its shards' peaks");
+    dmheap_reset_peaks(NULL);
+    dmheap_get_stats(ctx, &stats);
+    ASSERT_TEST(stats.peak_used_bytes == stats.used_bytes, "Default-list reset reaches every shard");
+    dmheap_remove_default_context(ctx);
+}
+
+static void test_history(void) {
+    TEST_SECTION("Occupancy History");
+
+    dmheap_sample_t samples[8];
+    dmheap_stats_t stats;
+    dmheap_context_t* ctx = dmheap_init_ex(lock_heaps[0], LOCK_HEAP_SIZE, 8, 0);
+    ASSERT_TEST(!dmheap_record_sample(ctx) && dmheap_get_history(ctx, samples, 8) == 0, "No history until configured");
+    ASSERT_TEST(!dmheap_set_history(NULL, 4, 0), "History needs an explicit heap");
+
+    ASSERT_TEST(dmheap_set_history(ctx, 4, 0), "Configure a timer-driven history");
+    ASSERT_TEST(dmheap_get_history(ctx, samples, 8) == 0, "Timer-driven history starts empty");
+    ASSERT_TEST(dmheap_record_sample(ctx), "Record a sample");
+    void* a = dmheap_malloc(ctx, 1000, "hist_a");
+    dmheap_record_sample(NULL);
+    ASSERT_TEST(dmheap_get_history(ctx, samples, 8) == 2, "Both samples kept");
+    ASSERT_TEST(samples[1].used_bytes >= samples[0].used_bytes + 1000 &&
+                samples[1].alloc_count > samples[0].alloc_count &&
+                samples[1].largest_free_block < samples[0].largest_free_block, "Samples follow the heap's occupancy");
+
+    for (int i = 0; i < 5; i++) {
+        dmheap_record_sample(ctx);
+    }
+    dmheap_free(ctx, a, false);
+    dmheap_record_sample(ctx);
+    dmheap_peek_stats(ctx, &stats);
+    ASSERT_TEST(dmheap_get_history(ctx, samples, 8) == 4, "Full ring keeps the newest samples");
+    ASSERT_TEST(samples[3].used_bytes == stats.used_bytes && samples[3].free_bytes == stats.free_bytes &&
+                samples[3].free_count == samples[2].free_count + 1, "Newest sample is last");
+    ASSERT_TEST(dmheap_get_history(ctx, samples, 2) == 2 && samples[1].used_bytes == stats.used_bytes, "Short buffer gets the newest samples");
+
+    ASSERT_TEST(dmheap_set_history(ctx, 8, 2), "Configure an operation-driven history");
+    dmheap_checkpoint_t cp = dmheap_checkpoint(ctx);
+    a = dmheap_malloc(ctx, 64, "hist_a");
+    void* b = dmheap_malloc(ctx, 64, "hist_a");
+    ASSERT_TEST(dmheap_get_history(ctx, samples, 8) == 2 &&
+                samples[1].alloc_count == samples[0].alloc_count + 2, "Sample taken every interval operations");
+    ASSERT_TEST(dmheap_rollback(ctx, cp) == 2 && dmheap_record_sample(ctx), "Rollback leaves the ring alone");
+    ASSERT_TEST(dmheap_get_history(ctx, samples, 8) == 4 && samples[3].free_count == samples[1].free_count + 2,
+                "Rolled back blocks count as frees");
+    (void)b;
+
+    dmheap_get_stats(ctx, &stats);
+    size_t used_blocks = stats.used_block_count;
+    ASSERT_TEST(dmheap_set_history(ctx, 0, 0) && !dmheap_record_sample(ctx), "Capacity 0 switches history off");
+    dmheap_get_stats(ctx, &stats);
+    ASSERT_TEST(stats.used_block_count == used_blocks - 1, "Ring returned to the heap");
+    dmheap_remove_default_context(ctx);
+
+    ctx = dmheap_init_sharded(lock_heaps, sizeof(lock_heaps), 8, LOCK_THREADS, 0);
+    ASSERT_TEST(dmheap_set_history(ctx, 4, 0), "Every shard gets a ring");
+    dmheap_malloc(ctx, 256, "hist_a");
+    dmheap_record_sample(ctx);
+    dmheap_peek_stats(ctx, &stats);
+    ASSERT_TEST(dmheap_get_history(ctx, samples, 8) == 1 && samples[0].used_bytes == stats.used_bytes &&
+                samples[0].free_block_count == stats.free_block_count, "Shard samples are combined");
+    dmheap_remove_default_context(ctx);
+}
+
+typedef struct {
+    char names[4][32];
+    dmheap_module_stats_t stats[4];
+    int count;
+} module_snapshot_t;
+
+static void snapshot_module(const char* module_name, const dmheap_module_stats_t* stats, void* user_data) {
+    module_snapshot_t* snapshot = (module_snapshot_t*)user_data;
+    if (snapshot->count < 4) {
+        strncpy(snapshot->names[snapshot->count], module_name, sizeof(snapshot->names[0]) - 1);
+        snapshot->stats[snapshot->count++] = *stats;
+    }
+}
+
+static void test_for_each_module(void) {
+    TEST_SECTION("Module Visitor");
+
+    dmheap_context_t* ctx = dmheap_init_ex(lock_heaps[0], LOCK_HEAP_SIZE, 8, 0);
+    dmheap_set_large_region(ctx, 8192, 16384);
+    void* a = dmheap_malloc(ctx, 100, "visit_a");
+    void* big = dmheap_malloc(ctx, 9000, "visit_a");
+    void* b = dmheap_malloc(ctx, 300, "visit_b");
+    dmheap_malloc(ctx, 50, NULL);
+    a = dmheap_realloc(ctx, a, 2000, "visit_a");
+    dmheap_retag(ctx, big, "visit_b");
+    dmheap_checkpoint_t cp = dmheap_checkpoint(ctx);
+    dmheap_malloc(ctx, 700, "visit_b");
+    dmheap_rollback(ctx, cp);
+    b = dmheap_realloc(ctx, b, 100, "visit_b");
+
+    module_snapshot_t snapshot = { 0 };
+    dmheap_for_each_module(ctx, snapshot_module, &snapshot);
+    ASSERT_TEST(snapshot.count == 2, "Every module visited once");
+    bool totals_match = true;
+    for (int i = 0; i < snapshot.count; i++) {
+        dmheap_module_stats_t walked;
+        dmheap_get_module_stats(ctx, snapshot.names[i], &walked);
+        totals_match &= walked.used_bytes == snapshot.stats[i].used_bytes &&
+                        walked.used_block_count == snapshot.stats[i].used_block_count &&
+                        walked.peak_used_bytes == snapshot.stats[i].peak_used_bytes;
+    }
+    ASSERT_TEST(totals_match, "Running totals match the block walk after realloc, retag and rollback");
+    ASSERT_TEST(strcmp(snapshot.names[0], "visit_b") == 0 ? snapshot.stats[0].used_block_count == 2
+                                                           : snapshot.stats[1].used_block_count == 2,
+                "Retagged large extent moved to its new module");
+    (void)b;
+    dmheap_remove_default_context(ctx);
+}
+
+static void mutex_lock(void* user_data) {
+    pthread_mutex_lock((pthread_mutex_t*)user_data);
+}
+
+static void mutex_unlock(void* user_data) {
+    pthread_mutex_unlock((pthread_mutex_t*)user_data);
+}
+
+// Global critical section vs per-heap locks, single- and multi-threaded
+static void benchmark_lock_strategies(void) {
+    TEST_SECTION("Lock Strategy Benchmark");
+
+    const char* names[4] = { "critical", "none", "spin", "mutex" };
+    const uint32_t flags[4] = { 0, DMHEAP_LOCK_NONE, DMHEAP_LOCK_SPIN, 0 };
+    static pthread_mutex_t mutexes[LOCK_THREADS];
+    dmheap_context_t* heaps[LOCK_THREADS];
+    const int rounds = 20000;
+    int failures = 0;
+
+    for (int i = 0; i < LOCK_THREADS; i++) {
+        pthread_mutex_init(&mutexes[i], NULL);
+    }
+
+    for (int strategy = 0; strategy < 4; strategy++) {
+        for (int i = 0; i < LOCK_THREADS; i++) {
+            heaps[i] = dmheap_init_ex(lock_heaps[i], LOCK_HEAP_SIZE, 8, flags[strategy]);
+            if (strategy == 3) {
+                dmheap_set_lock(heaps[i], mutex_lock, mutex_unlock, &mutexes[i]);
+            }
+            dmheap_register_module(heaps[i], "locks");
+        }
+
+        lock_worker_t single = { heaps[0], rounds * LOCK_THREADS, 0 };
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        lock_worker(&single);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double us = (end.tv_sec - start.tv_sec) * 1000000.0 + (end.tv_nsec - start.tv_nsec) / 1000.0;
+        TEST_BENCH("%-8s lock, 1 thread: %.3f us per free+malloc pair", names[strategy], us / single.rounds);
+
+        // An unlocked heap can't be shared - only the one-heap-per-thread case applies.
+        if (strategy != 1) {
+            us = run_lock_workers(heaps, 1, rounds, &failures);
+            TEST_BENCH("%-8s lock, %d threads on one heap: %.3f us per pair (%d failed)",
+                       names[strategy], LOCK_THREADS, us / (rounds * LOCK_THREADS), failures);
+        }
+        us = run_lock_workers(heaps, LOCK_THREADS, rounds, &failures);
+        TEST_BENCH("%-8s lock, %d threads on own heaps: %.3f us per pair (%d failed)",
+                   names[strategy], LOCK_THREADS, us / (rounds * LOCK_THREADS), failures);
+
+        for (int i = 0; i < LOCK_THREADS; i++) {
+            dmheap_remove_default_context(heaps[i]);
+        }
+    }
+
+    for (int i = 0; i < LOCK_THREADS; i++) {
+        pthread_mutex_destroy(&mutexes[i]);
+    }
+}
+
+// One spin-locked heap vs the same buffer split into per-thread shards
+static void benchmark_sharded_heap(void) {
+    TEST_SECTION("Sharded Heap Benchmark");
+
+    const int rounds = 20000;
+    int failures = 0;
+    for (int sharded = 0; sharded < 2; sharded++) {
+        dmheap_context_t* ctx = sharded ? dmheap_init_sharded(lock_heaps, sizeof(lock_heaps), 8, LOCK_THREADS, DMHEAP_LOCK_SPIN)
+                                        : dmheap_init_ex(lock_heaps, sizeof(lock_heaps), 8, DMHEAP_LOCK_SPIN);
+        dmheap_register_module(ctx, "locks");
+        double us = run_lock_workers(&ctx, 1, rounds, &failures);
+        TEST_BENCH("%-7s heap, %d threads: %.3f us per free+malloc pair (%d failed)",
+                   sharded ? "sharded" : "single", LOCK_THREADS, us / (rounds * LOCK_THREADS), failures);
+        dmheap_remove_default_context(ctx);
+    }
+}
+
+static void test_lifetime_hints(void) {
+    TEST_SECTION("Lifetime Hints");
+
+    const uint32_t flag_sets[] = { 0, DMHEAP_FREE_INDEX, DMHEAP_SEPARATE_METADATA };
+    const char* flag_names[] = { "inline headers", "free index", "out-of-band headers" };
+    char message[96];
+    for (size_t f = 0; f < sizeof(flag_sets) / sizeof(flag_sets[0]); f++) {
+        dmheap_context_t* ctx = dmheap_init_ex(lock_heaps[0], LOCK_HEAP_SIZE, 8, flag_sets[f]);
+        dmheap_register_module(ctx, "hints");
+        dmheap_stats_t before;
+        dmheap_get_stats(ctx, &before);
+        char* plain = dmheap_malloc(ctx, 128, "hints");
+        char* shortl = dmheap_malloc_hint(ctx, 128, DMHEAP_HINT_SHORT_LIVED, "hints");
+        char* longl = dmheap_malloc_hint(ctx, 100, DMHEAP_HINT_LONG_LIVED, "hints");
+        char* longl2 = dmheap_malloc_hint(ctx, 64, DMHEAP_HINT_LONG_LIVED, "hints");
+        snprintf(message, sizeof(message), "Long-lived blocks go to the top (%s)", flag_names[f]);
+        ASSERT_TEST(plain != NULL && shortl != NULL && longl != NULL && longl2 != NULL &&
+                    longl > shortl && longl > plain && longl2 < longl && longl2 > shortl &&
+                    longl + 100 > lock_heaps[0] + LOCK_HEAP_SIZE - 256, message);
+        snprintf(message, sizeof(message), "Hinted blocks keep the heap's alignment (%s)", flag_names[f]);
+        ASSERT_TEST(((uintptr_t)longl % 8) == 0 && ((uintptr_t)longl2 % 8) == 0 && ((uintptr_t)shortl % 8) == 0, message);
+
+        memset(longl2, 0x5A, 64);
+        char* moved = dmheap_realloc(ctx, longl2, 2048, "hints");
+        snprintf(message, sizeof(message), "Moved long-lived block stays up high (%s)", flag_names[f]);
+        ASSERT_TEST(moved != NULL && moved != longl2 && moved > shortl + 4096 && moved[63] == 0x5A, message);
+
+        dmheap_free(ctx, moved, false);
+        dmheap_free(ctx, longl, false);
+        dmheap_free(ctx, shortl, false);
+        dmheap_free(ctx, plain, true);
+        dmheap_stats_t stats;
+        dmheap_get_stats(ctx, &stats);
+        snprintf(message, sizeof(message), "Hinted blocks go back to the heap (%s)", flag_names[f]);
+        ASSERT_TEST(stats.used_bytes == before.used_bytes && stats.used_block_count == before.used_block_count, message);
+        dmheap_remove_default_context(ctx);
+    }
+
+    dmheap_context_t* ctx = dmheap_init_ex(lock_heaps[0], LOCK_HEAP_SIZE, 8, 0);
+    char* both = dmheap_malloc_hint(ctx, 128, DMHEAP_HINT_SHORT_LIVED | DMHEAP_HINT_LONG_LIVED, "hints");
+    char* plain = dmheap_malloc(ctx, 128, "hints");
+    ASSERT_TEST(both != NULL && plain != NULL && both < plain && plain < lock_heaps[0] + LOCK_HEAP_SIZE / 2,
+                "Both hints at once place like no hint");
+    ASSERT_TEST(dmheap_malloc_hint(NULL, 64, DMHEAP_HINT_LONG_LIVED, "hints") != NULL, "Hinted allocation from the default list");
+    dmheap_remove_default_context(ctx);
+}
+
+static void benchmark_lifetime_hints(void) {
+    TEST_SECTION("Lifetime Hints Benchmark");
+
+    // Churn: every round allocates a few request buffers that die in the next
+    // round, and every 8th round a small piece of state that is kept to the end.
+    enum { ROUNDS = 4000, PER_ROUND = 4, KEPT = ROUNDS / 8 };
+    static void* kept[KEPT];
+    void* live[PER_ROUND] = { NULL };
+    for (int hinted = 0; hinted < 2; hinted++) {
+        dmheap_context_t* ctx = dmheap_init_ex(lock_heaps, sizeof(lock_heaps), 8, 0);
+        dmheap_register_module(ctx, "churn");
+        uint32_t seed = 12345;
+        int kept_count = 0;
+        int failures = 0;
+        clock_t start = clock();
+        for (int round = 0; round < ROUNDS; round++) {
+            for (int i = 0; i < PER_ROUND; i++) {
+                dmheap_free(ctx, live[i], false);
+                seed = seed * 1103515245u + 12345u;
+                size_t size = 64 + (seed >> 16) % 960;
+                live[i] = hinted ? dmheap_malloc_hint(ctx, size, DMHEAP_HINT_SHORT_LIVED, "churn")
+                                 : dmheap_malloc(ctx, size, "churn");
+                failures += live[i] == NULL;
+            }
+            if (round % 8 == 0) {
+                kept[kept_count] = hinted ? dmheap_malloc_hint(ctx, 48, DMHEAP_HINT_LONG_LIVED, "churn")
+                                          : dmheap_malloc(ctx, 48, "churn");
+                failures += kept[kept_count++] == NULL;
+            }
+        }
+        double us = ((double)(clock() - start)) / CLOCKS_PER_SEC * 1000000.0;
+        for (int i = 0; i < PER_ROUND; i++) {
+            dmheap_free(ctx, live[i], false);
+            live[i] = NULL;
+        }
+        dmheap_concatenate_free_blocks(ctx);
+
+        dmheap_stats_t stats;
+        dmheap_get_stats(ctx, &stats);
+        TEST_BENCH("%-8s: %.3f us per op, %zu free blocks, largest %zu of %zu free bytes (%.1f%%), %d failed",
+                   hinted ? "hinted" : "unhinted", us / (ROUNDS * PER_ROUND + KEPT), stats.free_block_count,
+                   stats.largest_free_block, stats.free_bytes,
+                   stats.free_bytes ? 100.0 * stats.largest_free_block / stats.free_bytes : 0.0, failures);
+        dmheap_remove_default_context(ctx);
+    }
+}
+
+typedef struct {
+    uintptr_t start;
+    uintptr_t end;
+    size_t own_size;
+    int intruders;
+} line_check_t;
+
+// Record the size of the block at check->start and count other blocks touching its lines
+static void check_lines(void* address, size_t size, const char* module_name, void* user_data) {
+    line_check_t* check = (line_check_t*)user_data;
+    (void)module_name;
+    if ((uintptr_t)address == check->start) {
+        check->own_size = size;
+    } else if ((uintptr_t)address < check->end && (uintptr_t)address + size > check->start) {
+        check->intruders++;
+    }
+}
+
+static line_check_t check_isolated(dmheap_context_t* ctx, void* ptr, size_t size) {
+    size_t line = dmheap_get_cache_line_size(ctx);
+    line_check_t check = { (uintptr_t)ptr, (uintptr_t)ptr + ((size + line - 1) & ~(line - 1)), 0, 0 };
+    dmheap_for_each_used_block(ctx, check_lines, &check);
+    dmheap_for_each_free_block(ctx, check_lines, &check);
+    return check;
+}
+
+static void test_isolated_allocation(void) {
+    TEST_SECTION("Cache-Line Isolated Allocations");
+
+    size_t line = dmheap_get_cache_line_size(NULL);
+    ASSERT_TEST(line >= 16 && (line & (line - 1)) == 0, "Cache-line size is a power of two");
+
+    const uint32_t flag_sets[] = { 0, DMHEAP_SEPARATE_METADATA, DMHEAP_ENGINE_BUDDY };
+    const char* flag_names[] = { "inline headers", "out-of-band headers", "buddy engine" };
+    char message[96];
+    for (size_t f = 0; f < sizeof(flag_sets) / sizeof(flag_sets[0]); f++) {
+        dmheap_context_t* ctx = dmheap_init_ex(lock_heaps[0], LOCK_HEAP_SIZE, 8, flag_sets[f]);
+        dmheap_register_module(ctx, "iso");
+        char* before = dmheap_malloc(ctx, 24, "iso");
+        char* counter = dmheap_malloc_hint(ctx, 24, DMHEAP_HINT_ISOLATED, "iso");
+        char* after = dmheap_malloc(ctx, 24, "iso");
+        line_check_t check = check_isolated(ctx, counter, 24);
+        snprintf(message, sizeof(message), "Isolated block owns its cache line (%s)", flag_names[f]);
+        ASSERT_TEST(before != NULL && counter != NULL && after != NULL && ((uintptr_t)counter % line) == 0 &&
+                    check.own_size >= line && check.intruders == 0, message);
+
+        char* grown = dmheap_realloc(ctx, counter, line + 8, "iso");
+        check = check_isolated(ctx, grown, line + 8);
+        snprintf(message, sizeof(message), "Grown block stays isolated (%s)", flag_names[f]);
+        ASSERT_TEST(grown != NULL && ((uintptr_t)grown % line) == 0 && check.own_size >= 2 * line && check.intruders == 0, message);
+
+        char* shrunk = dmheap_realloc(ctx, grown, 8, "iso");
+        check = check_isolated(ctx, shrunk, 8);
+        snprintf(message, sizeof(message), "Shrunk block keeps whole lines (%s)", flag_names[f]);
+        ASSERT_TEST(shrunk == grown && check.own_size >= line && check.intruders == 0, message);
+        dmheap_remove_default_context(ctx);
+    }
+
+    dmheap_context_t* ctx = dmheap_init_ex(lock_heaps[0], LOCK_HEAP_SIZE, 8, 0);
+    char* top = dmheap_malloc_hint(ctx, 24, DMHEAP_HINT_ISOLATED | DMHEAP_HINT_LONG_LIVED, "iso");
+    ASSERT_TEST(top != NULL && ((uintptr_t)top % line) == 0 && top > lock_heaps[0] + LOCK_HEAP_SIZE / 2 &&
+                check_isolated(ctx, top, 24).intruders == 0, "Isolation combines with lifetime hints");
+    dmheap_remove_default_context(ctx);
+}
+
+typedef struct {
+    volatile uint64_t* counter;
+    int rounds;
+} counter_worker_t;
+
+// Bump one counter as fast as possible - nothing but its cache line in play
+static void* counter_worker(void* arg) {
+    counter_worker_t* worker = (counter_worker_t*)arg;
+    for (int i = 0; i < worker->rounds; i++) {
+        (*worker->counter)++;
+    }
+    return NULL;
+}
+
+static void benchmark_isolated_allocation(void) {
+    TEST_SECTION("Cache-Line Isolation Benchmark");
+
+    const int rounds = 2000000;
+    for (int isolated = 0; isolated < 2; isolated++) {
+        dmheap_context_t* ctx = dmheap_init_ex(lock_heaps[0], LOCK_HEAP_SIZE, 8, 0);
+        dmheap_register_module(ctx, "counters");
+        pthread_t threads[LOCK_THREADS];
+        counter_worker_t workers[LOCK_THREADS];
+        for (int i = 0; i < LOCK_THREADS; i++) {
+            workers[i].counter = isolated ? dmheap_malloc_hint(ctx, sizeof(uint64_t), DMHEAP_HINT_ISOLATED, "counters")
+                                          : dmheap_malloc(ctx, sizeof(uint64_t), "counters");
+            *workers[i].counter = 0;
+            workers[i].rounds = rounds;
+        }
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < LOCK_THREADS; i++) {
+            pthread_create(&threads[i], NULL, counter_worker, &workers[i]);
+        }
+        for (int i = 0; i < LOCK_THREADS; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double us = (end.tv_sec - start.tv_sec) * 1000000.0 + (end.tv_nsec - start.tv_nsec) / 1000.0;
+        TEST_BENCH("%-8s counters, %d threads: %.3f ns per increment (counters %td bytes apart)",
+                   isolated ? "isolated" : "packed", LOCK_THREADS, us * 1000.0 / ((double)rounds * LOCK_THREADS),
+                   (const char*)workers[1].counter - (const char*)workers[0].counter);
+        dmheap_remove_default_context(ctx);
+    }
+}
+
+static void test_aligned_realloc(void) {
+    TEST_SECTION("Alignment-Preserving Realloc");
+
+    const uint32_t flag_sets[] = { 0, DMHEAP_FREE_INDEX, DMHEAP_SEPARATE_METADATA };
+    const char* flag_names[] = { "inline headers", "free index", "out-of-band headers" };
+    char message[96];
+    for (size_t f = 0; f < sizeof(flag_sets) / sizeof(flag_sets[0]); f++) {
+        dmheap_context_t* ctx = dmheap_init_ex(lock_heaps[0], LOCK_HEAP_SIZE, 8, flag_sets[f]);
+        dmheap_register_module(ctx, "simd");
+        unsigned char* a = dmheap_aligned_alloc(ctx, 256, 100, "simd");
+        // Only the free space after a fits this, so it lands right behind a.
+        dmheap_stats_t stats;
+        dmheap_get_stats(ctx, &stats);
+        void* pin = dmheap_malloc(ctx, stats.largest_free_block / 2, "simd");
+        for (int i = 0; i < 100; i++) {
+            a[i] = (unsigned char)i;
+        }
+        unsigned char* moved = dmheap_realloc(ctx, a, 2000, "simd");
+        int intact = moved != NULL;
+        for (int i = 0; intact && i < 100; i++) {
+            intact = moved[i] == (unsigned char)i;
+        }
+        snprintf(message, sizeof(message), "Moved block keeps its 256-byte alignment (%s)", flag_names[f]);
+        ASSERT_TEST(moved != a && ((uintptr_t)moved % 256) == 0 && intact, message);
+
+        unsigned char* grown = dmheap_realloc(ctx, moved, 6000, "simd");
+        snprintf(message, sizeof(message), "Block grows in place into the free space after it (%s)", flag_names[f]);
+        ASSERT_TEST(grown == moved && grown[99] == 99, message);
+        ASSERT_TEST(dmheap_realloc(ctx, grown, 64, "simd") == grown && dmheap_realloc(ctx, grown, 3000, "simd") == grown,
+                    "Shrink and regrow stay in place");
+
+        unsigned char* wider = dmheap_aligned_realloc(ctx, grown, 4096, 3000, "simd");
+        snprintf(message, sizeof(message), "aligned_realloc moves to a wider alignment (%s)", flag_names[f]);
+        ASSERT_TEST(wider != NULL && ((uintptr_t)wider % 4096) == 0 && wider[50] == 50, message);
+        unsigned char* kept = dmheap_realloc(ctx, wider, 8000, "simd");
+        ASSERT_TEST(kept != NULL && ((uintptr_t)kept % 4096) == 0 && kept[50] == 50, "The wider alignment is kept from then on");
+
+        dmheap_stats_t counted, running;
+        dmheap_get_stats(ctx, &counted);
+        dmheap_peek_stats(ctx, &running);
+        dmheap_module_stats_t module;
+        dmheap_get_module_stats(ctx, "simd", &module);
+        snprintf(message, sizeof(message), "Running totals follow in-place resizes (%s)", flag_names[f]);
+        ASSERT_TEST(counted.used_bytes == running.used_bytes && counted.free_bytes == running.free_bytes &&
+                    module.used_block_count == 2, message);
+        dmheap_free(ctx, kept, false);
+        dmheap_free(ctx, pin, false);
+        dmheap_remove_default_context(ctx);
+    }
+
+    dmheap_context_t* ctx = dmheap_init_ex(lock_heaps[0], LOCK_HEAP_SIZE, 8, 0);
+    void* a = dmheap_aligned_realloc(ctx, NULL, 512, 40, "simd");
+    ASSERT_TEST(a != NULL && ((uintptr_t)a % 512) == 0, "aligned_realloc of NULL allocates aligned memory");
+    ASSERT_TEST(dmheap_aligned_realloc(ctx, a, 48, 80, "simd") == NULL, "Alignment that is not a power of two is rejected");
+    dmheap_remove_default_context(ctx);
+
+    ctx = dmheap_init_sharded(lock_heaps, sizeof(lock_heaps), 8, LOCK_THREADS, 0);
+    a = dmheap_aligned_alloc(ctx, 128, 64, "simd");
+    void* pin = dmheap_malloc(ctx, 64, "simd");
+    void* moved = dmheap_realloc(ctx, a, 4000, "simd");
+    ASSERT_TEST(moved != NULL && moved != a && ((uintptr_t)moved % 128) == 0, "Sharded heap keeps the alignment on a move");
+    (void)pin;
+    dmheap_remove_default_context(ctx);
+}
+
+static void test_reset(void) {
+    TEST_SECTION("Whole-Heap Reset");
+
+    ASSERT_TEST(!dmheap_reset(NULL, true), "reset rejects a NULL context");
+
+    #define RESET_HEAP_SIZE (64 * 1024)
+    static char reset_heap[RESET_HEAP_SIZE] __attribute__((aligned(256)));
+    const uint32_t flag_sets[] = { 0, DMHEAP_FREE_INDEX, DMHEAP_SEPARATE_METADATA, DMHEAP_ENGINE_BUDDY };
+    const char* flag_names[] = { "inline headers", "free index", "out-of-band headers", "buddy" };
+    char message[96];
+    for (size_t f = 0; f < sizeof(flag_sets) / sizeof(flag_sets[0]); f++) {
+        dmheap_context_t* ctx = dmheap_init_ex(reset_heap, RESET_HEAP_SIZE, 8, flag_sets[f]);
+        dmheap_register_module(ctx, "job");
+        dmheap_set_history(ctx, 8, 0);
+        dmheap_stats_t baseline;
+        dmheap_get_stats(ctx, &baseline);
+
+        void* blocks[64];
+        for (int i = 0; i < 64; i++) {
+            blocks[i] = dmheap_malloc(ctx, 32 + (i % 7) * 40, (i % 3) ? "job" : NULL);
+        }
+        for (int i = 0; i < 64; i += 2) {
+            dmheap_free(ctx, blocks[i], false);
+        }
+        dmheap_malloc_permanent(ctx, 256, 8, "job");
+
+        dmheap_stats_t counted, running;
+        ASSERT_TEST(dmheap_reset(ctx, true), "reset keeping the modules succeeds");
+        dmheap_get_stats(ctx, &counted);
+        dmheap_peek_stats(ctx, &running);
+        snprintf(message, sizeof(message), "Heap is back to its state after setup (%s)", flag_names[f]);
+        ASSERT_TEST(counted.used_bytes == baseline.used_bytes && counted.used_block_count == baseline.used_block_count &&
+                    counted.free_bytes == baseline.free_bytes && counted.largest_free_block == baseline.largest_free_block &&
+                    counted.permanent_bytes == 0, message);
+        snprintf(message, sizeof(message), "Running totals agree with a walk after reset (%s)", flag_names[f]);
+        ASSERT_TEST(running.used_bytes == counted.used_bytes && running.free_bytes == counted.free_bytes &&
+                    running.used_block_count == counted.used_block_count && running.free_block_count == counted.free_block_count,
+                    message);
+        dmheap_module_stats_t module;
+        ASSERT_TEST(dmheap_get_module_stats(ctx, "job", &module) && module.used_block_count == 0 &&
+                    module.used_bytes == 0 && module.permanent_bytes == 0 && module.peak_used_block_count > 0,
+                    "Kept module has no usage but keeps its peaks");
+        dmheap_sample_t samples[8];
+        ASSERT_TEST(dmheap_record_sample(ctx) && dmheap_get_history(ctx, samples, 8) > 0, "History ring survives the reset");
+        void* whole = dmheap_malloc(ctx, counted.largest_free_block - 64, "job");
+        ASSERT_TEST(whole != NULL && dmheap_get_module_stats(ctx, "job", &module) && module.used_block_count == 1,
+                    "Freed space and the kept module are usable again");
+
+        ASSERT_TEST(dmheap_reset(ctx, false), "reset dropping the modules succeeds");
+        dmheap_get_stats(ctx, &counted);
+        snprintf(message, sizeof(message), "Only the history ring is left (%s)", flag_names[f]);
+        ASSERT_TEST(!dmheap_get_module_stats(ctx, "job", &module) && counted.used_block_count == 1 &&
+                    counted.free_bytes > baseline.free_bytes, message);
+        ASSERT_TEST(dmheap_register_module(ctx, "job") && dmheap_malloc(ctx, 100, "job") != NULL,
+                    "Modules can be registered again after a reset");
+        dmheap_remove_default_context(ctx);
+    }
+
+    static char reset_large_heap[LARGE_HEAP_SIZE] __attribute__((aligned(16)));
+    dmheap_context_t* ctx = dmheap_init(reset_large_heap, LARGE_HEAP_SIZE, 8);
+    dmheap_set_large_region(ctx, 16 * 1024, LARGE_REGION_SIZE);
+    dmheap_malloc(ctx, 40 * 1024, "big");
+    dmheap_malloc(ctx, 20 * 1024, "big");
+    dmheap_malloc(ctx, 64, "small");
+    dmheap_stats_t stats;
+    dmheap_reset(ctx, true);
+    dmheap_get_stats(ctx, &stats);
+    ASSERT_TEST(stats.large_used_bytes == 0 && stats.large_free_bytes == LARGE_REGION_SIZE,
+                "Large region is whole and free again");
+    ASSERT_TEST(dmheap_malloc(ctx, LARGE_REGION_SIZE, "big") != NULL, "The whole region can be handed out after reset");
+    dmheap_remove_default_context(ctx);
+
+    ctx = dmheap_init_sharded(lock_heaps, sizeof(lock_heaps), 8, LOCK_THREADS, 0);
+    dmheap_register_module(ctx, "job");
+    dmheap_stats_t baseline;
+    dmheap_get_stats(ctx, &baseline);
+    for (int i = 0; i < 100; i++) {
+        dmheap_malloc(ctx, 200, "job");
+    }
+    dmheap_reset(ctx, true);
+    dmheap_get_stats(ctx, &stats);
+    dmheap_module_stats_t module;
+    ASSERT_TEST(stats.used_bytes == baseline.used_bytes && stats.free_bytes == baseline.free_bytes &&
+                dmheap_get_module_stats(ctx, "job", &module) && module.used_block_count == 0,
+                "Every shard of a sharded heap is reset");
+    dmheap_remove_default_context(ctx);
+}
+
+static void test_reserve(void) {
+    TEST_SECTION("Emergency Reserve");
+
+    ASSERT_TEST(!dmheap_set_reserve(NULL, 1024), "set_reserve rejects a NULL context");
+
+    const uint32_t flag_sets[] = { 0, DMHEAP_SEPARATE_METADATA, DMHEAP_ENGINE_BUDDY };
+    const char* flag_names[] = { "inline headers", "out-of-band headers", "buddy" };
+    char message[96];
+    for (size_t f = 0; f < sizeof(flag_sets) / sizeof(flag_sets[0]); f++) {
+        dmheap_context_t* ctx = dmheap_init_ex(lock_heaps[0], LOCK_HEAP_SIZE, 8, flag_sets[f]);
+        ASSERT_TEST(!dmheap_set_reserve(ctx, 2 * LOCK_HEAP_SIZE), "A reserve bigger than the free space is rejected");
+        dmheap_register_module(ctx, "app");
+        ASSERT_TEST(dmheap_set_module_critical(ctx, "watchdog", true), "Mark a module critical");
+        ASSERT_TEST(dmheap_set_reserve(ctx, 8192), "Set an 8 KiB reserve");
+
+        void* blocks[256];
+        size_t count = 0;
+        while (count < 256 && (blocks[count] = dmheap_malloc(ctx, 200, "app")) != NULL) {
+            count++;
+        }
+        while (dmheap_malloc(ctx, 16, "app") != NULL) {
+        }
+        dmheap_stats_t stats;
+        dmheap_get_stats(ctx, &stats);
+        snprintf(message, sizeof(message), "Ordinary allocations stop at the reserve (%s)", flag_names[f]);
+        ASSERT_TEST(count > 0 && count < 256 && stats.free_bytes >= 8192 && stats.reserve_bytes == 8192 &&
+                    stats.reserve_used_bytes == 0, message);
+        ASSERT_TEST(dmheap_malloc(ctx, 64, NULL) == NULL && dmheap_malloc_permanent(ctx, 64, 8, "app") == NULL,
+                    "Untracked and permanent allocations cannot use the reserve either");
+        ASSERT_TEST(dmheap_realloc(ctx, blocks[0], 4096, "app") == NULL, "Growing an ordinary block into the reserve fails");
+
+        void* log = dmheap_malloc(ctx, 1024, "watchdog");
+        dmheap_stats_t running;
+        dmheap_get_stats(ctx, &stats);
+        dmheap_peek_stats(ctx, &running);
+        snprintf(message, sizeof(message), "Critical module allocates from the reserve (%s)", flag_names[f]);
+        ASSERT_TEST(log != NULL && stats.reserve_used_bytes > 0 && stats.peak_reserve_used_bytes >= stats.reserve_used_bytes,
+                    message);
+        ASSERT_TEST(running.reserve_bytes == stats.reserve_bytes && running.reserve_used_bytes == stats.reserve_used_bytes &&
+                    running.peak_reserve_used_bytes == stats.peak_reserve_used_bytes, "peek_stats reports the same reserve usage");
+
+        dmheap_set_module_critical(ctx, "watchdog", false);
+        ASSERT_TEST(dmheap_malloc(ctx, 256, "watchdog") == NULL, "A module that is no longer critical is kept out");
+        dmheap_free(ctx, log, true);
+        dmheap_get_stats(ctx, &stats);
+        ASSERT_TEST(stats.reserve_used_bytes == 0 && stats.peak_reserve_used_bytes > 0, "Freeing refills the reserve, the peak stays");
+        ASSERT_TEST(dmheap_set_reserve(ctx, 0) && dmheap_malloc(ctx, 200, "app") != NULL, "Dropping the reserve frees it up");
+        dmheap_remove_default_context(ctx);
+    }
+
+    // Module records come out of the general heap too: registering ordinary
+    // modules on a full heap stops at the reserve, which is still whole for a
+    // module made critical afterwards - its own record may come out of it.
+    const uint32_t record_flags[] = { 0, DMHEAP_SEPARATE_METADATA };
+    for (size_t f = 0; f < sizeof(record_flags) / sizeof(record_flags[0]); f++) {
+        dmheap_context_t* ctx = dmheap_init_ex(lock_heaps[0], LOCK_HEAP_SIZE, 8, record_flags[f]);
+        dmheap_set_reserve(ctx, 8192);
+        while (dmheap_malloc(ctx, 256, "app") != NULL) {
+        }
+        size_t registered = 0;
+        for (int i = 0; i < 58; i++) {
+            char name[16];
+            snprintf(name, sizeof(name), "mod%d", i);
+            registered += dmheap_register_module(ctx, name) ? 1 : 0;
+            dmheap_malloc(ctx, 8, name);
+        }
+        dmheap_stats_t stats;
+        dmheap_get_stats(ctx, &stats);
+        snprintf(message, sizeof(message), "Module records stop at the reserve (%s)", flag_names[f]);
+        ASSERT_TEST(registered < 58 && stats.free_bytes >= 8192 && stats.reserve_used_bytes == 0, message);
+        snprintf(message, sizeof(message), "A module made critical on a full heap gets the reserve (%s)", flag_names[f]);
+        ASSERT_TEST(dmheap_set_module_critical(ctx, "wd", true) && dmheap_malloc(ctx, 1024, "wd") != NULL, message);
+        dmheap_remove_default_context(ctx);
+    }
+
+    // A carve that header or rounding takes past the reserve line is undone on
+    // the spot: the heap is left as it was - no coalescing pass merges the
+    // blocks freed without one - and pending teardowns keep waiting.
+    const uint32_t carve_flags[] = { 0, DMHEAP_ENGINE_BUDDY };
+    for (size_t f = 0; f < sizeof(carve_flags) / sizeof(carve_flags[0]); f++) {
+        dmheap_context_t* ctx = dmheap_init_ex(lock_heaps[0], LOCK_HEAP_SIZE, 8, carve_flags[f]);
+        dmheap_malloc(ctx, 100, "old");
+        dmheap_unregister_module_async(ctx, "old");
+        void* first = dmheap_malloc(ctx, 100, "app");
+        void* second = dmheap_malloc(ctx, 100, "app");
+        dmheap_free(ctx, first, false);
+        dmheap_free(ctx, second, false);
+        dmheap_stats_t before, after;
+        dmheap_get_stats(ctx, &before);
+        dmheap_set_reserve(ctx, before.free_bytes - 8);
+        bool refused = dmheap_malloc(ctx, 8, "app") == NULL;
+        dmheap_get_stats(ctx, &after);
+        snprintf(message, sizeof(message), "A refused carve leaves the heap as it was (%s)", flag_names[f * 2]);
+        ASSERT_TEST(refused && after.free_bytes == before.free_bytes && after.free_block_count == before.free_block_count &&
+                    after.largest_free_block == before.largest_free_block &&
+                    after.used_block_count == before.used_block_count && dmheap_maintain(ctx, 0), message);
+        dmheap_remove_default_context(ctx);
+    }
+
+    dmheap_context_t* ctx = dmheap_init_sharded(lock_heaps, sizeof(lock_heaps), 8, LOCK_THREADS, 0);
+    dmheap_set_reserve(ctx, 4096 * LOCK_THREADS);
+    dmheap_set_module_critical(ctx, "watchdog", true);
+    void* last = NULL;
+    for (void* ptr; (ptr = dmheap_malloc(ctx, 500, "app")) != NULL; last = ptr) {
+    }
+    ASSERT_TEST(dmheap_realloc(ctx, last, 1500, "app") == NULL, "Growing a sharded block in place respects the reserve");
+    dmheap_stats_t stats;
+    dmheap_get_stats(ctx, &stats);
+    ASSERT_TEST(stats.reserve_bytes == 4096 * LOCK_THREADS && stats.free_bytes >= stats.reserve_bytes &&
+                dmheap_malloc(ctx, 500, "watchdog") != NULL, "Sharded heap splits the reserve across its shards");
+    dmheap_remove_default_context(ctx);
+}
+
+static void test_async_unregister(void) {
+    TEST_SECTION("Asynchronous Module Teardown");
+
+    const uint32_t flag_sets[] = { 0, DMHEAP_FREE_INDEX, DMHEAP_SEPARATE_METADATA, DMHEAP_ENGINE_BUDDY };
+    const char* flag_names[] = { "inline headers", "free index", "out-of-band headers", "buddy" };
+    char message[96];
+    for (size_t f = 0; f < sizeof(flag_sets) / sizeof(flag_sets[0]); f++) {
+        dmheap_context_t* ctx = dmheap_init_ex(lock_heaps[0], LOCK_HEAP_SIZE, 8, flag_sets[f]);
+        dmheap_register_module(ctx, "keep");
+        dmheap_register_module(ctx, "drv");
+        void* kept[40];
+        for (int i = 0; i < 40; i++) {
+            kept[i] = dmheap_malloc(ctx, 48, "keep");
+            dmheap_malloc(ctx, 80 + (i % 5) * 16, "drv");
+        }
+        dmheap_stats_t before;
+        dmheap_get_stats(ctx, &before);
+
+        dmheap_module_stats_t module;
+        dmheap_unregister_module_async(ctx, "drv");
+        dmheap_stats_t stats;
+        dmheap_get_stats(ctx, &stats);
+        ASSERT_TEST(!dmheap_get_module_stats(ctx, "drv", &module) && stats.used_block_count == before.used_block_count,
+                    "Module is detached at once, its blocks are left for later");
+        ASSERT_TEST(dmheap_register_module(ctx, "drv") && dmheap_malloc(ctx, 32, "drv") != NULL,
+                    "The name can be registered again before the teardown");
+
+        // Free survivors between slices, so the sweep has to cope with the used
+        // list changing under it.
+        size_t slices = 0;
+        while (dmheap_maintain(ctx, 4)) {
+            if (slices < 20) {
+                dmheap_free(ctx, kept[slices * 2], false);
+            }
+            slices++;
+        }
+        size_t freed = slices < 20 ? slices : 20;
+        dmheap_stats_t running;
+        dmheap_get_stats(ctx, &stats);
+        dmheap_peek_stats(ctx, &running);
+        snprintf(message, sizeof(message), "Teardown runs in bounded slices (%s)", flag_names[f]);
+        ASSERT_TEST(slices >= 10, message);
+        snprintf(message, sizeof(message), "Only the detached module's blocks are gone (%s)", flag_names[f]);
+        ASSERT_TEST(stats.used_block_count == (40 - freed) + 1 + 2 && running.used_bytes == stats.used_bytes &&
+                    running.free_bytes == stats.free_bytes && running.used_block_count == stats.used_block_count, message);
+        ASSERT_TEST(dmheap_get_module_stats(ctx, "keep", &module) && module.used_block_count == 40 - freed &&
+                    dmheap_get_module_stats(ctx, "drv", &module) && module.used_block_count == 1,
+                    "Surviving and re-registered modules keep their blocks");
+        ASSERT_TEST(!dmheap_maintain(ctx, 0), "Nothing is left pending");
+        dmheap_remove_default_context(ctx);
+    }
+
+    dmheap_context_t* ctx = dmheap_init_ex(lock_heaps[0], LOCK_HEAP_SIZE, 8, 0);
+    while (dmheap_malloc(ctx, 512, "hog") != NULL) {
+    }
+    dmheap_unregister_module_async(ctx, "hog");
+    ASSERT_TEST(dmheap_maintain(ctx, 0) && dmheap_malloc(ctx, LOCK_HEAP_SIZE / 2, "app") != NULL,
+                "A failing allocation finishes the pending teardown first");
+    ASSERT_TEST(!dmheap_maintain(ctx, 0), "That teardown is complete");
+    dmheap_remove_default_context(ctx);
+
+    ctx = dmheap_init_sharded(lock_heaps, sizeof(lock_heaps), 8, LOCK_THREADS, 0);
+    dmheap_stats_t baseline;
+    dmheap_get_stats(ctx, &baseline);
+    for (int i = 0; i < 100; i++) {
+        dmheap_malloc(ctx, 100, "drv");
+    }
+    dmheap_unregister_module_async(ctx, "drv");
+    while (dmheap_maintain(ctx, 16)) {
+    }
+    dmheap_stats_t stats;
+    dmheap_get_stats(ctx, &stats);
+    ASSERT_TEST(stats.used_bytes == baseline.used_bytes && stats.used_block_count == baseline.used_block_count,
+                "Every shard of a sharded heap is torn down");
+    dmheap_remove_default_context(ctx);
+
+    // The merge of the freed space is sliced like the sweep before it - also
+    // when every default heap is maintained at once - and leaves nothing for
+    // a full concatenation to do.
+    ctx = dmheap_init_ex(lock_heaps[0], LOCK_HEAP_SIZE, 8, 0);
+    for (int i = 0; i < 60; i++) {
+        dmheap_malloc(ctx, 64, "drv");
+        dmheap_malloc(ctx, 64, i % 3 == 0 ? "keep" : "drv");
+    }
+    dmheap_get_stats(ctx, &baseline);
+    dmheap_unregister_module_async(ctx, "drv");
+    size_t slices = 0;
+    while (dmheap_maintain(NULL, 1)) {
+        slices++;
+    }
+    dmheap_get_stats(ctx, &stats);
+    dmheap_concatenate_free_blocks(ctx);
+    dmheap_stats_t merged;
+    dmheap_get_stats(ctx, &merged);
+    ASSERT_TEST(slices > baseline.used_block_count + 8 && merged.free_block_count == stats.free_block_count &&
+                merged.largest_free_block == stats.largest_free_block,
+                "The merge after a teardown sweep runs in bounded slices");
+    dmheap_remove_default_context(ctx);
+}
+
+typedef struct {
+    size_t count;
+    size_t bytes;
+} block_sum_t;
+
+static void sum_blocks(void* address, size_t size, const char* owner, void* user_data) {
+    (void)address; (void)owner;
+    block_sum_t* sum = (block_sum_t*)user_data;
+    sum->count++;
+    sum->bytes += size;
+}
+
+// Test: Cursor walks do the long walks a bounded slice at a time
+static void test_walk_cursor(void) {
+    TEST_SECTION("Cursor Walks");
+
+    dmheap_walk_cursor_t cursor;
+    ASSERT_TEST(!dmheap_walk_begin(NULL, NULL, DMHEAP_WALK_STATS), "NULL cursor rejected");
+    ASSERT_TEST(!dmheap_walk_step(NULL, 8, NULL, NULL), "Stepping a NULL cursor does nothing");
+
+    const uint32_t flag_sets[] = { 0, DMHEAP_FREE_INDEX, DMHEAP_SEPARATE_METADATA, DMHEAP_ENGINE_BUDDY };
+    const char* flag_names[] = { "inline headers", "free index", "out-of-band headers", "buddy" };
+    char message[96];
+    for (size_t f = 0; f < sizeof(flag_sets) / sizeof(flag_sets[0]); f++) {
+        dmheap_context_t* ctx = dmheap_init_ex(lock_heaps[0], LOCK_HEAP_SIZE, 8, flag_sets[f]);
+        void* ptrs[60];
+        for (int i = 0; i < 60; i++) {
+            ptrs[i] = dmheap_malloc(ctx, 40 + (i % 7) * 24, "walk");
+        }
+        for (int i = 0; i < 60; i += 2) {
+            dmheap_free(ctx, ptrs[i], false);
+        }
+
+        block_sum_t full = { 0, 0 }, sliced = { 0, 0 };
+        dmheap_for_each_free_block(ctx, sum_blocks, &full);
+        size_t steps = 0;
+        dmheap_walk_begin(&cursor, ctx, DMHEAP_WALK_FREE_BLOCKS);
+        while (dmheap_walk_step(&cursor, 4, sum_blocks, &sliced)) {
+            steps++;
+        }
+        snprintf(message, sizeof(message), "Free-block walk matches the full walk (%s)", flag_names[f]);
+        ASSERT_TEST(full.count > 8 && steps >= full.count / 4 && sliced.count == full.count &&
+                    sliced.bytes == full.bytes && cursor.restarts == 0, message);
+
+        memset(&full, 0, sizeof(full));
+        memset(&sliced, 0, sizeof(sliced));
+        dmheap_for_each_used_block(ctx, sum_blocks, &full);
+        dmheap_walk_begin(&cursor, ctx, DMHEAP_WALK_USED_BLOCKS);
+        while (dmheap_walk_step(&cursor, 3, sum_blocks, &sliced)) {
+        }
+        snprintf(message, sizeof(message), "Used-block walk matches the full walk (%s)", flag_names[f]);
+        ASSERT_TEST(sliced.count == full.count && sliced.bytes == full.bytes, message);
+
+        dmheap_stats_t stats;
+        dmheap_get_stats(ctx, &stats);
+        dmheap_walk_begin(&cursor, ctx, DMHEAP_WALK_STATS);
+        while (dmheap_walk_step(&cursor, 5, NULL, NULL)) {
+        }
+        snprintf(message, sizeof(message), "Statistics walk matches dmheap_get_stats() (%s)", flag_names[f]);
+        ASSERT_TEST(memcmp(&cursor.stats, &stats, sizeof(stats)) == 0, message);
+
+        // Change the heap between every two steps - the heap moves the walk's
+        // mark on, so it carries on without starting over.
+        memset(&sliced, 0, sizeof(sliced));
+        dmheap_walk_begin(&cursor, ctx, DMHEAP_WALK_USED_BLOCKS);
+        int next = 1;
+        while (dmheap_walk_step(&cursor, 4, sum_blocks, &sliced)) {
+            if (next < 60) {
+                dmheap_free(ctx, ptrs[next], false);
+                next += 2;
+            }
+        }
+        snprintf(message, sizeof(message), "Walk survives frees between steps (%s)", flag_names[f]);
+        ASSERT_TEST(cursor.restarts == 0 && sliced.count > 0 && sliced.count <= full.count, message);
+        while (next < 60) {
+            dmheap_free(ctx, ptrs[next], false);
+            next += 2;
+        }
+
+        dmheap_walk_begin(&cursor, ctx, DMHEAP_WALK_COALESCE);
+        steps = 0;
+        while (dmheap_walk_step(&cursor, 4, NULL, NULL)) {
+            steps++;
+        }
+        dmheap_stats_t running;
+        dmheap_get_stats(ctx, &stats);
+        dmheap_peek_stats(ctx, &running);
+        dmheap_concatenate_free_blocks(ctx);
+        dmheap_stats_t merged;
+        dmheap_get_stats(ctx, &merged);
+        snprintf(message, sizeof(message), "Coalescing walk leaves nothing to merge (%s)", flag_names[f]);
+        ASSERT_TEST(stats.free_block_count == running.free_block_count && stats.free_bytes == running.free_bytes &&
+                    merged.free_block_count == stats.free_block_count && merged.free_bytes == stats.free_bytes, message);
+        if (!(flag_sets[f] & DMHEAP_ENGINE_BUDDY)) {
+            ASSERT_TEST(steps > 1 && stats.free_block_count <= 2, "Coalescing walk took several steps");
+            ASSERT_TEST(dmheap_malloc(ctx, stats.largest_free_block - 64, "walk") != NULL,
+                        "The merged block can be allocated");
+        }
+        dmheap_remove_default_context(ctx);
+    }
+
+    // Allocating between coalescing steps keeps the free list usable.
+    dmheap_context_t* ctx = dmheap_init_ex(lock_heaps[0], LOCK_HEAP_SIZE, 8, DMHEAP_FREE_INDEX);
+    void* ptrs[80];
+    for (int i = 0; i < 80; i++) {
+        ptrs[i] = dmheap_malloc(ctx, 64, "walk");
+    }
+    for (int i = 0; i < 80; i++) {
+        if (i % 4 != 3) {
+            dmheap_free(ctx, ptrs[i], false);
+        }
+    }
+    dmheap_walk_begin(&cursor, ctx, DMHEAP_WALK_COALESCE);
+    bool ok = true;
+    while (dmheap_walk_step(&cursor, 2, NULL, NULL)) {
+        void* ptr = dmheap_malloc(ctx, 24, "walk");
+        ok = ok && ptr != NULL;
+        dmheap_free(ctx, ptr, false);
+    }
+    dmheap_stats_t stats, running;
+    dmheap_get_stats(ctx, &stats);
+    dmheap_peek_stats(ctx, &running);
+    ASSERT_TEST(ok && cursor.restarts == 0 && stats.free_bytes == running.free_bytes &&
+                stats.free_block_count == running.free_block_count && stats.used_block_count == 20 + 1,
+                "Coalescing walk copes with allocations between steps");
+    dmheap_remove_default_context(ctx);
+
+    // A heap that changes between every two steps never holds the walk back:
+    // each step still visits one more block and never more than asked.
+    ctx = dmheap_init_ex(lock_heaps[0], LOCK_HEAP_SIZE, 8, 0);
+    for (int i = 0; i < 80; i++) {
+        ptrs[i] = dmheap_malloc(ctx, 64, "walk");
+    }
+    block_sum_t full = { 0, 0 };
+    dmheap_for_each_used_block(ctx, sum_blocks, &full);
+    dmheap_walk_begin(&cursor, ctx, DMHEAP_WALK_USED_BLOCKS);
+    size_t steps = 0;
+    ok = true;
+    block_sum_t seen = { 0, 0 };
+    while (ok) {
+        block_sum_t step = { 0, 0 };
+        bool more = dmheap_walk_step(&cursor, steps % 2 == 0 ? 1 : 0, sum_blocks, &step);
+        ok = step.count <= 1 && steps++ <= full.count;
+        seen.count += step.count;
+        if (!more) {
+            break;
+        }
+        void* ptr = dmheap_malloc(ctx, 32, "busy");
+        dmheap_free(ctx, ptr, false);
+    }
+    ASSERT_TEST(ok && cursor.restarts == 0 && seen.count == full.count,
+                "Walk of a busy heap visits one block per step, including max_blocks == 0");
+
+    // More walks than the heap has marks take them over from each other. On a
+    // quiet heap each one carries on from its saved place; once blocks leave
+    // in between, a walk that lost its mark starts over - within its budget.
+    enum { WALKS = 12 };
+    dmheap_walk_cursor_t walks[WALKS];
+    block_sum_t walked[WALKS];
+    for (int round = 0; round < 2; round++) {
+        for (int w = 0; w < WALKS; w++) {
+            dmheap_walk_begin(&walks[w], ctx, DMHEAP_WALK_USED_BLOCKS);
+            memset(&walked[w], 0, sizeof(walked[w]));
+        }
+        memset(&full, 0, sizeof(full));
+        dmheap_for_each_used_block(ctx, sum_blocks, &full);
+        int next = 0;
+        size_t running = WALKS;
+        ok = true;
+        for (size_t pass = 0; running > 0 && ok; pass++) {
+            running = 0;
+            for (int w = 0; w < WALKS; w++) {
+                block_sum_t step = { 0, 0 };
+                if (dmheap_walk_step(&walks[w], 3, sum_blocks, &step)) {
+                    running++;
+                }
+                walked[w].count += step.count;
+                ok = ok && step.count <= 3 && pass < 10 * full.count;
+            }
+            if (round == 1 && next < 40) {
+                dmheap_free(ctx, ptrs[next], false);
+                next += 2;
+            }
+        }
+        uint32_t restarts = 0;
+        for (int w = 0; w < WALKS; w++) {
+            restarts += walks[w].restarts;
+            ok = ok && (round == 1 || walked[w].count == full.count);
+        }
+        ASSERT_TEST(ok && (round == 0 ? restarts == 0 : restarts > 0),
+                    round == 0 ? "More walks than marks share a quiet heap without starting over"
+                               : "Walks that lost their marks to a busy heap start over within their budget");
+    }
+    dmheap_remove_default_context(ctx);
+
+    ctx = dmheap_init_sharded(lock_heaps, sizeof(lock_heaps), 8, LOCK_THREADS, 0);
+    size_t selector = 0;
+    dmheap_set_shard_selector(ctx, rotating_selector, &selector);
+    for (int i = 0; i < 40; i++) {
+        dmheap_malloc(ctx, 100, "walk");
+    }
+    dmheap_get_stats(ctx, &stats);
+    dmheap_walk_begin(&cursor, ctx, DMHEAP_WALK_STATS);
+    while (dmheap_walk_step(&cursor, 7, NULL, NULL)) {
+    }
+    ASSERT_TEST(memcmp(&cursor.stats, &stats, sizeof(stats)) == 0, "Statistics walk covers every shard");
+    block_sum_t sliced = { 0, 0 };
+    dmheap_walk_begin(&cursor, ctx, DMHEAP_WALK_USED_BLOCKS);
+    while (dmheap_walk_step(&cursor, 7, sum_blocks, &sliced)) {
+    }
+    ASSERT_TEST(sliced.count == stats.used_block_count && sliced.bytes == stats.used_bytes - stats.permanent_bytes,
+                "Used-block walk covers every shard");
+    dmheap_remove_default_context(ctx);
+}
+
+// Test: Fragmentation starts incremental coalescing on its own
+static void test_auto_coalesce(void) {
+    TEST_SECTION("Automatic Coalescing");
+
+    ASSERT_TEST(!dmheap_set_coalesce_threshold(NULL, 50), "NULL context rejected");
+
+    const uint32_t flag_sets[] = { 0, DMHEAP_FREE_INDEX, DMHEAP_SEPARATE_METADATA };
+    const char* flag_names[] = { "inline headers", "free index", "out-of-band headers" };
+    char message[96];
+    for (size_t f = 0; f < sizeof(flag_sets) / sizeof(flag_sets[0]); f++) {
+        size_t free_blocks[2];
+        for (uint32_t threshold = 0; threshold <= 50; threshold += 50) {
+            dmheap_context_t* ctx = dmheap_init_ex(lock_heaps[0], LOCK_HEAP_SIZE, 8, flag_sets[f]);
+            ASSERT_TEST(dmheap_set_coalesce_threshold(ctx, threshold), "Threshold accepted");
+            void* ptrs[64];
+            for (int i = 0; i < 64; i++) {
+                ptrs[i] = dmheap_malloc(ctx, 64, "frag");
+            }
+            // Fill the rest, so the freed blocks are all the free memory there is.
+            dmheap_stats_t stats, running;
+            dmheap_get_stats(ctx, &stats);
+            dmheap_malloc(ctx, stats.largest_free_block - 64, "fill");
+            // Every other block first - nothing can merge yet - then the rest.
+            for (int i = 0; i < 64; i += 2) {
+                dmheap_free(ctx, ptrs[i], false);
+            }
+            for (int i = 1; i < 64; i += 2) {
+                dmheap_free(ctx, ptrs[i], false);
+            }
+            dmheap_get_stats(ctx, &stats);
+            dmheap_peek_stats(ctx, &running);
+            snprintf(message, sizeof(message), "Counters stay exact while merging (%s)", flag_names[f]);
+            ASSERT_TEST(stats.free_bytes == running.free_bytes && stats.free_block_count == running.free_block_count,
+                        message);
+            free_blocks[threshold / 50] = stats.free_block_count;
+            dmheap_remove_default_context(ctx);
+        }
+        snprintf(message, sizeof(message), "Fragmented heap merges without being asked (%s)", flag_names[f]);
+        ASSERT_TEST(free_blocks[0] > 32 && free_blocks[1] < free_blocks[0] / 4, message);
+    }
+
+    dmheap_context_t* ctx = dmheap_init_ex(lock_heaps[0], LOCK_HEAP_SIZE, 8, 0);
+    ASSERT_TEST(!dmheap_set_coalesce_threshold(ctx, 101), "Threshold above 100% rejected");
+    dmheap_set_coalesce_threshold(ctx, 1);
+    void* ptrs[48];
+    for (int i = 0; i < 48; i++) {
+        ptrs[i] = dmheap_malloc(ctx, 32 + (i % 3) * 32, "frag");
+    }
+    // Allocate and free while passes are running, so their position keeps
+    // leaving the free list under them.
+    for (int round = 0; round < 4; round++) {
+        for (int i = round % 2; i < 48; i += 2) {
+            dmheap_free(ctx, ptrs[i], false);
+            ptrs[i] = NULL;
+            void* ptr = dmheap_malloc(ctx, 16, "frag");
+            dmheap_free(ctx, ptr, false);
+        }
+        for (int i = 0; i < 48; i++) {
+            if (ptrs[i] == NULL) {
+                ptrs[i] = dmheap_malloc(ctx, 48, "frag");
+            }
+        }
+    }
+    for (int i = 0; i < 48; i++) {
+        dmheap_free(ctx, ptrs[i], false);
+    }
+    dmheap_stats_t stats, running;
+    dmheap_get_stats(ctx, &stats);
+    dmheap_peek_stats(ctx, &running);
+    ASSERT_TEST(stats.free_bytes == running.free_bytes && stats.free_block_count == running.free_block_count &&
+                stats.free_block_count < 8, "Passes cope with the free list changing between frees");
+    dmheap_remove_default_context(ctx);
+}
+
 int main(void) {
     printf("╔════════════════════════════════════════╗\n");
     printf("║     DMHEAP Unit Tests                  ║\n");
@@ -709,7 +2652,35 @@ int main(void) {
     test_multiple_contexts();
     test_default_heap_list();
     test_context_naming();
+    test_large_region();
+    test_calloc();
+    test_capabilities();
+    test_permanent_alloc();
+    test_checkpoint_rollback();
+    test_free_index();
+    test_separate_metadata();
+    test_buddy_engine();
+    test_lock_strategies();
+    test_peek_stats();
+    test_sharded_heap();
+    test_request_histogram();
+    test_peaks();
+    test_history();
+    test_for_each_module();
+    test_lifetime_hints();
+    test_isolated_allocation();
+    test_aligned_realloc();
+    test_reset();
+    test_reserve();
+    test_async_unregister();
+    test_walk_cursor();
+    test_auto_coalesce();
     benchmark_allocations();
+    benchmark_buddy_engine();
+    benchmark_lock_strategies();
+    benchmark_sharded_heap();
+    benchmark_lifetime_hints();
+    benchmark_isolated_allocation();
     
     // Print summary
     printf("\n╔════════════════════════════════════════╗\n");
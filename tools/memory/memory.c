@@ -15,6 +15,12 @@ static void print_usage( void )
     Dmod_Printf("  -s, --stats           Print overall heap occupancy statistics\n");
     Dmod_Printf("  -m, --modules         Print a per-module allocation summary\n");
     Dmod_Printf("  -f, --fragmentation   Print a histogram of free block sizes\n");
+    Dmod_Printf("  -r, --requests        Print histograms of requested sizes and alignments\n");
+    Dmod_Printf("  -p, --reset-peaks     Start a new high-water mark window on every heap\n");
+    Dmod_Printf("  -j, --json            Print the selected reports as one JSON document\n");
+    Dmod_Printf("  --save <slot>         Store a snapshot of per-module and per-size-class usage\n");
+    Dmod_Printf("  --diff <slot>         Print what changed since the snapshot in <slot>\n");
+    Dmod_Printf("  -H, --history         Plot each heap's recorded occupancy history as sparklines\n");
     Dmod_Printf("  -h, --help            Show this help message\n\n");
     Dmod_Printf("Multiple options can be combined in a single call, e.g.\n");
     Dmod_Printf("  memory --stats --modules\n\n");
@@ -24,6 +30,14 @@ static void print_usage( void )
     Dmod_Printf("Heaps named via dmheap_set_context_name() are shown by name; --stats also\n");
     Dmod_Printf("prints a used/total percentage per heap and a VT100 usage bar for each of\n");
     Dmod_Printf("them plus the combined total.\n");
+    Dmod_Printf("--requests needs heaps initialized with DMHEAP_REQUEST_HISTOGRAM, and\n");
+    Dmod_Printf("--history heaps that keep a sample ring (see dmheap_set_history()).\n");
+    Dmod_Printf("With --json, --stats is the default report and --reset-peaks applies after\n");
+    Dmod_Printf("the document is printed, e.g.\n");
+    Dmod_Printf("  memory --json --stats --modules --reset-peaks\n");
+    Dmod_Printf("Peak figures in --stats and --modules cover the time since the heap was\n");
+    Dmod_Printf("initialized or since the last --reset-peaks, e.g.\n");
+    Dmod_Printf("  memory --reset-peaks   (run the workload)   memory --stats\n");
 }
 
 // ============================================================================
@@ -58,9 +72,20 @@ static void print_one_heap_stats( const dmheap_stats_t* stats )
     Dmod_Printf("  Usage:          %.1f%%\n", usage_percent(stats));
     Dmod_Printf("  Blocks:         %zu (%zu free, %zu used)\n",
         total_block_count, stats->free_block_count, stats->used_block_count);
-    Dmod_Printf("  Largest free:   %zu bytes\n", stats->largest_free_block);
+    Dmod_Printf("  Largest free:   %zu bytes (lowest seen %zu)\n", stats->largest_free_block, stats->min_largest_free_block);
     Dmod_Printf("  Smallest free:  %zu bytes\n", stats->smallest_free_block);
     Dmod_Printf("  Fragmentation:  %.1f%%\n", fragmentation_percent);
+    Dmod_Printf("  Peak used:      %zu bytes (%zu blocks)\n", stats->peak_used_bytes, stats->peak_used_block_count);
+    if( stats->large_used_bytes + stats->large_free_bytes > 0 )
+    {
+        Dmod_Printf("  Large region:   %zu bytes (%zu used, %zu free)\n",
+            stats->large_used_bytes + stats->large_free_bytes, stats->large_used_bytes, stats->large_free_bytes);
+    }
+    if( stats->reserve_bytes > 0 )
+    {
+        Dmod_Printf("  Reserve:        %zu bytes (%zu in use, peak %zu)\n",
+            stats->reserve_bytes, stats->reserve_used_bytes, stats->peak_reserve_used_bytes);
+    }
 }
 
 // ============================================================================
@@ -196,12 +221,13 @@ static void print_stats( void )
     }
 
     // Visual overview: one usage bar per heap, followed by the combined total.
+    // Usage only needs the running totals, so re-read them without locking the heaps.
     Dmod_Printf("\n");
     for( size_t i = 0; i < heap_count; i++ )
     {
         dmheap_context_t* ctx = dmheap_get_default_context_at(i);
         dmheap_stats_t stats;
-        if( !dmheap_get_stats( ctx, &stats ) )
+        if( !dmheap_peek_stats( ctx, &stats ) )
         {
             continue;
         }
@@ -313,12 +339,20 @@ static void print_modules( void )
 
     Dmod_Printf("Module allocation summary (%zu module%s):\n",
         summary->count, summary->count == 1 ? "" : "s");
-    Dmod_Printf("  %-32s %10s %14s\n", "MODULE", "BLOCKS", "BYTES");
+    Dmod_Printf("  %-32s %10s %14s %14s\n", "MODULE", "BLOCKS", "BYTES", "PEAK BYTES");
     for( size_t i = 0; i < summary->count; i++ )
     {
         module_summary_entry_t* entry = &summary->entries[i];
-        Dmod_Printf("  %-32s %10zu %14zu\n",
-            entry->is_null ? "(null)" : entry->name, entry->block_count, entry->total_bytes);
+        // Untracked (NULL-owner) blocks have no module record to keep a peak in.
+        dmheap_module_stats_t module_stats;
+        if( entry->is_null || !dmheap_get_module_stats( NULL, entry->name, &module_stats ) )
+        {
+            Dmod_Printf("  %-32s %10zu %14zu %14s\n",
+                entry->is_null ? "(null)" : entry->name, entry->block_count, entry->total_bytes, "-");
+            continue;
+        }
+        Dmod_Printf("  %-32s %10zu %14zu %14zu\n",
+            entry->name, entry->block_count, entry->total_bytes, module_stats.peak_used_bytes);
     }
     if( summary->overflowed )
     {
@@ -414,6 +448,944 @@ static void print_fragmentation( void )
     Dmod_Free( frag );
 }
 
+// ============================================================================
+//                              --requests
+// ============================================================================
+
+#define MAX_REQUEST_ENTRIES 32
+
+typedef struct request_entry_t
+{
+    char name[DMOD_MAX_MODULE_NAME_LENGTH];
+    bool is_null;
+    dmheap_request_histogram_t histogram;
+} request_entry_t;
+
+typedef struct request_summary_t
+{
+    dmheap_request_histogram_t total;
+    request_entry_t entries[MAX_REQUEST_ENTRIES];
+    size_t count;
+    bool overflowed;
+} request_summary_t;
+
+static void add_histogram( dmheap_request_histogram_t* total, const dmheap_request_histogram_t* histogram )
+{
+    for( size_t i = 0; i < DMHEAP_REQUEST_SIZE_BUCKETS; i++ )
+    {
+        total->size[i] += histogram->size[i];
+    }
+    for( size_t i = 0; i < DMHEAP_REQUEST_ALIGN_BUCKETS; i++ )
+    {
+        total->alignment[i] += histogram->alignment[i];
+    }
+    total->requests += histogram->requests;
+}
+
+// A module with memory on several heaps is visited once per heap - merge by name.
+static void request_visitor( const char* module_name, const dmheap_request_histogram_t* histogram, void* user_data )
+{
+    request_summary_t* summary = (request_summary_t*)user_data;
+    add_histogram( &summary->total, histogram );
+
+    for( size_t i = 0; i < summary->count; i++ )
+    {
+        request_entry_t* entry = &summary->entries[i];
+        bool is_same = ( module_name == NULL )
+            ? entry->is_null
+            : ( !entry->is_null && strncmp( entry->name, module_name, DMOD_MAX_MODULE_NAME_LENGTH ) == 0 );
+        if( is_same )
+        {
+            add_histogram( &entry->histogram, histogram );
+            return;
+        }
+    }
+
+    if( summary->count >= MAX_REQUEST_ENTRIES )
+    {
+        summary->overflowed = true;
+        return;
+    }
+
+    request_entry_t* entry = &summary->entries[summary->count++];
+    entry->is_null = ( module_name == NULL );
+    entry->name[0] = '\0';
+    if( module_name != NULL )
+    {
+        strncpy( entry->name, module_name, sizeof(entry->name) - 1 );
+        entry->name[sizeof(entry->name) - 1] = '\0';
+    }
+    entry->histogram = *histogram;
+}
+
+static void print_request_histogram( const char* label, const dmheap_request_histogram_t* histogram )
+{
+    Dmod_Printf("  %s (%u request%s):\n", label, (unsigned)histogram->requests, histogram->requests == 1 ? "" : "s");
+    for( size_t i = 0; i < DMHEAP_REQUEST_SIZE_BUCKETS; i++ )
+    {
+        if( histogram->size[i] == 0 )
+        {
+            continue;
+        }
+        size_t low = i == 0 ? 0 : (size_t)1 << i;
+        if( i == DMHEAP_REQUEST_SIZE_BUCKETS - 1 )
+        {
+            Dmod_Printf("    size  %10zu B and up    %10u\n", low, (unsigned)histogram->size[i]);
+        }
+        else
+        {
+            Dmod_Printf("    size  %10zu - %10zu B %10u\n", low, ((size_t)1 << (i + 1)) - 1, (unsigned)histogram->size[i]);
+        }
+    }
+    for( size_t i = 0; i < DMHEAP_REQUEST_ALIGN_BUCKETS; i++ )
+    {
+        if( histogram->alignment[i] != 0 )
+        {
+            Dmod_Printf("    align %10zu B%s %10u\n", (size_t)1 << i,
+                i == DMHEAP_REQUEST_ALIGN_BUCKETS - 1 ? "+" : " ", (unsigned)histogram->alignment[i]);
+        }
+    }
+}
+
+static void print_requests( void )
+{
+    request_summary_t* summary = Dmod_Malloc( sizeof(request_summary_t) );
+    if( summary == NULL )
+    {
+        DMOD_LOG_ERROR("Failed to allocate memory for the request histogram\n");
+        return;
+    }
+    memset( summary, 0, sizeof(*summary) );
+
+    dmheap_for_each_request_histogram( NULL, request_visitor, summary );
+    if( summary->count == 0 )
+    {
+        Dmod_Printf("No request histograms (no default heap was initialized with DMHEAP_REQUEST_HISTOGRAM).\n");
+        Dmod_Free( summary );
+        return;
+    }
+
+    Dmod_Printf("Allocation requests (%u total):\n", (unsigned)summary->total.requests);
+    print_request_histogram( "All modules", &summary->total );
+    for( size_t i = 0; i < summary->count; i++ )
+    {
+        request_entry_t* entry = &summary->entries[i];
+        if( entry->histogram.requests > 0 )
+        {
+            print_request_histogram( entry->is_null ? "(null)" : entry->name, &entry->histogram );
+        }
+    }
+    if( summary->overflowed )
+    {
+        Dmod_Printf("  (more than %d distinct modules found - list truncated)\n", MAX_REQUEST_ENTRIES);
+    }
+
+    Dmod_Free( summary );
+}
+
+// ============================================================================
+//                              --history
+// ============================================================================
+
+#define MAX_HISTORY_SAMPLES 60
+
+// Eight block heights, lowest first; like the usage bar cells, each glyph is a
+// 3-byte UTF-8 sequence ("\xe2\x96\x81" .. "\xe2\x96\x88", i.e. ▁ .. █).
+#define SPARKLINE_LEVELS     8
+#define SPARKLINE_CELL_BYTES 3
+
+typedef size_t (*sample_field_t)( const dmheap_sample_t* samples, size_t index );
+
+static size_t sample_used( const dmheap_sample_t* samples, size_t index )
+{
+    return samples[index].used_bytes;
+}
+
+static size_t sample_largest_free( const dmheap_sample_t* samples, size_t index )
+{
+    return samples[index].largest_free_block;
+}
+
+static size_t sample_free_blocks( const dmheap_sample_t* samples, size_t index )
+{
+    return samples[index].free_block_count;
+}
+
+// Operations since the previous sample - the first sample has nothing to compare to.
+static size_t sample_operations( const dmheap_sample_t* samples, size_t index )
+{
+    if( index == 0 )
+    {
+        return 0;
+    }
+    return ( samples[index].alloc_count + samples[index].free_count ) -
+           ( samples[index - 1].alloc_count + samples[index - 1].free_count );
+}
+
+// One row of the history: the series scaled between its own minimum and maximum,
+// so slow drifts stay visible even on a big heap.
+static void print_sparkline( const char* label, const dmheap_sample_t* samples, size_t count, sample_field_t field )
+{
+    size_t min = field( samples, 0 );
+    size_t max = min;
+    for( size_t i = 1; i < count; i++ )
+    {
+        size_t value = field( samples, i );
+        min = value < min ? value : min;
+        max = value > max ? value : max;
+    }
+
+    char line[MAX_HISTORY_SAMPLES * SPARKLINE_CELL_BYTES + 1];
+    for( size_t i = 0; i < count; i++ )
+    {
+        size_t level = 0;
+        if( max > min )
+        {
+            level = (size_t)( (double)( field( samples, i ) - min ) / (double)( max - min ) * ( SPARKLINE_LEVELS - 1 ) + 0.5 );
+        }
+        line[i * SPARKLINE_CELL_BYTES]     = (char)0xe2;
+        line[i * SPARKLINE_CELL_BYTES + 1] = (char)0x96;
+        line[i * SPARKLINE_CELL_BYTES + 2] = (char)( 0x81 + level );
+    }
+    line[count * SPARKLINE_CELL_BYTES] = '\0';
+
+    Dmod_Printf("  %-14s %s  %zu .. %zu\n", label, line, min, max);
+}
+
+static void print_one_heap_history( dmheap_context_t* ctx, dmheap_sample_t* samples )
+{
+    size_t count = dmheap_get_history( ctx, samples, MAX_HISTORY_SAMPLES );
+    if( count == 0 )
+    {
+        Dmod_Printf("  (no samples - see dmheap_set_history())\n");
+        return;
+    }
+
+    Dmod_Printf("  %zu sample%s, oldest first:\n", count, count == 1 ? "" : "s");
+    print_sparkline( "Used bytes", samples, count, sample_used );
+    print_sparkline( "Largest free", samples, count, sample_largest_free );
+    print_sparkline( "Free blocks", samples, count, sample_free_blocks );
+    print_sparkline( "Operations", samples, count, sample_operations );
+}
+
+static void print_history( void )
+{
+    size_t heap_count = dmheap_get_default_context_count();
+    if( heap_count == 0 )
+    {
+        DMOD_LOG_ERROR("Failed to read heap history\n");
+        return;
+    }
+
+    dmheap_sample_t* samples = Dmod_Malloc( MAX_HISTORY_SAMPLES * sizeof(dmheap_sample_t) );
+    if( samples == NULL )
+    {
+        DMOD_LOG_ERROR("Failed to allocate memory for the heap history\n");
+        return;
+    }
+
+    Dmod_Printf("Occupancy history (%zu heap%s):\n", heap_count, heap_count == 1 ? "" : "s");
+    for( size_t i = 0; i < heap_count; i++ )
+    {
+        dmheap_context_t* ctx = dmheap_get_default_context_at(i);
+        print_heap_label( i, ctx );
+        print_one_heap_history( ctx, samples );
+    }
+
+    Dmod_Free( samples );
+}
+
+// ============================================================================
+//                              --save / --diff
+// ============================================================================
+
+// A snapshot lives in an ordinary heap block owned by the module
+// "memsnap:<slot>", so it survives between runs of the tool and is found again
+// by walking the used blocks for that owner. Owners with the prefix are left out
+// of what is measured, and --diff takes its scratch snapshot under the slot's
+// own owner, whose module record already existed when the slot was saved - so
+// taking snapshots does not show up in them.
+#define SNAPSHOT_PREFIX        "memsnap:"
+#define SNAPSHOT_MAGIC         0x50414e53u // "SNAP"
+#define SNAPSHOT_SIZE_CLASSES  32
+
+typedef struct snapshot_class_t
+{
+    size_t bytes;
+    size_t blocks;
+} snapshot_class_t;
+
+typedef struct snapshot_module_t
+{
+    char name[DMOD_MAX_MODULE_NAME_LENGTH];
+    size_t bytes;
+    size_t blocks;
+} snapshot_module_t;
+
+typedef struct snapshot_t
+{
+    uint32_t magic;
+    dmheap_checkpoint_t epoch;              // dmheap_checkpoint() right after its own allocation
+    size_t module_count;
+    size_t module_capacity;
+    snapshot_class_t classes[SNAPSHOT_SIZE_CLASSES]; // used blocks by log2 size
+    snapshot_module_t modules[];
+} snapshot_t;
+
+static bool is_snapshot_owner( const char* owner_name )
+{
+    return owner_name != NULL && strncmp( owner_name, SNAPSHOT_PREFIX, sizeof(SNAPSHOT_PREFIX) - 1 ) == 0;
+}
+
+static size_t size_class_of( size_t size )
+{
+    size_t size_class = 0;
+    while( size >>= 1 )
+    {
+        size_class++;
+    }
+    return size_class < SNAPSHOT_SIZE_CLASSES ? size_class : SNAPSHOT_SIZE_CLASSES - 1;
+}
+
+static void count_modules_visitor( const char* module_name, const dmheap_module_stats_t* stats, void* user_data )
+{
+    (void)module_name;
+    (void)stats;
+    (*(size_t*)user_data)++;
+}
+
+// A module with memory on several heaps is visited once per heap - merge by name.
+static void snapshot_module_visitor( const char* module_name, const dmheap_module_stats_t* stats, void* user_data )
+{
+    snapshot_t* snapshot = (snapshot_t*)user_data;
+    if( is_snapshot_owner( module_name ) )
+    {
+        return;
+    }
+
+    for( size_t i = 0; i < snapshot->module_count; i++ )
+    {
+        snapshot_module_t* module = &snapshot->modules[i];
+        if( strncmp( module->name, module_name, sizeof(module->name) ) == 0 )
+        {
+            module->bytes  += stats->used_bytes;
+            module->blocks += stats->used_block_count;
+            return;
+        }
+    }
+    if( snapshot->module_count >= snapshot->module_capacity )
+    {
+        return;
+    }
+    snapshot_module_t* module = &snapshot->modules[snapshot->module_count++];
+    strncpy( module->name, module_name, sizeof(module->name) - 1 );
+    module->name[sizeof(module->name) - 1] = '\0';
+    module->bytes  = stats->used_bytes;
+    module->blocks = stats->used_block_count;
+}
+
+static void snapshot_class_visitor( void* address, size_t size, const char* owner_name, void* user_data )
+{
+    (void)address;
+    if( is_snapshot_owner( owner_name ) )
+    {
+        return;
+    }
+    snapshot_class_t* size_class = &((snapshot_t*)user_data)->classes[size_class_of( size )];
+    size_class->bytes += size;
+    size_class->blocks++;
+}
+
+typedef struct slot_search_t
+{
+    const char* owner_name;
+    void* address;
+} slot_search_t;
+
+static void slot_search_visitor( void* address, size_t size, const char* owner_name, void* user_data )
+{
+    (void)size;
+    slot_search_t* search = (slot_search_t*)user_data;
+    if( search->address == NULL && owner_name != NULL &&
+        strncmp( owner_name, search->owner_name, DMOD_MAX_MODULE_NAME_LENGTH ) == 0 )
+    {
+        search->address = address;
+    }
+}
+
+// Builds "memsnap:<slot>", or returns false if the slot name does not fit a module name.
+static bool slot_owner_name( const char* slot, char* owner_name )
+{
+    size_t length = strlen( slot );
+    if( length == 0 || length >= DMOD_MAX_MODULE_NAME_LENGTH - (sizeof(SNAPSHOT_PREFIX) - 1) )
+    {
+        DMOD_LOG_ERROR("Invalid snapshot slot name: '%s'\n", slot);
+        return false;
+    }
+    memcpy( owner_name, SNAPSHOT_PREFIX, sizeof(SNAPSHOT_PREFIX) - 1 );
+    memcpy( owner_name + sizeof(SNAPSHOT_PREFIX) - 1, slot, length + 1 );
+    return true;
+}
+
+static snapshot_t* find_snapshot( const char* owner_name )
+{
+    slot_search_t search = { owner_name, NULL };
+    dmheap_for_each_used_block( NULL, slot_search_visitor, &search );
+    snapshot_t* snapshot = (snapshot_t*)search.address;
+    return snapshot != NULL && snapshot->magic == SNAPSHOT_MAGIC ? snapshot : NULL;
+}
+
+// Takes a snapshot of every default heap into a new block owned by owner_name.
+static snapshot_t* take_snapshot( const char* owner_name )
+{
+    size_t module_capacity = 0;
+    dmheap_for_each_module( NULL, count_modules_visitor, &module_capacity );
+
+    size_t size = sizeof(snapshot_t) + module_capacity * sizeof(snapshot_module_t);
+    snapshot_t* snapshot = dmheap_malloc( NULL, size, owner_name );
+    if( snapshot == NULL )
+    {
+        DMOD_LOG_ERROR("Failed to allocate %zu bytes for a heap snapshot\n", size);
+        return NULL;
+    }
+    memset( snapshot, 0, size );
+    snapshot->magic = SNAPSHOT_MAGIC;
+    snapshot->module_capacity = module_capacity;
+    snapshot->epoch = dmheap_checkpoint( NULL );
+    dmheap_for_each_module( NULL, snapshot_module_visitor, snapshot );
+    dmheap_for_each_used_block( NULL, snapshot_class_visitor, snapshot );
+    return snapshot;
+}
+
+static void save_snapshot( const char* slot, bool quiet )
+{
+    char owner_name[DMOD_MAX_MODULE_NAME_LENGTH];
+    if( !slot_owner_name( slot, owner_name ) )
+    {
+        return;
+    }
+
+    // Look the old one up before the new block appears under the same owner.
+    snapshot_t* old_snapshot = find_snapshot( owner_name );
+    snapshot_t* snapshot = take_snapshot( owner_name );
+    if( snapshot == NULL )
+    {
+        return;
+    }
+    if( old_snapshot != NULL )
+    {
+        dmheap_free( NULL, old_snapshot, false );
+    }
+    if( !quiet )
+    {
+        Dmod_Printf("Snapshot '%s' saved (%zu modules).\n", slot, snapshot->module_count);
+    }
+}
+
+static const snapshot_module_t* find_snapshot_module( const snapshot_t* snapshot, const char* name )
+{
+    for( size_t i = 0; i < snapshot->module_count; i++ )
+    {
+        if( strncmp( snapshot->modules[i].name, name, DMOD_MAX_MODULE_NAME_LENGTH ) == 0 )
+        {
+            return &snapshot->modules[i];
+        }
+    }
+    return NULL;
+}
+
+static bool has_delta( const snapshot_class_t* then, const snapshot_class_t* now )
+{
+    return then->bytes != now->bytes || then->blocks != now->blocks;
+}
+
+// Finishes a row whose label is already printed with the signed byte and block deltas.
+static void print_delta( const snapshot_class_t* then, const snapshot_class_t* now )
+{
+    Dmod_Printf(" %+14lld %+10lld\n",
+        (long long)now->bytes - (long long)then->bytes, (long long)now->blocks - (long long)then->blocks);
+}
+
+static bool print_module_delta( const char* name, const snapshot_module_t* then, const snapshot_module_t* now )
+{
+    snapshot_class_t before = { then != NULL ? then->bytes : 0, then != NULL ? then->blocks : 0 };
+    snapshot_class_t after  = { now != NULL ? now->bytes : 0, now != NULL ? now->blocks : 0 };
+    if( !has_delta( &before, &after ) )
+    {
+        return false;
+    }
+    Dmod_Printf("  %-32s", name);
+    print_delta( &before, &after );
+    return true;
+}
+
+static void print_diff( const char* slot )
+{
+    char owner_name[DMOD_MAX_MODULE_NAME_LENGTH];
+    if( !slot_owner_name( slot, owner_name ) )
+    {
+        return;
+    }
+    const snapshot_t* saved = find_snapshot( owner_name );
+    if( saved == NULL )
+    {
+        DMOD_LOG_ERROR("No snapshot saved in slot '%s' - use --save %s first\n", slot, slot);
+        return;
+    }
+    snapshot_t* current = take_snapshot( owner_name );
+    if( current == NULL )
+    {
+        return;
+    }
+
+    // Both epochs are read after the snapshot's own allocation - don't count the newer one.
+    unsigned allocations = (unsigned)(dmheap_checkpoint_t)(current->epoch - saved->epoch - 1);
+    Dmod_Printf("Changes since snapshot '%s' (%u allocation%s since):\n", slot,
+        allocations, allocations == 1 ? "" : "s");
+    Dmod_Printf("  %-32s %14s %10s\n", "MODULE", "BYTES", "BLOCKS");
+    size_t changed = 0;
+    for( size_t i = 0; i < current->module_count; i++ )
+    {
+        const snapshot_module_t* now = &current->modules[i];
+        changed += print_module_delta( now->name, find_snapshot_module( saved, now->name ), now );
+    }
+    for( size_t i = 0; i < saved->module_count; i++ )
+    {
+        const snapshot_module_t* then = &saved->modules[i];
+        if( find_snapshot_module( current, then->name ) == NULL )
+        {
+            changed += print_module_delta( then->name, then, NULL );
+        }
+    }
+    if( changed == 0 )
+    {
+        Dmod_Printf("  (no changes)\n");
+    }
+
+    Dmod_Printf("  %-32s %14s %10s\n", "SIZE CLASS", "BYTES", "BLOCKS");
+    changed = 0;
+    for( size_t i = 0; i < SNAPSHOT_SIZE_CLASSES; i++ )
+    {
+        if( !has_delta( &saved->classes[i], &current->classes[i] ) )
+        {
+            continue;
+        }
+        changed++;
+        size_t low = i == 0 ? 0 : (size_t)1 << i;
+        if( i == SNAPSHOT_SIZE_CLASSES - 1 )
+        {
+            Dmod_Printf("  %10zu B and up                ", low);
+        }
+        else
+        {
+            Dmod_Printf("  %10zu - %10zu B      ", low, ((size_t)1 << (i + 1)) - 1);
+        }
+        print_delta( &saved->classes[i], &current->classes[i] );
+    }
+    if( changed == 0 )
+    {
+        Dmod_Printf("  (no changes)\n");
+    }
+
+    dmheap_free( NULL, current, false );
+}
+
+// ============================================================================
+//                              --json
+// ============================================================================
+
+// Report sections --json can include, selected by the usual options.
+#define JSON_STATS          (1u << 0)
+#define JSON_MODULES        (1u << 1)
+#define JSON_FRAGMENTATION  (1u << 2)
+#define JSON_REQUESTS       (1u << 3)
+#define JSON_HISTORY        (1u << 4)
+
+// The visitors below run under the heap lock, so each section is copied into a
+// buffer sized from a counting pass first and only printed once the walk is
+// done - no fixed limit on modules or block sizes. Anything that appears
+// between the two passes is left out of the snapshot.
+
+typedef struct module_record_t
+{
+    char name[DMOD_MAX_MODULE_NAME_LENGTH];
+    dmheap_module_stats_t stats;
+} module_record_t;
+
+typedef struct module_snapshot_t
+{
+    module_record_t* records;
+    size_t capacity;
+    size_t count;
+} module_snapshot_t;
+
+static void module_snapshot_visitor( const char* module_name, const dmheap_module_stats_t* stats, void* user_data )
+{
+    module_snapshot_t* snapshot = (module_snapshot_t*)user_data;
+    if( snapshot->records == NULL || snapshot->count >= snapshot->capacity )
+    {
+        snapshot->count++;
+        return;
+    }
+    module_record_t* record = &snapshot->records[snapshot->count++];
+    strncpy( record->name, module_name, sizeof(record->name) - 1 );
+    record->name[sizeof(record->name) - 1] = '\0';
+    record->stats = *stats;
+}
+
+typedef struct request_record_t
+{
+    char name[DMOD_MAX_MODULE_NAME_LENGTH];
+    bool is_null;
+    dmheap_request_histogram_t histogram;
+} request_record_t;
+
+typedef struct request_snapshot_t
+{
+    request_record_t* records;
+    size_t capacity;
+    size_t count;
+} request_snapshot_t;
+
+static void request_snapshot_visitor( const char* module_name, const dmheap_request_histogram_t* histogram, void* user_data )
+{
+    request_snapshot_t* snapshot = (request_snapshot_t*)user_data;
+    if( snapshot->records == NULL || snapshot->count >= snapshot->capacity )
+    {
+        snapshot->count++;
+        return;
+    }
+    request_record_t* record = &snapshot->records[snapshot->count++];
+    record->is_null = ( module_name == NULL );
+    record->name[0] = '\0';
+    if( module_name != NULL )
+    {
+        strncpy( record->name, module_name, sizeof(record->name) - 1 );
+        record->name[sizeof(record->name) - 1] = '\0';
+    }
+    record->histogram = *histogram;
+}
+
+typedef struct free_size_snapshot_t
+{
+    size_t* sizes;
+    size_t capacity;
+    size_t count;
+} free_size_snapshot_t;
+
+static void free_size_visitor( void* address, size_t size, const char* owner_name, void* user_data )
+{
+    (void)address;
+    (void)owner_name;
+    free_size_snapshot_t* snapshot = (free_size_snapshot_t*)user_data;
+    if( snapshot->count < snapshot->capacity )
+    {
+        snapshot->sizes[snapshot->count++] = size;
+    }
+}
+
+// In-place heapsort, so the snapshot can be grouped by size without a libc
+// qsort (see the fragmentation histogram above) or quadratic insertion.
+static void sift_down( size_t* values, size_t root, size_t count )
+{
+    while( 2 * root + 1 < count )
+    {
+        size_t child = 2 * root + 1;
+        if( child + 1 < count && values[child + 1] > values[child] )
+        {
+            child++;
+        }
+        if( values[root] >= values[child] )
+        {
+            return;
+        }
+        size_t swap = values[root];
+        values[root] = values[child];
+        values[child] = swap;
+        root = child;
+    }
+}
+
+static void sort_sizes( size_t* values, size_t count )
+{
+    for( size_t i = count / 2; i > 0; i-- )
+    {
+        sift_down( values, i - 1, count );
+    }
+    for( size_t end = count; end > 1; end-- )
+    {
+        size_t swap = values[0];
+        values[0] = values[end - 1];
+        values[end - 1] = swap;
+        sift_down( values, 0, end - 1 );
+    }
+}
+
+static void json_print_string( const char* text )
+{
+    Dmod_Printf("\"");
+    for( const char* c = text; *c != '\0'; c++ )
+    {
+        if( *c == '"' || *c == '\\' )
+        {
+            Dmod_Printf("\\%c", *c);
+        }
+        else if( (unsigned char)*c < 0x20 )
+        {
+            Dmod_Printf("\\u%04x", (unsigned)(unsigned char)*c);
+        }
+        else
+        {
+            Dmod_Printf("%c", *c);
+        }
+    }
+    Dmod_Printf("\"");
+}
+
+static void json_print_stats( const dmheap_stats_t* stats )
+{
+    Dmod_Printf("{\"heap_size\":%zu,\"free_bytes\":%zu,\"used_bytes\":%zu,"
+                "\"free_block_count\":%zu,\"used_block_count\":%zu,"
+                "\"largest_free_block\":%zu,\"smallest_free_block\":%zu,"
+                "\"large_used_bytes\":%zu,\"large_free_bytes\":%zu,\"permanent_bytes\":%zu,"
+                "\"peak_used_bytes\":%zu,\"peak_used_block_count\":%zu,\"min_largest_free_block\":%zu,"
+                "\"reserve_bytes\":%zu,\"reserve_used_bytes\":%zu,\"peak_reserve_used_bytes\":%zu}",
+        stats->heap_size, stats->free_bytes, stats->used_bytes,
+        stats->free_block_count, stats->used_block_count,
+        stats->largest_free_block, stats->smallest_free_block,
+        stats->large_used_bytes, stats->large_free_bytes, stats->permanent_bytes,
+        stats->peak_used_bytes, stats->peak_used_block_count, stats->min_largest_free_block,
+        stats->reserve_bytes, stats->reserve_used_bytes, stats->peak_reserve_used_bytes);
+}
+
+static void json_print_counts( const uint32_t* counts, size_t count )
+{
+    Dmod_Printf("[");
+    for( size_t i = 0; i < count; i++ )
+    {
+        Dmod_Printf("%s%u", i > 0 ? "," : "", (unsigned)counts[i]);
+    }
+    Dmod_Printf("]");
+}
+
+static void json_print_modules( dmheap_context_t* ctx )
+{
+    module_snapshot_t snapshot = { NULL, 0, 0 };
+    dmheap_for_each_module( ctx, module_snapshot_visitor, &snapshot );
+    snapshot.capacity = snapshot.count;
+    snapshot.count = 0;
+    if( snapshot.capacity > 0 )
+    {
+        snapshot.records = Dmod_Malloc( snapshot.capacity * sizeof(module_record_t) );
+        if( snapshot.records == NULL )
+        {
+            DMOD_LOG_ERROR("Failed to allocate memory for the module snapshot\n");
+            snapshot.capacity = 0;
+        }
+        else
+        {
+            dmheap_for_each_module( ctx, module_snapshot_visitor, &snapshot );
+        }
+    }
+
+    Dmod_Printf(",\"modules\":[");
+    size_t tracked_bytes = 0;
+    for( size_t i = 0; i < snapshot.count && i < snapshot.capacity; i++ )
+    {
+        const module_record_t* record = &snapshot.records[i];
+        tracked_bytes += record->stats.used_bytes;
+        Dmod_Printf("%s{\"name\":", i > 0 ? "," : "");
+        json_print_string( record->name );
+        Dmod_Printf(",\"used_bytes\":%zu,\"used_block_count\":%zu,\"permanent_bytes\":%zu,"
+                    "\"peak_used_bytes\":%zu,\"peak_used_block_count\":%zu}",
+            record->stats.used_bytes, record->stats.used_block_count, record->stats.permanent_bytes,
+            record->stats.peak_used_bytes, record->stats.peak_used_block_count);
+    }
+    Dmod_Printf("]");
+    Dmod_Free( snapshot.records );
+
+    // Used bytes no module accounts for: untracked allocations and dmheap's own records.
+    dmheap_stats_t stats;
+    if( dmheap_peek_stats( ctx, &stats ) )
+    {
+        size_t accounted = tracked_bytes + stats.permanent_bytes;
+        Dmod_Printf(",\"untracked_bytes\":%zu", stats.used_bytes > accounted ? stats.used_bytes - accounted : 0);
+    }
+}
+
+static void json_print_fragmentation( dmheap_context_t* ctx, const dmheap_stats_t* stats )
+{
+    free_size_snapshot_t snapshot = { NULL, stats->free_block_count, 0 };
+    if( snapshot.capacity > 0 )
+    {
+        snapshot.sizes = Dmod_Malloc( snapshot.capacity * sizeof(size_t) );
+        if( snapshot.sizes == NULL )
+        {
+            DMOD_LOG_ERROR("Failed to allocate memory for the free block snapshot\n");
+            snapshot.capacity = 0;
+        }
+        else
+        {
+            dmheap_for_each_free_block( ctx, free_size_visitor, &snapshot );
+        }
+    }
+    sort_sizes( snapshot.sizes, snapshot.count );
+
+    Dmod_Printf(",\"fragmentation\":[");
+    for( size_t i = 0; i < snapshot.count; )
+    {
+        size_t run = i;
+        while( run < snapshot.count && snapshot.sizes[run] == snapshot.sizes[i] )
+        {
+            run++;
+        }
+        Dmod_Printf("%s{\"size\":%zu,\"count\":%zu}", i > 0 ? "," : "", snapshot.sizes[i], run - i);
+        i = run;
+    }
+    Dmod_Printf("]");
+    Dmod_Free( snapshot.sizes );
+}
+
+static void json_print_requests( dmheap_context_t* ctx )
+{
+    request_snapshot_t snapshot = { NULL, 0, 0 };
+    dmheap_for_each_request_histogram( ctx, request_snapshot_visitor, &snapshot );
+    snapshot.capacity = snapshot.count;
+    snapshot.count = 0;
+    if( snapshot.capacity > 0 )
+    {
+        snapshot.records = Dmod_Malloc( snapshot.capacity * sizeof(request_record_t) );
+        if( snapshot.records == NULL )
+        {
+            DMOD_LOG_ERROR("Failed to allocate memory for the request snapshot\n");
+            snapshot.capacity = 0;
+        }
+        else
+        {
+            dmheap_for_each_request_histogram( ctx, request_snapshot_visitor, &snapshot );
+        }
+    }
+
+    Dmod_Printf(",\"requests\":[");
+    for( size_t i = 0; i < snapshot.count && i < snapshot.capacity; i++ )
+    {
+        const request_record_t* record = &snapshot.records[i];
+        Dmod_Printf("%s{\"module\":", i > 0 ? "," : "");
+        if( record->is_null )
+        {
+            Dmod_Printf("null");
+        }
+        else
+        {
+            json_print_string( record->name );
+        }
+        Dmod_Printf(",\"requests\":%u,\"size\":", (unsigned)record->histogram.requests);
+        json_print_counts( record->histogram.size, DMHEAP_REQUEST_SIZE_BUCKETS );
+        Dmod_Printf(",\"alignment\":");
+        json_print_counts( record->histogram.alignment, DMHEAP_REQUEST_ALIGN_BUCKETS );
+        Dmod_Printf("}");
+    }
+    Dmod_Printf("]");
+    Dmod_Free( snapshot.records );
+}
+
+static void json_print_history( dmheap_context_t* ctx )
+{
+    // The ring's length isn't exposed, so grow the buffer until it holds it all.
+    dmheap_sample_t* samples = NULL;
+    size_t capacity = MAX_HISTORY_SAMPLES;
+    size_t count = 0;
+    for( ;; )
+    {
+        Dmod_Free( samples );
+        samples = Dmod_Malloc( capacity * sizeof(dmheap_sample_t) );
+        if( samples == NULL )
+        {
+            DMOD_LOG_ERROR("Failed to allocate memory for the heap history\n");
+            break;
+        }
+        count = dmheap_get_history( ctx, samples, capacity );
+        if( count < capacity )
+        {
+            break;
+        }
+        capacity *= 2;
+    }
+
+    Dmod_Printf(",\"history\":[");
+    for( size_t i = 0; samples != NULL && i < count; i++ )
+    {
+        const dmheap_sample_t* sample = &samples[i];
+        Dmod_Printf("%s{\"used_bytes\":%zu,\"free_bytes\":%zu,\"largest_free_block\":%zu,"
+                    "\"used_block_count\":%zu,\"free_block_count\":%zu,\"alloc_count\":%zu,\"free_count\":%zu}",
+            i > 0 ? "," : "", sample->used_bytes, sample->free_bytes, sample->largest_free_block,
+            sample->used_block_count, sample->free_block_count, sample->alloc_count, sample->free_count);
+    }
+    Dmod_Printf("]");
+    Dmod_Free( samples );
+}
+
+// One JSON document on a single line: {"heaps":[{...},...],"total":{...}}, with
+// each heap carrying the sections selected in `sections`.
+static void print_json( uint32_t sections )
+{
+    size_t heap_count = dmheap_get_default_context_count();
+    bool first = true;
+    Dmod_Printf("{\"heaps\":[");
+    for( size_t i = 0; i < heap_count; i++ )
+    {
+        dmheap_context_t* ctx = dmheap_get_default_context_at(i);
+        dmheap_stats_t stats;
+        if( !dmheap_get_stats( ctx, &stats ) )
+        {
+            continue;
+        }
+
+        Dmod_Printf("%s{\"index\":%zu,\"name\":", first ? "" : ",", i);
+        first = false;
+        const char* name = dmheap_get_context_name( ctx );
+        if( name != NULL && name[0] != '\0' )
+        {
+            json_print_string( name );
+        }
+        else
+        {
+            Dmod_Printf("null");
+        }
+        if( sections & JSON_STATS )
+        {
+            Dmod_Printf(",\"stats\":");
+            json_print_stats( &stats );
+        }
+        if( sections & JSON_MODULES )
+        {
+            json_print_modules( ctx );
+        }
+        if( sections & JSON_FRAGMENTATION )
+        {
+            json_print_fragmentation( ctx, &stats );
+        }
+        if( sections & JSON_REQUESTS )
+        {
+            json_print_requests( ctx );
+        }
+        if( sections & JSON_HISTORY )
+        {
+            json_print_history( ctx );
+        }
+        Dmod_Printf("}");
+    }
+    Dmod_Printf("]");
+
+    dmheap_stats_t total;
+    if( (sections & JSON_STATS) && heap_count > 0 && dmheap_get_stats( NULL, &total ) )
+    {
+        Dmod_Printf(",\"total\":");
+        json_print_stats( &total );
+    }
+    Dmod_Printf("}\n");
+}
+
 // ============================================================================
 //                              Entry point
 // ============================================================================
@@ -422,7 +1394,8 @@ static void print_fragmentation( void )
  * @brief Entry point for the 'memory' tool module.
  *
  * Inspects the dmheap allocator's current state: overall occupancy, a
- * per-module allocation breakdown, and free-block fragmentation.
+ * per-module allocation breakdown, free-block fragmentation, the
+ * distribution of requested sizes and alignments, and occupancy over time.
  *
  * @param argc Number of arguments
  * @param argv Array of argument strings
@@ -436,6 +1409,18 @@ int main( int argc, char** argv )
         return 0;
     }
 
+    // --json changes how every other report is printed, wherever it appears.
+    bool json = false;
+    for( int i = 1; i < argc; i++ )
+    {
+        if( strcmp( argv[i], "-j" ) == 0 || strcmp( argv[i], "--json" ) == 0 )
+        {
+            json = true;
+        }
+    }
+
+    uint32_t json_sections = 0;
+    bool json_reset_peaks = false;
     for( int i = 1; i < argc; i++ )
     {
         const char* arg = argv[i];
@@ -445,17 +1430,98 @@ int main( int argc, char** argv )
             print_usage();
             return 0;
         }
+        else if( strcmp( arg, "-j" ) == 0 || strcmp( arg, "--json" ) == 0 )
+        {
+            continue;
+        }
         else if( strcmp( arg, "-s" ) == 0 || strcmp( arg, "--stats" ) == 0 )
         {
-            print_stats();
+            if( json )
+            {
+                json_sections |= JSON_STATS;
+            }
+            else
+            {
+                print_stats();
+            }
         }
         else if( strcmp( arg, "-m" ) == 0 || strcmp( arg, "--modules" ) == 0 )
         {
-            print_modules();
+            if( json )
+            {
+                json_sections |= JSON_MODULES;
+            }
+            else
+            {
+                print_modules();
+            }
         }
         else if( strcmp( arg, "-f" ) == 0 || strcmp( arg, "--fragmentation" ) == 0 )
         {
-            print_fragmentation();
+            if( json )
+            {
+                json_sections |= JSON_FRAGMENTATION;
+            }
+            else
+            {
+                print_fragmentation();
+            }
+        }
+        else if( strcmp( arg, "-r" ) == 0 || strcmp( arg, "--requests" ) == 0 )
+        {
+            if( json )
+            {
+                json_sections |= JSON_REQUESTS;
+            }
+            else
+            {
+                print_requests();
+            }
+        }
+        else if( strcmp( arg, "-H" ) == 0 || strcmp( arg, "--history" ) == 0 )
+        {
+            if( json )
+            {
+                json_sections |= JSON_HISTORY;
+            }
+            else
+            {
+                print_history();
+            }
+        }
+        else if( strcmp( arg, "--save" ) == 0 || strcmp( arg, "--diff" ) == 0 )
+        {
+            if( i + 1 >= argc )
+            {
+                DMOD_LOG_ERROR("Option %s needs a slot name\n", arg);
+                return -EINVAL;
+            }
+            const char* slot = argv[++i];
+            if( strcmp( arg, "--save" ) == 0 )
+            {
+                save_snapshot( slot, json );
+            }
+            else if( json )
+            {
+                DMOD_LOG_ERROR("--diff has no JSON form\n");
+                return -EINVAL;
+            }
+            else
+            {
+                print_diff( slot );
+            }
+        }
+        else if( strcmp( arg, "-p" ) == 0 || strcmp( arg, "--reset-peaks" ) == 0 )
+        {
+            if( json )
+            {
+                json_reset_peaks = true;
+            }
+            else
+            {
+                dmheap_reset_peaks( NULL );
+                Dmod_Printf("High-water marks reset.\n");
+            }
         }
         else
         {
@@ -465,5 +1531,15 @@ int main( int argc, char** argv )
         }
     }
 
+    if( json )
+    {
+        print_json( json_sections != 0 ? json_sections : JSON_STATS );
+        // After the document, so one call can read a window and start the next.
+        if( json_reset_peaks )
+        {
+            dmheap_reset_peaks( NULL );
+        }
+    }
+
     return 0;
 }